@@ -31,11 +31,17 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <signal.h>
 #include <math.h>
 #include <getopt.h>
+#include <errno.h>
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
 
+#include "stream_out.h"
+#include "stream_reorder.h"
+#include "stream_frag.h"
+#include "stream_hop.h"
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
@@ -49,6 +55,10 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
 #define DEFAULT_FREQ_HZ     868500000U
+#define PAYLOAD_HDR_SIZE    9   /* header added by transmitter, not written to stdout */
+#define DEFAULT_REORDER_MS  200 /* time a packet waits for a missing one */
+#define DEFAULT_STAT_S      10  /* reorder and hop statistics report interval */
+#define DEFAULT_HOP_SEED    0x1302
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
@@ -56,6 +66,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
 static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
 
+static struct stream_reorder_s reorder; /* packets are released in FCnt order */
+static struct stream_hop_s hop;         /* hop mode: per channel statistics */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
 
@@ -90,6 +103,16 @@ void usage(void)
     fprintf(stderr, " -j            Set radio in single input mode (SX1250 only)\n");
     fprintf(stderr, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
     fprintf(stderr, " --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
+    fprintf(stderr, " --meta <path> Write per-packet metadata to a file (\"-\" for stderr)\n");
+    fprintf(stderr, " --meta-fmt <str> Metadata format ['csv', 'bin'] (default is csv)\n");
+    fprintf(stderr, " --reorder <uint> Reorder buffer size in packets [1..%u], disabled by default\n", STREAM_REORDER_SLOT_MAX);
+    fprintf(stderr, " --reorder-ms <uint> Time a packet waits for a missing one (default is %u ms)\n", DEFAULT_REORDER_MS);
+    fprintf(stderr, " --gap <str>   What to write for lost packets ['skip', 'marker', 'zero'] (default is skip)\n");
+    fprintf(stderr, " --stat <uint> Reorder and hop statistics report interval in seconds, 0 to disable\n");
+    fprintf(stderr, " --hop <uint>  Receive a hopping transmitter on that many channels [1..%u], the first one is -a\n", STREAM_HOP_CHAN_NB_MAX);
+    fprintf(stderr, "               (the radios are centered on the hop channels, -b and -m are ignored)\n");
+    fprintf(stderr, " --hop-step <uint> Hop channels spacing in kHz, default %u\n", STREAM_HOP_STEP_HZ / 1000);
+    fprintf(stderr, " --hop-seed <uint> Seed of the hop sequence, default %u\n", DEFAULT_HOP_SEED);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -116,6 +139,21 @@ int main(int argc, char **argv)
     float rssi_offset = 0.0;
     bool full_duplex = false;
 
+    const char *meta_path = NULL;
+    stream_meta_fmt_t meta_fmt = STREAM_META_CSV;
+    FILE *meta_file = NULL;
+
+    unsigned int reorder_window = 0;
+    unsigned int reorder_ms = DEFAULT_REORDER_MS;
+    stream_gap_mode_t gap_mode = STREAM_GAP_SKIP;
+    unsigned int stat_interval_s = DEFAULT_STAT_S;
+    uint64_t last_stat_us;
+    uint16_t seq;
+
+    bool hop_enable = false;
+    struct stream_hop_conf_s hop_conf;
+    struct stream_hop_rx_plan_s hop_plan;
+
     struct lgw_conf_board_s boardconf;
     struct lgw_conf_rxrf_s rfconf;
     struct lgw_conf_rxif_s ifconf;
@@ -157,8 +195,21 @@ int main(int argc, char **argv)
     int option_index = 0;
     static struct option long_options[] = {
         {"fdd", no_argument, 0, 0},
+        {"meta", required_argument, 0, 0},
+        {"meta-fmt", required_argument, 0, 0},
+        {"reorder", required_argument, 0, 0},
+        {"reorder-ms", required_argument, 0, 0},
+        {"gap", required_argument, 0, 0},
+        {"stat", required_argument, 0, 0},
+        {"hop", required_argument, 0, 0},
+        {"hop-step", required_argument, 0, 0},
+        {"hop-seed", required_argument, 0, 0},
         {0, 0, 0, 0}};
 
+    memset(&hop_conf, 0, sizeof hop_conf);
+    hop_conf.step_hz = STREAM_HOP_STEP_HZ;
+    hop_conf.seed = DEFAULT_HOP_SEED;
+
     /* parse command line options */
     while ((i = getopt_long(argc, argv, "hja:b:k:r:n:z:m:o:d:u", long_options, &option_index)) != -1)
     {
@@ -292,6 +343,107 @@ int main(int argc, char **argv)
             {
                 full_duplex = true;
             }
+            else if (strcmp(long_options[option_index].name, "meta") == 0)
+            {
+                meta_path = optarg;
+            }
+            else if (strcmp(long_options[option_index].name, "meta-fmt") == 0)
+            {
+                if (strcmp(optarg, "csv") == 0)
+                {
+                    meta_fmt = STREAM_META_CSV;
+                }
+                else if (strcmp(optarg, "bin") == 0)
+                {
+                    meta_fmt = STREAM_META_BIN;
+                }
+                else
+                {
+                    fprintf(stderr, "ERROR: invalid metadata format\n");
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (strcmp(long_options[option_index].name, "reorder") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > STREAM_REORDER_SLOT_MAX))
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --reorder argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                reorder_window = arg_u;
+            }
+            else if (strcmp(long_options[option_index].name, "reorder-ms") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if (i != 1)
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --reorder-ms argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                reorder_ms = arg_u;
+            }
+            else if (strcmp(long_options[option_index].name, "gap") == 0)
+            {
+                if (strcmp(optarg, "skip") == 0)
+                {
+                    gap_mode = STREAM_GAP_SKIP;
+                }
+                else if (strcmp(optarg, "marker") == 0)
+                {
+                    gap_mode = STREAM_GAP_MARKER;
+                }
+                else if (strcmp(optarg, "zero") == 0)
+                {
+                    gap_mode = STREAM_GAP_ZERO;
+                }
+                else
+                {
+                    fprintf(stderr, "ERROR: invalid gap mode\n");
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (strcmp(long_options[option_index].name, "stat") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if (i != 1)
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --stat argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                stat_interval_s = arg_u;
+            }
+            else if (strcmp(long_options[option_index].name, "hop") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u < 1) || (arg_u > STREAM_HOP_CHAN_NB_MAX))
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --hop argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                hop_enable = true;
+                hop_conf.nb_chan = (uint8_t)arg_u;
+            }
+            else if (strcmp(long_options[option_index].name, "hop-step") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u < 125) || (arg_u > 1000))
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --hop-step argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                hop_conf.step_hz = arg_u * 1000;
+            }
+            else if (strcmp(long_options[option_index].name, "hop-seed") == 0)
+            {
+                i = sscanf(optarg, "%u", &arg_u);
+                if (i != 1)
+                {
+                    fprintf(stderr, "ERROR: argument parsing of --hop-seed argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                hop_conf.seed = (uint32_t)arg_u;
+            }
             else
             {
                 fprintf(stderr, "ERROR: argument parsing options. Use -h to print help\n");
@@ -315,6 +467,21 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "===== sx1302 HAL RX test =====\n");
 
+    /* Hop mode: one multi-SF IF chain per hop channel, radios centered on them */
+    if (hop_enable == true)
+    {
+        hop_conf.freq_hz_start = fa;
+        if ((stream_hop_init(&hop, &hop_conf) != 0) || (stream_hop_rx_plan(&hop_conf, &hop_plan) != 0))
+        {
+            fprintf(stderr, "ERROR: hop channels cannot be received at once, reduce --hop or --hop-step\n");
+            return EXIT_FAILURE;
+        }
+        fa = hop_plan.rf_freq_hz[0];
+        fb = hop_plan.rf_freq_hz[1];
+        fprintf(stderr, "INFO: hop mode, %u channels from %u Hz, %u kHz apart (seed %u), radios at %u and %u Hz\n",
+                hop_conf.nb_chan, hop_conf.freq_hz_start, hop_conf.step_hz / 1000, hop_conf.seed, fa, fb);
+    }
+
     /* Configure the gateway */
     memset(&boardconf, 0, sizeof boardconf);
     boardconf.lorawan_public = true;
@@ -361,7 +528,13 @@ int main(int argc, char **argv)
     for (i = 0; i < 8; i++)
     {
         ifconf.enable = true;
-        if (channel_mode == 0)
+        if (hop_enable == true)
+        {
+            ifconf.enable = (i < hop_conf.nb_chan);
+            ifconf.rf_chain = hop_plan.if_rf_chain[i];
+            ifconf.freq_hz = hop_plan.if_freq_hz[i];
+        }
+        else if (channel_mode == 0)
         {
             ifconf.rf_chain = channel_rfchain_mode0[i];
             ifconf.freq_hz = channel_if_mode0[i];
@@ -401,6 +574,22 @@ int main(int argc, char **argv)
     fprintf(stderr, "INFO: rxpkt buffer size is set to %u\n", max_rx_pkt);
     fprintf(stderr, "INFO: Select channel mode %u\n", channel_mode);
 
+    if (meta_path != NULL)
+    {
+        meta_file = stream_meta_open(meta_path, meta_fmt);
+        if (meta_file == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (reorder_window > 0)
+    {
+        stream_reorder_init(&reorder, reorder_window, reorder_ms * 1000);
+        fprintf(stderr, "INFO: reorder buffer of %u packets, %u ms\n", reorder_window, reorder_ms);
+    }
+    last_stat_us = stream_time_us();
+
     /* Loop until user quits */
     cnt_loop = 0;
     while ((quit_sig != 1) && (exit_sig != 1))
@@ -433,7 +622,12 @@ int main(int argc, char **argv)
             /* fetch N packets */
             nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
 
-            if (nb_pkt == 0)
+            if (nb_pkt == LGW_HAL_ERROR)
+            {
+                fprintf(stderr, "ERROR: failed packet fetch, exiting\n");
+                return EXIT_FAILURE;
+            }
+            else if (nb_pkt == 0)
             {
                 wait_ms(1);
             }
@@ -444,34 +638,66 @@ int main(int argc, char **argv)
                     if (rxpkt[i].status == STAT_CRC_OK)
                     {
                         nb_pkt_crc_ok += 1;
+                        if ((hop_enable == true) && (rxpkt[i].size > PAYLOAD_HDR_SIZE))
+                        {
+                            stream_hop_rx(&hop, &rxpkt[i], rxpkt[i].payload[6] | ((uint16_t)rxpkt[i].payload[7] << 8));
+                        }
                     }
-                    fprintf(stderr, "\n----- %s packet -----\n", (rxpkt[i].modulation == MOD_LORA) ? "LoRa" : "FSK");
-                    fprintf(stderr, "  count_us: %u\n", rxpkt[i].count_us);
-                    fprintf(stderr, "  size:     %u\n", rxpkt[i].size);
-                    fprintf(stderr, "  chan:     %u\n", rxpkt[i].if_chain);
-                    fprintf(stderr, "  status:   0x%02X\n", rxpkt[i].status);
-                    fprintf(stderr, "  datr:     %u\n", rxpkt[i].datarate);
-                    fprintf(stderr, "  codr:     %u\n", rxpkt[i].coderate);
-                    fprintf(stderr, "  rf_chain  %u\n", rxpkt[i].rf_chain);
-                    fprintf(stderr, "  freq_hz   %u\n", rxpkt[i].freq_hz);
-                    fprintf(stderr, "  snr_avg:  %.1f\n", rxpkt[i].snr);
-                    fprintf(stderr, "  rssi_chan:%.1f\n", rxpkt[i].rssic);
-                    fprintf(stderr, "  rssi_sig :%.1f\n", rxpkt[i].rssis);
-                    fprintf(stderr, "  crc:      0x%04X\n", rxpkt[i].crc);
-                    char mensaje[255];
-                    for (int j = 9; j < rxpkt[i].size + 9; j++)
+                }
+                if (reorder_window > 0)
+                {
+                    for (i = 0; i < nb_pkt; i++)
                     {
-                        mensaje[j - 9] = rxpkt[i].payload[j];
+                        if ((rxpkt[i].status != STAT_CRC_OK) || (rxpkt[i].size <= PAYLOAD_HDR_SIZE))
+                        {
+                            continue;
+                        }
+                        seq = rxpkt[i].payload[6] | ((uint16_t)rxpkt[i].payload[7] << 8); /* FCnt */
+                        while (stream_reorder_push(&reorder, seq, rxpkt[i].payload + PAYLOAD_HDR_SIZE, rxpkt[i].size - PAYLOAD_HDR_SIZE) == STREAM_REORDER_FULL)
+                        {
+                            stream_reorder_write(&reorder, STDOUT_FILENO, true, gap_mode);
+                        }
                     }
+                }
+                else if (stream_out_payloads(STDOUT_FILENO, rxpkt, nb_pkt, PAYLOAD_HDR_SIZE) < 0)
+                {
+                    /* whole batch at once: one write for the payloads, one for the metadata */
+                    fprintf(stderr, "ERROR: failed to write payloads (%s)\n", strerror(errno));
+                }
+                if (meta_file != NULL)
+                {
+                    stream_meta_write(meta_file, meta_fmt, rxpkt, nb_pkt);
+                }
+            }
 
-                    write(STDOUT_FILENO, mensaje, rxpkt[i].size - 9);
-                    //}
-                    fprintf(stderr, "\n");
+            if (reorder_window > 0)
+            {
+                /* release what is in order, and the gaps which waited long enough */
+                if (stream_reorder_write(&reorder, STDOUT_FILENO, false, gap_mode) < 0)
+                {
+                    fprintf(stderr, "ERROR: failed to write payloads (%s)\n", strerror(errno));
                 }
-                // fprintf(stderr,"Received %d packets (total:%lu)\n", nb_pkt, nb_pkt_crc_ok);
+            }
+            if ((stat_interval_s > 0) && ((reorder_window > 0) || (hop_enable == true)) &&
+                ((stream_time_us() - last_stat_us) >= (stat_interval_s * 1000000ULL)))
+            {
+                if (reorder_window > 0)
+                {
+                    stream_reorder_report(&reorder, stderr);
+                }
+                if (hop_enable == true)
+                {
+                    stream_hop_report(&hop, stderr);
+                }
+                last_stat_us = stream_time_us();
             }
         }
 
+        if (reorder_window > 0)
+        {
+            stream_reorder_write(&reorder, STDOUT_FILENO, true, gap_mode);
+        }
+
         // fprintf(stderr, "\nNb valid packets received: %lu CRC OK (%lu)\n", nb_pkt_crc_ok, cnt_loop );
 
         /* Stop the gateway */
@@ -493,6 +719,8 @@ int main(int argc, char **argv)
         }
     }
 
+    stream_meta_close(meta_file);
+
     fprintf(stderr, "=========== Test End ===========\n");
 
     return 0;
@@ -31,11 +31,16 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <signal.h>
 #include <math.h>
 #include <getopt.h>
+#include <errno.h>
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
 
+#include "stream_out.h"
+#include "stream_reorder.h"
+#include "stream_frag.h"
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
@@ -49,6 +54,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
 #define DEFAULT_FREQ_HZ     868500000U
+#define PAYLOAD_HDR_SIZE    9   /* header added by transmitter, not written to stdout */
+#define DEFAULT_REORDER_MS  200 /* time a packet waits for a missing one */
+#define DEFAULT_STAT_S      10  /* reorder statistics report interval */
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
@@ -56,6 +64,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
 static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
 
+static struct stream_reorder_s reorder; /* packets are released in FCnt order */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
 
@@ -87,6 +97,12 @@ void usage(void) {
     fprintf(stderr, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~s~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
     fprintf(stderr," --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
     fprintf(stderr," --br <uint>   Datarate for FSK comms\n");
+    fprintf(stderr," --meta <path> Write per-packet metadata to a file (\"-\" for stderr)\n");
+    fprintf(stderr," --meta-fmt <str> Metadata format ['csv', 'bin'] (default is csv)\n");
+    fprintf(stderr," --reorder <uint> Reorder buffer size in packets [1..%u], disabled by default\n", STREAM_REORDER_SLOT_MAX);
+    fprintf(stderr," --reorder-ms <uint> Time a packet waits for a missing one (default is %u ms)\n", DEFAULT_REORDER_MS);
+    fprintf(stderr," --gap <str>   What to write for lost packets ['skip', 'marker', 'zero'] (default is skip)\n");
+    fprintf(stderr," --stat <uint> Reorder statistics report interval in seconds, 0 to disable\n");
 }
 
 /* -------------------------------------------------------------------------- */
@@ -120,6 +136,17 @@ int main(int argc, char **argv)
     float xf = 0.0;
     float br_kbps = 50;
 
+    const char * meta_path = NULL;
+    stream_meta_fmt_t meta_fmt = STREAM_META_CSV;
+    FILE * meta_file = NULL;
+
+    unsigned int reorder_window = 0;
+    unsigned int reorder_ms = DEFAULT_REORDER_MS;
+    stream_gap_mode_t gap_mode = STREAM_GAP_SKIP;
+    unsigned int stat_interval_s = DEFAULT_STAT_S;
+    uint64_t last_stat_us;
+    uint16_t seq;
+
     unsigned long nb_pkt_crc_ok = 0, nb_loop = 0, cnt_loop;
     int nb_pkt;
 
@@ -158,6 +185,12 @@ int main(int argc, char **argv)
     static struct option long_options[] = {
         {"fdd",  no_argument, 0, 0},
         {"br",  required_argument, 0, 0},
+        {"meta",  required_argument, 0, 0},
+        {"meta-fmt",  required_argument, 0, 0},
+        {"reorder",  required_argument, 0, 0},
+        {"reorder-ms",  required_argument, 0, 0},
+        {"gap",  required_argument, 0, 0},
+        {"stat",  required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -274,6 +307,58 @@ int main(int argc, char **argv)
                     } else {
                         br_kbps = xf;
                     }
+                }
+                else if (strcmp(long_options[option_index].name, "meta") == 0) {
+                    meta_path = optarg;
+                }
+                else if (strcmp(long_options[option_index].name, "meta-fmt") == 0) {
+                    if (strcmp(optarg, "csv") == 0) {
+                        meta_fmt = STREAM_META_CSV;
+                    } else if (strcmp(optarg, "bin") == 0) {
+                        meta_fmt = STREAM_META_BIN;
+                    } else {
+                        fprintf(stderr,"ERROR: invalid metadata format\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                else if (strcmp(long_options[option_index].name, "reorder") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > STREAM_REORDER_SLOT_MAX)) {
+                        fprintf(stderr,"ERROR: argument parsing of --reorder argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        reorder_window = arg_u;
+                    }
+                }
+                else if (strcmp(long_options[option_index].name, "reorder-ms") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if (i != 1) {
+                        fprintf(stderr,"ERROR: argument parsing of --reorder-ms argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        reorder_ms = arg_u;
+                    }
+                }
+                else if (strcmp(long_options[option_index].name, "gap") == 0) {
+                    if (strcmp(optarg, "skip") == 0) {
+                        gap_mode = STREAM_GAP_SKIP;
+                    } else if (strcmp(optarg, "marker") == 0) {
+                        gap_mode = STREAM_GAP_MARKER;
+                    } else if (strcmp(optarg, "zero") == 0) {
+                        gap_mode = STREAM_GAP_ZERO;
+                    } else {
+                        fprintf(stderr,"ERROR: invalid gap mode\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                else if (strcmp(long_options[option_index].name, "stat") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if (i != 1) {
+                        fprintf(stderr,"ERROR: argument parsing of --stat argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        stat_interval_s = arg_u;
+                    }
                 }
                  else {
                     fprintf(stderr,"ERROR: argument parsing options. Use -h to print help\n");
@@ -392,6 +477,19 @@ int main(int argc, char **argv)
     fprintf(stderr,"INFO: rxpkt buffer size is set to %u\n", max_rx_pkt);
     fprintf(stderr,"INFO: Select channel mode %u\n", channel_mode);
 
+    if (meta_path != NULL) {
+        meta_file = stream_meta_open(meta_path, meta_fmt);
+        if (meta_file == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (reorder_window > 0) {
+        stream_reorder_init(&reorder, reorder_window, reorder_ms * 1000);
+        fprintf(stderr,"INFO: reorder buffer of %u packets, %u ms\n", reorder_window, reorder_ms);
+    }
+    last_stat_us = stream_time_us();
+
     /* Loop until user quits */
     cnt_loop = 0;
     while( (quit_sig != 1) && (exit_sig != 1) )
@@ -420,37 +518,50 @@ int main(int argc, char **argv)
             /* fetch N packets */
             nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
 
-            if (nb_pkt == 0) {
-                // wait_ms(1);
-            } else {
-                for (i = 0; i < 1; i++) {
+            if (nb_pkt == LGW_HAL_ERROR) {
+                fprintf(stderr,"ERROR: failed packet fetch, exiting\n");
+                return EXIT_FAILURE;
+            } else if (nb_pkt > 0) {
+                for (i = 0; i < nb_pkt; i++) {
                     if (rxpkt[i].status == STAT_CRC_OK) {
                         nb_pkt_crc_ok += 1;
                     }
-                    // fprintf(stderr,"\n----- %s packet -----\n", (rxpkt[i].modulation == MOD_LORA) ? "LoRa" : "FSK");
-                    // fprintf(stderr,"  count_us: %u\n", rxpkt[i].count_us);
-                    // fprintf(stderr,"  size:     %u\n", rxpkt[i].size);
-                    // fprintf(stderr,"  chan:     %u\n", rxpkt[i].if_chain);
-                    // fprintf(stderr,"  status:   0x%02X\n", rxpkt[i].status);
-                    // fprintf(stderr,"  datr:     %u\n", rxpkt[i].datarate);
-                    // fprintf(stderr,"  codr:     %u\n", rxpkt[i].coderate);
-                    // fprintf(stderr,"  rf_chain  %u\n", rxpkt[i].rf_chain);
-                    // fprintf(stderr,"  freq_hz   %u\n", rxpkt[i].freq_hz);
-                    // fprintf(stderr,"  snr_avg:  %.1f\n", rxpkt[i].snr);
-                    // fprintf(stderr,"  rssi_chan:%.1f\n", rxpkt[i].rssic);
-                    // fprintf(stderr,"  rssi_sig :%.1f\n", rxpkt[i].rssis);
-                    // fprintf(stderr,"  crc:      0x%04X\n", rxpkt[i].crc);
-                    char mensaje[255];
-                    memcpy(mensaje, rxpkt[i].payload + 9, rxpkt[i].size - 9);
-
-                    write(STDOUT_FILENO, mensaje, rxpkt[i].size - 9);
-                    //}
-                    //fprintf(stderr,"\n");
                 }
-                //fprintf(stderr,"Received %d packets (total:%lu)\n", nb_pkt, nb_pkt_crc_ok);
+                if (reorder_window > 0) {
+                    for (i = 0; i < nb_pkt; i++) {
+                        if ((rxpkt[i].status != STAT_CRC_OK) || (rxpkt[i].size <= PAYLOAD_HDR_SIZE)) {
+                            continue;
+                        }
+                        seq = rxpkt[i].payload[6] | ((uint16_t)rxpkt[i].payload[7] << 8); /* FCnt */
+                        while (stream_reorder_push(&reorder, seq, rxpkt[i].payload + PAYLOAD_HDR_SIZE, rxpkt[i].size - PAYLOAD_HDR_SIZE) == STREAM_REORDER_FULL) {
+                            stream_reorder_write(&reorder, STDOUT_FILENO, true, gap_mode);
+                        }
+                    }
+                } else if (stream_out_payloads(STDOUT_FILENO, rxpkt, nb_pkt, PAYLOAD_HDR_SIZE) < 0) {
+                    /* whole batch at once: one write for the payloads, one for the metadata */
+                    fprintf(stderr,"ERROR: failed to write payloads (%s)\n", strerror(errno));
+                }
+                if (meta_file != NULL) {
+                    stream_meta_write(meta_file, meta_fmt, rxpkt, nb_pkt);
+                }
+            }
+
+            if (reorder_window > 0) {
+                /* release what is in order, and the gaps which waited long enough */
+                if (stream_reorder_write(&reorder, STDOUT_FILENO, false, gap_mode) < 0) {
+                    fprintf(stderr,"ERROR: failed to write payloads (%s)\n", strerror(errno));
+                }
+                if ((stat_interval_s > 0) && ((stream_time_us() - last_stat_us) >= (stat_interval_s * 1000000ULL))) {
+                    stream_reorder_report(&reorder, stderr);
+                    last_stat_us = stream_time_us();
+                }
             }
         }
 
+        if (reorder_window > 0) {
+            stream_reorder_write(&reorder, STDOUT_FILENO, true, gap_mode);
+        }
+
         //fprintf(stderr, "\nNb valid packets received: %lu CRC OK (%lu)\n", nb_pkt_crc_ok, cnt_loop );
 
         /* Stop the gateway */
@@ -469,6 +580,8 @@ int main(int argc, char **argv)
         }
     }
 
+    stream_meta_close(meta_file);
+
     fprintf(stderr,"=========== Test End ===========\n");
 
     return 0;
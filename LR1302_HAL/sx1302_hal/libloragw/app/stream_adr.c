@@ -0,0 +1,380 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Adaptive data rate for the point-to-point streaming applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fopen, fprintf */
+#include <string.h>     /* memset, strerror */
+#include <errno.h>      /* errno */
+#include <math.h>       /* log10f */
+
+#include "stream_adr.h"
+#include "stream_frag.h"    /* stream_time_us, STREAM_FRAME_TYPE_FB */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define NOISE_FIGURE_DB     6.0     /* receiver noise figure */
+#define FSK_SNR_REQ_DB      10.0    /* SNR required by the FSK demodulator */
+#define LEVEL_EWMA_DIV      4       /* weight of a new level report is 1/LEVEL_EWMA_DIV */
+#define PER_MIN_FRAMES      8       /* frame error rate is not relevant below */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* SNR required by the LoRa demodulator, SF5 to SF12 */
+static const float lora_snr_req_db[8] = { -2.5, -5.0, -7.5, -10.0, -12.5, -15.0, -17.5, -20.0 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static float bw_hz(uint8_t bandwidth) {
+    switch (bandwidth) {
+        case BW_500KHZ: return 500e3;
+        case BW_250KHZ: return 250e3;
+        default:        return 125e3;
+    }
+}
+
+static float noise_floor_dbm(float bw) {
+    return -174.0 + (10.0 * log10f(bw)) + NOISE_FIGURE_DB;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void rung_lora(struct stream_adr_rung_s * r, uint8_t sf, uint8_t bandwidth) {
+    r->modulation = MOD_LORA;
+    r->datarate = sf;
+    r->bandwidth = bandwidth;
+    r->bitrate = sf * bw_hz(bandwidth) / (float)(1 << sf) * 4.0 / 5.0; /* CR 4/5 */
+    r->sens_dbm = noise_floor_dbm(bw_hz(bandwidth)) + lora_snr_req_db[sf - 5];
+}
+
+static void rung_fsk(struct stream_adr_rung_s * r, uint32_t br, uint8_t fdev_khz) {
+    r->modulation = MOD_FSK;
+    r->datarate = br;
+    r->bandwidth = BW_125KHZ;
+    r->bitrate = (float)br;
+    /* Carson's rule gives the occupied bandwidth */
+    r->sens_dbm = noise_floor_dbm((2.0 * fdev_khz * 1e3) + br) + FSK_SNR_REQ_DB;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void put_i16(uint8_t * p, int16_t v) {
+    p[0] = (uint8_t)((uint16_t)v >> 0);
+    p[1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+static int16_t get_i16(const uint8_t * p) {
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void log_decision(struct stream_adr_s * ctx, const char * event, uint8_t from, uint8_t to) {
+    float margin, next_margin;
+
+    if (ctx->log == NULL) {
+        return;
+    }
+
+    margin = ctx->lvl_ewma - ctx->rung[from].sens_dbm;
+    next_margin = ((from + 1) < ctx->nb_rung) ? (ctx->lvl_ewma - ctx->rung[from + 1].sens_dbm) : 0.0;
+    fprintf(ctx->log, "%llu,%s,%u,%u,%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%u,%.3f\n",
+                (unsigned long long)(stream_time_us() / 1000), event, from, to,
+                (ctx->rung[to].modulation == MOD_LORA) ? "LORA" : "FSK", ctx->rung[to].datarate, ctx->rung[to].bandwidth,
+                ctx->fb_lvl, ctx->fb_lvl_min, ctx->lvl_ewma, margin, next_margin, ctx->fb_delta_tx, ctx->per);
+    fflush(ctx->log);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int stream_adr_init(struct stream_adr_s * ctx, const struct stream_adr_conf_s * conf, uint8_t modulation, uint32_t datarate, uint8_t bandwidth, uint8_t fdev_khz) {
+    int i;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (conf == NULL)) {
+        return -1;
+    }
+
+    memset(ctx, 0, sizeof *ctx);
+    ctx->conf = *conf;
+
+    if (modulation == MOD_LORA) {
+        if ((datarate < DR_LORA_SF5) || (datarate > DR_LORA_SF12)) {
+            return -1;
+        }
+        for (i = DR_LORA_SF12; i >= DR_LORA_SF7; i--) {
+            rung_lora(&ctx->rung[ctx->nb_rung++], (uint8_t)i, BW_125KHZ);
+        }
+        /* service channel datarate on top, if faster */
+        rung_lora(&ctx->rung[ctx->nb_rung], (uint8_t)datarate, bandwidth);
+        if (ctx->rung[ctx->nb_rung].bitrate > ctx->rung[ctx->nb_rung - 1].bitrate) {
+            ctx->nb_rung += 1;
+        }
+    } else if (modulation == MOD_FSK) {
+        for (i = 4; i >= 0; i--) {
+            if ((datarate >> i) >= DR_FSK_MIN) {
+                rung_fsk(&ctx->rung[ctx->nb_rung++], datarate >> i, fdev_khz);
+            }
+        }
+    }
+    if (ctx->nb_rung == 0) {
+        return -1;
+    }
+
+    ctx->rx_last_us = stream_time_us();
+    ctx->fb_last_us = ctx->rx_last_us;
+    ctx->change_us = ctx->rx_last_us;
+    ctx->lvl_min = 0.0;
+
+    return ctx->nb_rung;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_adr_log_open(struct stream_adr_s * ctx, const char * path) {
+    /* Check input parameters */
+    if ((ctx == NULL) || (path == NULL)) {
+        return -1;
+    }
+
+    ctx->log = fopen(path, "w");
+    if (ctx->log == NULL) {
+        fprintf(stderr, "ERROR: failed to open ADR log file %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(ctx->log, "time_ms,event,rung_from,rung_to,modulation,datarate,bandwidth,level_dbm,level_min_dbm,level_ewma_dbm,margin_db,next_margin_db,frames_tx,per\n");
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_adr_log_close(struct stream_adr_s * ctx) {
+    if ((ctx != NULL) && (ctx->log != NULL)) {
+        fclose(ctx->log);
+        ctx->log = NULL;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_adr_rx(struct stream_adr_s * ctx, const struct lgw_pkt_rx_s * pkt) {
+    float lvl;
+
+    if (pkt->status != STAT_CRC_OK) {
+        ctx->rx_bad += 1;
+        return;
+    }
+    ctx->rx_good += 1;
+    ctx->rx_last_us = stream_time_us();
+
+    if (pkt->modulation == MOD_LORA) {
+        lvl = noise_floor_dbm(bw_hz(pkt->bandwidth)) + pkt->snr;
+    } else {
+        lvl = pkt->rssis;
+    }
+    if ((ctx->lvl_nb == 0) || (lvl < ctx->lvl_min)) {
+        ctx->lvl_min = lvl;
+    }
+    ctx->lvl_sum += lvl;
+    ctx->lvl_nb += 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_adr_tx(struct stream_adr_s * ctx) {
+    ctx->tx_count += 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_adr_fb_build(struct stream_adr_s * ctx, uint8_t * buf) {
+    buf[0] = STREAM_FRAME_TYPE_FB;
+    buf[1] = ctx->tx_rung;
+    buf[2] = (uint8_t)(ctx->rx_good >> 0);
+    buf[3] = (uint8_t)(ctx->rx_good >> 8);
+    buf[4] = (uint8_t)(ctx->rx_bad >> 0);
+    buf[5] = (uint8_t)(ctx->rx_bad >> 8);
+    if (ctx->lvl_nb > 0) {
+        put_i16(&buf[6], (int16_t)lroundf(10.0 * ctx->lvl_sum / ctx->lvl_nb));
+        put_i16(&buf[8], (int16_t)lroundf(10.0 * ctx->lvl_min));
+    } else {
+        put_i16(&buf[6], STREAM_ADR_LEVEL_NONE);
+        put_i16(&buf[8], STREAM_ADR_LEVEL_NONE);
+    }
+
+    ctx->lvl_sum = 0.0;
+    ctx->lvl_nb = 0;
+
+    return STREAM_ADR_FB_SIZE;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_adr_fb_parse(struct stream_adr_s * ctx, const uint8_t * buf, uint16_t size) {
+    uint16_t rx_good, delta_rx;
+    int16_t lvl;
+
+    /* Check input parameters */
+    if ((size < STREAM_ADR_FB_SIZE) || (buf[0] != STREAM_FRAME_TYPE_FB) || (buf[1] >= ctx->nb_rung)) {
+        return -1;
+    }
+
+    ctx->rx_rung = buf[1];
+    rx_good = buf[2] | (buf[3] << 8);
+
+    /* frame error rate since the previous feedback */
+    if (ctx->fb_started == true) {
+        ctx->fb_delta_tx = ctx->tx_count - ctx->fb_tx_count;
+        delta_rx = rx_good - ctx->fb_rx_good;
+        if ((ctx->fb_delta_tx >= PER_MIN_FRAMES) && (delta_rx <= ctx->fb_delta_tx)) {
+            ctx->per = 1.0 - ((float)delta_rx / ctx->fb_delta_tx);
+        } else {
+            ctx->per = 0.0;
+        }
+    }
+    ctx->fb_started = true;
+    ctx->fb_tx_count = ctx->tx_count;
+    ctx->fb_rx_good = rx_good;
+
+    lvl = get_i16(&buf[6]);
+    if (lvl != STREAM_ADR_LEVEL_NONE) {
+        ctx->fb_lvl = lvl / 10.0;
+        ctx->fb_lvl_min = get_i16(&buf[8]) / 10.0;
+        if (ctx->lvl_valid == false) {
+            ctx->lvl_ewma = ctx->fb_lvl;
+            ctx->lvl_valid = true;
+        } else {
+            ctx->lvl_ewma += (ctx->fb_lvl - ctx->lvl_ewma) / LEVEL_EWMA_DIV;
+        }
+        ctx->fb_new = true; /* nothing to evaluate if the peer did not receive anything */
+    }
+    ctx->fb_last_us = stream_time_us();
+    ctx->nb_fb += 1;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_adr_update(struct stream_adr_s * ctx) {
+    int k;
+    uint8_t from = ctx->tx_rung;
+    uint64_t now = stream_time_us();
+
+    /* No feedback any more: the peer cannot hear us, use the most robust rung */
+    if ((now - ctx->fb_last_us) > ctx->conf.timeout_us) {
+        ctx->fb_last_us = now; /* one decision per timeout period */
+        ctx->fb_started = false;
+        if (from == 0) {
+            return -1;
+        }
+        ctx->tx_rung = 0;
+        ctx->change_us = now;
+        ctx->nb_timeout += 1;
+        log_decision(ctx, "timeout", from, 0);
+        return 0;
+    }
+
+    if (ctx->fb_new == false) {
+        return -1;
+    }
+    ctx->fb_new = false;
+
+    /* Step down to the fastest rung with enough margin */
+    if (((ctx->lvl_ewma - ctx->rung[from].sens_dbm) < ctx->conf.margin_down_db) || (ctx->per > ctx->conf.per_max)) {
+        if (from == 0) {
+            log_decision(ctx, "stay", from, from);
+            return -1;
+        }
+        for (k = from - 1; k > 0; k--) {
+            if ((ctx->lvl_ewma - ctx->rung[k].sens_dbm) >= ctx->conf.margin_up_db) {
+                break;
+            }
+        }
+        ctx->tx_rung = (uint8_t)k;
+        ctx->change_us = now;
+        ctx->nb_down += 1;
+        log_decision(ctx, (ctx->per > ctx->conf.per_max) ? "down_per" : "down_margin", from, ctx->tx_rung);
+        return ctx->tx_rung;
+    }
+
+    /* Step up one rung: only when the link is clean and has been stable for a while */
+    if (((from + 1) < ctx->nb_rung) && ((now - ctx->change_us) >= ctx->conf.hold_us) &&
+        ((ctx->lvl_ewma - ctx->rung[from + 1].sens_dbm) >= ctx->conf.margin_up_db) &&
+        (ctx->per <= (ctx->conf.per_max / 2))) {
+        ctx->tx_rung = from + 1;
+        ctx->change_us = now;
+        ctx->nb_up += 1;
+        log_decision(ctx, "up", from, ctx->tx_rung);
+        return ctx->tx_rung;
+    }
+
+    log_decision(ctx, "stay", from, from);
+    return -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+bool stream_adr_rx_timeout(struct stream_adr_s * ctx) {
+    uint64_t now = stream_time_us();
+
+    if ((now - ctx->rx_last_us) <= ctx->conf.timeout_us) {
+        return false;
+    }
+    ctx->rx_last_us = now; /* one fallback per timeout period */
+    if (ctx->rx_rung == 0) {
+        return false;
+    }
+    ctx->rx_rung = 0;
+
+    return true;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_adr_report(struct stream_adr_s * ctx, FILE * f) {
+    const struct stream_adr_rung_s * tx = &ctx->rung[ctx->tx_rung];
+    const struct stream_adr_rung_s * rx = &ctx->rung[ctx->rx_rung];
+
+    if (f == NULL) {
+        return;
+    }
+
+    fprintf(f, "INFO: adr: TX rung %u/%u (%s %u, %.1f kbps), RX rung %u (%.1f kbps), level %.1f dBm (margin %.1f dB), PER %.1f%%, feedback %u, up %u, down %u, timeout %u\n",
+                ctx->tx_rung, ctx->nb_rung - 1, (tx->modulation == MOD_LORA) ? "SF" : "FSK", tx->datarate, tx->bitrate / 1e3,
+                ctx->rx_rung, rx->bitrate / 1e3, ctx->lvl_ewma, ctx->lvl_ewma - tx->sens_dbm, 100.0 * ctx->per,
+                ctx->nb_fb, ctx->nb_up, ctx->nb_down, ctx->nb_timeout);
+
+    ctx->nb_fb = 0;
+    ctx->nb_up = 0;
+    ctx->nb_down = 0;
+    ctx->nb_timeout = 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,214 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Adaptive data rate for the point-to-point streaming applications.
+
+    Each side measures the level of the frames received from its peer and
+    sends it back periodically in a feedback frame, together with the number
+    of frames received. The sender converts the level into a margin for each
+    rung of a ladder of datarates (LoRa SF/BW or FSK bitrate, sorted from the
+    most robust to the fastest) and steps up or down with hysteresis:
+    - down as soon as the margin of the current rung, or the frame error rate,
+      is too bad;
+    - up one rung at a time, when the margin of the next rung is large enough
+      and no step happened for a while;
+    - back to the most robust rung when no feedback is received any more.
+
+    The rung used to transmit is announced in the feedback frames, sent at the
+    previous rate before switching, so that an FSK receiver can follow (LoRa
+    receivers demodulate all spreading factors in parallel). Both sides must
+    be started with the same modulation parameters to build the same ladder.
+
+    Feedback frame layout (STREAM_ADR_FB_SIZE bytes):
+        byte 0      STREAM_FRAME_TYPE_FB
+        byte 1      rung used from now on by the sender of the frame
+        byte 2-3    frames received from the peer with a valid CRC (cumulative, little endian)
+        byte 4-5    frames received from the peer with a bad CRC (cumulative, little endian)
+        byte 6-7    average level of the frames received since last feedback, in 0.1 dBm
+                    (signed, little endian), STREAM_ADR_LEVEL_NONE if none
+        byte 8-9    minimum level, same format
+
+    Level is RSSI for FSK, and SNR plus channel noise floor for LoRa, so that
+    it does not depend on the datarate the frames were sent with.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_ADR_H
+#define _STREAM_ADR_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_ADR_RUNG_NB_MAX  8
+#define STREAM_ADR_FB_SIZE      10
+#define STREAM_ADR_LEVEL_NONE   INT16_MIN
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_adr_conf_s
+@brief Tuning of the rate controller
+*/
+struct stream_adr_conf_s {
+    float       margin_up_db;   /*!> margin required on the next rung to step up */
+    float       margin_down_db; /*!> step down when the margin of the current rung is below */
+    float       per_max;        /*!> step down when the frame error rate is above [0..1] */
+    uint32_t    hold_us;        /*!> minimum time between a step and a step up */
+    uint32_t    timeout_us;     /*!> fall back to the most robust rung without feedback or frames */
+};
+
+/**
+@struct stream_adr_rung_s
+@brief A datarate of the ladder
+*/
+struct stream_adr_rung_s {
+    uint8_t     modulation;     /*!> MOD_LORA or MOD_FSK */
+    uint32_t    datarate;       /*!> LoRa spreading factor or FSK bitrate, as in lgw_pkt_tx_s */
+    uint8_t     bandwidth;      /*!> LoRa bandwidth */
+    float       bitrate;        /*!> raw bitrate in bps */
+    float       sens_dbm;       /*!> estimated sensitivity */
+};
+
+/**
+@struct stream_adr_s
+@brief Rate controller context
+*/
+struct stream_adr_s {
+    struct stream_adr_conf_s    conf;
+    struct stream_adr_rung_s    rung[STREAM_ADR_RUNG_NB_MAX];
+    uint8_t                     nb_rung;
+    uint8_t                     tx_rung;        /*!> rung to be used to send to the peer */
+    uint8_t                     rx_rung;        /*!> rung used by the peer, as announced */
+    /* frames received from the peer */
+    uint16_t                    rx_good;
+    uint16_t                    rx_bad;
+    float                       lvl_sum;
+    uint16_t                    lvl_nb;
+    float                       lvl_min;
+    uint64_t                    rx_last_us;
+    /* feedback received from the peer */
+    uint16_t                    tx_count;       /*!> frames sent to the peer */
+    uint16_t                    fb_tx_count;    /*!> tx_count when the last feedback was received */
+    uint16_t                    fb_rx_good;     /*!> rx_good of the last feedback */
+    bool                        fb_started;
+    bool                        fb_new;         /*!> a feedback is waiting to be evaluated */
+    float                       fb_lvl;
+    float                       fb_lvl_min;
+    uint16_t                    fb_delta_tx;    /*!> frames sent between the last two feedbacks */
+    float                       per;            /*!> frame error rate between the last two feedbacks */
+    bool                        lvl_valid;
+    float                       lvl_ewma;
+    uint64_t                    fb_last_us;
+    uint64_t                    change_us;
+    FILE *                      log;
+    /* statistics */
+    uint32_t                    nb_fb;
+    uint32_t                    nb_up;
+    uint32_t                    nb_down;
+    uint32_t                    nb_timeout;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a rate controller, and build its ladder of datarates
+@param ctx rate controller to be initialized
+@param conf tuning of the controller
+@param modulation MOD_LORA or MOD_FSK
+@param datarate fastest datarate (LoRa spreading factor or FSK bitrate)
+@param bandwidth LoRa bandwidth of the fastest datarate
+@param fdev_khz FSK frequency deviation
+@return the number of rungs, -1 on invalid parameters
+
+LoRa ladder is SF12 to SF7 at 125 kHz, plus the given datarate if faster.
+FSK ladder is the given bitrate divided by 16, 8, 4, 2 and 1.
+The controller starts on the most robust rung.
+*/
+int stream_adr_init(struct stream_adr_s * ctx, const struct stream_adr_conf_s * conf, uint8_t modulation, uint32_t datarate, uint8_t bandwidth, uint8_t fdev_khz);
+
+/**
+@brief Log each decision of the controller in a CSV file
+@param ctx rate controller
+@param path file to be created
+@return 0 on success, -1 on error
+*/
+int stream_adr_log_open(struct stream_adr_s * ctx, const char * path);
+
+/**
+@brief Close the decision log
+@param ctx rate controller
+*/
+void stream_adr_log_close(struct stream_adr_s * ctx);
+
+/**
+@brief Account for a frame received from the peer
+@param ctx rate controller
+@param pkt received packet, whatever its CRC status
+*/
+void stream_adr_rx(struct stream_adr_s * ctx, const struct lgw_pkt_rx_s * pkt);
+
+/**
+@brief Account for a frame sent to the peer
+@param ctx rate controller
+*/
+void stream_adr_tx(struct stream_adr_s * ctx);
+
+/**
+@brief Build a feedback frame, and reset the level measurement
+@param ctx rate controller
+@param buf buffer of at least STREAM_ADR_FB_SIZE bytes
+@return the size of the frame
+*/
+int stream_adr_fb_build(struct stream_adr_s * ctx, uint8_t * buf);
+
+/**
+@brief Process a feedback frame received from the peer
+@param ctx rate controller
+@param buf frame content
+@param size frame size
+@return 0 on success, -1 if the frame is invalid
+*/
+int stream_adr_fb_parse(struct stream_adr_s * ctx, const uint8_t * buf, uint16_t size);
+
+/**
+@brief Evaluate the last feedback, or the feedback timeout, and select the TX rung
+@param ctx rate controller
+@return the new TX rung if it changed, -1 otherwise
+*/
+int stream_adr_update(struct stream_adr_s * ctx);
+
+/**
+@brief Fall back to the most robust RX rung when nothing has been received for too long
+@param ctx rate controller
+@return true if the RX rung changed
+*/
+bool stream_adr_rx_timeout(struct stream_adr_s * ctx);
+
+/**
+@brief Print the state of the controller on one line, and reset the statistics
+@param ctx rate controller
+@param f stream to print to
+*/
+void stream_adr_report(struct stream_adr_s * ctx, FILE * f);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,232 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Fragmentation and reassembly of datagrams (IP packets...) bigger than a
+    radio frame, for the point-to-point streaming applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy */
+#include <time.h>       /* clock_gettime */
+
+#include "stream_frag.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void slot_release(struct stream_reasm_slot_s * slot) {
+    slot->busy = false;
+    slot->rcv_mask = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+uint64_t stream_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_frag_split(uint16_t pkt_id, const uint8_t * pkt, uint16_t size, uint8_t frame_size_max, struct stream_frame_s * frames, int nb_frames_max) {
+    int i, nb_frag;
+    uint16_t data_size, offset = 0;
+    uint64_t now;
+
+    /* Check input parameters */
+    if ((pkt == NULL) || (frames == NULL) || (size == 0)) {
+        return -1;
+    }
+    if (frame_size_max <= STREAM_FRAG_HDR_SIZE) {
+        return -1;
+    }
+
+    data_size = frame_size_max - STREAM_FRAG_HDR_SIZE;
+    nb_frag = (size + data_size - 1) / data_size;
+    if ((nb_frag > STREAM_FRAG_NB_MAX) || (nb_frag > nb_frames_max)) {
+        return -1;
+    }
+
+    now = stream_time_us();
+    for (i = 0; i < nb_frag; i++) {
+        uint16_t len = ((size - offset) > data_size) ? data_size : (size - offset);
+
+        frames[i].data[0] = STREAM_FRAME_TYPE_FRAG;
+        frames[i].data[1] = (uint8_t)(pkt_id >> 8);
+        frames[i].data[2] = (uint8_t)(pkt_id >> 0);
+        frames[i].data[3] = (uint8_t)((i << 4) | ((nb_frag - 1) & 0x0F));
+        memcpy(frames[i].data + STREAM_FRAG_HDR_SIZE, pkt + offset, len);
+        frames[i].size = STREAM_FRAG_HDR_SIZE + len;
+        frames[i].time_us = now;
+        offset += len;
+    }
+
+    return nb_frag;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_reasm_init(struct stream_reasm_s * ctx, uint32_t timeout_us) {
+    memset(ctx, 0, sizeof *ctx);
+    ctx->timeout_us = timeout_us;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_reasm_push(struct stream_reasm_s * ctx, const uint8_t * frame, uint16_t size, uint8_t ** pkt, uint16_t * pkt_size) {
+    int i;
+    uint16_t pkt_id, len, offset;
+    uint8_t idx, nb_frag;
+    uint32_t latency_us;
+    uint64_t now;
+    struct stream_reasm_slot_s * slot = NULL;
+    struct stream_reasm_slot_s * oldest = NULL;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (frame == NULL) || (pkt == NULL) || (pkt_size == NULL)) {
+        return -1;
+    }
+    if ((size <= STREAM_FRAG_HDR_SIZE) || (size > STREAM_FRAME_SIZE_MAX) || (frame[0] != STREAM_FRAME_TYPE_FRAG)) {
+        ctx->nb_frag_bad += 1;
+        return -1;
+    }
+
+    pkt_id = ((uint16_t)frame[1] << 8) | frame[2];
+    idx = frame[3] >> 4;
+    nb_frag = (frame[3] & 0x0F) + 1;
+    len = size - STREAM_FRAG_HDR_SIZE;
+    if (idx >= nb_frag) {
+        ctx->nb_frag_bad += 1;
+        return -1;
+    }
+
+    now = stream_time_us();
+    stream_reasm_expire(ctx);
+
+    /* Late or duplicated fragment of a packet already delivered */
+    for (i = 0; i < STREAM_REASM_DONE_NB; i++) {
+        if ((ctx->done[i].done_us != 0) && (ctx->done[i].pkt_id == pkt_id) && ((now - ctx->done[i].done_us) <= ctx->timeout_us)) {
+            ctx->nb_frag_dup += 1;
+            return 0;
+        }
+    }
+
+    /* Find the slot of that packet, or a free one, or evict the oldest */
+    for (i = 0; i < STREAM_REASM_SLOT_NB; i++) {
+        if ((ctx->slot[i].busy == true) && (ctx->slot[i].pkt_id == pkt_id)) {
+            slot = &ctx->slot[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        for (i = 0; i < STREAM_REASM_SLOT_NB; i++) {
+            if (ctx->slot[i].busy == false) {
+                slot = &ctx->slot[i];
+                break;
+            }
+            if ((oldest == NULL) || (ctx->slot[i].first_us < oldest->first_us)) {
+                oldest = &ctx->slot[i];
+            }
+        }
+        if (slot == NULL) {
+            slot = oldest;
+            ctx->nb_pkt_lost += 1;
+        }
+        slot_release(slot);
+        slot->busy = true;
+        slot->pkt_id = pkt_id;
+        slot->nb_frag = nb_frag;
+        slot->first_us = now;
+    }
+
+    if (slot->nb_frag != nb_frag) {
+        /* inconsistent with previous fragments, restart with this one */
+        ctx->nb_pkt_lost += 1;
+        slot_release(slot);
+        slot->busy = true;
+        slot->pkt_id = pkt_id;
+        slot->nb_frag = nb_frag;
+        slot->first_us = now;
+    }
+    if (slot->rcv_mask & (1 << idx)) {
+        ctx->nb_frag_dup += 1;
+        return 0;
+    }
+
+    memcpy(slot->frag[idx], frame + STREAM_FRAG_HDR_SIZE, len);
+    slot->frag_size[idx] = (uint8_t)len;
+    slot->rcv_mask |= (1 << idx);
+    if (slot->rcv_mask != ((1 << nb_frag) - 1)) {
+        return 0;
+    }
+
+    /* Packet complete: concatenate fragments */
+    offset = 0;
+    for (i = 0; i < nb_frag; i++) {
+        memcpy(ctx->pkt + offset, slot->frag[i], slot->frag_size[i]);
+        offset += slot->frag_size[i];
+    }
+    *pkt = ctx->pkt;
+    *pkt_size = offset;
+
+    latency_us = (uint32_t)(now - slot->first_us);
+    ctx->latency_us_sum += latency_us;
+    if (latency_us > ctx->latency_us_max) {
+        ctx->latency_us_max = latency_us;
+    }
+    ctx->nb_pkt_ok += 1;
+    slot_release(slot);
+
+    ctx->done[ctx->done_next].pkt_id = pkt_id;
+    ctx->done[ctx->done_next].done_us = now;
+    ctx->done_next = (ctx->done_next + 1) % STREAM_REASM_DONE_NB;
+
+    return 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_reasm_expire(struct stream_reasm_s * ctx) {
+    int i, nb_drop = 0;
+    uint64_t now;
+
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    now = stream_time_us();
+    for (i = 0; i < STREAM_REASM_SLOT_NB; i++) {
+        if ((ctx->slot[i].busy == true) && ((now - ctx->slot[i].first_us) > ctx->timeout_us)) {
+            slot_release(&ctx->slot[i]);
+            nb_drop += 1;
+        }
+    }
+    ctx->nb_pkt_lost += nb_drop;
+
+    return nb_drop;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
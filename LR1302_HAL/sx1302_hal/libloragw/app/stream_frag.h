@@ -0,0 +1,150 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Fragmentation and reassembly of datagrams (IP packets...) bigger than a
+    radio frame, for the point-to-point streaming applications.
+
+    Radio frame layout:
+        byte 0      frame type (STREAM_FRAME_TYPE_*)
+        byte 1-2    packet id (big endian)
+        byte 3      fragment index (4 MSB) | number of fragments - 1 (4 LSB)
+        byte 4..    fragment data
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_FRAG_H
+#define _STREAM_FRAG_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_FRAME_SIZE_MAX       255 /* Maximum payload of a LoRa/FSK frame */
+#define STREAM_FRAG_HDR_SIZE        4   /* Size of the fragmentation header */
+#define STREAM_FRAG_NB_MAX          16  /* Maximum number of fragments per packet */
+#define STREAM_FRAG_DATA_MAX        (STREAM_FRAME_SIZE_MAX - STREAM_FRAG_HDR_SIZE)
+#define STREAM_FRAG_PKT_SIZE_MAX    (STREAM_FRAG_NB_MAX * STREAM_FRAG_DATA_MAX)
+#define STREAM_REASM_SLOT_NB        4   /* Number of packets which can be reassembled in parallel */
+#define STREAM_REASM_DONE_NB        16  /* Number of completed packets remembered to drop their late fragments */
+
+/* Frame types */
+#define STREAM_FRAME_TYPE_FRAG      0x01 /* Fragment of a packet */
+#define STREAM_FRAME_TYPE_AGG       0x02 /* Aggregated records (see stream_rohc.h) */
+#define STREAM_FRAME_TYPE_FB        0x03 /* Link feedback (see stream_adr.h) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_frame_s
+@brief A radio frame, as given to or returned by the radio
+*/
+struct stream_frame_s {
+    uint16_t    size;                           /*!> frame size in bytes */
+    uint8_t     data[STREAM_FRAME_SIZE_MAX];    /*!> frame content, header included */
+    uint64_t    time_us;                        /*!> host monotonic time at which the frame was queued */
+};
+
+/**
+@struct stream_reasm_slot_s
+@brief A packet being reassembled
+*/
+struct stream_reasm_slot_s {
+    bool        busy;
+    uint16_t    pkt_id;
+    uint8_t     nb_frag;
+    uint16_t    rcv_mask;                                       /*!> bitmask of the fragments already received */
+    uint8_t     frag_size[STREAM_FRAG_NB_MAX];
+    uint8_t     frag[STREAM_FRAG_NB_MAX][STREAM_FRAG_DATA_MAX];
+    uint64_t    first_us;                                       /*!> time of reception of the first fragment */
+};
+
+/**
+@struct stream_reasm_done_s
+@brief A packet recently reassembled
+*/
+struct stream_reasm_done_s {
+    uint16_t    pkt_id;
+    uint64_t    done_us;                                        /*!> time of completion, 0 if unused */
+};
+
+/**
+@struct stream_reasm_s
+@brief Reassembly context
+*/
+struct stream_reasm_s {
+    uint32_t                    timeout_us;                     /*!> incomplete packets are dropped after that time */
+    struct stream_reasm_slot_s  slot[STREAM_REASM_SLOT_NB];
+    struct stream_reasm_done_s  done[STREAM_REASM_DONE_NB];     /*!> ring of the latest packets completed, kept for timeout_us */
+    uint8_t                     done_next;                      /*!> next entry of the ring to be written */
+    uint8_t                     pkt[STREAM_FRAG_PKT_SIZE_MAX];  /*!> last packet reassembled */
+    /* statistics */
+    uint32_t                    nb_pkt_ok;      /*!> packets completely reassembled */
+    uint32_t                    nb_pkt_lost;    /*!> packets dropped on timeout or slot eviction */
+    uint32_t                    nb_frag_dup;    /*!> duplicated fragments ignored, late ones of completed packets included */
+    uint32_t                    nb_frag_bad;    /*!> malformed frames ignored */
+    uint64_t                    latency_us_sum; /*!> sum of first fragment to completion delays */
+    uint32_t                    latency_us_max; /*!> max of first fragment to completion delays */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Get the current host monotonic time
+@return the time in microseconds
+*/
+uint64_t stream_time_us(void);
+
+/**
+@brief Split a packet into radio frames
+@param pkt_id identifier of the packet, to be incremented by the caller for each packet
+@param pkt packet to be split
+@param size size of the packet, in bytes
+@param frame_size_max maximum size of the radio frames to be generated (header included)
+@param frames array to receive the generated frames
+@param nb_frames_max size of the frames array
+@return the number of frames generated, -1 if the packet does not fit
+*/
+int stream_frag_split(uint16_t pkt_id, const uint8_t * pkt, uint16_t size, uint8_t frame_size_max, struct stream_frame_s * frames, int nb_frames_max);
+
+/**
+@brief Initialize a reassembly context
+@param ctx reassembly context to be initialized
+@param timeout_us maximum time to wait for all the fragments of a packet
+*/
+void stream_reasm_init(struct stream_reasm_s * ctx, uint32_t timeout_us);
+
+/**
+@brief Give a received radio frame to the reassembly context
+@param ctx reassembly context
+@param frame received frame, header included
+@param size size of the received frame
+@param pkt pointer set to the reassembled packet, valid until next call
+@param pkt_size pointer to receive the size of the reassembled packet
+@return 1 if a packet has been completed, 0 if more fragments are needed, -1 if the frame is invalid
+*/
+int stream_reasm_push(struct stream_reasm_s * ctx, const uint8_t * frame, uint16_t size, uint8_t ** pkt, uint16_t * pkt_size);
+
+/**
+@brief Drop the packets which have been waiting for fragments for too long
+@param ctx reassembly context
+@return the number of packets dropped
+*/
+int stream_reasm_expire(struct stream_reasm_s * ctx);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,283 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Interference-aware frequency hopping for the streaming applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fprintf */
+#include <string.h>     /* memset */
+
+#include "stream_hop.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define RX_IF_MAX_HZ        737500  /* half the radio RX bandwidth (1.6 MHz), minus half a 125 kHz channel */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* integer hash with good avalanche, so that consecutive rounds give unrelated permutations */
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Fisher-Yates shuffle of the channels, drawn from the seed and the round number */
+static void round_perm(const struct stream_hop_s * ctx, uint16_t fcnt, uint8_t perm[STREAM_HOP_CHAN_NB_MAX]) {
+    uint32_t r;
+    uint8_t i, j, tmp;
+
+    r = hash32(ctx->conf.seed ^ hash32(fcnt / ctx->conf.nb_chan));
+    for (i = 0; i < ctx->conf.nb_chan; i++) {
+        perm[i] = i;
+    }
+    for (i = ctx->conf.nb_chan - 1; i > 0; i--) {
+        r = hash32(r);
+        j = r % (i + 1);
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int stream_hop_init(struct stream_hop_s * ctx, const struct stream_hop_conf_s * conf) {
+    int i;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (conf == NULL) || (conf->nb_chan == 0) || (conf->nb_chan > STREAM_HOP_CHAN_NB_MAX)) {
+        return -1;
+    }
+    if ((conf->nb_chan > 1) && (conf->step_hz == 0)) {
+        return -1;
+    }
+
+    memset(ctx, 0, sizeof *ctx);
+    ctx->conf = *conf;
+    ctx->allowed = (uint8_t)((1U << conf->nb_chan) - 1);
+    for (i = 0; i < STREAM_HOP_CHAN_NB_MAX; i++) {
+        ctx->ratio[i] = -1.0;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint32_t stream_hop_freq(const struct stream_hop_s * ctx, uint8_t chan) {
+    return ctx->conf.freq_hz_start + (chan * ctx->conf.step_hz);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_hop_chan(const struct stream_hop_s * ctx, uint32_t freq_hz) {
+    uint32_t half = ctx->conf.step_hz / 2;
+    uint32_t i;
+
+    if (ctx->conf.nb_chan == 1) {
+        return (freq_hz == ctx->conf.freq_hz_start) ? 0 : -1;
+    }
+
+    /* nearest channel, within half a step */
+    if ((freq_hz + half) < ctx->conf.freq_hz_start) {
+        return -1;
+    }
+    i = (freq_hz + half - ctx->conf.freq_hz_start) / ctx->conf.step_hz;
+    if (i >= ctx->conf.nb_chan) {
+        return -1;
+    }
+
+    return (int)i;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint8_t stream_hop_seq(const struct stream_hop_s * ctx, uint16_t fcnt) {
+    uint8_t perm[STREAM_HOP_CHAN_NB_MAX];
+
+    round_perm(ctx, fcnt, perm);
+    return perm[fcnt % ctx->conf.nb_chan];
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint8_t stream_hop_next(struct stream_hop_s * ctx, uint16_t fcnt) {
+    uint8_t perm[STREAM_HOP_CHAN_NB_MAX];
+    uint8_t pos, chan;
+    int i;
+
+    round_perm(ctx, fcnt, perm);
+    pos = fcnt % ctx->conf.nb_chan;
+
+    /* sequence channel, or the next allowed one of the round */
+    chan = perm[pos];
+    for (i = 0; i < ctx->conf.nb_chan; i++) {
+        chan = perm[(pos + i) % ctx->conf.nb_chan];
+        if (ctx->allowed & (1U << chan)) {
+            break;
+        }
+    }
+    if (i > 0) {
+        ctx->nb_off_seq += 1;
+    }
+    ctx->nb_frame[chan] += 1;
+
+    return chan;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_hop_update(struct stream_hop_s * ctx, const lgw_occ_t * occ) {
+    uint8_t allowed = 0;
+    uint32_t age_s;
+    float ratio;
+    int i, best = 0, nb = 0;
+
+    if ((ctx == NULL) || (occ == NULL)) {
+        return -1;
+    }
+
+    for (i = 0; i < ctx->conf.nb_chan; i++) {
+        if ((lgw_occ_busy(occ, stream_hop_freq(ctx, i), ctx->conf.busy_rssi_dbm, &ratio, &age_s) != LGW_OCC_SUCCESS) ||
+            (age_s > ctx->conf.busy_age_s)) {
+            ctx->ratio[i] = -1.0; /* unknown, assumed free */
+        } else {
+            ctx->ratio[i] = ratio;
+        }
+        if (ctx->ratio[i] <= ctx->conf.busy_ratio) {
+            allowed |= (uint8_t)(1U << i);
+            nb += 1;
+        }
+        if (ctx->ratio[i] < ctx->ratio[best]) {
+            best = i;
+        }
+    }
+
+    /* never stop transmitting: keep the least busy channel */
+    if (nb == 0) {
+        allowed = (uint8_t)(1U << best);
+        nb = 1;
+    }
+
+    for (i = 0; i < ctx->conf.nb_chan; i++) {
+        if ((ctx->allowed & (1U << i)) && !(allowed & (1U << i))) {
+            ctx->nb_exclude += 1;
+        }
+    }
+    ctx->allowed = allowed;
+
+    return nb;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_hop_rx(struct stream_hop_s * ctx, const struct lgw_pkt_rx_s * pkt, uint16_t fcnt) {
+    int chan;
+
+    if ((ctx == NULL) || (pkt == NULL)) {
+        return;
+    }
+
+    chan = stream_hop_chan(ctx, pkt->freq_hz);
+    if (chan < 0) {
+        ctx->nb_unknown += 1;
+        return;
+    }
+    ctx->nb_frame[chan] += 1;
+    if (chan != stream_hop_seq(ctx, fcnt)) {
+        ctx->nb_off_seq += 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_hop_rx_plan(const struct stream_hop_conf_s * conf, struct stream_hop_rx_plan_s * plan) {
+    uint8_t nb_a, first, nb, rf, i;
+    uint32_t freq_hz;
+    int32_t if_hz;
+
+    /* Check input parameters */
+    if ((conf == NULL) || (plan == NULL) || (conf->nb_chan == 0) || (conf->nb_chan > STREAM_HOP_CHAN_NB_MAX)) {
+        return -1;
+    }
+
+    /* first half of the channels on radio A, second half on radio B, each radio centered on its channels */
+    memset(plan, 0, sizeof *plan);
+    nb_a = (conf->nb_chan + 1) / 2;
+    for (rf = 0; rf < LGW_RF_CHAIN_NB; rf++) {
+        first = (rf == 0) ? 0 : nb_a;
+        nb = (rf == 0) ? nb_a : (conf->nb_chan - nb_a);
+        if (nb == 0) {
+            plan->rf_freq_hz[rf] = plan->rf_freq_hz[0];
+            continue;
+        }
+        plan->rf_freq_hz[rf] = conf->freq_hz_start + (first * conf->step_hz) + (((nb - 1) * conf->step_hz) / 2);
+        for (i = first; i < (first + nb); i++) {
+            freq_hz = conf->freq_hz_start + (i * conf->step_hz);
+            if_hz = (int32_t)(freq_hz - plan->rf_freq_hz[rf]);
+            if ((if_hz > RX_IF_MAX_HZ) || (if_hz < -RX_IF_MAX_HZ)) {
+                return -1;
+            }
+            plan->if_rf_chain[i] = rf;
+            plan->if_freq_hz[i] = if_hz;
+        }
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_hop_report(struct stream_hop_s * ctx, FILE * f) {
+    int i;
+
+    if ((ctx == NULL) || (f == NULL)) {
+        return;
+    }
+
+    fprintf(f, "INFO: hop:");
+    for (i = 0; i < ctx->conf.nb_chan; i++) {
+        fprintf(f, " %.3f%s %u", stream_hop_freq(ctx, i) / 1e6, (ctx->allowed & (1U << i)) ? "" : "(x)", ctx->nb_frame[i]);
+        if (ctx->ratio[i] >= 0.0) {
+            fprintf(f, " (%.0f%%)", 100.0 * ctx->ratio[i]);
+        }
+        fprintf(f, ",");
+        ctx->nb_frame[i] = 0;
+    }
+    fprintf(f, " off sequence %u, unknown %u, exclusions %u\n", ctx->nb_off_seq, ctx->nb_unknown, ctx->nb_exclude);
+
+    ctx->nb_off_seq = 0;
+    ctx->nb_unknown = 0;
+    ctx->nb_exclude = 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
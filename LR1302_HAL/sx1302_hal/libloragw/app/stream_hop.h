@@ -0,0 +1,170 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Interference-aware frequency hopping for the streaming applications.
+
+    The hop channels are a regular grid of up to STREAM_HOP_CHAN_NB_MAX LoRa
+    125 kHz channels, so that the receiver can demodulate all of them at once
+    with its multi-SF IF chains: the first half of the grid is received on
+    radio A, the second half on radio B.
+
+    The channel of a frame is given by its FCnt: FCnt is split in rounds of
+    nb_chan frames, and each round is a permutation of the channels drawn from
+    the seed and the round number. Both sides compute the same sequence without
+    exchanging anything, each channel is used once per round, and a lost frame
+    does not shift the sequence.
+
+    The sender excludes the channels found busy in a spectrum occupancy map
+    (see loragw_occ.h): a channel is busy when the RSSI is above busy_rssi_dbm
+    for more than busy_ratio of the time, as long as its last scan is recent
+    enough. The frame is then sent on the next allowed channel of the round
+    permutation, so the receiver sees it "off sequence" on another channel.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_HOP_H
+#define _STREAM_HOP_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+
+#include "loragw_hal.h"
+#include "loragw_occ.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_HOP_CHAN_NB_MAX  8       /* LoRa multi-SF IF chains of the receiver */
+#define STREAM_HOP_STEP_HZ      200000  /* default channel spacing */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_hop_conf_s
+@brief Hop channels, sequence and exclusion criteria, identical on both sides
+(except for the exclusion criteria, only used by the sender)
+*/
+struct stream_hop_conf_s {
+    uint32_t    freq_hz_start;  /*!> frequency of the first channel */
+    uint32_t    step_hz;        /*!> frequency between 2 channels */
+    uint8_t     nb_chan;        /*!> number of channels [1..STREAM_HOP_CHAN_NB_MAX] */
+    uint32_t    seed;           /*!> seed of the hop sequence */
+    int16_t     busy_rssi_dbm;  /*!> RSSI above which the channel is considered occupied */
+    float       busy_ratio;     /*!> channel excluded when occupied more than this ratio of the time [0..1] */
+    uint32_t    busy_age_s;     /*!> scan results older than this are ignored */
+};
+
+/**
+@struct stream_hop_rx_plan_s
+@brief Receiver configuration to demodulate all hop channels at once
+*/
+struct stream_hop_rx_plan_s {
+    uint32_t    rf_freq_hz[LGW_RF_CHAIN_NB];        /*!> center frequency of each radio */
+    uint8_t     if_rf_chain[STREAM_HOP_CHAN_NB_MAX];/*!> radio of each hop channel */
+    int32_t     if_freq_hz[STREAM_HOP_CHAN_NB_MAX]; /*!> IF frequency of each hop channel */
+};
+
+/**
+@struct stream_hop_s
+@brief Hopping context
+*/
+struct stream_hop_s {
+    struct stream_hop_conf_s    conf;
+    uint8_t                     allowed;        /*!> bit mask of the channels not excluded */
+    float                       ratio[STREAM_HOP_CHAN_NB_MAX]; /*!> last busy ratio, -1 if unknown */
+    /* statistics */
+    uint32_t                    nb_frame[STREAM_HOP_CHAN_NB_MAX];   /*!> frames sent or received per channel */
+    uint32_t                    nb_off_seq;     /*!> frames moved to (TX) or received on (RX) another channel than the sequence one */
+    uint32_t                    nb_unknown;     /*!> frames received out of the hop channels */
+    uint32_t                    nb_exclude;     /*!> transitions of a channel to excluded */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a hopping context, all channels allowed
+@param ctx hopping context to be initialized
+@param conf hop channels and exclusion criteria
+@return 0 on success, -1 on invalid parameters
+*/
+int stream_hop_init(struct stream_hop_s * ctx, const struct stream_hop_conf_s * conf);
+
+/**
+@brief Get the frequency of a hop channel
+@param ctx hopping context
+@param chan channel index
+@return the frequency in Hz
+*/
+uint32_t stream_hop_freq(const struct stream_hop_s * ctx, uint8_t chan);
+
+/**
+@brief Get the index of the hop channel of a frequency
+@param ctx hopping context
+@param freq_hz frequency
+@return the channel index, -1 if not a hop channel
+*/
+int stream_hop_chan(const struct stream_hop_s * ctx, uint32_t freq_hz);
+
+/**
+@brief Get the channel given by the hop sequence for a frame, regardless of exclusions
+@param ctx hopping context
+@param fcnt frame counter
+@return the channel index
+*/
+uint8_t stream_hop_seq(const struct stream_hop_s * ctx, uint16_t fcnt);
+
+/**
+@brief Select the channel to send a frame on, skipping the excluded channels
+@param ctx hopping context
+@param fcnt frame counter
+@return the channel index
+*/
+uint8_t stream_hop_next(struct stream_hop_s * ctx, uint16_t fcnt);
+
+/**
+@brief Re-evaluate the excluded channels from an occupancy map
+@param ctx hopping context
+@param occ occupancy map, channels never scanned or out of the map are allowed
+@return the number of allowed channels (at least 1: the least busy one is kept)
+*/
+int stream_hop_update(struct stream_hop_s * ctx, const lgw_occ_t * occ);
+
+/**
+@brief Account for a frame received, to check the sequence and per channel statistics
+@param ctx hopping context
+@param pkt received packet
+@param fcnt frame counter carried by the packet
+*/
+void stream_hop_rx(struct stream_hop_s * ctx, const struct lgw_pkt_rx_s * pkt, uint16_t fcnt);
+
+/**
+@brief Compute the radios and IF chains configuration covering all hop channels
+@param conf hop channels
+@param plan receiver configuration to be filled
+@return 0 on success, -1 if the channels cannot be covered by the 2 radios
+*/
+int stream_hop_rx_plan(const struct stream_hop_conf_s * conf, struct stream_hop_rx_plan_s * plan);
+
+/**
+@brief Print the channels state and statistics on one line, and reset the statistics
+@param ctx hopping context
+@param f stream to print to
+*/
+void stream_hop_report(struct stream_hop_s * ctx, FILE * f);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
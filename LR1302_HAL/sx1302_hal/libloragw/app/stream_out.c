@@ -0,0 +1,237 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Output of the packets received by the streaming applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fopen, fwrite, fprintf */
+#include <string.h>     /* strcmp, memcpy */
+#include <errno.h>      /* errno */
+#include <unistd.h>     /* dup */
+#include <sys/uio.h>    /* writev */
+
+#include "stream_out.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define META_BUFF_SIZE      (64 * 1024) /* metadata is flushed once per fetch */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint8_t * put_u32(uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 0);
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+static uint8_t * put_u16(uint8_t * p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 0);
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* payloads written by stream_out_payloads() */
+static bool payload_out(const struct lgw_pkt_rx_s * pkt, uint16_t hdr_size) {
+    return (pkt->status == STAT_CRC_OK) && (pkt->size > hdr_size);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int stream_out_writev(int fd, struct iovec * iov, int nb_iov) {
+    ssize_t nb_byte, total = 0;
+
+    /* writev() can be partial on pipes and sockets: resume where it stopped */
+    while (nb_iov > 0) {
+        nb_byte = writev(fd, iov, nb_iov);
+        if (nb_byte < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (total > 0)) {
+                /* non-blocking fd full: report what has been written, iov holds the rest */
+                break;
+            }
+            return -1;
+        }
+        if (nb_byte == 0) {
+            /* nothing written while bytes are pending: no progress can be made */
+            errno = EIO;
+            return -1;
+        }
+        total += nb_byte;
+        while ((nb_iov > 0) && ((size_t)nb_byte >= iov->iov_len)) {
+            nb_byte -= iov->iov_len;
+            iov += 1;
+            nb_iov -= 1;
+        }
+        if (nb_iov > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + nb_byte;
+            iov->iov_len -= nb_byte;
+        }
+    }
+
+    return (int)total;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_out_payloads(int fd, const struct lgw_pkt_rx_s * pkt, int nb_pkt, uint16_t hdr_size) {
+    int i, nb_iov = 0;
+    struct iovec iov[nb_pkt > 0 ? nb_pkt : 1];
+
+    /* Check input parameters */
+    if ((pkt == NULL) || (nb_pkt < 0)) {
+        return -1;
+    }
+
+    for (i = 0; i < nb_pkt; i++) {
+        if (payload_out(&pkt[i], hdr_size) == false) {
+            continue;
+        }
+        iov[nb_iov].iov_base = (void *)(pkt[i].payload + hdr_size);
+        iov[nb_iov].iov_len = pkt[i].size - hdr_size;
+        nb_iov += 1;
+    }
+
+    return stream_out_writev(fd, iov, nb_iov);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_out_rest(const struct lgw_pkt_rx_s * pkt, int nb_pkt, uint16_t hdr_size, int skip, uint8_t * buf, int size) {
+    int i, len, nb_byte = 0;
+
+    /* Check input parameters */
+    if ((pkt == NULL) || (buf == NULL) || (skip < 0)) {
+        return -1;
+    }
+
+    for (i = 0; i < nb_pkt; i++) {
+        if (payload_out(&pkt[i], hdr_size) == false) {
+            continue;
+        }
+        len = pkt[i].size - hdr_size;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        if ((nb_byte + len - skip) > size) {
+            return -1;
+        }
+        memcpy(buf + nb_byte, pkt[i].payload + hdr_size + skip, len - skip);
+        nb_byte += len - skip;
+        skip = 0;
+    }
+
+    return nb_byte;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+FILE * stream_meta_open(const char * path, stream_meta_fmt_t fmt) {
+    FILE * f;
+    int fd;
+
+    /* Check input parameters */
+    if (path == NULL) {
+        return NULL;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        /* stderr is unbuffered, use a buffered stream on the same file */
+        fd = dup(STDERR_FILENO);
+        f = (fd < 0) ? NULL : fdopen(fd, "w");
+    } else {
+        f = fopen(path, (fmt == STREAM_META_BIN) ? "wb" : "w");
+    }
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: failed to open metadata file %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, META_BUFF_SIZE);
+
+    if (fmt == STREAM_META_CSV) {
+        fprintf(f, "count_us,freq_hz,if_chain,rf_chain,status,modulation,datarate,bandwidth,coderate,size,crc,rssic,rssis,snr\n");
+        fflush(f);
+    }
+
+    return f;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_meta_write(FILE * f, stream_meta_fmt_t fmt, const struct lgw_pkt_rx_s * pkt, int nb_pkt) {
+    int i;
+    uint8_t rec[STREAM_META_BIN_SIZE];
+    uint8_t * p;
+
+    /* Check input parameters */
+    if ((f == NULL) || (pkt == NULL)) {
+        return -1;
+    }
+
+    for (i = 0; i < nb_pkt; i++) {
+        if (fmt == STREAM_META_BIN) {
+            p = rec;
+            p = put_u32(p, pkt[i].count_us);
+            p = put_u32(p, pkt[i].freq_hz);
+            p = put_u32(p, pkt[i].datarate);
+            p = put_u16(p, pkt[i].size);
+            p = put_u16(p, pkt[i].crc);
+            p = put_u16(p, (uint16_t)(int16_t)(pkt[i].rssic * 10));
+            p = put_u16(p, (uint16_t)(int16_t)(pkt[i].rssis * 10));
+            p = put_u16(p, (uint16_t)(int16_t)(pkt[i].snr * 10));
+            *p++ = pkt[i].if_chain;
+            *p++ = pkt[i].rf_chain;
+            *p++ = pkt[i].modulation;
+            *p++ = pkt[i].bandwidth;
+            *p++ = pkt[i].coderate;
+            *p++ = pkt[i].status;
+            fwrite(rec, 1, sizeof rec, f);
+        } else {
+            fprintf(f, "%u,%u,%u,%u,0x%02X,%s,%u,%u,%u,%u,0x%04X,%.1f,%.1f,%.1f\n",
+                        pkt[i].count_us, pkt[i].freq_hz, pkt[i].if_chain, pkt[i].rf_chain, pkt[i].status,
+                        (pkt[i].modulation == MOD_LORA) ? "LORA" : "FSK", pkt[i].datarate, pkt[i].bandwidth,
+                        pkt[i].coderate, pkt[i].size, pkt[i].crc, pkt[i].rssic, pkt[i].rssis, pkt[i].snr);
+        }
+    }
+
+    return (fflush(f) == 0) ? 0 : -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_meta_close(FILE * f) {
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,107 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Output of the packets received by the streaming applications: payloads are
+    written with a single system call per fetch, per-packet metadata goes to an
+    optional buffered side channel (CSV or compact binary records).
+
+    Binary metadata record (little endian, STREAM_META_BIN_SIZE bytes):
+        count_us (4) | freq_hz (4) | datarate (4) | size (2) | crc (2) |
+        rssic x10 (2, signed) | rssis x10 (2, signed) | snr x10 (2, signed) |
+        if_chain (1) | rf_chain (1) | modulation (1) | bandwidth (1) |
+        coderate (1) | status (1)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_OUT_H
+#define _STREAM_OUT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdio.h>      /* FILE */
+#include <sys/uio.h>    /* struct iovec */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_META_BIN_SIZE    28
+
+typedef enum {
+    STREAM_META_CSV,
+    STREAM_META_BIN
+} stream_meta_fmt_t;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Write a vector of buffers, resuming after partial writes
+@param fd file descriptor to write to
+@param iov buffers to be written, modified by the function
+@param nb_iov number of buffers
+@return the number of bytes written, -1 on error. On a non-blocking fd, the
+        write stops when the fd is full: the count is then short if some bytes
+        went through (iov describes the rest), -1 with errno EAGAIN otherwise
+*/
+int stream_out_writev(int fd, struct iovec * iov, int nb_iov);
+
+/**
+@brief Write the payloads of the packets received with CRC OK, with a single writev()
+@param fd file descriptor to write to
+@param pkt array of packets returned by lgw_receive()
+@param nb_pkt number of packets in the array
+@param hdr_size number of bytes to be skipped at the beginning of each payload
+@return the number of bytes written, -1 on error
+*/
+int stream_out_payloads(int fd, const struct lgw_pkt_rx_s * pkt, int nb_pkt, uint16_t hdr_size);
+
+/**
+@brief Copy the payload bytes that a short stream_out_payloads() did not write
+@param pkt array of packets given to stream_out_payloads()
+@param nb_pkt number of packets in the array
+@param hdr_size number of bytes skipped at the beginning of each payload
+@param skip number of bytes written, as returned by stream_out_payloads()
+@param buf buffer to copy the rest to
+@param size size of the buffer
+@return the number of bytes copied, -1 if the buffer is too small
+*/
+int stream_out_rest(const struct lgw_pkt_rx_s * pkt, int nb_pkt, uint16_t hdr_size, int skip, uint8_t * buf, int size);
+
+/**
+@brief Open a metadata side channel
+@param path file to be written, "-" for stderr
+@param fmt format of the metadata
+@return a buffered stream, NULL on error
+*/
+FILE * stream_meta_open(const char * path, stream_meta_fmt_t fmt);
+
+/**
+@brief Write the metadata of a batch of packets, and flush it
+@param f stream returned by stream_meta_open()
+@param fmt format of the metadata
+@param pkt array of packets returned by lgw_receive()
+@param nb_pkt number of packets in the array
+@return 0 on success, -1 on error
+*/
+int stream_meta_write(FILE * f, stream_meta_fmt_t fmt, const struct lgw_pkt_rx_s * pkt, int nb_pkt);
+
+/**
+@brief Close a metadata side channel
+@param f stream returned by stream_meta_open()
+*/
+void stream_meta_close(FILE * f);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
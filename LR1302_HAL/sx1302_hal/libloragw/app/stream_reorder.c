@@ -0,0 +1,295 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Reorder/jitter buffer for the streaming applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fprintf */
+#include <string.h>     /* memset, memcpy */
+#include <sys/uio.h>    /* struct iovec */
+
+#include "stream_reorder.h"
+#include "stream_frag.h"    /* stream_time_us */
+#include "stream_out.h"     /* stream_out_writev */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define WRITE_IOV_NB        64  /* elements written per writev() call */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const uint8_t zero_fill[STREAM_REORDER_DATA_MAX] = { 0 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int stream_reorder_init(struct stream_reorder_s * ctx, uint16_t window, uint32_t latency_us) {
+    /* Check input parameters */
+    if ((ctx == NULL) || (window == 0) || (window > STREAM_REORDER_SLOT_MAX)) {
+        return -1;
+    }
+
+    memset(ctx, 0, sizeof *ctx);
+    ctx->window = window;
+    ctx->latency_us = latency_us;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_reorder_push(struct stream_reorder_s * ctx, uint16_t seq, const uint8_t * data, uint16_t size) {
+    int16_t d;
+    struct stream_reorder_slot_s * slot;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (data == NULL) || (size > STREAM_REORDER_DATA_MAX)) {
+        return -1;
+    }
+
+    if (ctx->started == false) {
+        ctx->started = true;
+        ctx->next_seq = seq;
+        ctx->highest_seq = seq;
+    }
+
+    d = (int16_t)(seq - ctx->next_seq);
+    if (d < 0) {
+        if (d > -(int16_t)ctx->window) {
+            ctx->nb_in += 1;
+            ctx->nb_late += 1;
+            return STREAM_REORDER_LATE;
+        }
+        /* far behind: the transmitter has restarted its sequence */
+        if (ctx->nb_buffered > 0) {
+            return STREAM_REORDER_FULL;
+        }
+        ctx->nb_resync += 1;
+        ctx->next_seq = seq;
+        ctx->highest_seq = seq;
+        d = 0;
+    } else if (d >= (int16_t)ctx->window) {
+        if (ctx->nb_buffered > 0) {
+            return STREAM_REORDER_FULL;
+        }
+        /* jump ahead with nothing buffered: the packets in between are lost */
+        ctx->pending_seq = ctx->next_seq;
+        ctx->pending_gap = (uint16_t)d;
+        ctx->nb_lost += d;
+        ctx->nb_gap += 1;
+        ctx->next_seq = seq;
+        d = 0;
+    }
+
+    ctx->nb_in += 1;
+    slot = &ctx->slot[(ctx->head + d) % ctx->window];
+    if (slot->used == true) {
+        ctx->nb_dup += 1;
+        return STREAM_REORDER_DUP;
+    }
+
+    memcpy(slot->data, data, size);
+    slot->size = size;
+    slot->rx_us = stream_time_us();
+    slot->used = true;
+    ctx->nb_buffered += 1;
+
+    if ((uint16_t)d > ctx->depth_max) {
+        ctx->depth_max = (uint16_t)d;
+    }
+    if ((int16_t)(seq - ctx->highest_seq) < 0) {
+        ctx->nb_reordered += 1;
+    } else {
+        ctx->highest_seq = seq;
+    }
+
+    return STREAM_REORDER_OK;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_reorder_pop(struct stream_reorder_s * ctx, bool force, struct stream_reorder_item_s * item) {
+    int i, first = -1;
+    uint64_t oldest_us = UINT64_MAX;
+    struct stream_reorder_slot_s * slot;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (item == NULL)) {
+        return 0;
+    }
+
+    if (ctx->pending_gap > 0) {
+        item->seq = ctx->pending_seq;
+        item->data = NULL;
+        item->size = ctx->last_size;
+        item->nb_missing = ctx->pending_gap;
+        ctx->pending_gap = 0;
+        return 1;
+    }
+
+    if (ctx->nb_buffered == 0) {
+        return 0;
+    }
+
+    slot = &ctx->slot[ctx->head];
+    if (slot->used == true) {
+        item->seq = ctx->next_seq;
+        item->data = slot->data;
+        item->size = slot->size;
+        item->nb_missing = 0;
+        slot->used = false;
+        ctx->nb_buffered -= 1;
+        ctx->head = (ctx->head + 1) % ctx->window;
+        ctx->next_seq += 1;
+        ctx->last_size = slot->size;
+        ctx->nb_out += 1;
+        return 1;
+    }
+
+    /* Next packet is missing: give up on it if a later one waited too long */
+    for (i = 1; i < ctx->window; i++) {
+        slot = &ctx->slot[(ctx->head + i) % ctx->window];
+        if (slot->used == true) {
+            if (first < 0) {
+                first = i;
+            }
+            if (slot->rx_us < oldest_us) {
+                oldest_us = slot->rx_us;
+            }
+        }
+    }
+    if (first < 0) {
+        return 0; /* cannot happen, nb_buffered > 0 */
+    }
+    if ((force == false) && ((stream_time_us() - oldest_us) < ctx->latency_us)) {
+        return 0;
+    }
+
+    item->seq = ctx->next_seq;
+    item->data = NULL;
+    item->size = ctx->last_size;
+    item->nb_missing = (uint16_t)first;
+    ctx->head = (ctx->head + first) % ctx->window;
+    ctx->next_seq += first;
+    ctx->nb_lost += first;
+    ctx->nb_gap += 1;
+
+    return 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_reorder_write(struct stream_reorder_s * ctx, int fd, bool force, stream_gap_mode_t gap_mode) {
+    int i, x, nb_iov = 0, nb_marker = 0, total = 0;
+    struct iovec iov[WRITE_IOV_NB];
+    uint8_t marker[WRITE_IOV_NB][STREAM_GAP_MARKER_SIZE];
+    struct stream_reorder_item_s item;
+
+    while (stream_reorder_pop(ctx, force, &item) == 1) {
+        if (item.data != NULL) {
+            iov[nb_iov].iov_base = (void *)item.data;
+            iov[nb_iov].iov_len = item.size;
+            nb_iov += 1;
+        } else if (gap_mode == STREAM_GAP_MARKER) {
+            marker[nb_marker][0] = 0xFF;
+            marker[nb_marker][1] = 'G';
+            marker[nb_marker][2] = 'A';
+            marker[nb_marker][3] = 'P';
+            marker[nb_marker][4] = (uint8_t)(item.seq >> 8);
+            marker[nb_marker][5] = (uint8_t)(item.seq >> 0);
+            marker[nb_marker][6] = (uint8_t)(item.nb_missing >> 8);
+            marker[nb_marker][7] = (uint8_t)(item.nb_missing >> 0);
+            iov[nb_iov].iov_base = marker[nb_marker];
+            iov[nb_iov].iov_len = STREAM_GAP_MARKER_SIZE;
+            nb_iov += 1;
+            nb_marker += 1;
+        } else if ((gap_mode == STREAM_GAP_ZERO) && (item.size > 0)) {
+            /* one block of zeros per missing packet, at most one window worth of them */
+            for (i = 0; (i < item.nb_missing) && (i < ctx->window); i++) {
+                iov[nb_iov].iov_base = (void *)zero_fill;
+                iov[nb_iov].iov_len = item.size;
+                nb_iov += 1;
+                if (nb_iov == WRITE_IOV_NB) {
+                    x = stream_out_writev(fd, iov, nb_iov);
+                    if (x < 0) {
+                        return -1;
+                    }
+                    total += x;
+                    nb_iov = 0;
+                    nb_marker = 0;
+                }
+            }
+        }
+
+        /* data pointers stay valid until next push, markers until the buffer is reused */
+        if (nb_iov == WRITE_IOV_NB) {
+            x = stream_out_writev(fd, iov, nb_iov);
+            if (x < 0) {
+                return -1;
+            }
+            total += x;
+            nb_iov = 0;
+            nb_marker = 0;
+        }
+    }
+
+    if (nb_iov > 0) {
+        x = stream_out_writev(fd, iov, nb_iov);
+        if (x < 0) {
+            return -1;
+        }
+        total += x;
+    }
+
+    return total;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_reorder_report(struct stream_reorder_s * ctx, FILE * f) {
+    uint32_t nb_expected;
+
+    if ((ctx == NULL) || (f == NULL)) {
+        return;
+    }
+
+    nb_expected = ctx->nb_out + ctx->nb_lost;
+    fprintf(f, "INFO: reorder: in %u, out %u, dup %u, late %u, reordered %u (depth max %u), lost %u (%.2f%%) in %u gaps, resync %u, buffered %u\n",
+                ctx->nb_in, ctx->nb_out, ctx->nb_dup, ctx->nb_late, ctx->nb_reordered, ctx->depth_max,
+                ctx->nb_lost, (nb_expected > 0) ? (100.0 * ctx->nb_lost / nb_expected) : 0.0, ctx->nb_gap,
+                ctx->nb_resync, ctx->nb_buffered);
+
+    ctx->nb_in = 0;
+    ctx->nb_out = 0;
+    ctx->nb_dup = 0;
+    ctx->nb_late = 0;
+    ctx->nb_reordered = 0;
+    ctx->nb_lost = 0;
+    ctx->nb_gap = 0;
+    ctx->nb_resync = 0;
+    ctx->depth_max = 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
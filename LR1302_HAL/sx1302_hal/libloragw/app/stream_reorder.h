@@ -0,0 +1,157 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Reorder/jitter buffer for the streaming applications: packets are released
+    in sequence number order, duplicates are dropped, and missing packets are
+    declared lost (gap) once a later packet has been waiting for longer than the
+    latency budget, or when the window is full.
+
+    Gaps can be skipped, signaled with a marker, or replaced with zeros so that
+    downstream consumers can resynchronize.
+
+    Gap marker (STREAM_GAP_MARKER_SIZE bytes):
+        0xFF 'G' 'A' 'P' | first missing sequence number (2, big endian) |
+        number of missing packets (2, big endian)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_REORDER_H
+#define _STREAM_REORDER_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_REORDER_SLOT_MAX     256 /* Maximum window size, in packets */
+#define STREAM_REORDER_DATA_MAX     255 /* Maximum size of a packet */
+#define STREAM_GAP_MARKER_SIZE      8
+
+/* Return values of stream_reorder_push() */
+#define STREAM_REORDER_OK           0
+#define STREAM_REORDER_DUP          1   /* duplicate of a packet still buffered */
+#define STREAM_REORDER_LATE         2   /* already delivered, or declared lost */
+#define STREAM_REORDER_FULL         3   /* out of the window: buffered packets must be released first */
+
+typedef enum {
+    STREAM_GAP_SKIP,    /* missing packets are only counted */
+    STREAM_GAP_MARKER,  /* a gap marker is written */
+    STREAM_GAP_ZERO     /* missing packets are replaced with zeros, size of the last packet */
+} stream_gap_mode_t;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_reorder_item_s
+@brief Element released by the reorder buffer, a packet or a gap
+*/
+struct stream_reorder_item_s {
+    uint16_t        seq;        /*!> sequence number of the packet, or of the first missing packet */
+    const uint8_t * data;       /*!> packet content, NULL for a gap, valid until next push */
+    uint16_t        size;       /*!> packet size, or size of the last packet released for a gap */
+    uint16_t        nb_missing; /*!> number of missing packets, 0 for a packet */
+};
+
+/**
+@struct stream_reorder_slot_s
+@brief A buffered packet
+*/
+struct stream_reorder_slot_s {
+    bool        used;
+    uint16_t    size;
+    uint8_t     data[STREAM_REORDER_DATA_MAX];
+    uint64_t    rx_us;      /*!> host time at which the packet was buffered */
+};
+
+/**
+@struct stream_reorder_s
+@brief Reorder buffer context
+*/
+struct stream_reorder_s {
+    uint16_t                        window;     /*!> number of sequence numbers which can be buffered */
+    uint32_t                        latency_us; /*!> maximum time a packet waits for a missing one */
+    bool                            started;
+    uint16_t                        next_seq;   /*!> next sequence number to be released */
+    uint16_t                        head;       /*!> slot of next_seq */
+    uint16_t                        highest_seq;/*!> highest sequence number received */
+    uint16_t                        nb_buffered;
+    uint16_t                        last_size;  /*!> size of the last packet released */
+    uint16_t                        pending_seq;/*!> first sequence number of a gap caused by a jump */
+    uint16_t                        pending_gap;/*!> size of a gap caused by a jump, released at next pop */
+    struct stream_reorder_slot_s    slot[STREAM_REORDER_SLOT_MAX];
+    /* statistics */
+    uint32_t                        nb_in;
+    uint32_t                        nb_out;
+    uint32_t                        nb_dup;
+    uint32_t                        nb_late;
+    uint32_t                        nb_reordered;   /*!> packets received after a higher sequence number */
+    uint32_t                        nb_lost;        /*!> packets declared missing */
+    uint32_t                        nb_gap;         /*!> unrecoverable gaps */
+    uint32_t                        nb_resync;      /*!> sequence restarts (transmitter restarted) */
+    uint16_t                        depth_max;      /*!> max distance between released and received sequence numbers */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a reorder buffer
+@param ctx reorder buffer to be initialized
+@param window number of sequence numbers which can be buffered [1..STREAM_REORDER_SLOT_MAX]
+@param latency_us maximum time a packet waits for a missing one
+@return 0 on success, -1 on invalid parameters
+*/
+int stream_reorder_init(struct stream_reorder_s * ctx, uint16_t window, uint32_t latency_us);
+
+/**
+@brief Give a received packet to the reorder buffer
+@param ctx reorder buffer
+@param seq sequence number of the packet
+@param data packet content
+@param size packet size
+@return STREAM_REORDER_OK, _DUP, _LATE or _FULL, -1 on invalid parameters
+*/
+int stream_reorder_push(struct stream_reorder_s * ctx, uint16_t seq, const uint8_t * data, uint16_t size);
+
+/**
+@brief Get the next packet or gap that can be released
+@param ctx reorder buffer
+@param force true to declare the missing packets lost without waiting
+@param item element released
+@return 1 if item has been filled, 0 if nothing can be released yet
+*/
+int stream_reorder_pop(struct stream_reorder_s * ctx, bool force, struct stream_reorder_item_s * item);
+
+/**
+@brief Release all the packets and gaps available to a file descriptor, with a single writev()
+@param ctx reorder buffer
+@param fd file descriptor to write to
+@param force true to declare the missing packets lost without waiting (window full, exit)
+@param gap_mode what to write for missing packets
+@return the number of bytes written, -1 on error
+*/
+int stream_reorder_write(struct stream_reorder_s * ctx, int fd, bool force, stream_gap_mode_t gap_mode);
+
+/**
+@brief Print the statistics of the reorder buffer on one line, and reset them
+@param ctx reorder buffer
+@param f stream to print to
+*/
+void stream_reorder_report(struct stream_reorder_s * ctx, FILE * f);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
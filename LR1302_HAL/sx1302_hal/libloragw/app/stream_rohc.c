@@ -0,0 +1,481 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    ROHC-like IPv4/UDP header compression and aggregation of several small
+    packets into one radio frame, for the point-to-point streaming
+    applications.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy, memcmp */
+
+#include "stream_rohc.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define IPV4_HDR_SIZE       20
+#define UDP_HDR_SIZE        8
+#define IPV4_UDP_HDR_SIZE   (IPV4_HDR_SIZE + UDP_HDR_SIZE)
+#define IPV4_PROTO_UDP      17
+
+/* Offsets in the IPv4 + UDP header */
+#define OFS_IP_LEN          2
+#define OFS_IP_ID           4
+#define OFS_IP_FRAG         6
+#define OFS_IP_CSUM         10
+#define OFS_IP_SADDR        12
+#define OFS_UDP_PORTS       20
+#define OFS_UDP_LEN         24
+#define OFS_UDP_CSUM        26
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint16_t get_u16(const uint8_t * p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static void set_u16(uint8_t * p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v >> 0);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Only option-less, non fragmented IPv4/UDP packets are compressed */
+static bool is_ipv4_udp(const uint8_t * pkt, uint16_t size) {
+    if (size < IPV4_UDP_HDR_SIZE) {
+        return false;
+    }
+    if ((pkt[0] != 0x45) || (pkt[9] != IPV4_PROTO_UDP)) {
+        return false;
+    }
+    if ((get_u16(pkt + OFS_IP_FRAG) & 0x3FFF) != 0) {
+        return false;
+    }
+    if ((get_u16(pkt + OFS_IP_LEN) != size) || (get_u16(pkt + OFS_UDP_LEN) != (size - IPV4_HDR_SIZE))) {
+        return false;
+    }
+    return true;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Fields which are elided from CO records must not have changed since last IR */
+static bool static_fields_match(const uint8_t * hdr, const uint8_t * pkt) {
+    if ((hdr[0] != pkt[0]) || (hdr[1] != pkt[1])) { /* version, IHL, TOS */
+        return false;
+    }
+    if (memcmp(hdr + OFS_IP_FRAG, pkt + OFS_IP_FRAG, 4) != 0) { /* flags, TTL, protocol */
+        return false;
+    }
+    if (memcmp(hdr + OFS_IP_SADDR, pkt + OFS_IP_SADDR, 12) != 0) { /* addresses, ports */
+        return false;
+    }
+    if ((get_u16(hdr + OFS_UDP_CSUM) == 0) != (get_u16(pkt + OFS_UDP_CSUM) == 0)) { /* checksum in use */
+        return false;
+    }
+    return true;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* CRC-8 (polynomial 0x07) of the fields compared by static_fields_match() */
+static uint8_t static_fields_crc(const uint8_t * hdr) {
+    static const uint8_t ofs[][2] = { { 0, 2 }, { OFS_IP_FRAG, 4 }, { OFS_IP_SADDR, 12 } };
+    uint8_t crc = 0;
+    unsigned i, j, k;
+
+    for (i = 0; i < (sizeof ofs / sizeof ofs[0]); i++) {
+        for (j = 0; j < ofs[i][1]; j++) {
+            crc ^= hdr[ofs[i][0] + j];
+            for (k = 0; k < 8; k++) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            }
+        }
+    }
+
+    /* checksum in use */
+    return (get_u16(hdr + OFS_UDP_CSUM) != 0) ? crc : (uint8_t)~crc;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint16_t ipv4_checksum(const uint8_t * hdr) {
+    int i;
+    uint32_t sum = 0;
+
+    for (i = 0; i < IPV4_HDR_SIZE; i += 2) {
+        if (i != OFS_IP_CSUM) {
+            sum += get_u16(hdr + i);
+        }
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int rec_write_hdr(uint8_t * rec, uint16_t rec_size_max, uint8_t type, uint8_t cid, uint16_t body_size) {
+    int hdr_size = (body_size < 128) ? 2 : 3;
+
+    if ((body_size > STREAM_REC_BODY_SIZE_MAX) || ((hdr_size + body_size) > rec_size_max)) {
+        return -1;
+    }
+
+    rec[0] = (uint8_t)((type << 4) | (cid & 0x0F));
+    if (hdr_size == 2) {
+        rec[1] = (uint8_t)body_size;
+    } else {
+        rec[1] = (uint8_t)(0x80 | (body_size >> 8));
+        rec[2] = (uint8_t)(body_size >> 0);
+    }
+
+    return hdr_size;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int rec_parse_hdr(const uint8_t * rec, uint16_t rec_size, uint16_t * body_size) {
+    if (rec_size < 2) {
+        return -1;
+    }
+    if ((rec[1] & 0x80) == 0) {
+        *body_size = rec[1];
+        return 2;
+    }
+    if (rec_size < 3) {
+        return -1;
+    }
+    *body_size = ((uint16_t)(rec[1] & 0x7F) << 8) | rec[2];
+    return 3;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void stream_rohc_init(struct stream_rohc_s * rohc, bool enable) {
+    memset(rohc, 0, sizeof *rohc);
+    rohc->enable = enable;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_rohc_compress(struct stream_rohc_s * rohc, const uint8_t * pkt, uint16_t size, uint8_t * rec, uint16_t rec_size_max) {
+    int i, x;
+    uint8_t cid;
+    uint16_t ip_id, id_delta, body_size;
+    bool udp_csum;
+    struct stream_rohc_ctx_s * ctx = NULL;
+    struct stream_rohc_ctx_s * lru = NULL;
+
+    /* Check input parameters */
+    if ((rohc == NULL) || (pkt == NULL) || (rec == NULL)) {
+        return -1;
+    }
+
+    if ((rohc->enable == false) || (is_ipv4_udp(pkt, size) == false)) {
+        x = rec_write_hdr(rec, rec_size_max, STREAM_REC_TYPE_RAW, 0, size);
+        if (x < 0) {
+            return -1;
+        }
+        memcpy(rec + x, pkt, size);
+        rohc->nb_raw += 1;
+        rohc->bytes_pkt += size;
+        rohc->bytes_rec += x + size;
+        return x + size;
+    }
+
+    /* Find the context of that flow, or the least recently used one */
+    for (i = 0; i < STREAM_ROHC_CTX_NB; i++) {
+        if ((rohc->ctx[i].valid == true) && (memcmp(rohc->ctx[i].hdr + OFS_IP_SADDR, pkt + OFS_IP_SADDR, 12) == 0)) {
+            ctx = &rohc->ctx[i];
+            break;
+        }
+        if ((lru == NULL) || (rohc->ctx[i].valid == false) || ((lru->valid == true) && (rohc->ctx[i].last_us < lru->last_us))) {
+            lru = &rohc->ctx[i];
+        }
+    }
+    if (ctx == NULL) {
+        ctx = lru;
+        ctx->valid = false;
+    }
+    cid = (uint8_t)(ctx - rohc->ctx);
+    ctx->last_us = stream_time_us();
+    ip_id = get_u16(pkt + OFS_IP_ID);
+
+    if ((ctx->valid == false) || (ctx->nb_since_ir >= STREAM_ROHC_IR_REFRESH) || (static_fields_match(ctx->hdr, pkt) == false)) {
+        /* IR: full packet, the decompressor takes its header as reference */
+        x = rec_write_hdr(rec, rec_size_max, STREAM_REC_TYPE_IR, cid, size);
+        if (x < 0) {
+            return -1;
+        }
+        memcpy(rec + x, pkt, size);
+        memcpy(ctx->hdr, pkt, IPV4_UDP_HDR_SIZE);
+        ctx->crc = static_fields_crc(ctx->hdr);
+        ctx->valid = true;
+        ctx->ip_id = ip_id;
+        ctx->nb_since_ir = 0;
+        rohc->nb_ir += 1;
+        rohc->bytes_pkt += size;
+        rohc->bytes_rec += x + size;
+        return x + size;
+    }
+
+    /* CO: only the dynamic fields are sent */
+    id_delta = ip_id - ctx->ip_id;
+    udp_csum = (get_u16(pkt + OFS_UDP_CSUM) != 0);
+    body_size = 1 + ((id_delta < STREAM_ROHC_ID_WINDOW) ? 1 : 2) + (udp_csum ? 2 : 0) + (size - IPV4_UDP_HDR_SIZE);
+    x = rec_write_hdr(rec, rec_size_max, (id_delta < STREAM_ROHC_ID_WINDOW) ? STREAM_REC_TYPE_CO : STREAM_REC_TYPE_CO_ID, cid, body_size);
+    if (x < 0) {
+        return -1;
+    }
+    rec[x++] = ctx->crc;
+    if (id_delta < STREAM_ROHC_ID_WINDOW) {
+        rec[x++] = (uint8_t)ip_id;
+    } else {
+        set_u16(rec + x, ip_id);
+        x += 2;
+    }
+    if (udp_csum) {
+        memcpy(rec + x, pkt + OFS_UDP_CSUM, 2);
+        x += 2;
+    }
+    memcpy(rec + x, pkt + IPV4_UDP_HDR_SIZE, size - IPV4_UDP_HDR_SIZE);
+    x += size - IPV4_UDP_HDR_SIZE;
+
+    ctx->ip_id = ip_id;
+    ctx->nb_since_ir += 1;
+    rohc->nb_co += 1;
+    rohc->bytes_pkt += size;
+    rohc->bytes_rec += x;
+
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_rohc_decompress(struct stream_rohc_s * rohc, const uint8_t * rec, uint16_t rec_size, uint8_t * pkt, uint16_t pkt_size_max) {
+    int x;
+    uint8_t type;
+    uint16_t body_size, size, ip_id;
+    const uint8_t * body;
+    struct stream_rohc_ctx_s * ctx;
+
+    /* Check input parameters */
+    if ((rohc == NULL) || (rec == NULL) || (pkt == NULL)) {
+        return -1;
+    }
+
+    x = rec_parse_hdr(rec, rec_size, &body_size);
+    if ((x < 0) || ((x + body_size) != rec_size)) {
+        rohc->nb_err += 1;
+        return -1;
+    }
+    type = rec[0] >> 4;
+    ctx = &rohc->ctx[rec[0] & 0x0F];
+    body = rec + x;
+
+    switch (type) {
+        case STREAM_REC_TYPE_RAW:
+        case STREAM_REC_TYPE_IR:
+            if (body_size > pkt_size_max) {
+                rohc->nb_err += 1;
+                return -1;
+            }
+            if (type == STREAM_REC_TYPE_IR) {
+                if (is_ipv4_udp(body, body_size) == false) {
+                    rohc->nb_err += 1;
+                    return -1;
+                }
+                memcpy(ctx->hdr, body, IPV4_UDP_HDR_SIZE);
+                ctx->crc = static_fields_crc(ctx->hdr);
+                ctx->ip_id = get_u16(body + OFS_IP_ID);
+                ctx->valid = true;
+                rohc->nb_ir += 1;
+            } else {
+                rohc->nb_raw += 1;
+            }
+            memcpy(pkt, body, body_size);
+            size = body_size;
+            break;
+        case STREAM_REC_TYPE_CO:
+        case STREAM_REC_TYPE_CO_ID:
+            if ((ctx->valid == false) || (body_size < 1)) {
+                rohc->nb_err += 1;
+                return -1;
+            }
+            /* context of another flow, whose IR was lost: wait for the next IR */
+            if (body[0] != ctx->crc) {
+                ctx->valid = false;
+                rohc->nb_err += 1;
+                return -1;
+            }
+            body += 1;
+            body_size -= 1;
+            /* IP ID: 8 LSB interpreted in [ref, ref + 255], or full value */
+            x = (type == STREAM_REC_TYPE_CO) ? 1 : 2;
+            if (get_u16(ctx->hdr + OFS_UDP_CSUM) != 0) {
+                x += 2;
+            }
+            if ((body_size < x) || ((IPV4_UDP_HDR_SIZE + body_size - x) > pkt_size_max)) {
+                rohc->nb_err += 1;
+                return -1;
+            }
+            if (type == STREAM_REC_TYPE_CO) {
+                ip_id = ctx->ip_id + (uint8_t)(body[0] - (uint8_t)ctx->ip_id);
+            } else {
+                ip_id = get_u16(body);
+            }
+            size = IPV4_UDP_HDR_SIZE + body_size - x;
+
+            memcpy(pkt, ctx->hdr, IPV4_UDP_HDR_SIZE);
+            set_u16(pkt + OFS_IP_LEN, size);
+            set_u16(pkt + OFS_IP_ID, ip_id);
+            set_u16(pkt + OFS_IP_CSUM, ipv4_checksum(pkt));
+            set_u16(pkt + OFS_UDP_LEN, size - IPV4_HDR_SIZE);
+            if (get_u16(ctx->hdr + OFS_UDP_CSUM) != 0) {
+                memcpy(pkt + OFS_UDP_CSUM, body + x - 2, 2);
+            }
+            memcpy(pkt + IPV4_UDP_HDR_SIZE, body + x, body_size - x);
+
+            ctx->ip_id = ip_id;
+            rohc->nb_co += 1;
+            break;
+        default:
+            rohc->nb_err += 1;
+            return -1;
+    }
+
+    rohc->bytes_pkt += size;
+    rohc->bytes_rec += rec_size;
+
+    return size;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_rec_next(const uint8_t * buf, uint16_t size, uint16_t * offset, const uint8_t ** rec, uint16_t * rec_size) {
+    int x;
+    uint16_t body_size;
+
+    /* Check input parameters */
+    if ((buf == NULL) || (offset == NULL) || (rec == NULL) || (rec_size == NULL)) {
+        return -1;
+    }
+
+    if (*offset >= size) {
+        return 0;
+    }
+
+    x = rec_parse_hdr(buf + *offset, size - *offset, &body_size);
+    if ((x < 0) || ((*offset + x + body_size) > size)) {
+        return -1;
+    }
+    *rec = buf + *offset;
+    *rec_size = x + body_size;
+    *offset += *rec_size;
+
+    return 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_agg_init(struct stream_agg_s * agg, uint8_t frame_size_max, uint32_t budget_us) {
+    memset(agg, 0, sizeof *agg);
+    agg->frame_size_max = frame_size_max;
+    agg->budget_us = budget_us;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_agg_push(struct stream_agg_s * agg, const uint8_t * rec, uint16_t rec_size, struct stream_frame_s * frame) {
+    int ret = 0;
+
+    /* Check input parameters */
+    if ((agg == NULL) || (rec == NULL) || (frame == NULL)) {
+        return -1;
+    }
+    if ((rec_size + 1) > agg->frame_size_max) {
+        return -1;
+    }
+
+    /* Close the current frame if there is no room left */
+    if ((agg->nb_rec > 0) && ((agg->frame.size + rec_size) > agg->frame_size_max)) {
+        ret = stream_agg_flush(agg, true, frame);
+    }
+
+    if (agg->nb_rec == 0) {
+        agg->first_us = stream_time_us();
+        agg->frame.data[0] = STREAM_FRAME_TYPE_AGG;
+        agg->frame.size = 1;
+        agg->frame.time_us = agg->first_us;
+    }
+    memcpy(agg->frame.data + agg->frame.size, rec, rec_size);
+    agg->frame.size += rec_size;
+    agg->nb_rec += 1;
+
+    return ret;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_agg_flush(struct stream_agg_s * agg, bool force, struct stream_frame_s * frame) {
+    /* Check input parameters */
+    if ((agg == NULL) || (frame == NULL)) {
+        return 0;
+    }
+
+    if (agg->nb_rec == 0) {
+        return 0;
+    }
+    if ((force == false) && (stream_agg_remaining_us(agg) > 0)) {
+        return 0;
+    }
+
+    *frame = agg->frame;
+    agg->nb_frame += 1;
+    agg->nb_rec_total += agg->nb_rec;
+    agg->nb_rec = 0;
+
+    return 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint32_t stream_agg_remaining_us(const struct stream_agg_s * agg) {
+    uint64_t age_us;
+
+    if (agg->nb_rec == 0) {
+        return UINT32_MAX;
+    }
+
+    age_us = stream_time_us() - agg->first_us;
+
+    return (age_us >= agg->budget_us) ? 0 : (uint32_t)(agg->budget_us - age_us);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
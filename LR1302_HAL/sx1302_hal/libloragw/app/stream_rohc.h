@@ -0,0 +1,193 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    ROHC-like IPv4/UDP header compression and aggregation of several small
+    packets into one radio frame, for the point-to-point streaming
+    applications.
+
+    Each packet is turned into a record:
+        byte 0      record type (4 MSB) | context id (4 LSB)
+        byte 1(-2)  body length: 1 byte if < 128, else 2 bytes big endian with MSB set
+        byte 2(3).. body
+
+    Record types:
+        RAW     body is the packet as is (generic streams, unsupported packets)
+        IR      body is the full IPv4/UDP packet, (re)initializes the context
+        CO      body is CRC | IP ID 8 LSB | UDP checksum (if used by the flow) | UDP payload
+        CO_ID   body is CRC | IP ID (16 bits) | UDP checksum (if used by the flow) | UDP payload
+
+    Version, IHL, TOS, flags, TTL, protocol, addresses and ports are stored in
+    the context and elided from CO records. The CRC-8 of these static fields
+    is sent instead: when it does not match the context of the decompressor
+    (IR lost while the context id was reused by another flow), the record is
+    dropped and the context waits for the next IR. Lengths and the IP header checksum
+    are rebuilt by the decompressor. The IP ID is sent as its 8 LSB as long as
+    it stays within a window of the last ID sent, which is robust to the loss
+    of a few records.
+
+    An aggregated radio frame is STREAM_FRAME_TYPE_AGG followed by records.
+    Records bigger than a radio frame are sent as fragments (see stream_frag.h).
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_ROHC_H
+#define _STREAM_ROHC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "stream_frag.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_ROHC_CTX_NB          16  /* Number of flows compressed in parallel */
+#define STREAM_ROHC_IR_REFRESH      16  /* A context is refreshed every N packets, in case an IR was lost */
+#define STREAM_ROHC_ID_WINDOW       128 /* Max IP ID increase between 2 packets of a flow to send 8 LSB only */
+
+#define STREAM_REC_HDR_SIZE_MAX     3   /* record header size for bodies >= 128 bytes */
+#define STREAM_REC_BODY_SIZE_MAX    0x7FFF
+
+/* Record types */
+#define STREAM_REC_TYPE_RAW         0x0
+#define STREAM_REC_TYPE_IR          0x1
+#define STREAM_REC_TYPE_CO          0x2
+#define STREAM_REC_TYPE_CO_ID       0x3
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_rohc_ctx_s
+@brief A flow context, common to compressor and decompressor
+*/
+struct stream_rohc_ctx_s {
+    bool        valid;
+    uint8_t     hdr[28];        /*!> IPv4 + UDP header of the last IR */
+    uint8_t     crc;            /*!> CRC-8 of the static fields of hdr */
+    uint16_t    ip_id;          /*!> last IP ID sent (compressor) / received (decompressor) */
+    uint8_t     nb_since_ir;    /*!> compressor only: packets sent since last IR */
+    uint64_t    last_us;        /*!> compressor only: last use, for LRU eviction */
+};
+
+/**
+@struct stream_rohc_s
+@brief Compressor or decompressor state, one per direction
+*/
+struct stream_rohc_s {
+    bool                        enable;     /*!> compressor only: false to send RAW records only */
+    struct stream_rohc_ctx_s    ctx[STREAM_ROHC_CTX_NB];
+    /* statistics */
+    uint32_t                    nb_raw;
+    uint32_t                    nb_ir;
+    uint32_t                    nb_co;
+    uint32_t                    nb_err;     /*!> decompressor only: records dropped (bad, unknown or mismatching context) */
+    uint64_t                    bytes_pkt;  /*!> cumulated size of packets */
+    uint64_t                    bytes_rec;  /*!> cumulated size of records */
+};
+
+/**
+@struct stream_agg_s
+@brief Aggregation of records into radio frames
+*/
+struct stream_agg_s {
+    uint8_t                 frame_size_max; /*!> maximum size of the radio frames to be generated */
+    uint32_t                budget_us;      /*!> maximum time a record can wait for other records */
+    struct stream_frame_s   frame;          /*!> frame being filled */
+    uint64_t                first_us;       /*!> time at which the first record was added */
+    uint8_t                 nb_rec;         /*!> number of records in the frame being filled */
+    /* statistics */
+    uint32_t                nb_frame;
+    uint32_t                nb_rec_total;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a compressor or decompressor
+@param rohc state to be initialized
+@param enable false to disable header compression (RAW records only)
+*/
+void stream_rohc_init(struct stream_rohc_s * rohc, bool enable);
+
+/**
+@brief Turn a packet into a record, compressing its header if possible
+@param rohc compressor state
+@param pkt packet to be compressed
+@param size size of the packet, in bytes
+@param rec buffer to receive the record
+@param rec_size_max size of the record buffer
+@return the size of the record, -1 if it does not fit
+*/
+int stream_rohc_compress(struct stream_rohc_s * rohc, const uint8_t * pkt, uint16_t size, uint8_t * rec, uint16_t rec_size_max);
+
+/**
+@brief Rebuild a packet from a record
+@param rohc decompressor state
+@param rec record, as returned by stream_rec_next()
+@param rec_size size of the record
+@param pkt buffer to receive the packet
+@param pkt_size_max size of the packet buffer
+@return the size of the packet, -1 if the record cannot be decompressed
+*/
+int stream_rohc_decompress(struct stream_rohc_s * rohc, const uint8_t * rec, uint16_t rec_size, uint8_t * pkt, uint16_t pkt_size_max);
+
+/**
+@brief Get the next record of a list of records (aggregated frame body, reassembled fragments)
+@param buf list of records
+@param size size of the list
+@param offset position in the list, to be set to 0 before first call, updated by the function
+@param rec pointer set to the record found
+@param rec_size pointer to receive the size of the record found
+@return 1 if a record was found, 0 at the end of the list, -1 if the list is malformed
+*/
+int stream_rec_next(const uint8_t * buf, uint16_t size, uint16_t * offset, const uint8_t ** rec, uint16_t * rec_size);
+
+/**
+@brief Initialize an aggregator
+@param agg aggregator to be initialized
+@param frame_size_max maximum size of the radio frames to be generated
+@param budget_us maximum time a record can wait for other records, 0 to send each record in its own frame
+*/
+void stream_agg_init(struct stream_agg_s * agg, uint8_t frame_size_max, uint32_t budget_us);
+
+/**
+@brief Add a record to the frame being filled
+@param agg aggregator
+@param rec record to be added
+@param rec_size size of the record
+@param frame frame to receive the previous frame if it had to be closed to make room
+@return 1 if frame has been filled, 0 if not, -1 if the record is too big for a radio frame
+*/
+int stream_agg_push(struct stream_agg_s * agg, const uint8_t * rec, uint16_t rec_size, struct stream_frame_s * frame);
+
+/**
+@brief Close the frame being filled if its latency budget is exhausted
+@param agg aggregator
+@param force true to close the frame whatever its age
+@param frame frame to receive the closed frame
+@return 1 if frame has been filled, 0 if not
+*/
+int stream_agg_flush(struct stream_agg_s * agg, bool force, struct stream_frame_s * frame);
+
+/**
+@brief Get the time before the frame being filled has to be closed
+@param agg aggregator
+@return the time in microseconds, 0 if the frame has to be closed now, UINT32_MAX if it is empty
+*/
+uint32_t stream_agg_remaining_us(const struct stream_agg_s * agg);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,484 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    MPEG transport stream queue for the video streaming mode.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fprintf */
+#include <string.h>     /* memset, memcpy */
+
+#include "stream_ts.h"
+#include "stream_frag.h"    /* stream_time_us */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define PID_PAT             0x0000
+
+/* PMT stream types */
+#define ST_MPEG1_VIDEO      0x01
+#define ST_MPEG2_VIDEO      0x02
+#define ST_MPEG1_AUDIO      0x03
+#define ST_MPEG2_AUDIO      0x04
+#define ST_AAC_ADTS         0x0F
+#define ST_AAC_LATM         0x11
+#define ST_H264             0x1B
+#define ST_HEVC             0x24
+#define ST_AC3              0x81
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static bool is_video(uint8_t stream_type) {
+    return (stream_type == ST_MPEG1_VIDEO) || (stream_type == ST_MPEG2_VIDEO) || (stream_type == ST_H264) || (stream_type == ST_HEVC);
+}
+
+static bool is_audio(uint8_t stream_type) {
+    return (stream_type == ST_MPEG1_AUDIO) || (stream_type == ST_MPEG2_AUDIO) || (stream_type == ST_AAC_ADTS) || (stream_type == ST_AAC_LATM) || (stream_type == ST_AC3);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static struct stream_ts_pid_s * pid_get(struct stream_ts_s * ctx, uint16_t pid) {
+    int i;
+    struct stream_ts_pid_s * free_slot = NULL;
+
+    for (i = 0; i < STREAM_TS_PID_NB; i++) {
+        if ((ctx->pid[i].used == true) && (ctx->pid[i].pid == pid)) {
+            return &ctx->pid[i];
+        }
+        if ((ctx->pid[i].used == false) && (free_slot == NULL)) {
+            free_slot = &ctx->pid[i];
+        }
+    }
+    if (free_slot != NULL) {
+        memset(free_slot, 0, sizeof *free_slot);
+        free_slot->used = true;
+        free_slot->pid = pid;
+        free_slot->prio = STREAM_TS_PRIO_CRITICAL;
+    }
+
+    return free_slot; /* NULL if table is full: packet handled as critical */
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Get the start of the section of a PSI packet, NULL if none */
+static const uint8_t * psi_section(const uint8_t * payload, int size, int * section_size) {
+    int ptr, len;
+
+    if (size < 1) {
+        return NULL;
+    }
+    ptr = payload[0];
+    if ((1 + ptr + 3) > size) {
+        return NULL;
+    }
+    payload += 1 + ptr;
+    size -= 1 + ptr;
+    len = 3 + (((payload[1] & 0x0F) << 8) | payload[2]);
+    *section_size = (len < size) ? len : size; /* sections spanning several packets are truncated */
+
+    return payload;
+}
+
+static void parse_pat(struct stream_ts_s * ctx, const uint8_t * payload, int size) {
+    int i, len;
+    uint16_t pid;
+    const uint8_t * s = psi_section(payload, size, &len);
+
+    if ((s == NULL) || (s[0] != 0x00)) {
+        return;
+    }
+    ctx->nb_pmt = 0;
+    for (i = 8; ((i + 4) <= (len - 4)) && (ctx->nb_pmt < STREAM_TS_PMT_NB); i += 4) {
+        pid = ((s[i + 2] & 0x1F) << 8) | s[i + 3];
+        if (((s[i] << 8) | s[i + 1]) != 0) { /* program 0 is the network PID */
+            ctx->pmt_pid[ctx->nb_pmt++] = pid;
+        }
+    }
+}
+
+static void parse_pmt(struct stream_ts_s * ctx, const uint8_t * payload, int size) {
+    int i, len;
+    uint16_t pid;
+    struct stream_ts_pid_s * es;
+    const uint8_t * s = psi_section(payload, size, &len);
+
+    if ((s == NULL) || (s[0] != 0x02) || (len < 12)) {
+        return;
+    }
+    i = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+    while ((i + 5) <= (len - 4)) {
+        pid = ((s[i + 1] & 0x1F) << 8) | s[i + 2];
+        es = pid_get(ctx, pid);
+        if (es != NULL) {
+            es->stream_type = s[i];
+        }
+        i += 5 + (((s[i + 3] & 0x0F) << 8) | s[i + 4]);
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Priority of a video frame, from the beginning of its PES */
+static uint8_t video_frame_prio(uint8_t stream_type, const uint8_t * pes, int size, bool rai) {
+    int i, es;
+    uint8_t nal;
+
+    if (rai == true) {
+        return STREAM_TS_PRIO_CRITICAL;
+    }
+    if ((size < 9) || (pes[0] != 0x00) || (pes[1] != 0x00) || (pes[2] != 0x01)) {
+        return STREAM_TS_PRIO_REF;
+    }
+
+    es = 9 + pes[8];
+    for (i = es; (i + 4) < size; i++) {
+        if ((pes[i] != 0x00) || (pes[i + 1] != 0x00) || (pes[i + 2] != 0x01)) {
+            continue;
+        }
+        nal = pes[i + 3];
+        if (stream_type == ST_H264) {
+            switch (nal & 0x1F) {
+                case 5: /* IDR slice */
+                case 7: /* SPS */
+                case 8: /* PPS */
+                    return STREAM_TS_PRIO_CRITICAL;
+                case 1: /* non-IDR slice */
+                    return ((nal & 0x60) == 0) ? STREAM_TS_PRIO_NONREF : STREAM_TS_PRIO_REF;
+                default: /* AUD, SEI... */
+                    break;
+            }
+        } else if (stream_type == ST_HEVC) {
+            nal = (nal >> 1) & 0x3F;
+            if (((nal >= 16) && (nal <= 23)) || ((nal >= 32) && (nal <= 34))) { /* IRAP, VPS/SPS/PPS */
+                return STREAM_TS_PRIO_CRITICAL;
+            }
+            if (nal <= 14) {
+                /* even types are sub-layer non-reference pictures */
+                return ((nal & 0x01) == 0) ? STREAM_TS_PRIO_NONREF : STREAM_TS_PRIO_REF;
+            }
+        } else if ((nal == 0x00) && ((i + 5) < size)) { /* MPEG-1/2 picture header */
+            switch ((pes[i + 5] >> 3) & 0x07) {
+                case 1:
+                    return STREAM_TS_PRIO_CRITICAL;
+                case 3:
+                    return STREAM_TS_PRIO_NONREF;
+                default:
+                    return STREAM_TS_PRIO_REF;
+            }
+        } else if (nal == 0xB3) { /* MPEG-1/2 sequence header */
+            return STREAM_TS_PRIO_CRITICAL;
+        }
+    }
+
+    return STREAM_TS_PRIO_REF;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Drop a queued frame; for a reference frame, also drop what depends on it */
+static void drop_frame(struct stream_ts_s * ctx, struct stream_ts_pid_s * es, uint32_t frame_id, uint8_t prio) {
+    int i;
+    struct stream_ts_pkt_s * p;
+
+    for (i = 0; i < ctx->count; i++) {
+        p = &ctx->queue[(ctx->head + i) % STREAM_TS_QUEUE_SIZE];
+        if ((p->dropped == true) || (p->pid != es->pid)) {
+            continue;
+        }
+        if ((p->frame_id == frame_id) || ((prio == STREAM_TS_PRIO_REF) && ((int32_t)(p->frame_id - frame_id) > 0) && (p->prio != STREAM_TS_PRIO_CRITICAL))) {
+            p->dropped = true;
+            ctx->nb_live -= 1;
+            ctx->nb_drop[p->prio] += 1;
+        }
+    }
+    ctx->nb_frame_drop[prio] += 1;
+
+    /* packets of that frame still to be read are dropped on arrival */
+    if (es->frame_id == frame_id) {
+        es->drop_frame = true;
+    }
+    if (prio == STREAM_TS_PRIO_REF) {
+        es->wait_irap = true;
+    }
+}
+
+/* Drop frames, lowest priority and oldest first, until the backlog fits in the latency budget */
+static void apply_policy(struct stream_ts_s * ctx) {
+    int i, prio;
+    uint64_t backlog_us;
+    struct stream_ts_pkt_s * p;
+    struct stream_ts_pid_s * es;
+    bool found;
+
+    while (1) {
+        backlog_us = (uint64_t)((ctx->nb_live + ctx->ts_per_frame - 1) / ctx->ts_per_frame) * ctx->airtime_us;
+        if (backlog_us <= ctx->budget_us) {
+            return;
+        }
+        found = false;
+        for (prio = STREAM_TS_PRIO_NB - 1; (prio > STREAM_TS_PRIO_CRITICAL) && (found == false); prio--) {
+            for (i = 0; i < ctx->count; i++) {
+                p = &ctx->queue[(ctx->head + i) % STREAM_TS_QUEUE_SIZE];
+                if ((p->dropped == false) && (p->prio == prio)) {
+                    es = pid_get(ctx, p->pid);
+                    if (es == NULL) {
+                        continue;
+                    }
+                    drop_frame(ctx, es, p->frame_id, (uint8_t)prio);
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (found == false) {
+            return; /* only critical packets left */
+        }
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void enqueue(struct stream_ts_s * ctx, const uint8_t * ts) {
+    int afc, ofs = 4;
+    bool pusi, rai = false;
+    uint16_t pid;
+    uint8_t prio;
+    uint32_t frame_id = 0;
+    struct stream_ts_pid_s * es;
+    struct stream_ts_pkt_s * p;
+
+    pid = ((ts[1] & 0x1F) << 8) | ts[2];
+    if (pid == STREAM_TS_PID_NULL) {
+        ctx->nb_null += 1;
+        return;
+    }
+    pusi = (ts[1] & 0x40) != 0;
+    afc = (ts[3] >> 4) & 0x03;
+    if (afc & 0x02) {
+        if ((ts[4] > 0) && (ts[4] < (STREAM_TS_SIZE - 5))) {
+            rai = (ts[5] & 0x40) != 0;
+        }
+        ofs = 5 + ts[4];
+    }
+    if (((afc & 0x01) == 0) || (ofs >= STREAM_TS_SIZE)) {
+        ofs = STREAM_TS_SIZE; /* no payload */
+    }
+
+    /* PSI tables */
+    es = pid_get(ctx, pid);
+    if (pid == PID_PAT) {
+        if (pusi) {
+            parse_pat(ctx, ts + ofs, STREAM_TS_SIZE - ofs);
+        }
+    } else {
+        for (int i = 0; i < ctx->nb_pmt; i++) {
+            if ((ctx->pmt_pid[i] == pid) && pusi) {
+                parse_pmt(ctx, ts + ofs, STREAM_TS_SIZE - ofs);
+            }
+        }
+    }
+
+    /* Frame priority, decided at the start of each PES */
+    if (es == NULL) {
+        prio = STREAM_TS_PRIO_CRITICAL;
+    } else {
+        if (pusi) {
+            es->frame_id += 1;
+            es->drop_frame = false;
+            if (is_video(es->stream_type)) {
+                es->prio = video_frame_prio(es->stream_type, ts + ofs, STREAM_TS_SIZE - ofs, rai);
+                if (es->prio == STREAM_TS_PRIO_CRITICAL) {
+                    es->wait_irap = false;
+                }
+            } else if (is_audio(es->stream_type)) {
+                es->prio = STREAM_TS_PRIO_AUDIO;
+            } else {
+                es->prio = STREAM_TS_PRIO_CRITICAL;
+            }
+        }
+        prio = es->prio;
+        frame_id = es->frame_id;
+        ctx->nb_in[prio] += 1;
+
+        /* Drop on arrival the rest of a dropped frame, or anything depending on a dropped reference */
+        if ((es->drop_frame == true) || ((es->wait_irap == true) && (prio != STREAM_TS_PRIO_CRITICAL) && (prio != STREAM_TS_PRIO_AUDIO))) {
+            ctx->nb_drop[prio] += 1;
+            return;
+        }
+    }
+
+    /* Queue full: oldest packet is dropped whatever its priority */
+    if (ctx->count == STREAM_TS_QUEUE_SIZE) {
+        p = &ctx->queue[ctx->head];
+        if (p->dropped == false) {
+            ctx->nb_live -= 1;
+            ctx->nb_overflow += 1;
+        }
+        ctx->head = (ctx->head + 1) % STREAM_TS_QUEUE_SIZE;
+        ctx->count -= 1;
+    }
+
+    p = &ctx->queue[(ctx->head + ctx->count) % STREAM_TS_QUEUE_SIZE];
+    memcpy(p->data, ts, STREAM_TS_SIZE);
+    p->pid = pid;
+    p->prio = prio;
+    p->dropped = false;
+    p->frame_id = frame_id;
+    p->in_us = stream_time_us();
+    p->vlat_us = (uint32_t)(((uint64_t)ctx->vqueue / ctx->ts_per_frame) * ctx->airtime_us);
+    ctx->count += 1;
+    ctx->nb_live += 1;
+    ctx->vqueue += 1;
+
+    apply_policy(ctx);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void stream_ts_init(struct stream_ts_s * ctx, uint32_t budget_us, uint8_t ts_per_frame, uint32_t airtime_us) {
+    memset(ctx, 0, sizeof *ctx);
+    ctx->budget_us = budget_us;
+    ctx->ts_per_frame = (ts_per_frame > 0) ? ts_per_frame : 1;
+    ctx->airtime_us = airtime_us;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_ts_feed(struct stream_ts_s * ctx, const uint8_t * data, int size) {
+    int i = 0, n, nb_ts = 0;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (data == NULL)) {
+        return 0;
+    }
+
+    while (i < size) {
+        /* look for the sync byte at the beginning of a packet */
+        if ((ctx->buf_size == 0) && (data[i] != STREAM_TS_SYNC_BYTE)) {
+            while ((i < size) && (data[i] != STREAM_TS_SYNC_BYTE)) {
+                i += 1;
+            }
+            ctx->nb_resync += 1;
+            continue;
+        }
+        n = STREAM_TS_SIZE - ctx->buf_size;
+        if (n > (size - i)) {
+            n = size - i;
+        }
+        memcpy(ctx->buf + ctx->buf_size, data + i, n);
+        ctx->buf_size += n;
+        i += n;
+        if (ctx->buf_size == STREAM_TS_SIZE) {
+            enqueue(ctx, ctx->buf);
+            ctx->buf_size = 0;
+            nb_ts += 1;
+        }
+    }
+
+    return nb_ts;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int stream_ts_pop(struct stream_ts_s * ctx, uint8_t * out) {
+    int nb_ts = 0;
+    uint32_t lat_us;
+    uint64_t now;
+    struct stream_ts_pkt_s * p;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (out == NULL)) {
+        return 0;
+    }
+
+    now = stream_time_us();
+    while ((ctx->count > 0) && (nb_ts < ctx->ts_per_frame)) {
+        p = &ctx->queue[ctx->head];
+        ctx->head = (ctx->head + 1) % STREAM_TS_QUEUE_SIZE;
+        ctx->count -= 1;
+        if (p->dropped == true) {
+            continue;
+        }
+        ctx->nb_live -= 1;
+        memcpy(out + (nb_ts * STREAM_TS_SIZE), p->data, STREAM_TS_SIZE);
+        nb_ts += 1;
+
+        /* end-to-end latency: queuing time plus time on air */
+        lat_us = (uint32_t)(now - p->in_us) + ctx->airtime_us;
+        ctx->nb_out += 1;
+        ctx->lat_us_sum += lat_us;
+        if (lat_us > ctx->lat_us_max) {
+            ctx->lat_us_max = lat_us;
+        }
+        lat_us = p->vlat_us + ctx->airtime_us;
+        ctx->vlat_us_sum += lat_us;
+        if (lat_us > ctx->vlat_us_max) {
+            ctx->vlat_us_max = lat_us;
+        }
+    }
+
+    /* a queue without drops would have sent a full frame in that slot */
+    if (nb_ts > 0) {
+        ctx->vqueue = (ctx->vqueue > ctx->ts_per_frame) ? (ctx->vqueue - ctx->ts_per_frame) : 0;
+    }
+
+    return nb_ts * STREAM_TS_SIZE;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void stream_ts_report(struct stream_ts_s * ctx, FILE * f) {
+    static const char * prio_name[STREAM_TS_PRIO_NB] = { "critical", "ref", "audio", "nonref" };
+    int i;
+
+    if ((ctx == NULL) || (f == NULL)) {
+        return;
+    }
+
+    fprintf(f, "INFO: video: %u TS sent, %u queued, %u null discarded, %u overflow, %u resync\n",
+                ctx->nb_out, ctx->nb_live, ctx->nb_null, ctx->nb_overflow, ctx->nb_resync);
+    for (i = 0; i < STREAM_TS_PRIO_NB; i++) {
+        fprintf(f, "INFO: video:   %-8s %u TS in, %u TS dropped (%u frames)\n", prio_name[i], ctx->nb_in[i], ctx->nb_drop[i], ctx->nb_frame_drop[i]);
+    }
+    fprintf(f, "INFO: video: latency avg %.0f ms, max %.0f ms (without drops: avg %.0f ms, max %.0f ms)\n",
+                (ctx->nb_out > 0) ? ((double)ctx->lat_us_sum / ctx->nb_out / 1000) : 0.0, (double)ctx->lat_us_max / 1000,
+                (ctx->nb_out > 0) ? ((double)ctx->vlat_us_sum / ctx->nb_out / 1000) : 0.0, (double)ctx->vlat_us_max / 1000);
+
+    memset(ctx->nb_in, 0, sizeof ctx->nb_in);
+    memset(ctx->nb_drop, 0, sizeof ctx->nb_drop);
+    memset(ctx->nb_frame_drop, 0, sizeof ctx->nb_frame_drop);
+    ctx->nb_null = 0;
+    ctx->nb_overflow = 0;
+    ctx->nb_resync = 0;
+    ctx->nb_out = 0;
+    ctx->lat_us_sum = 0;
+    ctx->lat_us_max = 0;
+    ctx->vlat_us_sum = 0;
+    ctx->vlat_us_max = 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,156 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    MPEG transport stream queue for the video streaming mode: the byte stream
+    is split into 188-byte TS packets, each packet is tagged with the priority
+    of the frame it belongs to (PAT/PMT, I-frame, reference frame, audio,
+    non-reference frame), and whole frames are dropped by increasing priority
+    when the queue holds more than the latency budget.
+
+    PAT and PMT are parsed to find the video and audio PIDs. Frame types are
+    taken from the random access indicator and from the first NAL units
+    (H.264, HEVC) or picture header (MPEG-2) of each PES.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _STREAM_TS_H
+#define _STREAM_TS_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define STREAM_TS_SIZE          188
+#define STREAM_TS_SYNC_BYTE     0x47
+#define STREAM_TS_PID_NULL      0x1FFF
+#define STREAM_TS_QUEUE_SIZE    1024    /* TS packets waiting to be sent */
+#define STREAM_TS_PID_NB        32      /* PIDs tracked */
+#define STREAM_TS_PMT_NB        8       /* programs tracked */
+
+/* Priorities, lowest priority (dropped first) last */
+typedef enum {
+    STREAM_TS_PRIO_CRITICAL,    /* PSI tables, I-frames, parameter sets: never dropped on backlog */
+    STREAM_TS_PRIO_REF,         /* reference frames, the following frames are dropped until next I-frame */
+    STREAM_TS_PRIO_AUDIO,
+    STREAM_TS_PRIO_NONREF,      /* non-reference frames */
+    STREAM_TS_PRIO_NB
+} stream_ts_prio_t;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct stream_ts_pkt_s
+@brief A queued TS packet
+*/
+struct stream_ts_pkt_s {
+    uint8_t     data[STREAM_TS_SIZE];
+    uint16_t    pid;
+    uint8_t     prio;           /*!> priority of the frame the packet belongs to */
+    bool        dropped;
+    uint32_t    frame_id;       /*!> frame counter of the PID */
+    uint64_t    in_us;          /*!> host time at which the packet was read */
+    uint32_t    vlat_us;        /*!> latency the packet would have without any drop */
+};
+
+/**
+@struct stream_ts_pid_s
+@brief State of an elementary stream
+*/
+struct stream_ts_pid_s {
+    bool        used;
+    uint16_t    pid;
+    uint8_t     stream_type;    /*!> from the PMT, 0 if unknown */
+    uint8_t     prio;           /*!> priority of the current frame */
+    uint32_t    frame_id;       /*!> incremented at each payload unit start */
+    bool        drop_frame;     /*!> current frame is being dropped */
+    bool        wait_irap;      /*!> a reference frame was dropped: drop everything until next I-frame */
+};
+
+/**
+@struct stream_ts_s
+@brief TS queue context
+*/
+struct stream_ts_s {
+    /* parser */
+    uint8_t                 buf[STREAM_TS_SIZE];
+    uint16_t                buf_size;
+    uint16_t                pmt_pid[STREAM_TS_PMT_NB];
+    uint8_t                 nb_pmt;
+    struct stream_ts_pid_s  pid[STREAM_TS_PID_NB];
+    /* queue */
+    struct stream_ts_pkt_s  queue[STREAM_TS_QUEUE_SIZE];
+    uint16_t                head;
+    uint16_t                count;          /*!> entries in the queue, dropped ones included */
+    uint16_t                nb_live;        /*!> entries to be sent */
+    uint32_t                vqueue;         /*!> TS packets which would be queued without any drop */
+    /* policy */
+    uint32_t                budget_us;      /*!> maximum queuing latency before dropping */
+    uint8_t                 ts_per_frame;   /*!> TS packets per radio frame */
+    uint32_t                airtime_us;     /*!> time on air of a radio frame */
+    /* statistics */
+    uint32_t                nb_in[STREAM_TS_PRIO_NB];
+    uint32_t                nb_drop[STREAM_TS_PRIO_NB];
+    uint32_t                nb_frame_drop[STREAM_TS_PRIO_NB];
+    uint32_t                nb_null;        /*!> null packets discarded */
+    uint32_t                nb_resync;      /*!> sync byte lost */
+    uint32_t                nb_overflow;    /*!> packets dropped because the queue was full */
+    uint32_t                nb_out;
+    uint64_t                lat_us_sum;
+    uint32_t                lat_us_max;
+    uint64_t                vlat_us_sum;
+    uint32_t                vlat_us_max;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a TS queue
+@param ctx context to be initialized
+@param budget_us maximum queuing latency, frames are dropped above
+@param ts_per_frame number of TS packets packed in each radio frame
+@param airtime_us time on air of a radio frame
+*/
+void stream_ts_init(struct stream_ts_s * ctx, uint32_t budget_us, uint8_t ts_per_frame, uint32_t airtime_us);
+
+/**
+@brief Give bytes of the transport stream to the queue
+@param ctx TS queue
+@param data bytes read from the input
+@param size number of bytes
+@return the number of TS packets queued
+*/
+int stream_ts_feed(struct stream_ts_s * ctx, const uint8_t * data, int size);
+
+/**
+@brief Get the next TS packets to be sent in a radio frame
+@param ctx TS queue
+@param out buffer to receive up to ts_per_frame TS packets
+@return the number of bytes written in out, 0 if the queue is empty
+*/
+int stream_ts_pop(struct stream_ts_s * ctx, uint8_t * out);
+
+/**
+@brief Print the statistics of the queue, and reset them
+@param ctx TS queue
+@param f stream to print to
+*/
+void stream_ts_report(struct stream_ts_s * ctx, FILE * f);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
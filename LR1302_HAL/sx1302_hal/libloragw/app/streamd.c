@@ -0,0 +1,816 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Streaming daemon: owns the concentrator for its whole life and serves
+    stream sessions over a Unix socket, so that back-to-back transfers do not
+    pay for a reset, a firmware load and a calibration each.
+
+    The concentrator is reset once at startup through the GPIO character
+    device (no reset_lgw.sh), then started once.
+
+    A client connects to the socket and sends one line:
+    - "TX\n": everything written afterwards is sent over the air, 246 bytes
+      per packet, with the same header as the transmitter application (FCnt
+      keeps counting across sessions). Only one TX session is served at a
+      time, the next ones wait for their turn. The session ends when the
+      client closes its side of the socket.
+    - "RX\n": the payloads of the packets received with a valid CRC are
+      written to the client without the header, as the receiver application
+      does on stdout, until the client closes the socket. Several RX
+      sessions can be opened at the same time.
+
+    Example:
+        (printf 'TX\n'; cat file) | socat - UNIX-CONNECT:/tmp/lgw_streamd.sock
+        printf 'RX\n' | socat -t 100000 UNIX-CONNECT:/tmp/lgw_streamd.sock - > file
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* printf, fprintf, snprintf */
+#include <string.h>         /* memset, strcmp */
+#include <signal.h>         /* sigaction */
+#include <unistd.h>         /* read, close, unlink */
+#include <stdlib.h>         /* exit */
+#include <errno.h>          /* error messages */
+#include <fcntl.h>          /* fcntl */
+#include <getopt.h>         /* getopt_long */
+#include <poll.h>           /* poll */
+
+#include <sys/socket.h>     /* socket, bind, listen, accept */
+#include <sys/un.h>         /* struct sockaddr_un */
+
+#include "loragw_hal.h"
+#include "loragw_aux.h"
+#include "loragw_gpio.h"
+
+#include "stream_out.h"
+#include "stream_frag.h"    /* stream_time_us */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define COM_TYPE_DEFAULT    LGW_COM_SPI
+#define COM_PATH_DEFAULT    "/dev/spidev0.0"
+#define SOCK_PATH_DEFAULT   "/tmp/lgw_streamd.sock"
+
+#define DEFAULT_FREQ_HZ     868500000U
+#define PAYLOAD_HDR_SIZE    9       /* MHDR, DevAddr, FCtrl, FCnt, FPort */
+#define PAYLOAD_DATA_MAX    246     /* bytes of a TX session sent per packet */
+
+#define SESSION_NB_MAX      8
+#define SESSION_HDR_MAX     16      /* length of the session request line */
+#define RX_PKT_NB_MAX       16      /* size of the array given to lgw_receive() */
+#define RX_PEND_SIZE        (RX_PKT_NB_MAX * 256) /* rest of a batch partly written to a slow RX client */
+#define POLL_RX_MS          5       /* RX FIFO poll period */
+#define POLL_TX_BUSY_MS     1       /* TX status poll period while a packet is on air */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+typedef enum {
+    SESSION_FREE,
+    SESSION_HDR,        /* waiting for the request line */
+    SESSION_TX_WAIT,    /* another TX session is being served */
+    SESSION_TX,
+    SESSION_RX
+} session_state_t;
+
+struct session_s {
+    session_state_t state;
+    int             fd;
+    unsigned int    id;
+    char            hdr[SESSION_HDR_MAX];
+    uint8_t         hdr_size;
+    uint64_t        open_us;    /* connection time */
+    uint64_t        first_us;   /* first packet sent or received, 0 if none */
+    uint32_t        nb_pkt;
+    uint64_t        nb_byte;
+    uint32_t        nb_drop;    /* RX packets not written because the client was too slow */
+    uint8_t         pend[RX_PEND_SIZE]; /* RX bytes of a batch not written yet */
+    uint16_t        pend_size;
+    uint16_t        pend_off;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* Signal handling variables */
+static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
+static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
+
+static struct session_s sessions[SESSION_NB_MAX];
+static unsigned int session_id = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* describe command line options */
+static void usage(void) {
+    printf("Library version information: %s\n", lgw_version_info());
+    printf("Available options:\n");
+    printf(" -h         print this help\n");
+    printf(" -u         Set COM type as USB (default is SPI)\n");
+    printf(" -d <path>  COM path to be used to connect the concentrator\n");
+    printf("            => default path: " COM_PATH_DEFAULT "\n");
+    printf(" -k <uint>  Concentrator clock source (Radio A or Radio B) [0..1]\n");
+    printf(" -r <uint>  Radio type (1255, 1257, 1250)\n");
+    printf(" -f <float> Radio TX/RX frequency in MHz\n");
+    printf(" -m <str>   modulation type ['LORA', 'FSK'] (default is FSK)\n");
+    printf(" -s <uint>  LoRa datarate [5..12]\n");
+    printf(" -b <uint>  LoRa bandwidth in khz [125, 250, 500]\n");
+    printf(" -l <uint>  FSK/LoRa preamble length, [6..65535]\n");
+    printf(" -p <int>   RF power in dBm\n");
+    printf(" -j         Set radio in single input mode (SX1250 only)\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --fdev <uint>  FSK frequency deviation in kHz [1:200]\n");
+    printf(" --br   <float> FSK bitrate in kbps [0.5:250]\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --pa   <uint> PA gain SX125x:[0..3], SX1250:[0,1]\n");
+    printf(" --pwid <uint> sx1250 power index [0..22]\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --sock <path>  Unix socket to listen on (default is " SOCK_PATH_DEFAULT ")\n");
+    printf(" --gpio <path>  GPIO chip used to reset the concentrator (default is " LGW_GPIO_CHIP_DEFAULT ")\n");
+    printf(" --no-reset     Do not reset the concentrator at startup\n");
+    printf(" --fdd          Enable Full-Duplex mode (CN490 reference design)\n");
+}
+
+/* handle signals */
+static void sig_handler(int sigio) {
+    if (sigio == SIGQUIT) {
+        quit_sig = 1;
+    } else if ((sigio == SIGINT) || (sigio == SIGTERM)) {
+        exit_sig = 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int sock_listen(const char * path) {
+    int fd;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        printf("ERROR: socket path %s is too long\n", path);
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("ERROR: failed to create socket (%s)\n", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+    unlink(path); /* left by a previous run */
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0) || (listen(fd, SESSION_NB_MAX) < 0)) {
+        printf("ERROR: failed to listen on %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void session_close(struct session_s * s) {
+    uint64_t now = stream_time_us();
+
+    printf("INFO: session %u (%s) closed after %.3f s: %u packets, %llu bytes", s->id,
+                (s->state == SESSION_RX) ? "RX" : "TX", (now - s->open_us) / 1e6, s->nb_pkt, (unsigned long long)s->nb_byte);
+    if (s->first_us != 0) {
+        printf(", first packet %.1f ms after connection", (s->first_us - s->open_us) / 1e3);
+    }
+    if (s->nb_drop > 0) {
+        printf(", %u packets dropped (client too slow)", s->nb_drop);
+    }
+    printf("\n");
+
+    close(s->fd);
+    memset(s, 0, sizeof *s);
+    s->state = SESSION_FREE;
+    s->fd = -1;
+}
+
+/* Oldest session in the given state, NULL if none */
+static struct session_s * session_find(session_state_t state) {
+    int i;
+    struct session_s * s = NULL;
+
+    for (i = 0; i < SESSION_NB_MAX; i++) {
+        if ((sessions[i].state == state) && ((s == NULL) || ((int)(sessions[i].id - s->id) < 0))) {
+            s = &sessions[i];
+        }
+    }
+
+    return s;
+}
+
+static void session_accept(int listen_fd) {
+    int i, fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        for (i = 0; i < SESSION_NB_MAX; i++) {
+            if (sessions[i].state == SESSION_FREE) {
+                break;
+            }
+        }
+        if (i == SESSION_NB_MAX) {
+            printf("WARNING: too many sessions, connection refused\n");
+            close(fd);
+            continue;
+        }
+        memset(&sessions[i], 0, sizeof sessions[i]);
+        sessions[i].state = SESSION_HDR;
+        sessions[i].fd = fd;
+        sessions[i].id = session_id++;
+        sessions[i].open_us = stream_time_us();
+    }
+}
+
+/* Write the rest of a batch partly written, 1 if the client is still full, -1 on error */
+static int session_flush(struct session_s * s) {
+    ssize_t n;
+
+    while (s->pend_off < s->pend_size) {
+        n = write(s->fd, s->pend + s->pend_off, s->pend_size - s->pend_off);
+        if (n > 0) {
+            s->pend_off += n;
+        } else if ((n < 0) && (errno == EINTR)) {
+            continue;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            return 1;
+        } else {
+            return -1;
+        }
+    }
+    s->pend_size = 0;
+    s->pend_off = 0;
+
+    return 0;
+}
+
+/* Read the request line, one byte at a time not to consume the stream behind it */
+static void session_read_hdr(struct session_s * s) {
+    ssize_t n;
+    char c;
+
+    n = read(s->fd, &c, 1);
+    if (n <= 0) {
+        session_close(s);
+        return;
+    }
+    if (c != '\n') {
+        if (s->hdr_size >= (SESSION_HDR_MAX - 1)) {
+            printf("WARNING: session %u: request line too long\n", s->id);
+            session_close(s);
+            return;
+        }
+        s->hdr[s->hdr_size++] = c;
+        return;
+    }
+
+    s->hdr[s->hdr_size] = '\0';
+    if ((s->hdr_size > 0) && (s->hdr[s->hdr_size - 1] == '\r')) {
+        s->hdr[s->hdr_size - 1] = '\0';
+    }
+    if (strcmp(s->hdr, "TX") == 0) {
+        s->state = (session_find(SESSION_TX) == NULL) ? SESSION_TX : SESSION_TX_WAIT;
+    } else if (strcmp(s->hdr, "RX") == 0) {
+        /* a slow client must not block the daemon */
+        fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+        s->state = SESSION_RX;
+    } else {
+        printf("WARNING: session %u: unknown request \"%s\"\n", s->id, s->hdr);
+        session_close(s);
+        return;
+    }
+    printf("INFO: session %u (%s) opened%s\n", s->id, s->hdr, (s->state == SESSION_TX_WAIT) ? ", waiting for the current TX session" : "");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    int i, x, nb_pfd, nb_pkt, timeout_ms;
+    unsigned int arg_u;
+    int arg_i;
+    double arg_d = 0.0;
+    float xf = 0.0;
+    char arg_s[64];
+    ssize_t nb_byte;
+    uint32_t freq_hz = DEFAULT_FREQ_HZ;
+    uint8_t clocksource = 0;
+    lgw_radio_type_t radio_type = LGW_RADIO_TYPE_NONE;
+    bool single_input_mode = false;
+    bool full_duplex = false;
+    bool gpio_reset = true;
+    uint8_t modulation = MOD_FSK;
+    uint32_t fsk_br = 50000;
+    uint8_t fsk_fdev_khz = 25;
+    uint8_t lora_sf = DR_LORA_SF7;
+    uint8_t lora_bw = BW_250KHZ;
+    uint16_t preamble = 8;
+    int8_t rf_power = 14;
+    uint16_t fcnt = 0;
+    uint8_t tx_status = TX_FREE;
+    uint64_t last_rx_us = 0;
+    const char * sock_path = SOCK_PATH_DEFAULT;
+    const char * gpio_path = LGW_GPIO_CHIP_DEFAULT;
+    int listen_fd;
+    struct session_s * tx_session;
+    struct session_s * pfd_session[SESSION_NB_MAX + 1];
+    struct pollfd pfd[SESSION_NB_MAX + 1];
+
+    struct lgw_conf_board_s boardconf;
+    struct lgw_conf_rxrf_s rfconf;
+    struct lgw_conf_rxif_s ifconf;
+    struct lgw_tx_gain_lut_s txlut;
+    struct lgw_pkt_tx_s pkt;
+    struct lgw_pkt_rx_s rxpkt[RX_PKT_NB_MAX];
+
+    /* COM interfaces */
+    const char com_path_default[] = COM_PATH_DEFAULT;
+    const char * com_path = com_path_default;
+    lgw_com_type_t com_type = COM_TYPE_DEFAULT;
+
+    static struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
+
+    /* Initialize TX gain LUT */
+    txlut.size = 0;
+    memset(txlut.lut, 0, sizeof txlut.lut);
+
+    /* Parameter parsing */
+    int option_index = 0;
+    static struct option long_options[] = {
+        {"fdev",  required_argument, 0, 0},
+        {"br",    required_argument, 0, 0},
+        {"pa",    required_argument, 0, 0},
+        {"pwid",  required_argument, 0, 0},
+        {"sock",  required_argument, 0, 0},
+        {"gpio",  required_argument, 0, 0},
+        {"no-reset", no_argument, 0, 0},
+        {"fdd",   no_argument, 0, 0},
+        {0, 0, 0, 0}
+    };
+
+    /* parse command line options */
+    while ((i = getopt_long (argc, argv, "hjuf:s:b:p:k:r:l:m:d:", long_options, &option_index)) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+                break;
+            case 'u':
+                com_type = LGW_COM_USB;
+                break;
+            case 'd': /* <char> COM path */
+                if (optarg != NULL) {
+                    com_path = optarg;
+                }
+                break;
+            case 'j': /* Set radio in single input mode */
+                single_input_mode = true;
+                break;
+            case 'r': /* <uint> Radio type */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || ((arg_u != 1255) && (arg_u != 1257) && (arg_u != 1250))) {
+                    printf("ERROR: argument parsing of -r argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    switch (arg_u) {
+                        case 1255:
+                            radio_type = LGW_RADIO_TYPE_SX1255;
+                            break;
+                        case 1257:
+                            radio_type = LGW_RADIO_TYPE_SX1257;
+                            break;
+                        default: /* 1250 */
+                            radio_type = LGW_RADIO_TYPE_SX1250;
+                            break;
+                    }
+                }
+                break;
+            case 'l': /* <uint> LoRa/FSK preamble length */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > 65535)) {
+                    printf("ERROR: argument parsing of -l argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    preamble = (uint16_t)arg_u;
+                }
+                break;
+            case 'm': /* <str> Modulation type */
+                i = sscanf(optarg, "%63s", arg_s);
+                if ((i != 1) || ((strcmp(arg_s, "LORA") != 0) && (strcmp(arg_s, "FSK") != 0))) {
+                    printf("ERROR: invalid modulation type\n");
+                    return EXIT_FAILURE;
+                } else {
+                    modulation = (strcmp(arg_s, "LORA") == 0) ? MOD_LORA : MOD_FSK;
+                }
+                break;
+            case 'k': /* <uint> Clock Source */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > 1)) {
+                    printf("ERROR: argument parsing of -k argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    clocksource = (uint8_t)arg_u;
+                }
+                break;
+            case 'f': /* <float> Radio frequency in MHz */
+                i = sscanf(optarg, "%lf", &arg_d);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -f argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    freq_hz = (uint32_t)((arg_d*1e6) + 0.5); /* .5 Hz offset to get rounding instead of truncating */
+                }
+                break;
+            case 's': /* <uint> LoRa datarate */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u < 5) || (arg_u > 12)) {
+                    printf("ERROR: argument parsing of -s argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    lora_sf = (uint8_t)arg_u;
+                }
+                break;
+            case 'b': /* <uint> LoRa bandwidth in khz */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || ((arg_u != 125) && (arg_u != 250) && (arg_u != 500))) {
+                    printf("ERROR: argument parsing of -b argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    lora_bw = (arg_u == 125) ? BW_125KHZ : ((arg_u == 250) ? BW_250KHZ : BW_500KHZ);
+                }
+                break;
+            case 'p': /* <int> RF power */
+                i = sscanf(optarg, "%d", &arg_i);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -p argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    rf_power = (int8_t)arg_i;
+                    txlut.size = 1;
+                    txlut.lut[0].rf_power = rf_power;
+                }
+                break;
+            case 0:
+                if (strcmp(long_options[option_index].name, "fdev") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u < 1) || (arg_u > 200)) {
+                        printf("ERROR: invalid FSK frequency deviation\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        fsk_fdev_khz = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "br") == 0) {
+                    i = sscanf(optarg, "%f", &xf);
+                    if ((i != 1) || (xf < 0.5) || (xf > 250)) {
+                        printf("ERROR: invalid FSK bitrate\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        fsk_br = (uint32_t)(xf * 1e3);
+                    }
+                } else if (strcmp(long_options[option_index].name, "pa") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 3)) {
+                        printf("ERROR: argument parsing of --pa argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        txlut.size = 1;
+                        txlut.lut[0].pa_gain = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "pwid") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 22)) {
+                        printf("ERROR: argument parsing of --pwid argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        txlut.size = 1;
+                        txlut.lut[0].mix_gain = 5; /* TODO: rework this, should not be needed for sx1250 */
+                        txlut.lut[0].pwr_idx = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "sock") == 0) {
+                    sock_path = optarg;
+                } else if (strcmp(long_options[option_index].name, "gpio") == 0) {
+                    gpio_path = optarg;
+                } else if (strcmp(long_options[option_index].name, "no-reset") == 0) {
+                    gpio_reset = false;
+                } else if (strcmp(long_options[option_index].name, "fdd") == 0) {
+                    full_duplex = true;
+                } else {
+                    printf("ERROR: argument parsing options. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return -1;
+        }
+    }
+
+    /* Configure signal handling */
+    sigemptyset( &sigact.sa_mask );
+    sigact.sa_flags = 0;
+    sigact.sa_handler = sig_handler;
+    sigaction( SIGQUIT, &sigact, NULL );
+    sigaction( SIGINT, &sigact, NULL );
+    sigaction( SIGTERM, &sigact, NULL );
+    sigact.sa_handler = SIG_IGN; /* clients closing their socket must not kill the daemon */
+    sigaction( SIGPIPE, &sigact, NULL );
+
+    /* Configure the gateway */
+    memset( &boardconf, 0, sizeof boardconf);
+    boardconf.lorawan_public = true;
+    boardconf.clksrc = clocksource;
+    boardconf.full_duplex = full_duplex;
+    boardconf.com_type = com_type;
+    strncpy(boardconf.com_path, com_path, sizeof boardconf.com_path);
+    boardconf.com_path[sizeof boardconf.com_path - 1] = '\0'; /* ensure string termination */
+    if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure board\n");
+        return EXIT_FAILURE;
+    }
+
+    memset( &rfconf, 0, sizeof rfconf);
+    rfconf.enable = true; /* rf chain 0 needs to be enabled for calibration to work on sx1257 */
+    rfconf.freq_hz = freq_hz;
+    rfconf.type = radio_type;
+    rfconf.tx_enable = true;
+    rfconf.single_input_mode = single_input_mode;
+    if (lgw_rxrf_setconf(0, &rfconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure rxrf 0\n");
+        return EXIT_FAILURE;
+    }
+
+    memset( &rfconf, 0, sizeof rfconf);
+    rfconf.enable = (clocksource == 1);
+    rfconf.freq_hz = freq_hz;
+    rfconf.type = radio_type;
+    rfconf.tx_enable = false;
+    rfconf.single_input_mode = single_input_mode;
+    if (lgw_rxrf_setconf(1, &rfconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure rxrf 1\n");
+        return EXIT_FAILURE;
+    }
+
+    /* RX channel: LoRa service channel or FSK channel, centered on radio A */
+    memset(&ifconf, 0, sizeof ifconf);
+    ifconf.enable = true;
+    ifconf.rf_chain = 0;
+    ifconf.freq_hz = 0;
+    if (modulation == MOD_LORA) {
+        ifconf.bandwidth = lora_bw;
+        ifconf.datarate = lora_sf;
+        x = lgw_rxif_setconf(8, &ifconf);
+    } else {
+        x = (2 * fsk_fdev_khz) + (fsk_br / 1000); /* Carson bandwidth in kHz */
+        ifconf.bandwidth = (x <= 125) ? BW_125KHZ : ((x <= 250) ? BW_250KHZ : BW_500KHZ);
+        ifconf.datarate = fsk_br;
+        x = lgw_rxif_setconf(9, &ifconf);
+    }
+    if (x != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure RX channel\n");
+        return EXIT_FAILURE;
+    }
+
+    if (txlut.size > 0) {
+        if (lgw_txgain_setconf(0, &txlut) != LGW_HAL_SUCCESS) {
+            printf("ERROR: failed to configure txgain lut\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Static TX parameters, same header as the transmitter application */
+    memset(&pkt, 0, sizeof pkt);
+    pkt.rf_chain = 0;
+    pkt.freq_hz = freq_hz;
+    pkt.rf_power = rf_power;
+    pkt.tx_mode = IMMEDIATE;
+    pkt.modulation = modulation;
+    pkt.preamble = preamble;
+    pkt.no_crc = false;
+    pkt.no_header = false;
+    if (modulation == MOD_FSK) {
+        pkt.datarate = fsk_br;
+        pkt.f_dev = fsk_fdev_khz;
+    } else {
+        pkt.datarate = lora_sf;
+        pkt.bandwidth = lora_bw;
+        pkt.coderate = CR_LORA_4_5;
+    }
+    pkt.payload[0] = 0x40; /* Confirmed Data Up */
+    pkt.payload[1] = 0xAB;
+    pkt.payload[2] = 0xAB;
+    pkt.payload[3] = 0xAB;
+    pkt.payload[4] = 0xAB;
+    pkt.payload[5] = 0x00; /* FCTrl */
+    pkt.payload[8] = 0x02; /* FPort */
+
+    /* Reset once, in-process */
+    if ((com_type == LGW_COM_SPI) && (gpio_reset == true)) {
+        if ((lgw_gpio_open(gpio_path) != LGW_GPIO_SUCCESS) || (lgw_gpio_reset() != LGW_GPIO_SUCCESS)) {
+            printf("ERROR: failed to reset SX1302 through %s\n", gpio_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* connect, configure and start the LoRa concentrator, once for all the sessions */
+    x = lgw_start();
+    if (x != 0) {
+        printf("ERROR: failed to start the gateway\n");
+        lgw_gpio_close();
+        return EXIT_FAILURE;
+    }
+
+    listen_fd = sock_listen(sock_path);
+    if (listen_fd < 0) {
+        lgw_stop();
+        lgw_gpio_close();
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < SESSION_NB_MAX; i++) {
+        sessions[i].state = SESSION_FREE;
+        sessions[i].fd = -1;
+    }
+    printf("INFO: concentrator started, listening on %s\n", sock_path);
+
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        /* Wait for a connection, a request line, TX data when the modem is free, or an RX client hanging up */
+        nb_pfd = 0;
+        pfd[nb_pfd].fd = listen_fd;
+        pfd[nb_pfd].events = POLLIN;
+        pfd_session[nb_pfd++] = NULL;
+        for (i = 0; i < SESSION_NB_MAX; i++) {
+            if ((sessions[i].state == SESSION_HDR) || (sessions[i].state == SESSION_RX) ||
+                ((sessions[i].state == SESSION_TX) && (tx_status == TX_FREE))) {
+                pfd[nb_pfd].fd = sessions[i].fd;
+                pfd[nb_pfd].events = POLLIN | ((sessions[i].pend_size > 0) ? POLLOUT : 0);
+                pfd_session[nb_pfd++] = &sessions[i];
+            }
+        }
+        timeout_ms = (tx_status != TX_FREE) ? POLL_TX_BUSY_MS : POLL_RX_MS;
+        x = poll(pfd, nb_pfd, timeout_ms);
+        if ((x < 0) && (errno != EINTR)) {
+            printf("ERROR: poll failed (%s)\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; (x > 0) && (i < nb_pfd); i++) {
+            if ((pfd[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) == 0) {
+                continue;
+            }
+            if (pfd_session[i] == NULL) {
+                session_accept(listen_fd);
+            } else if (pfd_session[i]->state == SESSION_HDR) {
+                session_read_hdr(pfd_session[i]);
+            } else if (pfd_session[i]->state == SESSION_RX) {
+                /* the client can take the rest of a batch */
+                if ((pfd[i].revents & POLLOUT) && (session_flush(pfd_session[i]) < 0)) {
+                    session_close(pfd_session[i]);
+                    continue;
+                }
+                if ((pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+                    continue;
+                }
+                /* RX clients are not expected to send anything: drain, detect hang up */
+                nb_byte = read(pfd_session[i]->fd, rxpkt[0].payload, sizeof rxpkt[0].payload);
+                if ((nb_byte == 0) || ((nb_byte < 0) && (errno != EAGAIN))) {
+                    session_close(pfd_session[i]);
+                }
+            } else if ((pfd_session[i]->state == SESSION_TX) && (tx_status == TX_FREE)) {
+                tx_session = pfd_session[i];
+                nb_byte = read(tx_session->fd, pkt.payload + PAYLOAD_HDR_SIZE, PAYLOAD_DATA_MAX);
+                if (nb_byte <= 0) {
+                    session_close(tx_session);
+                    tx_session = session_find(SESSION_TX_WAIT);
+                    if (tx_session != NULL) {
+                        tx_session->state = SESSION_TX;
+                        printf("INFO: session %u (TX) started\n", tx_session->id);
+                    }
+                    continue;
+                }
+                pkt.payload[6] = (uint8_t)(fcnt >> 0); /* FCnt */
+                pkt.payload[7] = (uint8_t)(fcnt >> 8); /* FCnt */
+                pkt.size = PAYLOAD_HDR_SIZE + nb_byte;
+                if (lgw_send(&pkt) != LGW_HAL_SUCCESS) {
+                    printf("ERROR: failed to send packet\n");
+                    continue;
+                }
+                fcnt += 1;
+                tx_status = TX_EMITTING;
+                if (tx_session->first_us == 0) {
+                    tx_session->first_us = stream_time_us();
+                }
+                tx_session->nb_pkt += 1;
+                tx_session->nb_byte += nb_byte;
+            }
+        }
+
+        if (tx_status != TX_FREE) {
+            lgw_status(pkt.rf_chain, TX_STATUS, &tx_status);
+        }
+
+        /* RX: fetch the packets available, forward them to all the RX sessions */
+        if ((stream_time_us() - last_rx_us) < (POLL_RX_MS * 1000)) {
+            continue;
+        }
+        last_rx_us = stream_time_us();
+        nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
+        if (nb_pkt == LGW_HAL_ERROR) {
+            printf("ERROR: failed packet fetch, exiting\n");
+            break;
+        }
+        if (nb_pkt == 0) {
+            continue;
+        }
+        for (i = 0; i < SESSION_NB_MAX; i++) {
+            if (sessions[i].state != SESSION_RX) {
+                continue;
+            }
+            /* a batch is either written whole or dropped whole, so that the client stream never breaks mid-packet */
+            x = session_flush(&sessions[i]);
+            if (x < 0) {
+                session_close(&sessions[i]);
+                continue;
+            } else if (x > 0) {
+                sessions[i].nb_drop += nb_pkt;
+                continue;
+            }
+            x = stream_out_payloads(sessions[i].fd, rxpkt, nb_pkt, PAYLOAD_HDR_SIZE);
+            if (x >= 0) {
+                /* short write: keep the rest, finished when the client can take it */
+                nb_byte = stream_out_rest(rxpkt, nb_pkt, PAYLOAD_HDR_SIZE, x, sessions[i].pend, sizeof sessions[i].pend);
+                if (nb_byte < 0) {
+                    session_close(&sessions[i]);
+                    continue;
+                }
+                sessions[i].pend_size = (uint16_t)nb_byte;
+                sessions[i].pend_off = 0;
+                if (((x + nb_byte) > 0) && (sessions[i].first_us == 0)) {
+                    sessions[i].first_us = last_rx_us;
+                }
+                sessions[i].nb_pkt += nb_pkt;
+                sessions[i].nb_byte += x + nb_byte;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                sessions[i].nb_drop += nb_pkt;
+            } else {
+                session_close(&sessions[i]);
+            }
+        }
+    }
+
+    for (i = 0; i < SESSION_NB_MAX; i++) {
+        if (sessions[i].state != SESSION_FREE) {
+            session_close(&sessions[i]);
+        }
+    }
+    close(listen_fd);
+    unlink(sock_path);
+
+    if (exit_sig == 1) {
+        /* Stop the gateway */
+        x = lgw_stop();
+        if (x != 0) {
+            printf("ERROR: failed to stop the gateway\n");
+        }
+        if ((com_type == LGW_COM_SPI) && (gpio_reset == true)) {
+            lgw_gpio_reset();
+        }
+    }
+    lgw_gpio_close();
+
+    printf("=========== Daemon End ===========\n");
+
+    return 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
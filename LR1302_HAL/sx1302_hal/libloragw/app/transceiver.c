@@ -1,10 +1,30 @@
 /*
-Programa con capacidad de recepción y transmisión "simultáneas" (todavía no tengo claro que sea full duplex)
-- 2 hilos tx y rx
-- mutex para acceder al lr1302 (no se puede enviar comandos al mismo tiempo desde dos hilos).
-- Conexión con interfaz TUN del dispositivo. Lo que leo de la TUN lo transmito por el módulo y lo que recibo por el módulo lo escribo en la TUN.
-- Hablo siempre desde la perspectiva del módulo (RX significa recibir por el módulo y TX transmitir por el módulo)
-/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Full-duplex IP bridge between a TUN interface and the LR1302 concentrator.
+
+    - thread_tx reads IP packets from the TUN interface, compresses their
+      headers, aggregates small packets or splits big ones into radio frames and
+      queues them for transmission.
+    - thread_concent is the only thread accessing the concentrator: it sends the
+      queued frames (TX has priority) and polls the RX FIFO.
+    - thread_rx reassembles the received frames, decompresses the headers and
+      writes the IP packets to the TUN interface.
+
+    With --adr, thread_concent also exchanges link feedback frames with the
+    peer and steps the TX datarate up and down (see stream_adr.h).
+
+    Point of view is always the one of the radio module: RX means received by
+    the module, TX means transmitted by the module.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
 
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
@@ -20,108 +40,1141 @@ Programa con capacidad de recepción y transmisión "simultáneas" (todavía no
 #include <stdbool.h>        /* bool type */
 #include <stdio.h>          /* printf, fprintf, snprintf, fopen, fputs */
 #include <inttypes.h>       /* PRIx64, PRIu64... */
-#include <fcntl.h>          /* file control options */  
-
+#include <fcntl.h>          /* file control options */
 #include <string.h>         /* memset */
 #include <signal.h>         /* sigaction */
-#include <time.h>           /* time, clock_gettime, strftime, gmtime */
-#include <sys/time.h>       /* timeval */
-#include <sys/ioctl.h>      /* ioctl */
+#include <time.h>           /* clock_gettime */
 #include <unistd.h>         /* getopt, access */
 #include <stdlib.h>         /* atoi, exit */
 #include <errno.h>          /* error messages */
-#include <math.h>           /* modf */
-
-#include <sys/socket.h>     /* socket specific definitions */
-#include <netinet/in.h>     /* INET constants and stuff */
-#include <arpa/inet.h>      /* IP address conversion stuff */
-#include <netdb.h>          /* gai_strerror */
-
+#include <getopt.h>         /* getopt_long */
+#include <poll.h>           /* poll */
 #include <pthread.h>
 
+#include <sys/ioctl.h>      /* ioctl */
+#include <sys/socket.h>     /* socket */
 #include <linux/if.h>
 #include <linux/if_tun.h>
 
-#include "trace.h"
-#include "base64.h"
 #include "loragw_hal.h"
 #include "loragw_aux.h"
 #include "loragw_reg.h"
-#include "loragw_gps.h"
 
-#define TUN "/dev/net/tun"
-#define COM_PATH_DEFAULT "/dev/spidev0.0"
+#include "stream_frag.h"
+#include "stream_rohc.h"
+#include "stream_adr.h"
 
-int tun_fd;
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
 
-void thread_rx(void);
-void thread_tx(void);
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
-void configurar_lr1302(){
-    struct lgw_conf_board_s boardconf;
-    const char com_path_default[] = COM_PATH_DEFAULT;
-    const char * com_path = com_path_default;
+#define TUN_PATH            "/dev/net/tun"
+#define TUN_NAME_DEFAULT    "tun0"
 
-    memset( &boardconf, 0, sizeof boardconf);
-    boardconf.lorawan_public = true;
-    boardconf.clksrc = 0;
-    boardconf.full_duplex = true;
-    boardconf.com_type = LGW_COM_SPI;
-    strncpy(boardconf.com_path, com_path, sizeof boardconf.com_path);
-    boardconf.com_path[sizeof boardconf.com_path - 1] = '\0'; /* ensure string termination */
-    if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
-        printf("ERROR: failed to configure board\n");
-        return EXIT_FAILURE;
+#define COM_TYPE_DEFAULT    LGW_COM_SPI
+#define COM_PATH_DEFAULT    "/dev/spidev0.0"
+
+#define DEFAULT_FREQ_HZ     868500000U
+#define DEFAULT_MTU         1000        /* 4 radio frames per IP packet at most */
+#define DEFAULT_STAT_S      10          /* statistics report interval */
+#define DEFAULT_REASM_MS    1000        /* reassembly timeout */
+#define DEFAULT_AGG_MS      20          /* latency budget to aggregate small packets */
+#define MTU_MAX             (STREAM_FRAG_PKT_SIZE_MAX - STREAM_REC_HDR_SIZE_MAX)
+
+#define FRAME_QUEUE_SIZE    64          /* frames waiting to be sent / to be reassembled */
+#define RX_PKT_NB_MAX       16          /* size of the array given to lgw_receive() */
+#define POLL_IDLE_US        1000        /* concentrator poll period when idle */
+#define POLL_TX_BUSY_US     500         /* TX status poll period while a frame is pending */
+
+#define ADR_FB_PERIOD_US    1000000     /* feedback period, also a keepalive when there is no traffic */
+#define ADR_TIMEOUT_MS      5000        /* fall back to the most robust datarate without feedback */
+#define ADR_HOLD_MS         3000        /* minimum time on a datarate before stepping up */
+#define ADR_MARGIN_UP_DB    6.0
+#define ADR_MARGIN_DOWN_DB  2.0
+#define ADR_PER_MAX         0.1
+#define ADR_ANNOUNCE_NB     2           /* feedback frames sent at the old datarate before switching */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct frame_queue_s {
+    pthread_mutex_t         mx;
+    pthread_cond_t          cond;
+    int                     head;
+    int                     count;
+    struct stream_frame_s   frames[FRAME_QUEUE_SIZE];
+};
+
+struct bridge_stats_s {
+    /* TUN -> radio */
+    uint32_t    tun_pkt_in;
+    uint64_t    tun_bytes_in;
+    uint32_t    tun_pkt_drop;       /* packets dropped before TX (too big) */
+    uint32_t    frame_tx_drop;      /* frames dropped before TX (queue full) */
+    uint32_t    frame_tx;
+    uint32_t    frame_tx_err;
+    uint64_t    frame_tx_bytes;
+    uint64_t    tx_airtime_ms;
+    uint64_t    tx_lat_us_sum;      /* TUN read to lgw_send() delay */
+    uint32_t    tx_lat_us_max;
+    /* radio -> TUN */
+    uint32_t    frame_rx;
+    uint32_t    frame_rx_bad;       /* CRC errors, bad headers */
+    uint32_t    frame_rx_drop;      /* RX queue full */
+    uint64_t    frame_rx_bytes;
+    uint32_t    tun_pkt_out;
+    uint64_t    tun_bytes_out;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* Signal handling variables */
+static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
+static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
+
+static int tun_fd = -1;
+
+/* Radio parameters, set once before threads are started */
+static uint32_t tx_freq_hz = DEFAULT_FREQ_HZ;
+static uint8_t  tx_rf_chain = 0;
+static int8_t   tx_rf_power = 14;
+static uint8_t  modulation = MOD_FSK;
+static uint32_t fsk_br = 100000;
+static uint8_t  fsk_fdev_khz = 25;
+static uint8_t  lora_sf = DR_LORA_SF7;
+static uint8_t  lora_bw = BW_250KHZ;
+static uint16_t preamble = 8;
+static uint16_t mtu = DEFAULT_MTU;
+static uint32_t reasm_timeout_ms = DEFAULT_REASM_MS;
+static uint32_t agg_budget_ms = DEFAULT_AGG_MS;
+static bool     rohc_enable = true;
+
+static struct frame_queue_s tx_queue;   /* thread_tx -> thread_concent */
+static struct frame_queue_s rx_queue;   /* thread_concent -> thread_rx */
+
+static pthread_mutex_t mx_stats = PTHREAD_MUTEX_INITIALIZER; /* control access to the statistics */
+static struct bridge_stats_s stats;
+static struct stream_reasm_s reasm;     /* only accessed by thread_rx, except for statistics */
+static struct stream_rohc_s comp;       /* only accessed by thread_tx, except for statistics */
+static struct stream_agg_s agg;         /* only accessed by thread_tx, except for statistics */
+static struct stream_rohc_s decomp;     /* only accessed by thread_rx, except for statistics */
+static bool     adr_enable = false;
+static struct stream_adr_s adr;         /* only accessed by thread_concent, except for statistics */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+static void * thread_tx(void * arg);
+static void * thread_rx(void * arg);
+static void * thread_concent(void * arg);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* describe command line options */
+static void usage(void) {
+    printf("Library version information: %s\n", lgw_version_info());
+    printf("Available options:\n");
+    printf(" -h         print this help\n");
+    printf(" -u         Set COM type as USB (default is SPI)\n");
+    printf(" -d <path>  COM path to be used to connect the concentrator\n");
+    printf("            => default path: " COM_PATH_DEFAULT "\n");
+    printf(" -k <uint>  Concentrator clock source (Radio A or Radio B) [0..1]\n");
+    printf(" -c <uint>  RF chain to be used for TX (Radio A or Radio B) [0..1]\n");
+    printf(" -r <uint>  Radio type (1255, 1257, 1250)\n");
+    printf(" -f <float> Radio TX frequency in MHz\n");
+    printf(" -a <float> Radio RX frequency in MHz (default is TX frequency)\n");
+    printf(" -m <str>   modulation type ['LORA', 'FSK'] (default is FSK)\n");
+    printf(" -s <uint>  LoRa datarate [5..12]\n");
+    printf(" -b <uint>  LoRa bandwidth in khz [125, 250, 500]\n");
+    printf(" -l <uint>  FSK/LoRa preamble length, [6..65535]\n");
+    printf(" -p <int>   RF power in dBm\n");
+    printf(" -j         Set radio in single input mode (SX1250 only)\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --fdev <uint>  FSK frequency deviation in kHz [1:200]\n");
+    printf(" --br   <float> FSK bitrate in kbps [0.5:250]\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --pa   <uint> PA gain SX125x:[0..3], SX1250:[0,1]\n");
+    printf(" --pwid <uint> sx1250 power index [0..22]\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --tun   <str>  TUN interface name (default is " TUN_NAME_DEFAULT ")\n");
+    printf(" --mtu   <uint> TUN interface MTU in bytes [68..%u]\n", MTU_MAX);
+    printf(" --reasm <uint> Reassembly timeout in ms\n");
+    printf(" --agg   <uint> Latency budget in ms to aggregate small packets in one radio frame, 0 to disable\n");
+    printf(" --no-rohc      Disable IPv4/UDP header compression\n");
+    printf(" --stat  <uint> Statistics report interval in seconds\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --adr          Adapt the TX datarate to the link quality reported by the peer,\n");
+    printf("                up to -s/-b (LoRa) or --br (FSK). Both sides must use the same options\n");
+    printf(" --adr-log <path> Log each datarate decision in a CSV file\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --fdd          Enable Full-Duplex mode (CN490 reference design)\n");
+}
+
+/* handle signals */
+static void sig_handler(int sigio) {
+    if (sigio == SIGQUIT) {
+        quit_sig = 1;
+    } else if ((sigio == SIGINT) || (sigio == SIGTERM)) {
+        exit_sig = 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void frame_queue_init(struct frame_queue_s * q) {
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&q->mx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    q->head = 0;
+    q->count = 0;
+}
+
+/* Queue all the given frames, or none of them if there is not enough room */
+static bool frame_queue_push(struct frame_queue_s * q, const struct stream_frame_s * frames, int nb) {
+    int i;
+
+    pthread_mutex_lock(&q->mx);
+    if ((q->count + nb) > FRAME_QUEUE_SIZE) {
+        pthread_mutex_unlock(&q->mx);
+        return false;
+    }
+    for (i = 0; i < nb; i++) {
+        q->frames[(q->head + q->count) % FRAME_QUEUE_SIZE] = frames[i];
+        q->count += 1;
+    }
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mx);
+
+    return true;
+}
+
+/* Wait up to timeout_us for the queue to be non empty, return the number of frames queued */
+static int frame_queue_wait(struct frame_queue_s * q, uint32_t timeout_us) {
+    int count;
+    struct timespec ts;
+
+    pthread_mutex_lock(&q->mx);
+    if ((q->count == 0) && (timeout_us > 0)) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += timeout_us / 1000000;
+        ts.tv_nsec += (timeout_us % 1000000) * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&q->cond, &q->mx, &ts);
     }
+    count = q->count;
+    pthread_mutex_unlock(&q->mx);
 
-    
+    return count;
 }
 
-int conectar_tun(char * dev){
+static bool frame_queue_pop(struct frame_queue_s * q, struct stream_frame_s * frame, uint32_t timeout_us) {
+    if (frame_queue_wait(q, timeout_us) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&q->mx);
+    *frame = q->frames[q->head];
+    q->head = (q->head + 1) % FRAME_QUEUE_SIZE;
+    q->count -= 1;
+    pthread_mutex_unlock(&q->mx);
+
+    return true;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int tun_open(char * dev) {
     struct ifreq ifr;
     int fd;
-    int err;
-    if ((fd = open(TUN, O_RDWR)) < 0) {
-        perror("Abriendo dispositivo TUN");
-        exit(1);
+
+    if ((fd = open(TUN_PATH, O_RDWR)) < 0) {
+        fprintf(stderr, "ERROR: failed to open %s (%s)\n", TUN_PATH, strerror(errno));
+        return -1;
     }
     memset(&ifr, 0, sizeof(ifr));
     ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-    if (*dev){
-        strncpy(ifr.ifr_name, dev, IFNAMSIZ);
+    if (*dev) {
+        snprintf(ifr.ifr_name, IFNAMSIZ, "%s", dev);
     }
-    if ((err = ioctl(fd, TUNSETIFF, (void *)&ifr)) < 0) {
+    if (ioctl(fd, TUNSETIFF, (void *)&ifr) < 0) {
+        fprintf(stderr, "ERROR: ioctl(TUNSETIFF) failed (%s)\n", strerror(errno));
         close(fd);
-        perror("ioctl(TUNSETIFF)");
-        exit(1);
+        return -1;
     }
-    strcpy(dev, ifr.ifr_name);
+    snprintf(dev, IFNAMSIZ, "%s", ifr.ifr_name);
 
     return fd;
 }
 
-int main(int argc, char ** argv)
+static int tun_set_mtu(const char * dev, uint16_t mtu_bytes) {
+    struct ifreq ifr;
+    int sock, err;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", dev);
+    ifr.ifr_mtu = mtu_bytes;
+    err = ioctl(sock, SIOCSIFMTU, (void *)&ifr);
+    close(sock);
+
+    return err;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void print_stats(uint32_t interval_s) {
+    struct bridge_stats_s s;
+    uint32_t reasm_ok, reasm_lost, reasm_lat_max;
+    uint64_t reasm_lat_sum;
+    struct stream_rohc_s c, d;
+    uint32_t agg_frame, agg_rec;
+    struct stream_adr_s a;
+
+    pthread_mutex_lock(&mx_stats);
+    s = stats;
+    memset(&stats, 0, sizeof stats);
+    reasm_ok = reasm.nb_pkt_ok;
+    reasm_lost = reasm.nb_pkt_lost;
+    reasm_lat_sum = reasm.latency_us_sum;
+    reasm_lat_max = reasm.latency_us_max;
+    reasm.nb_pkt_ok = 0;
+    reasm.nb_pkt_lost = 0;
+    reasm.latency_us_sum = 0;
+    reasm.latency_us_max = 0;
+    c = comp;
+    d = decomp;
+    comp.nb_raw = comp.nb_ir = comp.nb_co = comp.nb_err = 0;
+    comp.bytes_pkt = comp.bytes_rec = 0;
+    decomp.nb_raw = decomp.nb_ir = decomp.nb_co = decomp.nb_err = 0;
+    decomp.bytes_pkt = decomp.bytes_rec = 0;
+    agg_frame = agg.nb_frame;
+    agg_rec = agg.nb_rec_total;
+    agg.nb_frame = 0;
+    agg.nb_rec_total = 0;
+    a = adr;
+    adr.nb_fb = adr.nb_up = adr.nb_down = adr.nb_timeout = 0;
+    pthread_mutex_unlock(&mx_stats);
+
+    printf("\n##### BRIDGE STATISTICS (%us) #####\n", interval_s);
+    printf("# MTU: %u bytes, %u bytes of payload per radio frame\n", mtu, STREAM_FRAG_DATA_MAX);
+    printf("### [TUN -> RADIO] ###\n");
+    printf("# IP packets: %u (%" PRIu64 " bytes), dropped: %u\n", s.tun_pkt_in, s.tun_bytes_in, s.tun_pkt_drop);
+    printf("# header compression: %u IR, %u CO, %u RAW, records are %.1f%% of IP bytes\n", c.nb_ir, c.nb_co, c.nb_raw,
+                                                                                         (c.bytes_pkt > 0) ? (100.0 * c.bytes_rec / c.bytes_pkt) : 0.0);
+    printf("# aggregation: %u frames, %.2f records per frame\n", agg_frame, (agg_frame > 0) ? ((double)agg_rec / agg_frame) : 0.0);
+    printf("# radio frames sent: %u (%" PRIu64 " bytes), failed: %u, dropped: %u\n", s.frame_tx, s.frame_tx_bytes, s.frame_tx_err, s.frame_tx_drop);
+    printf("# throughput: %.2f kbps (IP), %.2f kbps (radio), airtime %.1f%%\n", (double)s.tun_bytes_in * 8 / 1000 / interval_s,
+                                                                                (double)s.frame_tx_bytes * 8 / 1000 / interval_s,
+                                                                                (double)s.tx_airtime_ms / 10 / interval_s);
+    printf("# queuing latency: avg %.1f ms, max %.1f ms\n", (s.frame_tx > 0) ? ((double)s.tx_lat_us_sum / s.frame_tx / 1000) : 0.0,
+                                                           (double)s.tx_lat_us_max / 1000);
+    printf("### [RADIO -> TUN] ###\n");
+    printf("# radio frames received: %u (%" PRIu64 " bytes), bad: %u, dropped: %u\n", s.frame_rx, s.frame_rx_bytes, s.frame_rx_bad, s.frame_rx_drop);
+    printf("# IP packets: %u (%" PRIu64 " bytes), reassembled: %u, lost: %u\n", s.tun_pkt_out, s.tun_bytes_out, reasm_ok, reasm_lost);
+    printf("# header decompression: %u IR, %u CO, %u RAW, %u failed\n", d.nb_ir, d.nb_co, d.nb_raw, d.nb_err);
+    printf("# throughput: %.2f kbps (IP)\n", (double)s.tun_bytes_out * 8 / 1000 / interval_s);
+    printf("# reassembly latency: avg %.1f ms, max %.1f ms\n", (reasm_ok > 0) ? ((double)reasm_lat_sum / reasm_ok / 1000) : 0.0,
+                                                              (double)reasm_lat_max / 1000);
+    if (adr_enable == true) {
+        printf("### [DATARATE] ###\n");
+        stream_adr_report(&a, stdout);
+    }
+    printf("##### END #####\n");
+    fflush(stdout);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
 {
-    struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
-    pthread_t thrid_rx;
+    int i, x;
+    unsigned int arg_u;
+    int arg_i;
+    double arg_d = 0.0;
+    float xf = 0.0;
+    char arg_s[64];
+    uint32_t rx_freq_hz = 0;
+    uint8_t clocksource = 0;
+    lgw_radio_type_t radio_type = LGW_RADIO_TYPE_NONE;
+    bool single_input_mode = false;
+    bool full_duplex = false;
+    uint32_t stat_interval_s = DEFAULT_STAT_S;
+    uint32_t fsk_bw_khz;
+    char tun_name[IFNAMSIZ] = TUN_NAME_DEFAULT;
+    const char * adr_log_path = NULL;
+    struct stream_adr_conf_s adr_conf = {
+        .margin_up_db = ADR_MARGIN_UP_DB,
+        .margin_down_db = ADR_MARGIN_DOWN_DB,
+        .per_max = ADR_PER_MAX,
+        .hold_us = ADR_HOLD_MS * 1000,
+        .timeout_us = ADR_TIMEOUT_MS * 1000
+    };
+
+    struct lgw_conf_board_s boardconf;
+    struct lgw_conf_rxrf_s rfconf;
+    struct lgw_conf_rxif_s ifconf;
+    struct lgw_tx_gain_lut_s txlut;
+
     pthread_t thrid_tx;
-    char devname[IFNAMSIZ] = "tun0";
-    tun_fd = conectar_tun(devname);
-    pthread_create(&thrid_rx, NULL, thread_rx, NULL);
-    pthread_create(&thrid_tx, NULL, thread_tx, NULL);
+    pthread_t thrid_rx;
+    pthread_t thrid_concent;
 
-    pthread_join(thrid_rx, NULL);
+    /* COM interfaces */
+    const char com_path_default[] = COM_PATH_DEFAULT;
+    const char * com_path = com_path_default;
+    lgw_com_type_t com_type = COM_TYPE_DEFAULT;
+
+    static struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
+
+    /* Initialize TX gain LUT */
+    txlut.size = 0;
+    memset(txlut.lut, 0, sizeof txlut.lut);
+
+    /* Parameter parsing */
+    int option_index = 0;
+    static struct option long_options[] = {
+        {"fdev",  required_argument, 0, 0},
+        {"br",    required_argument, 0, 0},
+        {"pa",    required_argument, 0, 0},
+        {"pwid",  required_argument, 0, 0},
+        {"tun",   required_argument, 0, 0},
+        {"mtu",   required_argument, 0, 0},
+        {"reasm", required_argument, 0, 0},
+        {"agg",   required_argument, 0, 0},
+        {"no-rohc", no_argument, 0, 0},
+        {"stat",  required_argument, 0, 0},
+        {"fdd",   no_argument, 0, 0},
+        {"adr",   no_argument, 0, 0},
+        {"adr-log", required_argument, 0, 0},
+        {0, 0, 0, 0}
+    };
+
+    /* parse command line options */
+    while ((i = getopt_long (argc, argv, "hjuf:a:s:b:p:k:r:c:l:m:d:", long_options, &option_index)) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+                break;
+            case 'u':
+                com_type = LGW_COM_USB;
+                break;
+            case 'd': /* <char> COM path */
+                if (optarg != NULL) {
+                    com_path = optarg;
+                }
+                break;
+            case 'j': /* Set radio in single input mode */
+                single_input_mode = true;
+                break;
+            case 'r': /* <uint> Radio type */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || ((arg_u != 1255) && (arg_u != 1257) && (arg_u != 1250))) {
+                    printf("ERROR: argument parsing of -r argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    switch (arg_u) {
+                        case 1255:
+                            radio_type = LGW_RADIO_TYPE_SX1255;
+                            break;
+                        case 1257:
+                            radio_type = LGW_RADIO_TYPE_SX1257;
+                            break;
+                        default: /* 1250 */
+                            radio_type = LGW_RADIO_TYPE_SX1250;
+                            break;
+                    }
+                }
+                break;
+            case 'l': /* <uint> LoRa/FSK preamble length */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > 65535)) {
+                    printf("ERROR: argument parsing of -l argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    preamble = (uint16_t)arg_u;
+                }
+                break;
+            case 'm': /* <str> Modulation type */
+                i = sscanf(optarg, "%63s", arg_s);
+                if ((i == 1) && (strcmp(arg_s, "LORA") == 0)) {
+                    modulation = MOD_LORA;
+                } else if ((i == 1) && (strcmp(arg_s, "FSK") == 0)) {
+                    modulation = MOD_FSK;
+                } else {
+                    printf("ERROR: invalid modulation type\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k': /* <uint> Clock Source */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > 1)) {
+                    printf("ERROR: argument parsing of -k argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    clocksource = (uint8_t)arg_u;
+                }
+                break;
+            case 'c': /* <uint> RF chain */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u > 1)) {
+                    printf("ERROR: argument parsing of -c argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    tx_rf_chain = (uint8_t)arg_u;
+                }
+                break;
+            case 'f': /* <float> Radio TX frequency in MHz */
+                i = sscanf(optarg, "%lf", &arg_d);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -f argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    tx_freq_hz = (uint32_t)((arg_d*1e6) + 0.5); /* .5 Hz offset to get rounding instead of truncating */
+                }
+                break;
+            case 'a': /* <float> Radio RX frequency in MHz */
+                i = sscanf(optarg, "%lf", &arg_d);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -a argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    rx_freq_hz = (uint32_t)((arg_d*1e6) + 0.5); /* .5 Hz offset to get rounding instead of truncating */
+                }
+                break;
+            case 's': /* <uint> LoRa datarate */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || (arg_u < 5) || (arg_u > 12)) {
+                    printf("ERROR: argument parsing of -s argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    lora_sf = (uint8_t)arg_u;
+                }
+                break;
+            case 'b': /* <uint> LoRa bandwidth in khz */
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || ((arg_u != 125) && (arg_u != 250) && (arg_u != 500))) {
+                    printf("ERROR: argument parsing of -b argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    lora_bw = (arg_u == 125) ? BW_125KHZ : ((arg_u == 250) ? BW_250KHZ : BW_500KHZ);
+                }
+                break;
+            case 'p': /* <int> RF power */
+                i = sscanf(optarg, "%d", &arg_i);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -p argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    tx_rf_power = (int8_t)arg_i;
+                    txlut.size = 1;
+                    txlut.lut[0].rf_power = tx_rf_power;
+                }
+                break;
+            case 0:
+                if (strcmp(long_options[option_index].name, "fdev") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u < 1) || (arg_u > 200)) {
+                        printf("ERROR: invalid FSK frequency deviation\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        fsk_fdev_khz = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "br") == 0) {
+                    i = sscanf(optarg, "%f", &xf);
+                    if ((i != 1) || (xf < 0.5) || (xf > 250)) {
+                        printf("ERROR: invalid FSK bitrate\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        fsk_br = (uint32_t)(xf * 1e3);
+                    }
+                } else if (strcmp(long_options[option_index].name, "pa") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 3)) {
+                        printf("ERROR: argument parsing of --pa argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        txlut.size = 1;
+                        txlut.lut[0].pa_gain = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "pwid") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 22)) {
+                        printf("ERROR: argument parsing of --pwid argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        txlut.size = 1;
+                        txlut.lut[0].mix_gain = 5; /* TODO: rework this, should not be needed for sx1250 */
+                        txlut.lut[0].pwr_idx = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "tun") == 0) {
+                    strncpy(tun_name, optarg, IFNAMSIZ - 1);
+                    tun_name[IFNAMSIZ - 1] = '\0';
+                } else if (strcmp(long_options[option_index].name, "mtu") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u < 68) || (arg_u > MTU_MAX)) {
+                        printf("ERROR: argument parsing of --mtu argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        mtu = (uint16_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "reasm") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u == 0)) {
+                        printf("ERROR: argument parsing of --reasm argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        reasm_timeout_ms = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "agg") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 1000)) {
+                        printf("ERROR: argument parsing of --agg argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        agg_budget_ms = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "no-rohc") == 0) {
+                    rohc_enable = false;
+                } else if (strcmp(long_options[option_index].name, "stat") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u == 0)) {
+                        printf("ERROR: argument parsing of --stat argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        stat_interval_s = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "fdd") == 0) {
+                    full_duplex = true;
+                } else if (strcmp(long_options[option_index].name, "adr") == 0) {
+                    adr_enable = true;
+                } else if (strcmp(long_options[option_index].name, "adr-log") == 0) {
+                    adr_log_path = optarg;
+                } else {
+                    printf("ERROR: argument parsing options. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return -1;
+        }
+    }
+
+    if (rx_freq_hz == 0) {
+        rx_freq_hz = tx_freq_hz;
+    }
+
+    /* Summary of radio parameters */
+    if (modulation == MOD_FSK) {
+        printf("INFO: FSK bridge, TX %u Hz, RX %u Hz (FDev %u kHz, Bitrate %.2f kbps, %u bytes preamble) at %i dBm\n", tx_freq_hz, rx_freq_hz, fsk_fdev_khz, fsk_br / 1e3, preamble, tx_rf_power);
+    } else {
+        printf("INFO: LoRa bridge, TX %u Hz, RX %u Hz (BW %u kHz, SF %u, %u symbols preamble) at %i dBm\n", tx_freq_hz, rx_freq_hz, (lora_bw == BW_125KHZ) ? 125 : ((lora_bw == BW_250KHZ) ? 250 : 500), lora_sf, preamble, tx_rf_power);
+    }
+
+    /* Ladder of datarates, both sides start on the most robust one */
+    if (adr_enable == true) {
+        x = stream_adr_init(&adr, &adr_conf, modulation, (modulation == MOD_FSK) ? fsk_br : lora_sf, lora_bw, fsk_fdev_khz);
+        if (x < 0) {
+            printf("ERROR: failed to initialize ADR\n");
+            return EXIT_FAILURE;
+        }
+        printf("INFO: ADR enabled, %d datarates from %.2f to %.2f kbps\n", x, adr.rung[0].bitrate / 1e3, adr.rung[x - 1].bitrate / 1e3);
+        if ((adr_log_path != NULL) && (stream_adr_log_open(&adr, adr_log_path) != 0)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Configure signal handling */
+    sigemptyset( &sigact.sa_mask );
+    sigact.sa_flags = 0;
+    sigact.sa_handler = sig_handler;
+    sigaction( SIGQUIT, &sigact, NULL );
+    sigaction( SIGINT, &sigact, NULL );
+    sigaction( SIGTERM, &sigact, NULL );
+
+    /* Open the TUN interface */
+    tun_fd = tun_open(tun_name);
+    if (tun_fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (tun_set_mtu(tun_name, mtu) != 0) {
+        printf("WARNING: failed to set %s MTU to %u (%s)\n", tun_name, mtu, strerror(errno));
+    }
+    printf("INFO: %s opened, MTU %u bytes (%u radio frames max per packet)\n", tun_name, mtu, (mtu + STREAM_FRAG_DATA_MAX - 1) / STREAM_FRAG_DATA_MAX);
+
+    /* Configure the gateway */
+    memset( &boardconf, 0, sizeof boardconf);
+    boardconf.lorawan_public = false;
+    boardconf.clksrc = clocksource;
+    boardconf.full_duplex = full_duplex;
+    boardconf.com_type = com_type;
+    strncpy(boardconf.com_path, com_path, sizeof boardconf.com_path);
+    boardconf.com_path[sizeof boardconf.com_path - 1] = '\0'; /* ensure string termination */
+    if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure board\n");
+        return EXIT_FAILURE;
+    }
+
+    memset( &rfconf, 0, sizeof rfconf);
+    rfconf.enable = true; /* rf chain 0 needs to be enabled for calibration to work on sx1257 */
+    rfconf.freq_hz = rx_freq_hz;
+    rfconf.type = radio_type;
+    rfconf.tx_enable = (tx_rf_chain == 0);
+    rfconf.single_input_mode = single_input_mode;
+    if (lgw_rxrf_setconf(0, &rfconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure rxrf 0\n");
+        return EXIT_FAILURE;
+    }
+
+    memset( &rfconf, 0, sizeof rfconf);
+    rfconf.enable = (((tx_rf_chain == 1) || (clocksource == 1)) ? true : false);
+    rfconf.freq_hz = rx_freq_hz;
+    rfconf.type = radio_type;
+    rfconf.tx_enable = (tx_rf_chain == 1);
+    rfconf.single_input_mode = single_input_mode;
+    if (lgw_rxrf_setconf(1, &rfconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure rxrf 1\n");
+        return EXIT_FAILURE;
+    }
+
+    /* RX channel: LoRa service channel or FSK channel, centered on radio A */
+    memset(&ifconf, 0, sizeof ifconf);
+    ifconf.enable = true;
+    ifconf.rf_chain = 0;
+    ifconf.freq_hz = 0;
+    if (modulation == MOD_LORA) {
+        ifconf.bandwidth = lora_bw;
+        ifconf.datarate = lora_sf;
+        x = lgw_rxif_setconf(8, &ifconf);
+        if ((x == LGW_HAL_SUCCESS) && (adr_enable == true)) {
+            /* multi-SF channel on the same frequency, for the 125 kHz datarates of the ladder */
+            ifconf.bandwidth = BW_125KHZ;
+            ifconf.datarate = DR_LORA_SF7;
+            x = lgw_rxif_setconf(0, &ifconf);
+        }
+    } else {
+        /* Carson's rule to select the FSK RX bandwidth */
+        fsk_bw_khz = (2 * fsk_fdev_khz) + (fsk_br / 1000);
+        ifconf.bandwidth = (fsk_bw_khz <= 125) ? BW_125KHZ : ((fsk_bw_khz <= 250) ? BW_250KHZ : BW_500KHZ);
+        ifconf.datarate = (adr_enable == true) ? adr.rung[0].datarate : fsk_br;
+        x = lgw_rxif_setconf(9, &ifconf);
+    }
+    if (x != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to configure RX channel\n");
+        return EXIT_FAILURE;
+    }
+
+    if (txlut.size > 0) {
+        if (lgw_txgain_setconf(tx_rf_chain, &txlut) != LGW_HAL_SUCCESS) {
+            printf("ERROR: failed to configure txgain lut\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (com_type == LGW_COM_SPI) {
+        /* Board reset */
+        if (system("./reset_lgw.sh start") != 0) {
+            printf("ERROR: failed to reset SX1302, check your reset_lgw.sh script\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* connect, configure and start the LoRa concentrator */
+    x = lgw_start();
+    if (x != 0) {
+        printf("ERROR: failed to start the gateway\n");
+        return EXIT_FAILURE;
+    }
+
+    frame_queue_init(&tx_queue);
+    frame_queue_init(&rx_queue);
+    stream_reasm_init(&reasm, reasm_timeout_ms * 1000);
+    stream_rohc_init(&comp, rohc_enable);
+    stream_rohc_init(&decomp, true);
+    stream_agg_init(&agg, STREAM_FRAME_SIZE_MAX, agg_budget_ms * 1000);
+
+    /* spawn threads */
+    if (pthread_create(&thrid_concent, NULL, thread_concent, NULL) != 0) {
+        printf("ERROR: impossible to create concentrator thread\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&thrid_tx, NULL, thread_tx, NULL) != 0) {
+        printf("ERROR: impossible to create TX thread\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&thrid_rx, NULL, thread_rx, NULL) != 0) {
+        printf("ERROR: impossible to create RX thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* main loop task : statistics */
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        for (i = 0; (i < (int)(stat_interval_s * 10)) && (quit_sig != 1) && (exit_sig != 1); i++) {
+            wait_ms(100);
+        }
+        print_stats(stat_interval_s);
+    }
+
+    /* wait for threads to finish */
     pthread_join(thrid_tx, NULL);
+    pthread_join(thrid_rx, NULL);
+    pthread_join(thrid_concent, NULL);
+
+    close(tun_fd);
+    stream_adr_log_close(&adr);
+
+    if (exit_sig == 1) {
+        /* Stop the gateway */
+        x = lgw_stop();
+        if (x != 0) {
+            printf("ERROR: failed to stop the gateway\n");
+        }
 
+        if (com_type == LGW_COM_SPI) {
+            /* Board reset */
+            if (system("./reset_lgw.sh stop") != 0) {
+                printf("ERROR: failed to reset SX1302, check your reset_lgw.sh script\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    printf("=========== Bridge End ===========\n");
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 1: READ IP PACKETS FROM TUN AND TURN THEM INTO FRAMES -------- */
+
+static void * thread_tx(void * arg) {
+    int x, nb_frame, timeout_ms;
+    ssize_t nb_byte;
+    uint32_t remaining_us;
+    uint16_t pkt_id = 0;
+    uint8_t buff[MTU_MAX + 1];
+    uint8_t rec[STREAM_FRAG_PKT_SIZE_MAX];
+    struct stream_frame_s frames[STREAM_FRAG_NB_MAX + 2]; /* pending aggregated frame + fragments + new aggregated frame */
+    struct pollfd pfd = { .fd = tun_fd, .events = POLLIN };
+
+    (void)arg;
+
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        /* wait for a packet, or for the latency budget of the aggregated frame to expire */
+        pthread_mutex_lock(&mx_stats);
+        remaining_us = stream_agg_remaining_us(&agg);
+        pthread_mutex_unlock(&mx_stats);
+        timeout_ms = (remaining_us < 100000) ? (int)((remaining_us + 999) / 1000) : 100;
+        nb_byte = 0;
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            nb_byte = read(tun_fd, buff, sizeof buff);
+        }
+
+        nb_frame = 0;
+        pthread_mutex_lock(&mx_stats);
+        if (nb_byte > 0) {
+            stats.tun_pkt_in += 1;
+            stats.tun_bytes_in += nb_byte;
+            x = stream_rohc_compress(&comp, buff, (uint16_t)nb_byte, rec, sizeof rec);
+            if (x > 0) {
+                nb_frame = stream_agg_push(&agg, rec, (uint16_t)x, &frames[0]);
+                if (nb_frame < 0) {
+                    /* too big to be aggregated: send the pending records first, then the fragments */
+                    nb_frame = stream_agg_flush(&agg, true, &frames[0]);
+                    x = stream_frag_split(pkt_id, rec, (uint16_t)x, STREAM_FRAME_SIZE_MAX, &frames[nb_frame], STREAM_FRAG_NB_MAX);
+                    pkt_id += 1;
+                    nb_frame += (x > 0) ? x : 0;
+                }
+            }
+            if (x < 0) {
+                stats.tun_pkt_drop += 1;
+            }
+        }
+        nb_frame += stream_agg_flush(&agg, false, &frames[nb_frame]);
+        if ((nb_frame > 0) && (frame_queue_push(&tx_queue, frames, nb_frame) == false)) {
+            stats.frame_tx_drop += nb_frame;
+        }
+        pthread_mutex_unlock(&mx_stats);
+    }
+
+    printf("\nINFO: End of TX thread\n");
+    return NULL;
 }
 
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 2: REASSEMBLE RECEIVED FRAMES AND WRITE IP PACKETS TO TUN ----- */
+
+/* Decompress a list of records and write the packets to TUN */
+static void tun_write_records(const uint8_t * buf, uint16_t size) {
+    int x, nb_byte;
+    uint16_t offset = 0;
+    uint16_t rec_size;
+    const uint8_t * rec;
+    static uint8_t pkt[STREAM_FRAG_PKT_SIZE_MAX]; /* only used by thread_rx */
+
+    while ((x = stream_rec_next(buf, size, &offset, &rec, &rec_size)) == 1) {
+        pthread_mutex_lock(&mx_stats);
+        nb_byte = stream_rohc_decompress(&decomp, rec, rec_size, pkt, sizeof pkt);
+        pthread_mutex_unlock(&mx_stats);
+        if (nb_byte < 0) {
+            continue;
+        }
+        if (write(tun_fd, pkt, nb_byte) == nb_byte) {
+            pthread_mutex_lock(&mx_stats);
+            stats.tun_pkt_out += 1;
+            stats.tun_bytes_out += nb_byte;
+            pthread_mutex_unlock(&mx_stats);
+        } else {
+            printf("WARNING: failed to write packet to TUN (%s)\n", strerror(errno));
+        }
+    }
+    if (x < 0) {
+        pthread_mutex_lock(&mx_stats);
+        stats.frame_rx_bad += 1;
+        pthread_mutex_unlock(&mx_stats);
+    }
+}
 
-void thread_rx(void) {
+static void * thread_rx(void * arg) {
+    int x;
+    uint8_t * pkt;
+    uint16_t pkt_size;
+    struct stream_frame_s frame;
 
+    (void)arg;
 
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        if (frame_queue_pop(&rx_queue, &frame, 100000) == false) {
+            pthread_mutex_lock(&mx_stats);
+            stream_reasm_expire(&reasm);
+            pthread_mutex_unlock(&mx_stats);
+            continue;
+        }
+
+        if (frame.size < 1) {
+            continue;
+        }
+        if (frame.data[0] == STREAM_FRAME_TYPE_AGG) {
+            tun_write_records(frame.data + 1, frame.size - 1);
+            continue;
+        }
+
+        pthread_mutex_lock(&mx_stats);
+        x = stream_reasm_push(&reasm, frame.data, frame.size, &pkt, &pkt_size);
+        if (x < 0) {
+            stats.frame_rx_bad += 1;
+        }
+        pthread_mutex_unlock(&mx_stats);
+
+        if (x == 1) {
+            tun_write_records(pkt, pkt_size);
+        }
+    }
+
+    printf("\nINFO: End of RX thread\n");
+    return NULL;
 }
 
-void thread_tx(void) {
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 3: CONCENTRATOR OWNER, SEND QUEUED FRAMES AND POLL RX FIFO ---- */
+
+static void apply_rung(struct lgw_pkt_tx_s * pkt, const struct stream_adr_rung_s * rung) {
+    pkt->datarate = rung->datarate;
+    if (rung->modulation == MOD_LORA) {
+        pkt->bandwidth = rung->bandwidth;
+        printf("INFO: ADR: TX datarate SF%u, BW %u kHz (%.2f kbps)\n", rung->datarate, (rung->bandwidth == BW_125KHZ) ? 125 : ((rung->bandwidth == BW_250KHZ) ? 250 : 500), rung->bitrate / 1e3);
+    } else {
+        printf("INFO: ADR: TX datarate %.2f kbps\n", rung->bitrate / 1e3);
+    }
+}
+
+static void follow_rx_rung(const struct stream_adr_rung_s * rung) {
+    /* LoRa datarates are all demodulated in parallel, only FSK has to be reconfigured */
+    if (rung->modulation != MOD_FSK) {
+        return;
+    }
+    if (lgw_rxif_set_fsk_datarate(rung->datarate) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to set FSK RX datarate to %u bps\n", rung->datarate);
+        return;
+    }
+    printf("INFO: ADR: RX datarate %.2f kbps\n", rung->bitrate / 1e3);
+}
+
+static void * thread_concent(void * arg) {
+    int i, nb_pkt, x;
+    bool idle, has_frame;
+    bool fb_pending = false;
+    int nb_announce = 0;
+    uint8_t tx_rung = 0;    /* ADR rung currently used by pkt */
+    uint8_t rx_rung;
+    uint8_t tx_status;
+    uint32_t lat_us;
+    uint64_t fb_next_us = stream_time_us();
+    struct stream_frame_s frame;
+    struct lgw_pkt_tx_s pkt;
+    struct lgw_pkt_rx_s rxpkt[RX_PKT_NB_MAX];
+
+    (void)arg;
+
+    /* Static TX parameters */
+    memset(&pkt, 0, sizeof pkt);
+    pkt.rf_chain = tx_rf_chain;
+    pkt.freq_hz = tx_freq_hz;
+    pkt.rf_power = tx_rf_power;
+    pkt.tx_mode = IMMEDIATE;
+    pkt.modulation = modulation;
+    pkt.preamble = preamble;
+    pkt.no_crc = false;
+    pkt.no_header = false;
+    if (modulation == MOD_FSK) {
+        pkt.datarate = fsk_br;
+        pkt.f_dev = fsk_fdev_khz;
+    } else {
+        pkt.datarate = lora_sf;
+        pkt.bandwidth = lora_bw;
+        pkt.coderate = CR_LORA_4_5;
+    }
+    if (adr_enable == true) {
+        apply_rung(&pkt, &adr.rung[tx_rung]);
+    }
+
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        idle = true;
+
+        /* Datarate decisions, feedback to be sent to the peer */
+        if (adr_enable == true) {
+            pthread_mutex_lock(&mx_stats);
+            if (stream_adr_update(&adr) >= 0) {
+                nb_announce = ADR_ANNOUNCE_NB; /* the peer must know before we switch */
+            }
+            if (stream_adr_rx_timeout(&adr) == true) {
+                follow_rx_rung(&adr.rung[adr.rx_rung]);
+            }
+            pthread_mutex_unlock(&mx_stats);
+            if ((nb_announce > 0) || (stream_time_us() >= fb_next_us)) {
+                fb_pending = true;
+            }
+        }
+
+        /* TX first: only one frame can be loaded in the TX modem at a time */
+        if ((fb_pending == true) || (frame_queue_wait(&tx_queue, 0) > 0)) {
+            idle = false;
+            x = lgw_status(tx_rf_chain, TX_STATUS, &tx_status);
+            if ((x == LGW_HAL_SUCCESS) && (tx_status == TX_FREE)) {
+                /* announcements are on air: switch to the new datarate */
+                if ((adr_enable == true) && (nb_announce == 0) && (tx_rung != adr.tx_rung)) {
+                    tx_rung = adr.tx_rung;
+                    apply_rung(&pkt, &adr.rung[tx_rung]);
+                }
+                if (fb_pending == true) {
+                    pthread_mutex_lock(&mx_stats);
+                    frame.size = stream_adr_fb_build(&adr, frame.data);
+                    pthread_mutex_unlock(&mx_stats);
+                    frame.time_us = stream_time_us();
+                    fb_pending = false;
+                    fb_next_us = frame.time_us + ADR_FB_PERIOD_US;
+                    nb_announce -= (nb_announce > 0) ? 1 : 0;
+                    has_frame = true;
+                } else {
+                    has_frame = frame_queue_pop(&tx_queue, &frame, 0);
+                }
+            } else {
+                has_frame = false;
+            }
+            if (has_frame == true) {
+                lat_us = (uint32_t)(stream_time_us() - frame.time_us);
+                pkt.size = frame.size;
+                memcpy(pkt.payload, frame.data, frame.size);
+                x = lgw_send(&pkt);
+
+                pthread_mutex_lock(&mx_stats);
+                if (x == LGW_HAL_SUCCESS) {
+                    stream_adr_tx(&adr);
+                    stats.frame_tx += 1;
+                    stats.frame_tx_bytes += frame.size;
+                    stats.tx_airtime_ms += lgw_time_on_air(&pkt);
+                    stats.tx_lat_us_sum += lat_us;
+                    if (lat_us > stats.tx_lat_us_max) {
+                        stats.tx_lat_us_max = lat_us;
+                    }
+                } else {
+                    stats.frame_tx_err += 1;
+                }
+                pthread_mutex_unlock(&mx_stats);
+            } else {
+                wait_us(POLL_TX_BUSY_US);
+            }
+        }
+
+        /* RX: fetch all the packets available */
+        nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
+        if (nb_pkt == LGW_HAL_ERROR) {
+            printf("ERROR: failed packet fetch, exiting\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < nb_pkt; i++) {
+            idle = false;
+            pthread_mutex_lock(&mx_stats);
+            if (adr_enable == true) {
+                stream_adr_rx(&adr, &rxpkt[i]);
+            }
+            /* an empty frame has no type byte */
+            if ((rxpkt[i].status != STAT_CRC_OK) || (rxpkt[i].size < 1)) {
+                stats.frame_rx_bad += 1;
+                pthread_mutex_unlock(&mx_stats);
+                continue;
+            }
+            stats.frame_rx += 1;
+            stats.frame_rx_bytes += rxpkt[i].size;
+
+            /* Feedback frames are consumed here, ignored if ADR is disabled */
+            if (rxpkt[i].payload[0] == STREAM_FRAME_TYPE_FB) {
+                rx_rung = adr.rx_rung;
+                if ((adr_enable == true) && (stream_adr_fb_parse(&adr, rxpkt[i].payload, rxpkt[i].size) == 0) && (adr.rx_rung != rx_rung)) {
+                    follow_rx_rung(&adr.rung[adr.rx_rung]);
+                }
+                pthread_mutex_unlock(&mx_stats);
+                continue;
+            }
+            pthread_mutex_unlock(&mx_stats);
+
+            frame.size = rxpkt[i].size;
+            memcpy(frame.data, rxpkt[i].payload, rxpkt[i].size);
+            frame.time_us = stream_time_us();
+            if (frame_queue_push(&rx_queue, &frame, 1) == false) {
+                pthread_mutex_lock(&mx_stats);
+                stats.frame_rx_drop += 1;
+                pthread_mutex_unlock(&mx_stats);
+            }
+        }
+
+        /* Nothing to do: sleep until a frame is queued for TX or next RX poll */
+        if (idle == true) {
+            frame_queue_wait(&tx_queue, POLL_IDLE_US);
+        }
+    }
+
+    printf("\nINFO: End of concentrator thread\n");
+    return NULL;
+}
 
-}
\ No newline at end of file
+/* --- EOF ------------------------------------------------------------------ */
@@ -31,10 +31,17 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <math.h>
 #include <signal.h>     /* sigaction */
 #include <getopt.h>     /* getopt_long */
+#include <poll.h>       /* poll */
+#include <fcntl.h>      /* fcntl */
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
+#include "loragw_duty.h"
+
+#include "stream_ts.h"
+#include "stream_frag.h"    /* stream_time_us */
+#include "stream_hop.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -46,10 +53,25 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define COM_TYPE_DEFAULT LGW_COM_SPI
 #define COM_PATH_DEFAULT "/dev/spidev0.0"
+#define SX1261_PATH_DEFAULT "/dev/spidev0.1"
 
 #define DEFAULT_CLK_SRC     0
 #define DEFAULT_FREQ_HZ     868500000U
 
+#define PAYLOAD_HDR_SIZE    9       /* MHDR, DevAddr, FCtrl, FCnt, FPort */
+#define PAYLOAD_DATA_MAX    246     /* bytes of stdin sent per packet */
+#define DEFAULT_TS_LATENCY_MS   1000    /* video mode: queuing latency budget */
+#define DEFAULT_STAT_S      10      /* video, hop and duty cycle: statistics report interval */
+#define DEFAULT_HOP_SEED    0x1302
+#define DEFAULT_HOP_RSSI    -90     /* hop mode: level of an occupied channel, in dBm */
+#define DEFAULT_HOP_BUSY    10      /* hop mode: channel excluded when occupied more than this % of the time */
+#define HOP_BUSY_AGE_S      60      /* hop mode: scan results older than this are ignored */
+#define HOP_UPDATE_MS       1000    /* hop mode: interval between 2 evaluations of an external occupancy map */
+#define HOP_SCAN_NB         2000    /* hop mode: RSSI points of a scan, 10us each */
+#define HOP_SCAN_TIMEOUT_MS 100
+#define HOP_HALF_LIFE_S     30      /* hop mode: half-life of the scan results accumulated by the transmitter */
+#define HOP_OCC_PATH_SCAN   LGW_OCC_PATH_DEFAULT "_hop" /* hop mode: map of our own scans, on the hop grid */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
@@ -57,6 +79,20 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
 static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
 
+static struct stream_ts_s ts_queue; /* video mode: TS packets waiting for the radio */
+
+/* Hop mode */
+static bool hop_enable = false;
+static struct stream_hop_s hop;
+static lgw_occ_t * hop_occ = NULL;      /* occupancy map of the hop channels, NULL if none */
+static unsigned int hop_scan_ms = 0;    /* interval between 2 scans with the sx1261, 0 to disable */
+static uint8_t hop_scan_chan = 0;       /* next channel to be scanned */
+static uint64_t hop_last_us = 0;        /* last scan or evaluation of the occupancy map */
+
+/* Duty cycle */
+static bool duty_enable = false;
+static struct lgw_duty_s duty;
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
 
@@ -98,6 +134,26 @@ void usage(void) {
     printf(" --loop        Number of loops for HAL start/stop (HAL unitary test)\n");
     printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
     printf(" --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --video              stdin is an MPEG transport stream: one TS packet per radio packet,\n");
+    printf("                      frames dropped by priority when the backlog exceeds the latency budget\n");
+    printf(" --ts-latency <uint>  Video mode latency budget in ms, default %u\n", DEFAULT_TS_LATENCY_MS);
+    printf(" --stat <uint>        Video, hop and duty cycle statistics report interval in seconds, 0 to disable, default %u\n", DEFAULT_STAT_S);
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --hop <uint>         Hop over that many LoRa 125 kHz channels [1..%u], the first one is -f,\n", STREAM_HOP_CHAN_NB_MAX);
+    printf("                      with SF -s (default 7), for a receiver started with the same hop options\n");
+    printf(" --hop-step <uint>    Hop channels spacing in kHz, default %u\n", STREAM_HOP_STEP_HZ / 1000);
+    printf(" --hop-seed <uint>    Seed of the hop sequence, default %u\n", DEFAULT_HOP_SEED);
+    printf(" --hop-occ <path>     Spectrum occupancy map used to exclude busy channels, default " LGW_OCC_PATH_DEFAULT ",\n");
+    printf("                      or " HOP_OCC_PATH_SCAN " with --hop-scan\n");
+    printf(" --hop-rssi <int>     Level of an occupied channel in dBm, default %d\n", DEFAULT_HOP_RSSI);
+    printf(" --hop-busy <uint>    Channel excluded when occupied more than this %% of the time, default %u\n", DEFAULT_HOP_BUSY);
+    printf(" --hop-scan <uint>    Scan one hop channel with the sx1261 every <uint> ms and feed the occupancy map,\n");
+    printf("                      0 to only read a map fed by another process (default)\n");
+    printf(" --sx1261 <path>      sx1261 SPI path for --hop-scan, default " SX1261_PATH_DEFAULT "\n");
+    printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
+    printf(" --duty               Respect the EU868 sub-band duty cycles: in hop mode a packet is sent in the\n");
+    printf("                      sub-band with the most airtime left, and waits when no channel has airtime left\n");
 }
 
 /* handle signals */
@@ -111,6 +167,280 @@ static void sig_handler(int sigio)
     }
 }
 
+/* Hop mode: scan the next hop channel with the sx1261, the radio must be free */
+static void hop_scan(void) {
+    uint32_t freq_hz = stream_hop_freq(&hop, hop_scan_chan);
+    lgw_spectral_scan_status_t status;
+    int16_t levels[LGW_SPECTRAL_SCAN_RESULT_SIZE];
+    uint16_t results[LGW_SPECTRAL_SCAN_RESULT_SIZE];
+    uint64_t start_us;
+
+    hop_scan_chan = (hop_scan_chan + 1) % hop.conf.nb_chan;
+    if (lgw_spectral_scan_start(freq_hz, HOP_SCAN_NB) != LGW_HAL_SUCCESS) {
+        printf("ERROR: failed to start spectral scan on %u Hz\n", freq_hz);
+        return;
+    }
+    start_us = stream_time_us();
+    do {
+        wait_ms(1);
+        status = LGW_SPECTRAL_SCAN_STATUS_UNKNOWN;
+        if (lgw_spectral_scan_get_status(&status) != LGW_HAL_SUCCESS) {
+            printf("ERROR: spectral scan status failed\n");
+            return;
+        }
+        if ((stream_time_us() - start_us) > (HOP_SCAN_TIMEOUT_MS * 1000)) {
+            printf("ERROR: TIMEOUT on spectral scan of %u Hz\n", freq_hz);
+            lgw_spectral_scan_abort();
+            return;
+        }
+    } while (status == LGW_SPECTRAL_SCAN_STATUS_ON_GOING);
+
+    if ((status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED) && (lgw_spectral_scan_get_results(levels, results) == LGW_HAL_SUCCESS)) {
+        lgw_occ_update(hop_occ, freq_hz, levels, results);
+    }
+}
+
+/* Hop mode: set the frequency of the next packet, after a scan or an evaluation of the map when due,
+   the size of the packet must be set for the duty cycle */
+static void hop_select(struct lgw_pkt_tx_s * pkt, uint16_t fcnt) {
+    uint64_t now_us;
+    uint32_t toa_us;
+    uint32_t freq_hz[STREAM_HOP_CHAN_NB_MAX];
+    uint8_t chan[STREAM_HOP_CHAN_NB_MAX];
+    uint8_t allowed;
+    int i, nb_chan, best, band;
+
+    if (hop_enable == false) {
+        return;
+    }
+
+    if (hop_occ != NULL) {
+        now_us = stream_time_us();
+        if (hop_scan_ms > 0) {
+            if ((now_us - hop_last_us) >= (hop_scan_ms * 1000ULL)) {
+                hop_scan();
+                stream_hop_update(&hop, hop_occ);
+                hop_last_us = now_us;
+            }
+        } else if ((now_us - hop_last_us) >= (HOP_UPDATE_MS * 1000ULL)) {
+            stream_hop_update(&hop, hop_occ);
+            hop_last_us = now_us;
+        }
+    }
+
+    if (duty_enable == true) {
+        /* send in the sub-band with the most airtime left among the channels not busy, or among
+           all of them when none of those has enough (the duty cycle is a legal limit, the occupancy
+           is not), following the hop sequence over the channels of that sub-band */
+        allowed = hop.allowed;
+        toa_us = lgw_duty_airtime_us(pkt);
+        best = -1;
+        while (best < 0) {
+            nb_chan = 0;
+            for (i = 0; i < hop.conf.nb_chan; i++) {
+                if (hop.allowed & (1U << i)) {
+                    chan[nb_chan] = (uint8_t)i;
+                    freq_hz[nb_chan++] = stream_hop_freq(&hop, i);
+                }
+            }
+            best = lgw_duty_pick(&duty, pkt->rf_chain, freq_hz, nb_chan, toa_us);
+            if ((best >= 0) || (hop.allowed == (uint8_t)((1U << hop.conf.nb_chan) - 1))) {
+                break;
+            }
+            hop.allowed = (uint8_t)((1U << hop.conf.nb_chan) - 1);
+        }
+        if (best >= 0) {
+            band = lgw_duty_band(&duty, freq_hz[best]);
+            hop.allowed = 0;
+            for (i = 0; i < nb_chan; i++) {
+                if (lgw_duty_band(&duty, freq_hz[i]) == band) {
+                    hop.allowed |= (uint8_t)(1U << chan[i]);
+                }
+            }
+        }
+        pkt->freq_hz = stream_hop_freq(&hop, stream_hop_next(&hop, fcnt));
+        hop.allowed = allowed;
+        return;
+    }
+
+    pkt->freq_hz = stream_hop_freq(&hop, stream_hop_next(&hop, fcnt));
+}
+
+/* Duty cycle: time before a packet of that size can be sent, on the first hop channel ready in hop mode,
+   0 if it can be sent now */
+static uint32_t duty_wait_us(const struct lgw_pkt_tx_s * pkt, uint16_t size) {
+    struct lgw_pkt_tx_s p = *pkt;
+    uint32_t wait_us, best_us = UINT32_MAX;
+    int i;
+
+    if (duty_enable == false) {
+        return 0;
+    }
+
+    p.size = size;
+    if (hop_enable == false) {
+        lgw_duty_check(&duty, &p, &best_us);
+        return best_us;
+    }
+    for (i = 0; (i < hop.conf.nb_chan) && (best_us > 0); i++) {
+        p.freq_hz = stream_hop_freq(&hop, i);
+        if ((lgw_duty_check(&duty, &p, &wait_us) == LGW_DUTY_SUCCESS) && (wait_us < best_us)) {
+            best_us = wait_us;
+        }
+    }
+
+    return best_us;
+}
+
+/* Duty cycle: wait until the packet can be sent on its frequency, -1 if it never can or on exit */
+static int duty_hold(const struct lgw_pkt_tx_s * pkt) {
+    uint32_t wait_us;
+
+    if (duty_enable == false) {
+        return 0;
+    }
+
+    if (lgw_duty_check(&duty, pkt, &wait_us) != LGW_DUTY_SUCCESS) {
+        return -1;
+    }
+    if (wait_us == UINT32_MAX) {
+        printf("ERROR: %u ms on air is more than the duty cycle of %u Hz allows\n", lgw_time_on_air(pkt), pkt->freq_hz);
+        return -1;
+    }
+    if (wait_us > 0) {
+        lgw_duty_deny(&duty, pkt);
+    }
+    while ((wait_us > 0) && (quit_sig != 1) && (exit_sig != 1)) {
+        wait_ms((wait_us < 100000) ? ((wait_us + 999) / 1000) : 100);
+        lgw_duty_check(&duty, pkt, &wait_us);
+    }
+
+    return ((quit_sig != 1) && (exit_sig != 1)) ? 0 : -1;
+}
+
+/* Duty cycle: airtime used and left per sub-band, for the sub-bands used since the start */
+static void duty_report(uint8_t rf_chain) {
+    const struct lgw_duty_bucket_s * b;
+    uint32_t remaining_us;
+    int i;
+
+    if (duty_enable == false) {
+        return;
+    }
+
+    for (i = 0; i < duty.conf.nb_band; i++) {
+        b = &duty.bucket[i][rf_chain];
+        if ((b->airtime_us == 0) && (b->nb_denied == 0)) {
+            continue;
+        }
+        lgw_duty_remaining(&duty, duty.conf.band[i].freq_hz_min, rf_chain, &remaining_us);
+        printf("INFO: duty cycle %.3f-%.3f MHz (%.1f%%): %llu ms used, %u ms left, %u packet(s) delayed\n",
+                    duty.conf.band[i].freq_hz_min / 1e6, duty.conf.band[i].freq_hz_max / 1e6, duty.conf.band[i].duty_ppm / 1e4,
+                    (unsigned long long)(b->airtime_us / 1000), remaining_us / 1000, b->nb_denied);
+    }
+}
+
+/* Video mode: stdin is read while a packet is on air, so that the queue always
+   knows the real backlog and can drop frames before the latency budget is blown */
+static int send_video(struct lgw_pkt_tx_s * pkt, unsigned int ts_latency_ms, unsigned int stat_interval_s) {
+    int x, nb_byte;
+    uint8_t buffer[16 * STREAM_TS_SIZE];
+    uint8_t tx_status = TX_FREE;
+    uint16_t fcnt = 0;
+    uint32_t airtime_us, x_us;
+    uint64_t last_stat_us;
+    bool eof = false;
+    int timeout_ms;
+    struct pollfd pfd;
+
+    /* Time on air of a full TS packet */
+    pkt->size = PAYLOAD_HDR_SIZE + STREAM_TS_SIZE;
+    airtime_us = lgw_duty_airtime_us(pkt);
+    stream_ts_init(&ts_queue, ts_latency_ms * 1000, PAYLOAD_DATA_MAX / STREAM_TS_SIZE, airtime_us);
+    printf("INFO: video mode, %u TS packet(s) per radio packet, %u ms on air, latency budget %u ms\n",
+                PAYLOAD_DATA_MAX / STREAM_TS_SIZE, airtime_us / 1000, ts_latency_ms);
+    if (duty_enable == true) {
+        if ((lgw_duty_check(&duty, pkt, &x_us) != LGW_DUTY_SUCCESS) || (x_us == UINT32_MAX)) {
+            printf("ERROR: %u ms on air is more than the duty cycle of %u Hz allows\n", airtime_us / 1000, pkt->freq_hz);
+            return -1;
+        }
+    }
+
+    x = fcntl(STDIN_FILENO, F_GETFL);
+    if ((x < 0) || (fcntl(STDIN_FILENO, F_SETFL, x | O_NONBLOCK) < 0)) {
+        printf("ERROR: failed to set stdin non-blocking\n");
+        return -1;
+    }
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+
+    last_stat_us = stream_time_us();
+    while ((quit_sig != 1) && (exit_sig != 1)) {
+        /* Radio is free: send the oldest TS packet still in the queue, unless out of airtime:
+           the queue then keeps filling and drops what would exceed the latency budget */
+        x_us = (tx_status == TX_FREE) ? duty_wait_us(pkt, PAYLOAD_HDR_SIZE + STREAM_TS_SIZE) : 0;
+        if ((tx_status == TX_FREE) && (x_us == 0)) {
+            x = stream_ts_pop(&ts_queue, pkt->payload + PAYLOAD_HDR_SIZE);
+            if (x > 0) {
+                pkt->size = PAYLOAD_HDR_SIZE + x;
+                hop_select(pkt, fcnt);
+                pkt->payload[6] = (uint8_t)(fcnt >> 0); /* FCnt */
+                pkt->payload[7] = (uint8_t)(fcnt >> 8); /* FCnt */
+                fcnt += 1;
+                if (lgw_send(pkt) != 0) {
+                    printf("ERROR: failed to send packet\n");
+                } else {
+                    tx_status = TX_EMITTING;
+                    if (duty_enable == true) {
+                        lgw_duty_consume(&duty, pkt);
+                    }
+                }
+            } else if (eof == true) {
+                break;
+            }
+        }
+
+        /* Read the input while the packet is on air; poll for 1 ms only when waiting for the radio,
+           until the airtime is back when out of it, but not longer than the latency budget */
+        if (tx_status != TX_FREE) {
+            timeout_ms = 1;
+        } else if (x_us > 0) {
+            timeout_ms = ((ts_latency_ms > 0) && (x_us >= (ts_latency_ms * 1000))) ? (int)ts_latency_ms : (int)(x_us / 1000) + 1;
+        } else {
+            timeout_ms = -1;
+        }
+        if (eof == false) {
+            x = poll(&pfd, 1, timeout_ms);
+            if ((x > 0) && (pfd.revents & (POLLIN | POLLHUP))) {
+                nb_byte = read(STDIN_FILENO, buffer, sizeof buffer);
+                if (nb_byte > 0) {
+                    stream_ts_feed(&ts_queue, buffer, nb_byte);
+                } else if (nb_byte == 0) {
+                    eof = true;
+                }
+            }
+        } else {
+            wait_ms((timeout_ms > 0) ? timeout_ms : 1);
+        }
+        if (tx_status != TX_FREE) {
+            lgw_status(pkt->rf_chain, TX_STATUS, &tx_status);
+        }
+
+        if ((stat_interval_s > 0) && ((stream_time_us() - last_stat_us) >= (stat_interval_s * 1000000ULL))) {
+            stream_ts_report(&ts_queue, stdout);
+            if (hop_enable == true) {
+                stream_hop_report(&hop, stdout);
+            }
+            duty_report(pkt->rf_chain);
+            last_stat_us = stream_time_us();
+        }
+    }
+    stream_ts_report(&ts_queue, stdout);
+    duty_report(pkt->rf_chain);
+
+    return 0;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- MAIN FUNCTION -------------------------------------------------------- */
 
@@ -141,9 +471,19 @@ int main(int argc, char **argv)
     bool no_header = false;
     bool single_input_mode = false;
     bool full_duplex = false;
+    bool video = false;
+    unsigned int ts_latency_ms = DEFAULT_TS_LATENCY_MS;
+    unsigned int stat_interval_s = DEFAULT_STAT_S;
+    uint64_t last_stat_us;
+    struct stream_hop_conf_s hop_conf;
+    struct lgw_occ_conf_s occ_conf;
+    const char * hop_occ_path = NULL;
+    int hop_busy_pct = DEFAULT_HOP_BUSY;
+    const char * sx1261_path = SX1261_PATH_DEFAULT;
 
     struct lgw_conf_board_s boardconf;
     struct lgw_conf_rxrf_s rfconf;
+    struct lgw_conf_sx1261_s sx1261conf;
     struct lgw_pkt_tx_s pkt;
     struct lgw_tx_gain_lut_s txlut; /* TX gain table */
     uint8_t tx_status;
@@ -162,6 +502,12 @@ int main(int argc, char **argv)
     txlut.size = 0;
     memset(txlut.lut, 0, sizeof txlut.lut);
 
+    memset(&hop_conf, 0, sizeof hop_conf);
+    hop_conf.step_hz = STREAM_HOP_STEP_HZ;
+    hop_conf.seed = DEFAULT_HOP_SEED;
+    hop_conf.busy_rssi_dbm = DEFAULT_HOP_RSSI;
+    hop_conf.busy_age_s = HOP_BUSY_AGE_S;
+
     /* Parameter parsing */
     int option_index = 0;
     static struct option long_options[] = {
@@ -175,6 +521,18 @@ int main(int argc, char **argv)
         {"loop", required_argument, 0, 0},
         {"nhdr", no_argument, 0, 0},
         {"fdd",  no_argument, 0, 0},
+        {"video", no_argument, 0, 0},
+        {"ts-latency", required_argument, 0, 0},
+        {"stat", required_argument, 0, 0},
+        {"hop", required_argument, 0, 0},
+        {"hop-step", required_argument, 0, 0},
+        {"hop-seed", required_argument, 0, 0},
+        {"hop-occ", required_argument, 0, 0},
+        {"hop-rssi", required_argument, 0, 0},
+        {"hop-busy", required_argument, 0, 0},
+        {"hop-scan", required_argument, 0, 0},
+        {"sx1261", required_argument, 0, 0},
+        {"duty", no_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -405,6 +763,79 @@ int main(int argc, char **argv)
                     no_header = true;
                 } else if (strcmp(long_options[option_index].name, "fdd") == 0) {
                     full_duplex = true;
+                } else if (strcmp(long_options[option_index].name, "video") == 0) {
+                    video = true;
+                } else if (strcmp(long_options[option_index].name, "ts-latency") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 60000)) {
+                        printf("ERROR: argument parsing of --ts-latency argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        ts_latency_ms = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "stat") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if (i != 1) {
+                        printf("ERROR: argument parsing of --stat argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        stat_interval_s = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u < 1) || (arg_u > STREAM_HOP_CHAN_NB_MAX)) {
+                        printf("ERROR: argument parsing of --hop argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_enable = true;
+                        hop_conf.nb_chan = (uint8_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop-step") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u < 125) || (arg_u > 1000)) {
+                        printf("ERROR: argument parsing of --hop-step argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_conf.step_hz = arg_u * 1000;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop-seed") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if (i != 1) {
+                        printf("ERROR: argument parsing of --hop-seed argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_conf.seed = (uint32_t)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop-occ") == 0) {
+                    hop_occ_path = optarg;
+                } else if (strcmp(long_options[option_index].name, "hop-rssi") == 0) {
+                    i = sscanf(optarg, "%d", &arg_i);
+                    if ((i != 1) || (arg_i < -127) || (arg_i > 0)) {
+                        printf("ERROR: argument parsing of --hop-rssi argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_conf.busy_rssi_dbm = (int16_t)arg_i;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop-busy") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if ((i != 1) || (arg_u > 100)) {
+                        printf("ERROR: argument parsing of --hop-busy argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_busy_pct = (int)arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "hop-scan") == 0) {
+                    i = sscanf(optarg, "%u", &arg_u);
+                    if (i != 1) {
+                        printf("ERROR: argument parsing of --hop-scan argument. Use -h to print help\n");
+                        return EXIT_FAILURE;
+                    } else {
+                        hop_scan_ms = arg_u;
+                    }
+                } else if (strcmp(long_options[option_index].name, "sx1261") == 0) {
+                    sx1261_path = optarg;
+                } else if (strcmp(long_options[option_index].name, "duty") == 0) {
+                    duty_enable = true;
                 } else {
                     printf("ERROR: argument parsing options. Use -h to print help\n");
                     return EXIT_FAILURE;
@@ -417,6 +848,30 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Hop mode: LoRa, so that the receiver demodulates all channels at once on its multi-SF IF chains */
+    if (hop_enable == true) {
+        hop_conf.freq_hz_start = ft;
+        hop_conf.busy_ratio = hop_busy_pct / 100.0;
+        if (stream_hop_init(&hop, &hop_conf) != 0) {
+            printf("ERROR: invalid hop channels\n");
+            return EXIT_FAILURE;
+        }
+        sprintf(mod, "LORA");
+        if (sf == 0) {
+            sf = DR_LORA_SF7;
+        }
+        bw_khz = 125;
+        printf("INFO: hopping over %u channels from %u Hz, %u kHz apart (seed %u)\n", hop_conf.nb_chan, ft, hop_conf.step_hz / 1000, hop_conf.seed);
+    }
+
+    /* Duty cycle: EU868 sub-bands, each one starts with a full window of airtime */
+    if (duty_enable == true) {
+        if (lgw_duty_init(&duty, NULL) != LGW_DUTY_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        printf("INFO: EU868 sub-band duty cycles enforced\n");
+    }
+
     /* Summary of packet parameters */
     if (strcmp(mod, "CW") == 0) {
         printf("Sending %i CW on %u Hz (Freq. offset %d kHz) at %i dBm\n", nb_pkt, ft, freq_offset, rf_power);
@@ -477,6 +932,18 @@ int main(int argc, char **argv)
         }
     }
 
+    if ((hop_enable == true) && (hop_scan_ms > 0)) {
+        memset(&sx1261conf, 0, sizeof sx1261conf);
+        sx1261conf.enable = true;
+        strncpy(sx1261conf.spi_path, sx1261_path, sizeof sx1261conf.spi_path);
+        sx1261conf.spi_path[sizeof sx1261conf.spi_path - 1] = '\0'; /* ensure string termination */
+        sx1261conf.lbt_conf.enable = false;
+        if (lgw_sx1261_setconf(&sx1261conf) != LGW_HAL_SUCCESS) {
+            printf("ERROR: failed to configure sx1261\n");
+            return EXIT_FAILURE;
+        }
+    }
+
 
     //EMPEZAMOS
 
@@ -494,7 +961,24 @@ int main(int argc, char **argv)
         printf("ERROR: failed to start the gateway\n");
         return EXIT_FAILURE;
     }
-    char buffer[246];
+    char buffer[PAYLOAD_DATA_MAX];
+    uint16_t fcnt = 0;
+
+    /* Hop mode: the map is fed by our own scans on the hop grid, or by another process; our own
+       scans go to a map of their own, not to replace the map of the other processes by the hop grid */
+    if (hop_enable == true) {
+        if (hop_occ_path == NULL) {
+            hop_occ_path = (hop_scan_ms > 0) ? HOP_OCC_PATH_SCAN : LGW_OCC_PATH_DEFAULT;
+        }
+        occ_conf.freq_hz_start = hop_conf.freq_hz_start;
+        occ_conf.freq_step_hz = hop_conf.step_hz;
+        occ_conf.nb_slots = hop_conf.nb_chan;
+        occ_conf.half_life_s = HOP_HALF_LIFE_S;
+        if (lgw_occ_open(hop_occ_path, (hop_scan_ms > 0) ? &occ_conf : NULL, &hop_occ) != LGW_OCC_SUCCESS) {
+            printf("WARNING: no occupancy map at %s, no channel will be excluded\n", hop_occ_path);
+            hop_occ = NULL;
+        }
+    }
 
 
     /* Send packets */
@@ -507,6 +991,11 @@ int main(int argc, char **argv)
     pkt.no_crc = false;
     pkt.datarate = br_kbps * 1e3;
     pkt.f_dev = fdev_khz;
+    if (hop_enable == true) {
+        pkt.modulation = MOD_LORA;
+        pkt.datarate = sf;
+        pkt.coderate = CR_LORA_4_5;
+    }
     pkt.invert_pol = invert_pol;
     pkt.preamble = preamble;
     pkt.no_header = no_header;
@@ -520,9 +1009,15 @@ int main(int argc, char **argv)
     pkt.payload[7] = 0; /* FCnt */
     pkt.payload[8] = 0x02; /* FPort */
     pkt.bandwidth = BW_125KHZ;
-    pkt.payload[6] = (uint8_t)(0 >> 0); /* FCnt */
-    pkt.payload[7] = (uint8_t)(0 >> 8); /* FCnt */
 
+    if (video == true) {
+        x = send_video(&pkt, ts_latency_ms, stat_interval_s);
+        lgw_occ_close(hop_occ);
+        printf("=========== Test End ===========\n");
+        return (x == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    last_stat_us = stream_time_us();
 
     //BUCLE PRINCIPAL DE LECTURA DE STDIN:
     while((quit_sig != 1) && (exit_sig != 1)){
@@ -536,8 +1031,17 @@ int main(int argc, char **argv)
             //     pkt.payload[i+9] = buffer[i];
             // }
 
-            memcpy(pkt.payload + 9, buffer, nbytes);
-            pkt.size = 9 + nbytes;//(size == 0) ? (uint8_t)RAND_RANGE(9, 255) : size;
+            memcpy(pkt.payload + PAYLOAD_HDR_SIZE, buffer, nbytes);
+            pkt.size = PAYLOAD_HDR_SIZE + nbytes;//(size == 0) ? (uint8_t)RAND_RANGE(9, 255) : size;
+            hop_select(&pkt, fcnt);
+            pkt.payload[6] = (uint8_t)(fcnt >> 0); /* FCnt: stream sequence number, used by receivers to reorder */
+            pkt.payload[7] = (uint8_t)(fcnt >> 8); /* FCnt */
+            fcnt += 1;
+
+            /* Duty cycle: wait for the airtime of the packet on its channel */
+            if (duty_hold(&pkt) != 0) {
+                continue;
+            }
 
             // system("date +\"\%s\%3N\"");
             x = lgw_send(&pkt);
@@ -545,12 +1049,23 @@ int main(int argc, char **argv)
                 printf("ERROR: failed to send packet\n");
                 continue;
             }
+            if (duty_enable == true) {
+                lgw_duty_consume(&duty, &pkt);
+            }
             /* wait for packet to finish sending */
             do {
                 // wait_ms(1);
                 lgw_status(pkt.rf_chain, TX_STATUS, &tx_status); /* get TX status */
             } while ((tx_status != TX_FREE) && (quit_sig != 1) && (exit_sig != 1));
 
+            if (((hop_enable == true) || (duty_enable == true)) && (stat_interval_s > 0) && ((stream_time_us() - last_stat_us) >= (stat_interval_s * 1000000ULL))) {
+                if (hop_enable == true) {
+                    stream_hop_report(&hop, stdout);
+                }
+                duty_report(pkt.rf_chain);
+                last_stat_us = stream_time_us();
+            }
+
             //printf( "\nNb packets sent: %u (%u)\n", i, cnt_loop + 1 );
 
             // /* Stop the gateway */
@@ -570,6 +1085,7 @@ int main(int argc, char **argv)
             
         }
     }
+    lgw_occ_close(hop_occ);
     printf("=========== Test End ===========\n");
 
     return 0;
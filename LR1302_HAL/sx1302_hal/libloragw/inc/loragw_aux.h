@@ -25,11 +25,6 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "config.h"     /* library configuration options (dynamically generated) */
 
-/* -------------------------------------------------------------------------- */
-/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
-
-#define DEBUG_PERF 0   /* Debug timing performances: level [0..4] */
-
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC MACROS -------------------------------------------------------- */
 
@@ -101,20 +96,6 @@ uint32_t lora_packet_time_on_air( const uint8_t bw,
                                   uint32_t * nb_symbols_payload,
                                   uint16_t * t_symbol_us);
 
-/**
-@brief Record the current time, for measure start
-@param tm Pointer to the current time value
-*/
-void _meas_time_start(struct timeval *tm);
-
-/**
-@brief Measure the ellapsed time since given time
-@param debug_level  debug print debug level to be used
-@param start_time   start time of the measure to be used
-@param str          string to be used for debug print
-*/
-void _meas_time_stop(int debug_level, struct timeval start_time, const char *str);
-
 /**
 @brief Get the current time for later timeout check
 @param start contains the current time to be used as start time for timeout
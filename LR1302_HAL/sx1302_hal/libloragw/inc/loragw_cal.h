@@ -54,6 +54,31 @@ struct lgw_sx125x_cal_tx_result_s {
 
 int sx1302_cal_start(uint8_t version, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut);
 
+/**
+@brief Restore the sx125x calibration results saved by sx1302_cal_cache_save()
+@param path calibration cache file
+@param eui concentrator chip EUI
+@param clksrc RF chain providing the clock to the concentrator
+@param rf_chain_cfg RF chains configuration
+@param txgain_lut TX gain LUTs, their DC offsets are filled on success
+@param temperature current board temperature in degrees C
+@param temp_drift maximum difference with the calibration temperature, in degrees C
+@return LGW_HAL_SUCCESS if the results were applied, LGW_HAL_ERROR if a calibration is needed
+*/
+int sx1302_cal_cache_load(const char * path, uint64_t eui, uint8_t clksrc, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut, float temperature, float temp_drift);
+
+/**
+@brief Save the results of the last sx1302_cal_start()
+@param path calibration cache file, replaced atomically
+@param eui concentrator chip EUI
+@param clksrc RF chain providing the clock to the concentrator
+@param rf_chain_cfg RF chains configuration
+@param txgain_lut calibrated TX gain LUTs
+@param temperature board temperature during the calibration, in degrees C
+@return LGW_HAL_SUCCESS on success, LGW_HAL_ERROR otherwise
+*/
+int sx1302_cal_cache_save(const char * path, uint64_t eui, uint8_t clksrc, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut, float temperature);
+
 #endif
 
 /* --- EOF ------------------------------------------------------------------ */
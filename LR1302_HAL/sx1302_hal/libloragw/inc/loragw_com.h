@@ -41,6 +41,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 typedef enum com_type_e {
     LGW_COM_SPI,
     LGW_COM_USB,
+    LGW_COM_SIM,
     LGW_COM_UNKNOWN
 } lgw_com_type_t;
 
@@ -84,7 +85,8 @@ int lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t
 int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size);
 
 /**
- *
+@brief Burst read. In bulk mode (USB), the read is queued with the writes and
+@brief data is only filled by lgw_com_flush(); on SPI, it is filled right away.
 */
 int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
 
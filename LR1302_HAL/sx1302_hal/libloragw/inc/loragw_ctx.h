@@ -0,0 +1,105 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Internal state of one concentrator, shared by the HAL, register and
+    communication layers (not part of the public API).
+
+    Each module used to keep its state in file scope variables, so that a
+    process could only drive one board. It is now gathered in a lgw_ctx_t,
+    and the modules reach the context selected by the calling thread through
+    lgw_ctx_cur(). Threads which never call lgw_ctx_select() use the default
+    context, which is what the legacy API operates on.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_CTX_H
+#define _LORAGW_CTX_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+#include <sys/time.h>   /* timeval */
+
+#include "loragw_hal.h"
+#include "loragw_com.h"
+#include "loragw_mcu.h"
+#include "loragw_sx1302_rx.h"
+#include "loragw_sx1302_timestamp.h"
+
+#include "config.h"     /* library configuration options (dynamically generated) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct lgw_ctx_s
+@brief State of one concentrator, one field per module owning it
+*/
+struct lgw_ctx_s {
+    /* loragw_hal */
+    lgw_context_t           hal;                /*!> configuration provided by the user */
+    FILE *                  log_file;           /*!> debug log */
+    int                     ts_fd;              /*!> I2C temperature sensor */
+    uint8_t                 ts_addr;
+    int                     ad_fd;              /*!> I2C AD5338R */
+    /* loragw_com, loragw_usb, loragw_mcu */
+    lgw_com_type_t          com_type;
+    void *                  com_target;         /*!> SPI or USB device handle */
+    lgw_com_write_mode_t    write_mode;
+    uint8_t                 spi_req_nb;
+    spi_req_bulk_t          spi_bulk_buffer;
+    mcu_pipe_t *            mcu_pipe;           /*!> ACK reader thread, NULL if not started */
+    mcu_req_t               mcu_bulk_req;       /*!> write-only bulk in flight, see mcu_spi_flush() */
+    bool                    mcu_bulk_pending;
+    uint8_t                 mcu_bulk_inflight[LGW_USB_BURST_CHUNK]; /*!> its requests, then its ACK */
+    uint8_t                 mcu_req_id;         /*!> ID of the next MCU request */
+    /* sx1261_com, sx1261_usb */
+    lgw_com_type_t          sx1261_com_type;
+    void *                  sx1261_com_target;
+    lgw_com_write_mode_t    sx1261_write_mode;
+    uint8_t                 sx1261_spi_req_nb;
+    /* loragw_sx1302, loragw_sx1302_timestamp */
+    rx_buffer_t             rx_buffer;
+    timestamp_counter_t     counter_us;
+    bool                    fw_check_strict;
+    struct timestamp_pps_history_s timestamp_pps_history;
+    /* loragw_lbt */
+    bool                    lbt_parked;         /*!> SX1261 left scanning a TX channel */
+    uint32_t                lbt_freq_hz;        /*!> channel it is scanning */
+    uint8_t                 lbt_bandwidth;
+    struct timeval          lbt_scan_start;     /*!> start of its last scan */
+    /* loragw_cal */
+    int8_t                  rf_rx_image_amp[LGW_RF_CHAIN_NB];
+    int8_t                  rf_rx_image_phi[LGW_RF_CHAIN_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+extern lgw_ctx_t lgw_ctx_default;           /* context of the legacy API */
+extern __thread lgw_ctx_t * lgw_ctx_tls;    /* context selected by the calling thread */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Get the context of the calling thread
+@return the context selected by lgw_ctx_select(), or the default one
+*/
+static inline lgw_ctx_t * lgw_ctx_cur(void) {
+    return lgw_ctx_tls;
+}
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,175 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator regulatory duty cycle accounting
+
+    The airtime of the transmitted packets, as given by lgw_duty_airtime_us()
+    (rounded up to the microsecond for LoRa, to the millisecond for FSK), is
+    accounted per (sub-band, RF chain) over a sliding observation window. A
+    packet can be sent when the airtime of the window plus its own time on air
+    stays within the duty cycle of its sub-band, and among several candidate
+    frequencies the one whose sub-band has the most airtime left can be
+    picked, to spread the traffic over the sub-bands and maximize the legal
+    throughput.
+
+    The window is kept as a ring of LGW_DUTY_SLICE_NB + 1 slices of
+    window_s / LGW_DUTY_SLICE_NB: a packet counts in the slice it starts in
+    until that slice is entirely out of the window. The airtime over any window
+    thus never exceeds the duty cycle, at the cost of waiting up to one slice
+    longer than strictly needed.
+    Frequencies out of all sub-bands are not regulated and always allowed.
+
+    A context is not protected against concurrent accesses, it must be used
+    from a single thread or under a lock of the caller.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_DUTY_H
+#define _LORAGW_DUTY_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_DUTY_SUCCESS        0
+#define LGW_DUTY_ERROR          -1
+
+#define LGW_DUTY_BAND_NB_MAX    12
+#define LGW_DUTY_WINDOW_S       3600    /* default observation window (ETSI EN 300 220: 1 hour) */
+#define LGW_DUTY_SLICE_NB       60      /* number of slices the window is accounted in */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct lgw_duty_band_s
+@brief Regulated sub-band
+*/
+struct lgw_duty_band_s {
+    uint32_t    freq_hz_min;    /*!> lowest frequency of the sub-band */
+    uint32_t    freq_hz_max;    /*!> highest frequency of the sub-band */
+    uint32_t    duty_ppm;       /*!> duty cycle, in parts per million (10000 for 1%) */
+};
+
+/**
+@struct lgw_duty_conf_s
+@brief Regulated sub-bands and observation window
+*/
+struct lgw_duty_conf_s {
+    uint8_t                 nb_band;    /*!> number of sub-bands [1..LGW_DUTY_BAND_NB_MAX] */
+    struct lgw_duty_band_s  band[LGW_DUTY_BAND_NB_MAX];
+    uint32_t                window_s;   /*!> observation window */
+};
+
+/**
+@struct lgw_duty_bucket_s
+@brief Airtime account of a (sub-band, RF chain)
+*/
+struct lgw_duty_bucket_s {
+    uint64_t    slice_us[LGW_DUTY_SLICE_NB + 1]; /*!> airtime started in each slice, indexed by slice number modulo the ring size */
+    uint64_t    slice;          /*!> number of the newest slice */
+    uint64_t    used_us;        /*!> airtime of the window, sum of the slices */
+    /* statistics */
+    uint64_t    airtime_us;     /*!> airtime consumed */
+    uint32_t    nb_denied;      /*!> packets found over the duty cycle */
+};
+
+/**
+@struct lgw_duty_s
+@brief Duty cycle accounting context
+*/
+struct lgw_duty_s {
+    struct lgw_duty_conf_s      conf;
+    uint64_t                    slice_len_us;   /*!> length of a slice, window_s / LGW_DUTY_SLICE_NB rounded up */
+    struct lgw_duty_bucket_s    bucket[LGW_DUTY_BAND_NB_MAX][LGW_RF_CHAIN_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a duty cycle accounting context, no airtime used
+@param ctx context to be initialized
+@param conf sub-bands and window, NULL for the EU868 plan (ETSI EN 300 220 / ERC REC 70-03)
+@return status of operation (LGW_DUTY_SUCCESS/LGW_DUTY_ERROR)
+*/
+int lgw_duty_init(struct lgw_duty_s * ctx, const struct lgw_duty_conf_s * conf);
+
+/**
+@brief Get the sub-band of a frequency
+@param ctx duty cycle accounting context
+@param freq_hz frequency
+@return the sub-band index, -1 if the frequency is not regulated
+*/
+int lgw_duty_band(const struct lgw_duty_s * ctx, uint32_t freq_hz);
+
+/**
+@brief Get the airtime left on a frequency
+@param ctx duty cycle accounting context
+@param freq_hz frequency
+@param rf_chain RF chain
+@param remaining_us pointer to the airtime left, 0 when over the duty cycle, UINT32_MAX if not regulated
+@return status of operation (LGW_DUTY_SUCCESS/LGW_DUTY_ERROR)
+*/
+int lgw_duty_remaining(struct lgw_duty_s * ctx, uint32_t freq_hz, uint8_t rf_chain, uint32_t * remaining_us);
+
+/**
+@brief Get the airtime a packet is accounted for, rounded up so that it is never under-counted
+@param pkt packet
+@return the time on air in microseconds, 0 if pkt is NULL
+*/
+uint32_t lgw_duty_airtime_us(const struct lgw_pkt_tx_s * pkt);
+
+/**
+@brief Check if a packet can be sent now without exceeding the duty cycle
+@param ctx duty cycle accounting context
+@param pkt packet to be sent
+@param wait_us pointer to the time to wait before the packet can be sent, 0 if it can be sent now,
+       UINT32_MAX if it is longer than the window allows
+@return status of operation (LGW_DUTY_SUCCESS/LGW_DUTY_ERROR)
+*/
+int lgw_duty_check(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt, uint32_t * wait_us);
+
+/**
+@brief Account for a packet sent, even if over the duty cycle (its window is then full until enough airtime leaves it)
+@param ctx duty cycle accounting context
+@param pkt packet sent
+@return status of operation (LGW_DUTY_SUCCESS/LGW_DUTY_ERROR)
+*/
+int lgw_duty_consume(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt);
+
+/**
+@brief Count a packet found over the duty cycle in the statistics of its bucket
+@param ctx duty cycle accounting context
+@param pkt packet not sent
+*/
+void lgw_duty_deny(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt);
+
+/**
+@brief Pick the candidate frequency with the most airtime left for the next packet
+@param ctx duty cycle accounting context
+@param rf_chain RF chain the packet will be sent on
+@param freq_hz candidate frequencies
+@param nb_freq number of candidates
+@param toa_us time on air of the packet
+@return the index of the candidate, -1 if none has enough airtime left
+*/
+int lgw_duty_pick(struct lgw_duty_s * ctx, uint8_t rf_chain, const uint32_t * freq_hz, int nb_freq, uint32_t toa_us);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
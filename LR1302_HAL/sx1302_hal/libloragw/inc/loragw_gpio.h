@@ -0,0 +1,67 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    In-process reset of the concentrator through the Linux GPIO character
+    device, same sequence as tools/reset_lgw.sh without forking a shell.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_GPIO_H
+#define _LORAGW_GPIO_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+#include "config.h"     /* library configuration options (dynamically generated) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_GPIO_SUCCESS    0
+#define LGW_GPIO_ERROR      -1
+
+#define LGW_GPIO_CHIP_DEFAULT   "/dev/gpiochip0"
+
+/* GPIO mapping of the CoreCell, as in reset_lgw.sh: has to be adapted with HW */
+#define LGW_GPIO_SX1302_RESET       17  /* SX1302 reset */
+#define LGW_GPIO_SX1302_POWER_EN    18  /* SX1302 power enable */
+#define LGW_GPIO_SX1261_RESET       5   /* SX1261 reset (LBT / Spectral Scan) */
+#define LGW_GPIO_AD5338R_RESET      13  /* AD5338R reset (full-duplex CN490 reference design) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Request the reset and power enable lines of the concentrator as outputs
+@param path path of the GPIO chip device (NULL for LGW_GPIO_CHIP_DEFAULT)
+@return LGW_GPIO_SUCCESS if the lines are owned by the process, LGW_GPIO_ERROR else
+
+The lines stay owned by the process until lgw_gpio_close() is called, no other
+process (reset_lgw.sh...) can use them meanwhile.
+*/
+int lgw_gpio_open(const char * path);
+
+/**
+@brief Power the concentrator and pulse the reset lines (reset_lgw.sh start)
+@return LGW_GPIO_SUCCESS if the sequence was applied, LGW_GPIO_ERROR else
+*/
+int lgw_gpio_reset(void);
+
+/**
+@brief Release the lines
+@return LGW_GPIO_SUCCESS if the lines were released, LGW_GPIO_ERROR else
+*/
+int lgw_gpio_close(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
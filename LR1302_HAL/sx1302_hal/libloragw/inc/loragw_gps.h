@@ -23,6 +23,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define _GNU_SOURCE
 #include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
 #include <time.h>       /* time library */
 #include <termios.h>    /* speed_t */
 #include <unistd.h>     /* ssize_t */
@@ -92,6 +93,36 @@ enum gps_msg {
 #define LGW_GPS_UBX_SYNC_CHAR     (0xB5)
 #define LGW_GPS_NMEA_SYNC_CHAR    (0x24)
 
+#define LGW_GPS_STREAM_SIZE       (512) /* ring buffer of the stream parser, must be a power of 2 */
+#define LGW_GPS_NMEA_FIELDS_MAX   (30)  /* fields of a NMEA sentence, label included */
+
+/**
+@struct lgw_gps_stream_s
+@brief Incremental UBX/NMEA parser, fed with the bytes read on the GPS tty
+
+The bytes are parsed one at a time as they arrive, the UBX checksum and the
+NMEA XOR are computed on the fly, and the fields of interest are decoded in
+place from the ring buffer once the last byte of a frame has been checked.
+Positions are free running counters, the ring index is (pos % LGW_GPS_STREAM_SIZE).
+*/
+struct lgw_gps_stream_s {
+    uint8_t     ring[LGW_GPS_STREAM_SIZE];  /*!> received bytes */
+    uint32_t    wr;             /*!> position of the next byte to be received */
+    uint32_t    rd;             /*!> position of the next byte to be parsed */
+    uint32_t    start;          /*!> position of the first byte still needed for decoding */
+    bool        keep;           /*!> the bytes from start must not be overwritten */
+    int         state;          /*!> parser state */
+    uint8_t     ck_a;           /*!> UBX Fletcher checksum (A), or NMEA XOR checksum */
+    uint8_t     ck_b;           /*!> UBX Fletcher checksum (B) */
+    uint8_t     ck_rcv;         /*!> NMEA checksum received */
+    uint8_t     ubx_class;      /*!> UBX message class */
+    uint8_t     ubx_id;         /*!> UBX message ID */
+    uint16_t    ubx_len;        /*!> UBX payload length */
+    uint16_t    ubx_todo;       /*!> UBX payload bytes still to be received */
+    int         nb_fields;      /*!> NMEA fields found so far */
+    uint32_t    field[LGW_GPS_NMEA_FIELDS_MAX + 2]; /*!> position of the NMEA fields, then end of the last field + 1 */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
 
@@ -143,6 +174,46 @@ lock must be acquired before calling either function.
 */
 enum gps_msg lgw_parse_ubx(const char* serial_buff, size_t buff_size, size_t *msg_size);
 
+/**
+@brief Reset a stream parser
+
+@param stream pointer to the stream parser
+*/
+void lgw_gps_stream_init(struct lgw_gps_stream_s *stream);
+
+/**
+@brief Read the bytes available on the GPS tty, directly into the stream ring buffer
+
+@param stream pointer to the stream parser
+@param fd file descriptor on GPS tty
+@return number of bytes read, or the read() error (-1) or end of file (0)
+*/
+ssize_t lgw_gps_stream_read(struct lgw_gps_stream_s *stream, int fd);
+
+/**
+@brief Copy bytes received by other means into the stream ring buffer
+
+@param stream pointer to the stream parser
+@param data pointer to the bytes received
+@param size number of bytes received
+@return number of bytes copied, less than size if the ring buffer is full
+*/
+size_t lgw_gps_stream_write(struct lgw_gps_stream_s *stream, const uint8_t *data, size_t size);
+
+/**
+@brief Parse the bytes received so far, up to the end of the next frame
+
+@param stream pointer to the stream parser
+@return type of frame parsed, UNKNOWN when all bytes received have been parsed
+
+Must be called until it returns UNKNOWN after each read. A frame is reported as
+soon as its last byte is parsed: UBX_NAV_TIMEGPS, UBX_NAV_TIMEUTC, NMEA_RMC and
+NMEA_GGA are decoded to the global set of variables shared with lgw_gps_get,
+as lgw_parse_ubx/lgw_parse_nmea do, other frames are IGNORED, corrupted ones
+are INVALID and the parser resynchronizes on the next sync char.
+*/
+enum gps_msg lgw_gps_stream_next(struct lgw_gps_stream_s *stream);
+
 /**
 @brief Get the GPS solution (space & time) for the concentrator
 
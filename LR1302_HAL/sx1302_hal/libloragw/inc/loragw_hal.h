@@ -291,6 +291,16 @@ struct lgw_tx_gain_lut_s {
     uint8_t                 size;                       /*!> Number of LUT indexes */
 };
 
+/**
+@struct lgw_conf_cal_s
+@brief Configuration structure for the radio calibration cache
+*/
+struct lgw_conf_cal_s {
+    bool    cache_enable;       /*!> reuse the results of a previous calibration when still valid */
+    char    cache_path[128];    /*!> file holding the calibration results */
+    float   temp_drift;         /*!> recalibrate when the temperature moved by more than this, in degrees C */
+};
+
 /**
 @struct lgw_conf_debug_s
 @brief Configuration structure for debug
@@ -304,6 +314,7 @@ struct lgw_conf_debug_s {
     uint8_t                     nb_ref_payload;
     struct conf_ref_payload_s   ref_payload[16];
     char log_file_name[128];
+    bool                        fw_check_strict;    /*!> read back the whole AGC/ARB firmware after loading */
 };
 
 /**
@@ -352,6 +363,8 @@ struct lgw_conf_lbt_s {
     int8_t                      rssi_target;        /*!> RSSI threshold to detect if channel is busy or not (dBm) */
     uint8_t                     nb_channel;         /*!> number of LBT channels */
     struct lgw_conf_chan_lbt_s  channels[LGW_LBT_CHANNEL_NB_MAX];  /*!> LBT channels configuration */
+    uint16_t                    hold_ms;            /*!> keep the SX1261 scanning the TX channel between packets, and reuse
+                                                         its clear-channel result for that long, 0 to scan before each packet */
 };
 
 /**
@@ -384,10 +397,18 @@ typedef struct lgw_context_s {
     /* Misc */
     struct lgw_conf_ftime_s     ftime_cfg;
     struct lgw_conf_sx1261_s    sx1261_cfg;
+    struct lgw_conf_cal_s       cal_cfg;
     /* Debug */
     struct lgw_conf_debug_s     debug_cfg;
 } lgw_context_t;
 
+/**
+@struct lgw_ctx_s
+@brief Handle on one concentrator: its configuration context and the state of
+its drivers (opaque, see lgw_ctx_new)
+*/
+typedef struct lgw_ctx_s lgw_ctx_t;
+
 /**
 @struct lgw_spectral_scan_status_t
 @brief Spectral Scan status
@@ -426,6 +447,13 @@ int lgw_rxrf_setconf(uint8_t rf_chain, struct lgw_conf_rxrf_s * conf);
 */
 int lgw_rxif_setconf(uint8_t if_chain, struct lgw_conf_rxif_s * conf);
 
+/**
+@brief Change the datarate of the FSK IF chain while the concentrator is running
+@param datarate new FSK datarate in bps [DR_FSK_MIN, DR_FSK_MAX]
+@return LGW_HAL_ERROR id the operation failed, LGW_HAL_SUCCESS else
+*/
+int lgw_rxif_set_fsk_datarate(uint32_t datarate);
+
 /**
 @brief Configure LoRa/FSK demodulators
 @param conf structure containing the configuration parameters
@@ -454,6 +482,16 @@ int lgw_ftime_setconf(struct lgw_conf_ftime_s * conf);
 */
 int lgw_sx1261_setconf(struct lgw_conf_sx1261_s * conf);
 
+/**
+@brief Configure the radio calibration cache (must configure before start)
+@param conf pointer to structure defining the config to be applied
+@return LGW_HAL_ERROR id the operation failed, LGW_HAL_SUCCESS else
+
+The cache is keyed on the chip EUI, the radio types and frequencies and the TX
+gains to be calibrated. It only applies to sx125x radios.
+*/
+int lgw_cal_setconf(struct lgw_conf_cal_s * conf);
+
 /**
 @brief Configure the debug context
 @param conf pointer to structure defining the config to be applied
@@ -591,6 +629,62 @@ int lgw_spectral_scan_get_results(int16_t levels_dbm[static LGW_SPECTRAL_SCAN_RE
 */
 int lgw_spectral_scan_abort();
 
+/**
+@brief Create the handle of an additional concentrator
+@return pointer to the new handle, NULL if the allocation failed
+
+The handle holds the same defaults as a freshly loaded library. It has to be
+configured and started like the default concentrator, either with the lgw_ctx_
+functions or with the legacy API after a lgw_ctx_select().
+*/
+lgw_ctx_t * lgw_ctx_new(void);
+
+/**
+@brief Release a handle created by lgw_ctx_new
+@param ctx handle to be released, the concentrator must be stopped
+
+The handle must not be selected by any thread any more.
+*/
+void lgw_ctx_free(lgw_ctx_t * ctx);
+
+/**
+@brief Select the concentrator the legacy API of the calling thread applies to
+@param ctx handle of the concentrator, NULL for the default one
+@return the handle which was selected before, to be restored if needed
+
+The selection is per thread, so that each thread can drive its own board
+without any lock. Threads which never call this function, and applications
+written for a single board, use the default concentrator.
+*/
+lgw_ctx_t * lgw_ctx_select(lgw_ctx_t * ctx);
+
+/**
+@brief Same as the legacy functions, applied to the concentrator of handle ctx
+@return LGW_HAL_ERROR if ctx is NULL, the result of the legacy function else
+
+The handle is selected for the duration of the call only, and the selection
+of the calling thread is restored afterwards.
+*/
+int lgw_ctx_board_setconf(lgw_ctx_t * ctx, struct lgw_conf_board_s * conf);
+int lgw_ctx_rxrf_setconf(lgw_ctx_t * ctx, uint8_t rf_chain, struct lgw_conf_rxrf_s * conf);
+int lgw_ctx_rxif_setconf(lgw_ctx_t * ctx, uint8_t if_chain, struct lgw_conf_rxif_s * conf);
+int lgw_ctx_demod_setconf(lgw_ctx_t * ctx, struct lgw_conf_demod_s * conf);
+int lgw_ctx_txgain_setconf(lgw_ctx_t * ctx, uint8_t rf_chain, struct lgw_tx_gain_lut_s * conf);
+int lgw_ctx_ftime_setconf(lgw_ctx_t * ctx, struct lgw_conf_ftime_s * conf);
+int lgw_ctx_sx1261_setconf(lgw_ctx_t * ctx, struct lgw_conf_sx1261_s * conf);
+int lgw_ctx_cal_setconf(lgw_ctx_t * ctx, struct lgw_conf_cal_s * conf);
+int lgw_ctx_debug_setconf(lgw_ctx_t * ctx, struct lgw_conf_debug_s * conf);
+int lgw_ctx_start(lgw_ctx_t * ctx);
+int lgw_ctx_stop(lgw_ctx_t * ctx);
+int lgw_ctx_receive(lgw_ctx_t * ctx, uint8_t max_pkt, struct lgw_pkt_rx_s * pkt_data);
+int lgw_ctx_send(lgw_ctx_t * ctx, struct lgw_pkt_tx_s * pkt_data);
+int lgw_ctx_status(lgw_ctx_t * ctx, uint8_t rf_chain, uint8_t select, uint8_t * code);
+int lgw_ctx_abort_tx(lgw_ctx_t * ctx, uint8_t rf_chain);
+int lgw_ctx_get_trigcnt(lgw_ctx_t * ctx, uint32_t * trig_cnt_us);
+int lgw_ctx_get_instcnt(lgw_ctx_t * ctx, uint32_t * inst_cnt_us);
+int lgw_ctx_get_eui(lgw_ctx_t * ctx, uint64_t * eui);
+int lgw_ctx_get_temperature(lgw_ctx_t * ctx, float * temperature);
+
 #endif
 
 /* --- EOF ------------------------------------------------------------------ */
@@ -47,11 +47,22 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 int lgw_lbt_start(const struct lgw_conf_sx1261_s * sx1261_context, const struct lgw_pkt_tx_s * pkt);
 
 /**
-@brief Stop LBT scanning
+@brief Stop LBT scanning after a packet, unless the SX1261 is kept on the channel (hold_ms)
 @return 0 for success, -1 for failure
 */
 int lgw_lbt_stop(void);
 
+/**
+@brief Stop LBT scanning, even if the SX1261 is kept on a channel
+@return 0 for success, -1 for failure
+*/
+int lgw_lbt_release(void);
+
+/**
+@brief Discard the scan the SX1261 was kept on, when it is used for something else
+*/
+void lgw_lbt_forget(void);
+
 /**
 @brief Check if packet was allowed to be transmitted or not
 @param rf_chain the TX path on which TX was requested
@@ -22,6 +22,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
 #include <stdint.h>   /* C99 types*/
+#include <stdbool.h>  /* bool type */
+#include <stddef.h>   /* size_t */
+#include <sys/uio.h>  /* iovec */
 
 #include "config.h"   /* library configuration options (dynamically generated) */
 
@@ -35,9 +38,47 @@ static const char mcu_version_string[] = "01.00.00";
 
 #define LGW_USB_BURST_CHUNK ( 4096 )
 
+#define LGW_USB_BULK_READ_MAX ( 32 ) /* max number of read requests queued in bulk mode */
+
+#define HEADER_CMD_SIZE 4
+
+#define MCU_PIPE_DEPTH ( 8 )        /* max number of requests waiting for their ACK */
+#define MCU_ACK_TIMEOUT_MS ( 1000 ) /* max time to wait for an ACK, once pipelined */
+#define MCU_REQ_IOV_MAX ( 2 )       /* max number of buffers of a request payload or ACK */
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC TYPES --------------------------------------------------------- */
 
+typedef struct mcu_pipe_s mcu_pipe_t;
+
+/**
+@struct mcu_req_s
+@brief A request sent to the MCU, to be given to mcu_req_wait() to get its ACK
+*/
+typedef struct mcu_req_s {
+    uint8_t id;                     /*!> request ID, echoed in the ACK */
+    uint8_t hdr[HEADER_CMD_SIZE];   /*!> ACK header */
+    struct iovec ack[MCU_REQ_IOV_MAX]; /*!> buffers receiving the ACK payload, the excess is dropped */
+    int ack_iovcnt;                 /*!> number of ACK buffers */
+    int ack_len;                    /*!> size of the ACK payload received, -1 on error */
+    bool claimed;                   /*!> ACK payload being read by the reader thread */
+    bool done;
+} mcu_req_t;
+
+typedef struct spi_req_read_s {
+    uint8_t req_idx;    /* position of the read request in the bulk buffer */
+    uint16_t size;      /* number of bytes read */
+    uint8_t * data;     /* where to copy the bytes read when the ACK is received */
+} spi_req_read_t;
+
+typedef struct spi_req_bulk_s {
+    uint16_t size;
+    uint8_t nb_req;
+    uint8_t buffer[LGW_USB_BURST_CHUNK];
+    uint8_t nb_read;
+    spi_req_read_t read[LGW_USB_BULK_READ_MAX];
+} spi_req_bulk_t;
+
 typedef enum order_id_e
 {
     ORDER_ID__REQ_PING            = 0x00,
@@ -181,12 +222,122 @@ SPI answer when the function exits.
 int mcu_spi_write(int fd, uint8_t * in_out_buf, size_t buf_size);
 
 /**
- *
+@brief Send a single SX1302 read/write SPI request to the MCU, without copying the data
+@param fd File descriptor of the device used to access the MCU
+@param hdr The request metadata and SPI header (r/w, target mux), overwritten by
+the ACK metadata and SPI header when the function exits
+@param hdr_size The size of the header
+@param tx The bytes to be written (dummy bytes for a read)
+@param rx The buffer receiving the bytes read, may be tx, NULL for a write
+@param size The number of bytes written or read
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_spi_transfer(int fd, uint8_t * hdr, uint16_t hdr_size, const uint8_t * tx, uint8_t * rx, uint16_t size);
+
+/**
+@brief Store a SX1302 SPI request in the bulk buffer, to be sent by mcu_spi_flush()
+@param in_out_buf The request, with the SPI header (r/w, target mux)
+@param buf_size The size of the request
+@return 0 for SUCCESS, -1 for failure
 */
 int mcu_spi_store(uint8_t * in_out_buf, size_t buf_size);
 
 /**
- *
+@brief Store a SX1302 write SPI request in the bulk buffer
+@param hdr The request metadata and SPI header (r/w, target mux)
+@param hdr_size The size of the header
+@param data The bytes to be written
+@param size The number of bytes written
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_spi_store_write(const uint8_t * hdr, uint16_t hdr_size, const uint8_t * data, uint16_t size);
+
+/**
+@brief Start a thread reading the ACKs of the MCU, so that several requests
+@brief can be in flight. Without it, requests are sent and acknowledged one by one.
+@param fd File descriptor of the device used to access the MCU
+@return 0 for SUCCESS (including when the MCU does not support it), -1 for failure
+*/
+int mcu_pipe_start(int fd);
+
+/**
+@brief Stop the thread started by mcu_pipe_start(), requests in flight fail
+*/
+void mcu_pipe_stop(void);
+
+/**
+@brief Send a request to the MCU without waiting for its ACK
+@param fd File descriptor of the device used to access the MCU
+@param req The request handle, to be kept until mcu_req_wait() returns
+@param cmd The request type
+@param payload The request payload, may be reused as soon as the function returns
+@param payload_size The size of the payload
+@param ack The buffer receiving the ACK payload
+@param ack_size The size of the ACK buffer
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_req_submit(int fd, mcu_req_t * req, order_id_t cmd, const uint8_t * payload, uint16_t payload_size, uint8_t * ack, size_t ack_size);
+
+/**
+@brief Same as mcu_req_submit(), the payload is gathered from several buffers and
+@brief the ACK payload is scattered to several buffers, without intermediate copy
+@param fd File descriptor of the device used to access the MCU
+@param req The request handle, to be kept until mcu_req_wait() returns
+@param cmd The request type
+@param payload The payload buffers, may be reused as soon as the function returns
+@param payload_cnt The number of payload buffers, up to MCU_REQ_IOV_MAX
+@param ack The buffers receiving the ACK payload, to be kept until mcu_req_wait() returns
+@param ack_cnt The number of ACK buffers, up to MCU_REQ_IOV_MAX
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_req_submitv(int fd, mcu_req_t * req, order_id_t cmd, const struct iovec * payload, int payload_cnt, const struct iovec * ack, int ack_cnt);
+
+/**
+@brief Wait for the ACK of a request. Without the reader thread, the requests
+@brief must be waited for in the order they were submitted.
+@param fd File descriptor of the device used to access the MCU
+@param req The request handle given to mcu_req_submit()
+@return the size of the ACK payload (may exceed the ACK buffers), -1 for failure
+*/
+int mcu_req_wait(int fd, mcu_req_t * req);
+
+/**
+@brief Send a SX1302 read/write SPI request to the MCU without waiting for its ACK
+@param fd File descriptor of the device used to access the MCU
+@param req The request handle, to be given to mcu_spi_write_wait()
+@param in_out_buf As for mcu_spi_write(), holds the answer after mcu_spi_write_wait()
+@param buf_size The size of the given input/output buffer
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_spi_write_submit(int fd, mcu_req_t * req, uint8_t * in_out_buf, size_t buf_size);
+
+/**
+@brief Wait for the answer of a request sent by mcu_spi_write_submit()
+@param fd File descriptor of the device used to access the MCU
+@param req The request handle
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_spi_write_wait(int fd, mcu_req_t * req);
+
+/**
+@brief Store a SX1302 read SPI request in the bulk buffer
+@param hdr The request metadata and SPI header (r/w, target mux)
+@param hdr_size The size of the header
+@param data The buffer receiving the bytes read, only valid after mcu_spi_flush(),
+its content is sent as dummy bytes
+@param size The number of bytes read
+@return 0 for SUCCESS, -1 for failure
+*/
+int mcu_spi_store_read(const uint8_t * hdr, uint16_t hdr_size, uint8_t * data, uint16_t size);
+
+/**
+@brief Send the requests stored in the bulk buffer to the MCU, in one transaction
+@brief The results of the stored read requests are copied to the buffers given
+@brief to mcu_spi_store_read(). With the reader thread, a bulk without read
+@brief requests is not waited for: its ACK is checked by the next request, and
+@brief a failure is reported by that request
+@param fd File descriptor of the device used to access the MCU
+@return 0 for SUCCESS, -1 for failure
 */
 int mcu_spi_flush(int fd);
 
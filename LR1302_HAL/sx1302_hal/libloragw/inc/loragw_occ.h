@@ -0,0 +1,139 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator spectrum occupancy map
+
+    The RSSI histograms given by the SX1261 spectral scan are accumulated in a
+    memory-mapped file, one slot per channel of a regular grid. Each slot holds
+    the exponentially decayed distribution of the RSSI (as the probability to
+    measure a level above each histogram threshold) and the time of its last
+    update. The writer (spectral scan) updates a slot under a seqlock, so that
+    any number of readers, in this process or in others mapping the same file,
+    get a consistent copy without any lock, and the busy ratio of a channel for
+    a given threshold is a constant time lookup.
+
+    A map is never resized in place: when the grid changes, a new file is
+    built aside and renamed over the previous one, so the processes which had
+    mapped the previous file keep reading it safely until they open the map
+    again.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_OCC_H
+#define _LORAGW_OCC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_OCC_SUCCESS     0
+#define LGW_OCC_ERROR       -1
+
+#define LGW_OCC_PATH_DEFAULT    "/dev/shm/loragw_occ"
+#define LGW_OCC_NB_BINS         LGW_SPECTRAL_SCAN_RESULT_SIZE
+#define LGW_OCC_BIN_DB          4       /* dB between 2 thresholds of the sx1261 histogram */
+#define LGW_OCC_HALF_LIFE_S     600     /* default weight half-life of a scan result */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+typedef struct lgw_occ_s lgw_occ_t;
+
+/**
+@struct lgw_occ_conf_s
+@brief Channel grid of an occupancy map
+*/
+struct lgw_occ_conf_s {
+    uint32_t    freq_hz_start;  /*!> frequency of the first slot */
+    uint32_t    freq_step_hz;   /*!> frequency between 2 slots */
+    uint16_t    nb_slots;       /*!> number of slots */
+    uint32_t    half_life_s;    /*!> time for the weight of a scan result to be halved */
+};
+
+/**
+@struct lgw_occ_slot_s
+@brief Copy of a slot of an occupancy map
+*/
+struct lgw_occ_slot_s {
+    uint32_t    freq_hz;        /*!> center frequency of the slot */
+    uint32_t    nb_updates;     /*!> number of scan results accumulated, 0 if never scanned */
+    uint64_t    ts_ns;          /*!> time of the last update (CLOCK_REALTIME) */
+    int16_t     level_dbm;      /*!> highest threshold, the next ones are LGW_OCC_BIN_DB apart */
+    float       above[LGW_OCC_NB_BINS]; /*!> probability to measure an RSSI above each threshold, the last one is 1 */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Map an occupancy map
+@param path path of the file, NULL for LGW_OCC_PATH_DEFAULT
+@param conf channel grid, to create (or reuse if it matches) the map and update it,
+       NULL to map an existing one read-only
+@param occ pointer to the handle of the map
+@return status of operation (LGW_OCC_SUCCESS/LGW_OCC_ERROR)
+*/
+int lgw_occ_open(const char * path, const struct lgw_occ_conf_s * conf, lgw_occ_t ** occ);
+
+/**
+@brief Unmap an occupancy map, the file is kept
+@param occ handle of the map
+@return status of operation (LGW_OCC_SUCCESS/LGW_OCC_ERROR)
+*/
+int lgw_occ_close(lgw_occ_t * occ);
+
+/**
+@brief Get the channel grid of an occupancy map
+@param occ handle of the map
+@param conf pointer to the channel grid to be filled
+@return status of operation (LGW_OCC_SUCCESS/LGW_OCC_ERROR)
+*/
+int lgw_occ_get_conf(const lgw_occ_t * occ, struct lgw_occ_conf_s * conf);
+
+/**
+@brief Accumulate a spectral scan result in the slot of a frequency
+@param occ handle of the map, opened with a conf
+@param freq_hz frequency scanned
+@param levels_dbm thresholds of the histogram, as given by lgw_spectral_scan_get_results()
+@param results histogram, as given by lgw_spectral_scan_get_results()
+@return status of operation (LGW_OCC_SUCCESS/LGW_OCC_ERROR)
+*/
+int lgw_occ_update(lgw_occ_t * occ, uint32_t freq_hz, const int16_t levels_dbm[LGW_OCC_NB_BINS], const uint16_t results[LGW_OCC_NB_BINS]);
+
+/**
+@brief Get a consistent copy of the slot of a frequency
+@param occ handle of the map
+@param freq_hz frequency
+@param slot pointer to the copy
+@return status of operation (LGW_OCC_SUCCESS/LGW_OCC_ERROR)
+*/
+int lgw_occ_get_slot(const lgw_occ_t * occ, uint32_t freq_hz, struct lgw_occ_slot_s * slot);
+
+/**
+@brief Get the ratio of time a channel is busy, in constant time
+@param occ handle of the map
+@param freq_hz frequency of the channel
+@param rssi_dbm level above which the channel is busy (rounded up to a threshold)
+@param ratio pointer to the busy ratio [0..1]
+@param age_s pointer to the age of the last scan in seconds, may be NULL
+@return LGW_OCC_ERROR if the frequency is out of the map or has never been scanned
+*/
+int lgw_occ_busy(const lgw_occ_t * occ, uint32_t freq_hz, int16_t rssi_dbm, float * ratio, uint32_t * age_s);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -1100,6 +1100,11 @@ struct lgw_reg_s {
 
 #define LGW_TOTALREGS 1044
 
+/* -------------------------------------------------------------------------- */
+/* --- INTERNAL SHARED VARIABLES -------------------------------------------- */
+
+extern const struct lgw_reg_s loregs[LGW_TOTALREGS+1]; /* register map, also used by the simulated concentrator */
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC MACROS -------------------------------------------------------- */
 
@@ -0,0 +1,185 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Simulated concentrator, used as a communication interface (LGW_COM_SIM)
+
+    The SX1302 register file, its RX FIFO, TX buffers and state machines,
+    the AGC/ARB MCU handshakes and the sx1250 radios are modelled in memory,
+    and each transaction is delayed like on a real SPI or USB link. A traffic
+    generator fills the RX FIFO with LoRa packets, so that lgw_receive(),
+    lgw_send() and the packet forwarder can be benchmarked without hardware.
+
+    The com_path is a list of options, e.g. "rate=50,sf=7:4/12:1,link=usb":
+        rate=<pkt/s>        mean rate of uplinks (Poisson arrivals), 10
+        sf=<sf>:<w>/...     spreading factor mix (relative weights), 7:40/8:20/9:15/10:10/11:10/12:5
+        ch=<nb>             number of multi-SF channels used, 1 to 8, 8
+        len=<bytes>         payload size, 20
+        coll=<p>            probability of sending a packet on the channel and
+                            spreading factor of the last one, 0
+        link=<spi|usb|none> link latency model, spi (8MHz)
+        lat=<us>            fixed cost of a transaction, overrides the link
+        bns=<ns>            cost of a byte, overrides the link
+        seed=<n>            seed of the traffic generator, 1
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_SIM_H
+#define _LORAGW_SIM_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types*/
+
+#include "sx1250_defs.h"
+
+#include "config.h"     /* library configuration options (dynamically generated) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_SIM_SUCCESS     0
+#define LGW_SIM_ERROR       -1
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct lgw_sim_stats_s {
+    uint32_t nb_rx_generated;   /*!> uplinks put on air by the traffic generator */
+    uint32_t nb_rx_delivered;   /*!> uplinks pushed in the RX FIFO, collided ones included */
+    uint32_t nb_rx_collided;    /*!> uplinks overlapping another one on the same channel and SF */
+    uint32_t nb_rx_overflow;    /*!> uplinks lost because the RX FIFO was full */
+    uint32_t nb_rx_blind;       /*!> uplinks lost because the gateway was transmitting */
+    uint32_t nb_tx;             /*!> downlinks emitted */
+    uint64_t nb_xfer;           /*!> link transactions */
+    uint64_t xfer_bytes;        /*!> bytes exchanged on the link */
+    uint64_t xfer_ns;           /*!> time spent on the link */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Create a simulated concentrator
+@param com_path list of options (see above), may be empty
+@param com_target_ptr pointer on a generic pointer to the simulated concentrator
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_open(const char * com_path, void **com_target_ptr);
+
+/**
+@brief Print the statistics and release a simulated concentrator
+@param com_target generic pointer to the simulated concentrator
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_close(void *com_target);
+
+/**
+@brief Simulated single-byte write
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target SPI mux target, only the SX1302 is accessed this way
+@param address register address
+@param data data byte to write
+@return status of register operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t data);
+
+/**
+@brief Simulated single-byte read
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target SPI mux target, only the SX1302 is accessed this way
+@param address register address
+@param data pointer to the byte read
+@return status of register operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data);
+
+/**
+@brief Simulated single-byte read-modify-write
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target SPI mux target, only the SX1302 is accessed this way
+@param address register address
+@param offs start offset of the bits to be modified
+@param leng number of bits to be modified
+@param data value to be written in the selected bits
+@return status of register operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_rmw(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data);
+
+/**
+@brief Simulated burst (multiple-byte) write
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target SPI mux target, only the SX1302 is accessed this way
+@param address start address
+@param data pointer to the bytes to be written
+@param size size of the transfer, in byte(s)
+@return status of register operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size);
+
+/**
+@brief Simulated burst (multiple-byte) read
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target SPI mux target, only the SX1302 is accessed this way
+@param address start address
+@param data pointer to the bytes read
+@param size size of the transfer, in byte(s)
+@return status of register operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
+
+/**
+@brief Get the maximum size of a burst on the simulated link
+@param com_target generic pointer to the simulated concentrator
+@return chunk size in bytes
+*/
+uint16_t lgw_sim_chunk_size(void *com_target);
+
+/**
+@brief Simulated sx1250 command
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target radio A or B
+@param op_code sx1250 command
+@param data command parameters
+@param size number of parameters
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_radio_w(void *com_target, uint8_t spi_mux_target, sx1250_op_code_t op_code, uint8_t *data, uint16_t size);
+
+/**
+@brief Simulated sx1250 request
+@param com_target generic pointer to the simulated concentrator
+@param spi_mux_target radio A or B
+@param op_code sx1250 command
+@param data buffer for the response
+@param size size of the response
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_radio_r(void *com_target, uint8_t spi_mux_target, sx1250_op_code_t op_code, uint8_t *data, uint16_t size);
+
+/**
+@brief Get the temperature of the simulated board
+@param com_target generic pointer to the simulated concentrator
+@param temperature pointer to the temperature, in degrees Celsius
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_get_temperature(void *com_target, float * temperature);
+
+/**
+@brief Get the statistics of a simulated concentrator
+@param com_target generic pointer to the simulated concentrator
+@param stats pointer to the statistics to be filled
+@return status of operation (LGW_SIM_SUCCESS/LGW_SIM_ERROR)
+*/
+int lgw_sim_get_stats(void *com_target, struct lgw_sim_stats_s * stats);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
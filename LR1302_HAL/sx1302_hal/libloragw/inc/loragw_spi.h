@@ -23,6 +23,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
 #include <stdint.h>        /* C99 types*/
+#include <stddef.h>        /* size_t */
 
 #include "config.h"    /* library configuration options (dynamically generated) */
 
@@ -34,6 +35,27 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define SPI_SPEED       8000000
 
+#define LGW_SPI_SPEED_MIN           1000000
+#define LGW_SPI_SPEED_MAX           32000000
+#define LGW_SPI_BURST_CHUNK         1024    /* default max size of a burst transfer */
+#define LGW_SPI_BURST_CHUNK_MIN     16
+#define LGW_SPI_BURST_CHUNK_MAX     4092    /* spidev bufsiz (4096 by default) minus the burst command */
+
+#define LGW_SPI_LINK_DIR    "/var/lib/loragw"   /* where the calibrated link parameters are kept */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct lgw_spi_link_s
+@brief Parameters of the SX1302 accesses on a SPI device
+*/
+struct lgw_spi_link_s {
+    uint32_t speed_hz;      /*!> SPI clock, the radios are still accessed at SPI_SPEED */
+    uint16_t chunk;         /*!> max size of a burst transfer, in bytes */
+    uint32_t throughput;    /*!> error-free R/W throughput measured by the calibration, in bytes/s */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
 
@@ -104,9 +126,53 @@ int lgw_spi_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
 int lgw_spi_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
 
 /**
- *
- **/
-uint16_t lgw_spi_chunk_size(void);
+@brief Get the max size of a burst transfer on a SPI device
+@param com_target generic pointer to SPI target, NULL for the default
+@return chunk size in bytes
+*/
+uint16_t lgw_spi_chunk_size(void *com_target);
+
+/**
+@brief Change the clock and burst size of the SX1302 accesses on an opened SPI device
+@param com_target generic pointer to SPI target
+@param link link parameters, the throughput is ignored
+@return status of operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_set_link(void *com_target, const struct lgw_spi_link_s * link);
+
+/**
+@brief Get the clock and burst size of the SX1302 accesses on an opened SPI device
+@param com_target generic pointer to SPI target
+@param link link parameters, the throughput is set to 0
+@return status of operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_get_link(void *com_target, struct lgw_spi_link_s * link);
+
+/**
+@brief Get the file holding the calibrated link parameters of a SPI device,
+loaded by lgw_spi_open()
+@param com_path path to the SPI device
+@param path buffer receiving the file path
+@param size size of the buffer
+@return status of operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_link_path(const char * com_path, char * path, size_t size);
+
+/**
+@brief Read link parameters saved by lgw_spi_link_save()
+@param path file holding the link parameters
+@param link link parameters read, untouched on error
+@return status of operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_link_load(const char * path, struct lgw_spi_link_s * link);
+
+/**
+@brief Save link parameters, the file is replaced atomically
+@param path file to hold the link parameters
+@param link link parameters
+@return status of operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_link_save(const char * path, const struct lgw_spi_link_s * link);
 
 #endif
 
@@ -54,6 +54,7 @@ int sx1261_setup(void);
 int sx1261_set_rx_params(uint32_t freq_hz, uint8_t bandwidth);
 
 int sx1261_lbt_start(lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm);
+int sx1261_lbt_start_on(uint32_t freq_hz, uint8_t bandwidth, lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm);
 int sx1261_lbt_stop(void);
 
 int sx1261_spectral_scan_start(uint16_t nb_scan);
@@ -260,6 +260,12 @@ uint32_t sx1302_timestamp_counter(bool pps);
 */
 int sx1302_agc_load_firmware(const uint8_t *firmware);
 
+/**
+@brief Select how the AGC and ARB firmwares are checked after loading
+@param strict true to read back the whole firmware, false to read back a few windows only
+*/
+void sx1302_set_fw_check_strict(bool strict);
+
 /**
 @brief Read the AGC status register for current status
 @param status A pointer to store the current status returned
@@ -373,6 +379,14 @@ uint16_t sx1302_lora_payload_crc(const uint8_t * data, uint8_t size);
 */
 int sx1302_fetch(uint8_t * nb_pkt);
 
+/**
+@brief Same as sx1302_fetch() followed by sx1302_update(), with the RX buffer level
+@brief and the counters read in a single transaction on USB
+@param  nb_pkt A pointer to allocated memory to hold the number of packet fetched
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int sx1302_poll(uint8_t * nb_pkt);
+
 /**
 @brief Parse and return the next packet available in rx_buffer.
 @param context      Gateway configuration context
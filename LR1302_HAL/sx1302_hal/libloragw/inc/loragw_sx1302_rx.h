@@ -26,6 +26,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC CONSTANTS ----------------------------------------------------- */
 
+#define RX_BUFFER_NB_BYTES_RAW_SIZE 4 /* two reads of the RX buffer NB_BYTES registers */
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC MACROS -------------------------------------------------------- */
 
@@ -99,6 +101,23 @@ int rx_buffer_del(rx_buffer_t * self);
 */
 int rx_buffer_fetch(rx_buffer_t * self);
 
+/**
+@brief Read the number of bytes available in the SX1302 internal RX buffer, without decoding it.
+@brief In USB bulk mode, the reads are queued and raw is filled by lgw_com_flush()
+@param raw      Buffer of RX_BUFFER_NB_BYTES_RAW_SIZE bytes to receive the registers
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int rx_buffer_read_nb_bytes(uint8_t * raw);
+
+/**
+@brief Fetch packets from the SX1302 internal RX buffer, and count packets available.
+@brief The number of bytes to fetch is given by rx_buffer_read_nb_bytes().
+@param self     A pointer to a rx_buffer handler
+@param raw      Registers read by rx_buffer_read_nb_bytes()
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int rx_buffer_fetch_nb_bytes(rx_buffer_t * self, const uint8_t * raw);
+
 /**
 @brief Parse the rx_buffer and return the first packet available in the given structure.
 @param self     A pointer to a rx_buffer handler
@@ -35,6 +35,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC CONSTANTS ----------------------------------------------------- */
 
+#define TIMESTAMP_COUNTER_RAW_SIZE 16 /* two reads of the PPS and freerun counters */
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC MACROS -------------------------------------------------------- */
 
@@ -54,6 +56,17 @@ typedef struct timestamp_counter_s {
     struct timestamp_info_s pps;  /* holds current reference of the pps-trigged counter */
 } timestamp_counter_t;
 
+/**
+@struct timestamp_pps_history_s
+@brief history of the last PPS timestamps
+*/
+#define MAX_TIMESTAMP_PPS_HISTORY 16
+struct timestamp_pps_history_s {
+    uint32_t history[MAX_TIMESTAMP_PPS_HISTORY];
+    uint8_t idx; /* next slot to be written */
+    uint8_t size; /* current size */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
 
@@ -97,6 +110,25 @@ uint32_t timestamp_counter_expand(timestamp_counter_t * self, bool pps, uint32_t
 */
 uint32_t timestamp_pkt_expand(timestamp_counter_t * self, uint32_t cnt_us);
 
+/**
+@brief Reads the SX1302 internal counter registers, without decoding them.
+@brief In USB bulk mode, the reads are queued and raw is filled by lgw_com_flush()
+@param raw      Buffer of TIMESTAMP_COUNTER_RAW_SIZE bytes to receive the registers
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int timestamp_counter_read(uint8_t * raw);
+
+/**
+@brief Update the counter wrapping status from the registers read by timestamp_counter_read(),
+@brief and return the 32-bits 1 MHz counters
+@param self     Pointer to the counter handler
+@param raw      Registers read by timestamp_counter_read(), may be read again if unstable
+@param inst     Current value of the freerun counter
+@param pps      Current value of the PPS counter
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int timestamp_counter_decode(timestamp_counter_t * self, uint8_t * raw, uint32_t * inst, uint32_t * pps);
+
 /**
 @brief Reads the SX1302 internal counter register, and return the 32-bits 1 MHz counter
 @param self     Pointer to the counter handler
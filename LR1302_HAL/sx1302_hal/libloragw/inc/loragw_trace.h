@@ -0,0 +1,143 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator HAL runtime tracing
+
+    Tracepoints are always compiled in. When tracing is disabled, each one
+    costs a single load and branch. When enabled, each thread records its
+    complete sections (CLOCK_MONOTONIC start and duration in ns, event,
+    argument, result) into its own ring, without any lock; the rings can be
+    exported at any time in the Chrome trace JSON format, which is read by
+    chrome://tracing and Perfetto.
+
+    A section is recorded at its LGW_TRACE_END(). A section left by a return
+    without its end (error paths) is dropped, along with the sections opened
+    in it, when its caller's section ends or when the same event begins again,
+    so that the trace never shows unbalanced sections.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_TRACE_H
+#define _LORAGW_TRACE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_TRACE_SUCCESS     0
+#define LGW_TRACE_ERROR       -1
+
+#define LGW_TRACE_RING_SIZE   8192 /* records kept per thread, power of 2 */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+typedef enum {
+    LGW_TRACE_HAL_RECEIVE,
+    LGW_TRACE_HAL_SEND,
+    LGW_TRACE_SX1302_UPDATE,
+    LGW_TRACE_SX1302_FETCH,
+    LGW_TRACE_SX1302_POLL,
+    LGW_TRACE_SX1302_PARSE,
+    LGW_TRACE_SX1302_SEND,
+    LGW_TRACE_COM_W,
+    LGW_TRACE_COM_R,
+    LGW_TRACE_COM_RMW,
+    LGW_TRACE_COM_WB,
+    LGW_TRACE_COM_RB,
+    LGW_TRACE_MCU_WRITE_REQ,
+    LGW_TRACE_MCU_READ_ACK_HDR,
+    LGW_TRACE_MCU_READ_ACK_PAYLOAD,
+    LGW_TRACE_LBT_START,
+    LGW_TRACE_LBT_TX_STATUS,
+    LGW_TRACE_LBT_STOP,
+    LGW_TRACE_SX1261_SET_RX_PARAMS,
+    LGW_TRACE_SX1261_LBT_START,
+    LGW_TRACE_SX1261_LBT_STOP,
+    LGW_TRACE_SX1261_SCAN_START,
+    LGW_TRACE_SX1261_SCAN_RESULTS,
+    LGW_TRACE_SX1261_SCAN_STATUS,
+    LGW_TRACE_SX1261_SCAN_ABORT,
+    LGW_TRACE_EVENT_NB
+} lgw_trace_event_t;
+
+typedef enum {
+    LGW_TRACE_PHASE_BEGIN,
+    LGW_TRACE_PHASE_END
+} lgw_trace_phase_t;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+extern bool lgw_trace_enabled; /* read by the tracepoints, use lgw_trace_enable() to change */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+/**
+@brief Mark the beginning of a traced section
+@param ev event (lgw_trace_event_t)
+@param arg argument recorded with the event (address, command, size...)
+*/
+#define LGW_TRACE_BEGIN(ev, arg)                                                       \
+    do {                                                                               \
+        if (__builtin_expect(__atomic_load_n(&lgw_trace_enabled, __ATOMIC_RELAXED), 0)) { \
+            lgw_trace_record((ev), LGW_TRACE_PHASE_BEGIN, (uint32_t)(arg));            \
+        }                                                                              \
+    } while (0)
+
+/**
+@brief Mark the end of a traced section
+@param ev event (lgw_trace_event_t)
+@param ret result recorded with the event (status, number of packets...)
+*/
+#define LGW_TRACE_END(ev, ret)                                                         \
+    do {                                                                               \
+        if (__builtin_expect(__atomic_load_n(&lgw_trace_enabled, __ATOMIC_RELAXED), 0)) { \
+            lgw_trace_record((ev), LGW_TRACE_PHASE_END, (uint32_t)(ret));              \
+        }                                                                              \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Enable or disable the tracepoints
+@param enable true to start recording, false to stop
+*/
+void lgw_trace_enable(bool enable);
+
+/**
+@brief Open or close a section of the calling thread, called by the tracepoints
+@param event event
+@param phase beginning or end of the section
+@param arg argument at the beginning, result at the end
+*/
+void lgw_trace_record(lgw_trace_event_t event, lgw_trace_phase_t phase, uint32_t arg);
+
+/**
+@brief Export the recorded events in the Chrome trace JSON format
+@param path file to be written
+@return LGW_TRACE_SUCCESS if the file was written, LGW_TRACE_ERROR else
+
+The LGW_TRACE_RING_SIZE latest sections of each thread are exported, as
+complete ("X") events. The records overwritten by their thread during the
+export are skipped.
+*/
+int lgw_trace_export(const char * path);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
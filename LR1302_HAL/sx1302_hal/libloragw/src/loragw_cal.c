@@ -18,7 +18,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include <stdint.h>     /* C99 types */
 #include <stdio.h>      /* printf fprintf */
-#include <math.h>       /* log10 */
+#include <string.h>     /* memset, memcmp */
+#include <math.h>       /* log10, fabs */
 
 #include "loragw_reg.h"
 #include "loragw_aux.h"
@@ -26,6 +27,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_sx1302.h"
 #include "loragw_sx125x.h"
 #include "loragw_cal.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- DEBUG FLAGS ---------------------------------------------------------- */
@@ -39,11 +41,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #if DEBUG_CAL == 1
     #define DEBUG_MSG(str)                fprintf(stdout, str)
     #define DEBUG_PRINTF(fmt, args...)    fprintf(stdout,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
-    #define CHECK_NULL(a)                if(a==NULL){fprintf(stderr,"%s:%d: ERROR: NULL POINTER AS ARGUMENT\n", __FUNCTION__, __LINE__);return LGW_SPI_ERROR;}
+    #define CHECK_NULL(a)                if(a==NULL){fprintf(stderr,"%s:%d: ERROR: NULL POINTER AS ARGUMENT\n", __FUNCTION__, __LINE__);return LGW_HAL_ERROR;}
 #else
     #define DEBUG_MSG(str)
     #define DEBUG_PRINTF(fmt, args...)
-    #define CHECK_NULL(a)                if(a==NULL){return LGW_SPI_ERROR;}
+    #define CHECK_NULL(a)                if(a==NULL){return LGW_HAL_ERROR;}
 #endif
 
 /* -------------------------------------------------------------------------- */
@@ -53,12 +55,45 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define CAL_ITER                3 /* Number of calibration iterations */
 #define CAL_TX_CORR_DURATION    0 /* 0:1ms, 1:2ms, 2:4ms, 3:8ms */
 
+#define CAL_CACHE_MAGIC         "LGWCAL"
+#define CAL_CACHE_VERSION       1   /* to be incremented when the record or the calibration changes */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* What the calibration results depend on */
+struct cal_cache_key_s {
+    uint64_t    eui;
+    uint8_t     clksrc;
+    struct {
+        uint8_t     enable;
+        uint8_t     tx_enable;
+        uint8_t     type;
+        uint32_t    freq_hz;
+        uint8_t     lut_size;
+        uint8_t     dac_gain[TX_GAIN_LUT_SIZE_MAX];
+        uint8_t     mix_gain[TX_GAIN_LUT_SIZE_MAX];
+    } rf[LGW_RF_CHAIN_NB];
+};
+
+/* Calibration cache file content */
+struct cal_cache_record_s {
+    char                    magic[8];
+    uint32_t                version;
+    struct cal_cache_key_s  key;
+    float                   temperature;    /* at calibration time */
+    int8_t                  rx_image_amp[LGW_RF_CHAIN_NB];
+    int8_t                  rx_image_phi[LGW_RF_CHAIN_NB];
+    int8_t                  offset_i[LGW_RF_CHAIN_NB][TX_GAIN_LUT_SIZE_MAX];
+    int8_t                  offset_q[LGW_RF_CHAIN_NB][TX_GAIN_LUT_SIZE_MAX];
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES -------------------------------------------- */
 
 /* Record Rx IQ mismatch corrections from calibration */
-static int8_t rf_rx_image_amp[LGW_RF_CHAIN_NB] = {0, 0};
-static int8_t rf_rx_image_phi[LGW_RF_CHAIN_NB] = {0, 0};
+#define rf_rx_image_amp     (lgw_ctx_cur()->rf_rx_image_amp)
+#define rf_rx_image_phi     (lgw_ctx_cur()->rf_rx_image_phi)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
@@ -73,6 +108,25 @@ void cal_tx_result_sort(struct lgw_sx125x_cal_tx_result_s *res_tx, struct lgw_sx
 bool cal_tx_result_assert(struct lgw_sx125x_cal_tx_result_s *res_tx_min, struct lgw_sx125x_cal_tx_result_s *res_tx_max);
 int sx125x_cal_tx_dc_offset(uint8_t rf_chain, uint32_t freq_hz, uint8_t dac_gain, uint8_t mix_gain, uint8_t radio_type, struct lgw_sx125x_cal_tx_result_s * res);
 
+static void cal_cache_key(struct cal_cache_key_s * key, uint64_t eui, uint8_t clksrc, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut) {
+    int i, j;
+
+    memset(key, 0, sizeof *key); /* padding is compared too */
+    key->eui = eui;
+    key->clksrc = clksrc;
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        key->rf[i].enable = rf_chain_cfg[i].enable;
+        key->rf[i].tx_enable = rf_chain_cfg[i].tx_enable;
+        key->rf[i].type = (uint8_t)rf_chain_cfg[i].type;
+        key->rf[i].freq_hz = rf_chain_cfg[i].freq_hz;
+        key->rf[i].lut_size = txgain_lut[i].size;
+        for (j = 0; j < txgain_lut[i].size; j++) {
+            key->rf[i].dac_gain[j] = txgain_lut[i].lut[j].dac_gain;
+            key->rf[i].mix_gain[j] = txgain_lut[i].lut[j].mix_gain;
+        }
+    }
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -247,6 +301,113 @@ int sx1302_cal_start(uint8_t version, struct lgw_conf_rxrf_s * rf_chain_cfg, str
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int sx1302_cal_cache_load(const char * path, uint64_t eui, uint8_t clksrc, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut, float temperature, float temp_drift) {
+    int i, j;
+    FILE * f;
+    size_t n;
+    struct cal_cache_key_s key;
+    struct cal_cache_record_s rec;
+
+    CHECK_NULL(path);
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("INFO: no calibration cache %s\n", path);
+        return LGW_HAL_ERROR;
+    }
+    n = fread(&rec, 1, sizeof rec, f);
+    fclose(f);
+
+    /* Check that the results apply to this board, configuration and temperature */
+    cal_cache_key(&key, eui, clksrc, rf_chain_cfg, txgain_lut);
+    if ((n != sizeof rec) || (memcmp(rec.magic, CAL_CACHE_MAGIC, sizeof CAL_CACHE_MAGIC) != 0) || (rec.version != CAL_CACHE_VERSION)) {
+        printf("INFO: calibration cache %s is invalid or from another version\n", path);
+        return LGW_HAL_ERROR;
+    }
+    if (memcmp(&rec.key, &key, sizeof key) != 0) {
+        printf("INFO: calibration cache %s was made for another board or configuration\n", path);
+        return LGW_HAL_ERROR;
+    }
+    if (fabs(temperature - rec.temperature) > temp_drift) {
+        printf("INFO: calibration cache %s was made at %.1f C, now %.1f C\n", path, rec.temperature, temperature);
+        return LGW_HAL_ERROR;
+    }
+
+    /* Apply them as sx1302_cal_start() would have done */
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        rf_rx_image_amp[i] = rec.rx_image_amp[i];
+        rf_rx_image_phi[i] = rec.rx_image_phi[i];
+        for (j = 0; j < txgain_lut[i].size; j++) {
+            txgain_lut[i].lut[j].offset_i = rec.offset_i[i][j];
+            txgain_lut[i].lut[j].offset_q = rec.offset_q[i][j];
+        }
+    }
+    lgw_reg_w(SX1302_REG_RADIO_FE_IQ_COMP_AMP_COEFF_RADIO_A_AMP_COEFF, (int32_t)rf_rx_image_amp[0]);
+    lgw_reg_w(SX1302_REG_RADIO_FE_IQ_COMP_PHI_COEFF_RADIO_A_PHI_COEFF, (int32_t)rf_rx_image_phi[0]);
+    lgw_reg_w(SX1302_REG_RADIO_FE_IQ_COMP_AMP_COEFF_RADIO_B_AMP_COEFF, (int32_t)rf_rx_image_amp[1]);
+    lgw_reg_w(SX1302_REG_RADIO_FE_IQ_COMP_PHI_COEFF_RADIO_B_PHI_COEFF, (int32_t)rf_rx_image_phi[1]);
+
+    printf("INFO: radio calibration restored from %s (made at %.1f C)\n", path, rec.temperature);
+
+    return LGW_HAL_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int sx1302_cal_cache_save(const char * path, uint64_t eui, uint8_t clksrc, struct lgw_conf_rxrf_s * rf_chain_cfg, struct lgw_tx_gain_lut_s * txgain_lut, float temperature) {
+    int i, j;
+    FILE * f;
+    size_t n;
+    char tmp_path[128];
+    struct cal_cache_record_s rec;
+
+    CHECK_NULL(path);
+
+    memset(&rec, 0, sizeof rec);
+    memcpy(rec.magic, CAL_CACHE_MAGIC, sizeof CAL_CACHE_MAGIC);
+    rec.version = CAL_CACHE_VERSION;
+    cal_cache_key(&rec.key, eui, clksrc, rf_chain_cfg, txgain_lut);
+    rec.temperature = temperature;
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        rec.rx_image_amp[i] = rf_rx_image_amp[i];
+        rec.rx_image_phi[i] = rf_rx_image_phi[i];
+        for (j = 0; j < txgain_lut[i].size; j++) {
+            rec.offset_i[i][j] = txgain_lut[i].lut[j].offset_i;
+            rec.offset_q[i][j] = txgain_lut[i].lut[j].offset_q;
+        }
+    }
+
+    /* Write aside then rename, so that a crash never leaves a truncated cache */
+    if (snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path) >= (int)sizeof tmp_path) {
+        printf("ERROR: calibration cache path %s is too long\n", path);
+        return LGW_HAL_ERROR;
+    }
+    f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        printf("ERROR: failed to create calibration cache %s\n", tmp_path);
+        return LGW_HAL_ERROR;
+    }
+    n = fwrite(&rec, sizeof rec, 1, f);
+    if (fclose(f) != 0) {
+        n = 0;
+    }
+    if (n != 1) {
+        printf("ERROR: failed to write calibration cache %s\n", tmp_path);
+        remove(tmp_path);
+        return LGW_HAL_ERROR;
+    }
+    if (rename(tmp_path, path) != 0) {
+        printf("ERROR: failed to rename %s to %s\n", tmp_path, path);
+        remove(tmp_path);
+        return LGW_HAL_ERROR;
+    }
+    DEBUG_PRINTF("INFO: radio calibration saved to %s\n", path);
+
+    return LGW_HAL_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int sx125x_cal_rx_image(uint8_t rf_chain, uint32_t freq_hz, bool use_loopback, uint8_t radio_type, struct lgw_sx125x_cal_rx_result_s * res) {
     uint8_t rx, tx;
     uint32_t rx_freq_hz, tx_freq_hz;
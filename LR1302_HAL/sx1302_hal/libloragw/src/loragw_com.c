@@ -24,7 +24,10 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_com.h"
 #include "loragw_usb.h"
 #include "loragw_spi.h"
+#include "loragw_sim.h"
 #include "loragw_aux.h"
+#include "loragw_trace.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -47,14 +50,14 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
 /**
-@brief The current communication type in use (SPI, USB)
+@brief The current communication type in use (SPI, USB, SIM), of the selected concentrator
 */
-static lgw_com_type_t _lgw_com_type = LGW_COM_UNKNOWN;
+#define _lgw_com_type       (lgw_ctx_cur()->com_type)
 
 /**
-@brief A generic pointer to the COM device (file descriptor)
+@brief A generic pointer to the COM device (file descriptor), of the selected concentrator
 */
-static void* _lgw_com_target = NULL;
+#define _lgw_com_target     (lgw_ctx_cur()->com_target)
 
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
@@ -64,7 +67,7 @@ int lgw_com_open(lgw_com_type_t com_type, const char * com_path) {
 
     /* Check input parameters */
     CHECK_NULL(com_path);
-    if ((com_type != LGW_COM_SPI) && (com_type != LGW_COM_USB)) {
+    if ((com_type != LGW_COM_SPI) && (com_type != LGW_COM_USB) && (com_type != LGW_COM_SIM)) {
         DEBUG_MSG("ERROR: COMMUNICATION INTERFACE TYPE IS NOT SUPPORTED\n");
         return LGW_COM_ERROR;
     }
@@ -86,6 +89,10 @@ int lgw_com_open(lgw_com_type_t com_type, const char * com_path) {
             fprintf(stderr,"Opening USB communication interface\n");
             com_stat = lgw_usb_open(com_path, &_lgw_com_target);
             break;
+        case LGW_COM_SIM:
+            fprintf(stderr,"Opening simulated communication interface\n");
+            com_stat = lgw_sim_open(com_path, &_lgw_com_target);
+            break;
         default:
             com_stat = LGW_COM_ERROR;
             break;
@@ -114,6 +121,10 @@ int lgw_com_close(void) {
             fprintf(stderr,"Closing USB communication interface\n");
             com_stat = lgw_usb_close(_lgw_com_target);
             break;
+        case LGW_COM_SIM:
+            fprintf(stderr,"Closing simulated communication interface\n");
+            com_stat = lgw_sim_close(_lgw_com_target);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -130,11 +141,9 @@ int lgw_com_close(void) {
 /* Simple write */
 int lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data) {
     int com_stat;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_COM_W, address);
 
     /* Check input parameters */
     CHECK_NULL(_lgw_com_target);
@@ -146,6 +155,9 @@ int lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data) {
         case LGW_COM_USB:
             com_stat = lgw_usb_w(_lgw_com_target, spi_mux_target, address, data);
             break;
+        case LGW_COM_SIM:
+            com_stat = lgw_sim_w(_lgw_com_target, spi_mux_target, address, data);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -153,7 +165,7 @@ int lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data) {
     }
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_COM_W, com_stat);
 
     return com_stat;
 }
@@ -163,11 +175,9 @@ int lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data) {
 /* Simple read */
 int lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
     int com_stat;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_COM_R, address);
 
     /* Check input parameters */
     CHECK_NULL(_lgw_com_target);
@@ -180,6 +190,9 @@ int lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
         case LGW_COM_USB:
             com_stat = lgw_usb_r(_lgw_com_target, spi_mux_target, address, data);
             break;
+        case LGW_COM_SIM:
+            com_stat = lgw_sim_r(_lgw_com_target, spi_mux_target, address, data);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -187,7 +200,7 @@ int lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
     }
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_COM_R, com_stat);
 
     return com_stat;
 }
@@ -196,11 +209,9 @@ int lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
 
 int lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data) {
     int com_stat;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_COM_RMW, address);
 
     /* Check input parameters */
     CHECK_NULL(_lgw_com_target);
@@ -212,6 +223,9 @@ int lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t
         case LGW_COM_USB:
             com_stat = lgw_usb_rmw(_lgw_com_target, address, offs, leng, data);
             break;
+        case LGW_COM_SIM:
+            com_stat = lgw_sim_rmw(_lgw_com_target, spi_mux_target, address, offs, leng, data);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -219,7 +233,7 @@ int lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t
     }
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_COM_RMW, com_stat);
 
     return com_stat;
 }
@@ -229,11 +243,9 @@ int lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t
 /* Burst (multiple-byte) write */
 int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size) {
     int com_stat;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_COM_WB, size);
 
     /* Check input parameters */
     CHECK_NULL(_lgw_com_target);
@@ -246,6 +258,9 @@ int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, ui
         case LGW_COM_USB:
             com_stat = lgw_usb_wb(_lgw_com_target, spi_mux_target, address, data, size);
             break;
+        case LGW_COM_SIM:
+            com_stat = lgw_sim_wb(_lgw_com_target, spi_mux_target, address, data, size);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -253,7 +268,7 @@ int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, ui
     }
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_COM_WB, com_stat);
 
     return com_stat;
 }
@@ -263,11 +278,9 @@ int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, ui
 /* Burst (multiple-byte) read */
 int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
     int com_stat;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_COM_RB, size);
 
     /* Check input parameters */
     CHECK_NULL(_lgw_com_target);
@@ -280,6 +293,9 @@ int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t
         case LGW_COM_USB:
             com_stat = lgw_usb_rb(_lgw_com_target, spi_mux_target, address, data, size);
             break;
+        case LGW_COM_SIM:
+            com_stat = lgw_sim_rb(_lgw_com_target, spi_mux_target, address, data, size);
+            break;
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             com_stat = LGW_COM_ERROR;
@@ -287,7 +303,7 @@ int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t
     }
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_COM_RB, com_stat);
 
     return com_stat;
 }
@@ -299,6 +315,7 @@ int lgw_com_set_write_mode(lgw_com_write_mode_t write_mode) {
 
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
+        case LGW_COM_SIM:
             /* Do nothing: only single mode is supported on SPI */
             break;
         case LGW_COM_USB:
@@ -320,6 +337,7 @@ int lgw_com_flush(void) {
 
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
+        case LGW_COM_SIM:
             /* Do nothing: only single mode is supported on SPI */
             break;
         case LGW_COM_USB:
@@ -339,10 +357,12 @@ int lgw_com_flush(void) {
 uint16_t lgw_com_chunk_size(void) {
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
-            return lgw_spi_chunk_size();
+            return lgw_spi_chunk_size(_lgw_com_target);
         case LGW_COM_USB:
             return lgw_usb_chunk_size();
             break;
+        case LGW_COM_SIM:
+            return lgw_sim_chunk_size(_lgw_com_target);
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             return 0;
@@ -362,6 +382,8 @@ int lgw_com_get_temperature(float * temperature) {
             return -1;
         case LGW_COM_USB:
             return lgw_usb_get_temperature(_lgw_com_target, temperature);
+        case LGW_COM_SIM:
+            return lgw_sim_get_temperature(_lgw_com_target, temperature);
         default:
             fprintf(stderr,"ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
             return LGW_COM_ERROR;
@@ -0,0 +1,319 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator regulatory duty cycle accounting
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+
+#include "loragw_duty.h"
+#include "loragw_aux.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#if DEBUG_DUTY == 1
+    #define DEBUG_MSG(str)                fprintf(stdout, str)
+    #define DEBUG_PRINTF(fmt, args...)    fprintf(stdout,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
+#else
+    #define DEBUG_MSG(str)
+    #define DEBUG_PRINTF(fmt, args...)
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define PPM         1000000LL
+#define SLICE_RING  (LGW_DUTY_SLICE_NB + 1) /* slices partly in the window included */
+
+/* EU868 sub-bands (ERC REC 70-03 annex 1, bands h1.3 to h1.7), the gaps between
+   the LoRaWAN sub-bands fall back to the 0.1% of the whole 863-870 MHz band */
+static const struct lgw_duty_conf_s duty_conf_eu868 = {
+    .nb_band = 9,
+    .band = {
+        { 863000000, 865000000,   1000 },   /* 0.1% */
+        { 865000000, 868000000,  10000 },   /* 1% */
+        { 868000000, 868600000,  10000 },   /* 1%, LoRaWAN g1 */
+        { 868600000, 868700000,   1000 },   /* 0.1% */
+        { 868700000, 869200000,   1000 },   /* 0.1%, LoRaWAN g2 */
+        { 869200000, 869400000,   1000 },   /* 0.1% */
+        { 869400000, 869650000, 100000 },   /* 10%, LoRaWAN g3 (RX2, beacons) */
+        { 869650000, 869700000,   1000 },   /* 0.1% */
+        { 869700000, 870000000,  10000 }    /* 1%, LoRaWAN g4 */
+    },
+    .window_s = LGW_DUTY_WINDOW_S
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* airtime allowed over the window, in us */
+static int64_t band_limit(const struct lgw_duty_s * ctx, int band) {
+    return (int64_t)ctx->conf.window_s * ctx->conf.band[band].duty_ppm;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* move the window up to now, forgetting the slices entirely out of it */
+static struct lgw_duty_bucket_s * bucket_update(struct lgw_duty_s * ctx, int band, uint8_t rf_chain, uint64_t now) {
+    struct lgw_duty_bucket_s * b = &ctx->bucket[band][rf_chain];
+    uint64_t cur = now / ctx->slice_len_us;
+    uint64_t * x;
+
+    if ((cur - b->slice) >= SLICE_RING) {
+        /* nothing sent over the last window */
+        memset(b->slice_us, 0, sizeof b->slice_us);
+        b->used_us = 0;
+        b->slice = cur;
+        return b;
+    }
+    while (b->slice < cur) {
+        b->slice += 1;
+        x = &b->slice_us[b->slice % SLICE_RING];
+        b->used_us -= *x;
+        *x = 0;
+    }
+
+    return b;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint32_t airtime_left(const struct lgw_duty_s * ctx, int band, const struct lgw_duty_bucket_s * b) {
+    int64_t left = band_limit(ctx, band) - (int64_t)b->used_us;
+
+    if (left <= 0) {
+        return 0;
+    }
+    return (left >= UINT32_MAX) ? (UINT32_MAX - 1) : (uint32_t)left;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int lgw_duty_init(struct lgw_duty_s * ctx, const struct lgw_duty_conf_s * conf) {
+    uint64_t now = now_us();
+    int i, j;
+
+    /* Check input parameters */
+    if (ctx == NULL) {
+        return LGW_DUTY_ERROR;
+    }
+    if (conf == NULL) {
+        conf = &duty_conf_eu868;
+    }
+    if ((conf->nb_band == 0) || (conf->nb_band > LGW_DUTY_BAND_NB_MAX) || (conf->window_s == 0)) {
+        printf("ERROR: invalid duty cycle configuration\n");
+        return LGW_DUTY_ERROR;
+    }
+    for (i = 0; i < conf->nb_band; i++) {
+        if ((conf->band[i].freq_hz_min >= conf->band[i].freq_hz_max) || (conf->band[i].duty_ppm > PPM)) {
+            printf("ERROR: invalid duty cycle sub-band %d\n", i);
+            return LGW_DUTY_ERROR;
+        }
+    }
+
+    memset(ctx, 0, sizeof *ctx);
+    ctx->conf = *conf;
+    /* rounded up, so that LGW_DUTY_SLICE_NB slices cover at least the window */
+    ctx->slice_len_us = ((uint64_t)conf->window_s * PPM + LGW_DUTY_SLICE_NB - 1) / LGW_DUTY_SLICE_NB;
+    for (i = 0; i < conf->nb_band; i++) {
+        for (j = 0; j < LGW_RF_CHAIN_NB; j++) {
+            ctx->bucket[i][j].slice = now / ctx->slice_len_us;
+        }
+    }
+
+    return LGW_DUTY_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_duty_band(const struct lgw_duty_s * ctx, uint32_t freq_hz) {
+    int i;
+
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < ctx->conf.nb_band; i++) {
+        if ((freq_hz >= ctx->conf.band[i].freq_hz_min) && (freq_hz < ctx->conf.band[i].freq_hz_max)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_duty_remaining(struct lgw_duty_s * ctx, uint32_t freq_hz, uint8_t rf_chain, uint32_t * remaining_us) {
+    int band;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (remaining_us == NULL) || (rf_chain >= LGW_RF_CHAIN_NB)) {
+        return LGW_DUTY_ERROR;
+    }
+
+    band = lgw_duty_band(ctx, freq_hz);
+    if (band < 0) {
+        *remaining_us = UINT32_MAX;
+    } else {
+        *remaining_us = airtime_left(ctx, band, bucket_update(ctx, band, rf_chain, now_us()));
+    }
+
+    return LGW_DUTY_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint32_t lgw_duty_airtime_us(const struct lgw_pkt_tx_s * pkt) {
+    if (pkt == NULL) {
+        return 0;
+    }
+
+    if (pkt->modulation == MOD_LORA) {
+        /* truncated to the us by lora_packet_time_on_air() */
+        return lora_packet_time_on_air(pkt->bandwidth, pkt->datarate, pkt->coderate, pkt->preamble, pkt->no_header, pkt->no_crc, pkt->size, NULL, NULL, NULL) + 1;
+    }
+
+    /* already rounded up to the next ms */
+    return lgw_time_on_air(pkt) * 1000;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_duty_check(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt, uint32_t * wait_us) {
+    struct lgw_duty_bucket_s * b;
+    uint64_t now = now_us();
+    uint64_t expiry_us;
+    int64_t need, excess, freed = 0;
+    int band, i;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (pkt == NULL) || (wait_us == NULL) || (pkt->rf_chain >= LGW_RF_CHAIN_NB)) {
+        return LGW_DUTY_ERROR;
+    }
+
+    band = lgw_duty_band(ctx, pkt->freq_hz);
+    if (band < 0) {
+        *wait_us = 0;
+        return LGW_DUTY_SUCCESS;
+    }
+
+    need = (int64_t)lgw_duty_airtime_us(pkt);
+    if ((ctx->conf.band[band].duty_ppm == 0) || (need > band_limit(ctx, band))) {
+        *wait_us = UINT32_MAX;
+        return LGW_DUTY_SUCCESS;
+    }
+
+    b = bucket_update(ctx, band, pkt->rf_chain, now);
+    excess = (int64_t)b->used_us + need - band_limit(ctx, band);
+    *wait_us = 0;
+    /* oldest slice first, the slice i leaves the window at the start of slice (b->slice + i + 1) */
+    for (i = 0; (excess > 0) && (i < SLICE_RING); i++) {
+        freed += b->slice_us[(b->slice + i + 1) % SLICE_RING];
+        if (freed >= excess) {
+            expiry_us = (b->slice + i + 1) * ctx->slice_len_us - now;
+            *wait_us = (expiry_us >= UINT32_MAX) ? (UINT32_MAX - 1) : (uint32_t)expiry_us;
+            break;
+        }
+    }
+    DEBUG_PRINTF("duty cycle: %u Hz, used %llu us, wait %u us\n", pkt->freq_hz, (unsigned long long)b->used_us, *wait_us);
+
+    return LGW_DUTY_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_duty_consume(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt) {
+    struct lgw_duty_bucket_s * b;
+    uint32_t toa_us;
+    int band;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (pkt == NULL) || (pkt->rf_chain >= LGW_RF_CHAIN_NB)) {
+        return LGW_DUTY_ERROR;
+    }
+
+    band = lgw_duty_band(ctx, pkt->freq_hz);
+    if (band < 0) {
+        return LGW_DUTY_SUCCESS;
+    }
+
+    toa_us = lgw_duty_airtime_us(pkt);
+    b = bucket_update(ctx, band, pkt->rf_chain, now_us());
+    b->slice_us[b->slice % SLICE_RING] += toa_us;
+    b->used_us += toa_us;
+    b->airtime_us += toa_us;
+
+    return LGW_DUTY_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_duty_deny(struct lgw_duty_s * ctx, const struct lgw_pkt_tx_s * pkt) {
+    int band;
+
+    if ((ctx == NULL) || (pkt == NULL) || (pkt->rf_chain >= LGW_RF_CHAIN_NB)) {
+        return;
+    }
+
+    band = lgw_duty_band(ctx, pkt->freq_hz);
+    if (band >= 0) {
+        ctx->bucket[band][pkt->rf_chain].nb_denied += 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_duty_pick(struct lgw_duty_s * ctx, uint8_t rf_chain, const uint32_t * freq_hz, int nb_freq, uint32_t toa_us) {
+    uint32_t remaining, best_remaining = 0;
+    int i, best = -1;
+
+    /* Check input parameters */
+    if ((ctx == NULL) || (freq_hz == NULL) || (rf_chain >= LGW_RF_CHAIN_NB)) {
+        return -1;
+    }
+
+    /* candidates sharing a sub-band see the same airtime, the first one wins */
+    for (i = 0; i < nb_freq; i++) {
+        lgw_duty_remaining(ctx, freq_hz[i], rf_chain, &remaining);
+        if ((remaining >= toa_us) && ((best < 0) || (remaining > best_remaining))) {
+            best = i;
+            best_remaining = remaining;
+        }
+    }
+
+    return best;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
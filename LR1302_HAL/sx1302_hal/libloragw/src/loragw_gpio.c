@@ -0,0 +1,160 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    In-process reset of the concentrator through the Linux GPIO character
+    device, same sequence as tools/reset_lgw.sh without forking a shell.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdio.h>      /* printf fprintf */
+#include <string.h>     /* memset, strerror */
+#include <unistd.h>     /* close */
+#include <fcntl.h>      /* open */
+#include <errno.h>      /* errno */
+
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "loragw_gpio.h"
+#include "loragw_aux.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#if DEBUG_GPIO == 1
+    #define DEBUG_MSG(str)                fprintf(stdout, str)
+    #define DEBUG_PRINTF(fmt, args...)    fprintf(stdout,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
+#else
+    #define DEBUG_MSG(str)
+    #define DEBUG_PRINTF(fmt, args...)
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define GPIO_WAIT_MS        10  /* hold time of each level (reset_lgw.sh waits 100 ms for sysfs) */
+
+/* Index of the lines in the handle request */
+enum {
+    LINE_SX1302_RESET,
+    LINE_SX1302_POWER_EN,
+    LINE_SX1261_RESET,
+    LINE_AD5338R_RESET,
+    LINE_NB
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static int gpio_fd = -1;    /* line handle, -1 if not requested */
+static struct gpiohandle_data gpio_values;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+
+static int gpio_set(int line, uint8_t value) {
+    gpio_values.values[line] = value;
+    if (ioctl(gpio_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &gpio_values) < 0) {
+        printf("ERROR: failed to set GPIO lines (%s)\n", strerror(errno));
+        return LGW_GPIO_ERROR;
+    }
+    wait_ms(GPIO_WAIT_MS);
+
+    return LGW_GPIO_SUCCESS;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int lgw_gpio_open(const char * path) {
+    int chip_fd;
+    struct gpiohandle_request req;
+
+    if (gpio_fd >= 0) {
+        DEBUG_MSG("Note: GPIO lines already requested\n");
+        return LGW_GPIO_SUCCESS;
+    }
+    if (path == NULL) {
+        path = LGW_GPIO_CHIP_DEFAULT;
+    }
+
+    chip_fd = open(path, O_RDWR);
+    if (chip_fd < 0) {
+        printf("ERROR: failed to open GPIO chip %s (%s)\n", path, strerror(errno));
+        return LGW_GPIO_ERROR;
+    }
+
+    /* Same initial state as a freshly exported sysfs output */
+    memset(&req, 0, sizeof req);
+    req.lineoffsets[LINE_SX1302_RESET] = LGW_GPIO_SX1302_RESET;
+    req.lineoffsets[LINE_SX1302_POWER_EN] = LGW_GPIO_SX1302_POWER_EN;
+    req.lineoffsets[LINE_SX1261_RESET] = LGW_GPIO_SX1261_RESET;
+    req.lineoffsets[LINE_AD5338R_RESET] = LGW_GPIO_AD5338R_RESET;
+    req.lines = LINE_NB;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    snprintf(req.consumer_label, sizeof req.consumer_label, "%s", "libloragw");
+    if (ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+        printf("ERROR: failed to request GPIO lines on %s (%s)\n", path, strerror(errno));
+        close(chip_fd);
+        return LGW_GPIO_ERROR;
+    }
+    close(chip_fd); /* the line handle stays valid */
+
+    gpio_fd = req.fd;
+    memset(&gpio_values, 0, sizeof gpio_values);
+    DEBUG_PRINTF("Note: GPIO lines requested on %s\n", path);
+
+    return LGW_GPIO_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_gpio_reset(void) {
+    int err = LGW_GPIO_SUCCESS;
+
+    if (gpio_fd < 0) {
+        printf("ERROR: GPIO lines not requested\n");
+        return LGW_GPIO_ERROR;
+    }
+
+    /* power enable, then reset pulses */
+    err |= gpio_set(LINE_SX1302_POWER_EN, 1);
+    err |= gpio_set(LINE_SX1302_RESET, 1);
+    err |= gpio_set(LINE_SX1302_RESET, 0);
+    err |= gpio_set(LINE_SX1261_RESET, 0);
+    err |= gpio_set(LINE_SX1261_RESET, 1);
+    err |= gpio_set(LINE_AD5338R_RESET, 0);
+    err |= gpio_set(LINE_AD5338R_RESET, 1);
+
+    return (err == LGW_GPIO_SUCCESS) ? LGW_GPIO_SUCCESS : LGW_GPIO_ERROR;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_gpio_close(void) {
+    if (gpio_fd < 0) {
+        return LGW_GPIO_SUCCESS;
+    }
+    if (close(gpio_fd) != 0) {
+        printf("ERROR: failed to release GPIO lines (%s)\n", strerror(errno));
+        gpio_fd = -1;
+        return LGW_GPIO_ERROR;
+    }
+    gpio_fd = -1;
+
+    return LGW_GPIO_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -27,6 +27,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include <time.h>       /* struct timespec */
 #include <fcntl.h>      /* open */
+#include <sys/uio.h>    /* readv */
 #include <termios.h>    /* tcflush */
 #include <math.h>       /* modf */
 
@@ -59,6 +60,38 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define UBX_MSG_NAVTIMEGPS_LEN  16
 
+#define UBX_SYNC_CHAR2          0x62
+#define UBX_CLASS_NAV           0x01
+#define UBX_ID_NAV_TIMEGPS      0x20
+#define UBX_ID_NAV_TIMEUTC      0x21
+#define UBX_NAV_TIMEGPS_LEN     16  /* payload length */
+#define UBX_NAV_TIMEUTC_LEN     20  /* payload length */
+#define UBX_LEN_MAX             1024 /* longer payloads are a lost sync, not a message to skip */
+
+#define NMEA_LEN_MAX            128 /* 82 chars by the standard, some margin for proprietary sentences */
+
+#define STREAM_MASK             (LGW_GPS_STREAM_SIZE - 1)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* state of the incremental parser: which byte of a frame is expected next */
+enum stream_state_e {
+    ST_SYNC = 0,    /* UBX or NMEA sync char */
+    ST_UBX_SYNC2,
+    ST_UBX_CLASS,
+    ST_UBX_ID,
+    ST_UBX_LEN1,
+    ST_UBX_LEN2,
+    ST_UBX_PAYLOAD,
+    ST_UBX_CK_A,
+    ST_UBX_CK_B,
+    ST_NMEA_BODY,   /* up to the '*' */
+    ST_NMEA_CK1,
+    ST_NMEA_CK2,
+    ST_NMEA_EOL     /* CR and/or LF */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
@@ -93,159 +126,305 @@ static struct termios ttyopt_restore;
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
 
-static int nmea_checksum(const char *nmea_string, int buff_size, char *checksum);
+static uint8_t ring_at(const struct lgw_gps_stream_s *st, uint32_t pos);
+
+static uint32_t ring_le(const struct lgw_gps_stream_s *st, uint32_t pos, int size);
+
+static bool ring_number(const struct lgw_gps_stream_s *st, uint32_t *pos, uint32_t end, int max_chars, double *val);
 
-static char nibble_to_hexchar(uint8_t a);
+static int hexchar_to_nibble(uint8_t c);
 
-static bool validate_nmea_checksum(const char *serial_buff, int buff_size);
+static enum gps_msg ubx_decode(const struct lgw_gps_stream_s *st);
 
-static bool match_label(const char *s, char *label, int size, char wildcard);
+static enum gps_msg nmea_decode(const struct lgw_gps_stream_s *st);
 
-static int str_chop(char *s, int buff_size, char separator, int *idx_ary, int max_idx);
+static void stream_sync(struct lgw_gps_stream_s *st, uint8_t c, uint32_t pos);
+
+static size_t stream_room(struct lgw_gps_stream_s *st, struct iovec iov[2]);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
+static uint8_t ring_at(const struct lgw_gps_stream_s *st, uint32_t pos) {
+    return st->ring[pos & STREAM_MASK];
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 /*
-Calculate the checksum for a NMEA string
-Skip the first '$' if necessary and calculate checksum until '*' character is
-reached (or buff_size exceeded).
-Checksum must point to a 2-byte (or more) char array.
-Return position of the checksum in the string
+Read a little endian field of a UBX payload, straight from the ring
 */
-static int nmea_checksum(const char *nmea_string, int buff_size, char *checksum) {
-    int i = 0;
-    uint8_t check_num = 0;
+static uint32_t ring_le(const struct lgw_gps_stream_s *st, uint32_t pos, int size) {
+    uint32_t val = 0;
+    int i;
 
-    /* check input parameters */
-    if ((nmea_string == NULL) ||  (checksum == NULL) || (buff_size <= 1)) {
-        DEBUG_MSG("Invalid parameters for nmea_checksum\n");
-        return -1;
+    for (i = size - 1; i >= 0; i--) {
+        val = (val << 8) | ring_at(st, pos + i);
     }
+    return val;
+}
 
-    /* skip the first '$' if necessary */
-    if (nmea_string[i] == '$') {
-        i += 1;
-    }
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-    /* xor until '*' or max length is reached */
-    while (nmea_string[i] != '*') {
-        check_num ^= nmea_string[i];
-        i += 1;
-        if (i >= buff_size) {
-            DEBUG_MSG("Maximum length reached for nmea_checksum\n");
-            return -1;
+/*
+Parse a decimal number ([-]ddd[.ddd]) of a NMEA field, straight from the ring,
+as sscanf("%<max_chars>lf") would.
+Advance pos after the characters used.
+Return true if at least one digit was found
+*/
+static bool ring_number(const struct lgw_gps_stream_s *st, uint32_t *pos, uint32_t end, int max_chars, double *val) {
+    uint32_t p = *pos;
+    uint32_t last = ((end - p) < (uint32_t)max_chars) ? end : (p + max_chars);
+    double scale = 0.0; /* 0 until the decimal point */
+    double x = 0.0;
+    bool neg = false;
+    int nb_digits = 0;
+    uint8_t c;
+
+    if ((p != last) && (ring_at(st, p) == '-')) {
+        neg = true;
+        p += 1;
+    }
+    for (; p != last; p++) {
+        c = ring_at(st, p);
+        if ((c >= '0') && (c <= '9')) {
+            if (scale == 0.0) {
+                x = (x * 10.0) + (c - '0');
+            } else {
+                x += (c - '0') * scale;
+                scale /= 10.0;
+            }
+            nb_digits += 1;
+        } else if ((c == '.') && (scale == 0.0)) {
+            scale = 0.1;
+        } else {
+            break;
         }
     }
+    if (nb_digits == 0) {
+        return false;
+    }
 
-    /* Convert checksum value to 2 hexadecimal characters */
-    checksum[0] = nibble_to_hexchar(check_num / 16); /* upper nibble */
-    checksum[1] = nibble_to_hexchar(check_num % 16); /* lower nibble */
-
-    return i + 1;
+    *val = (neg == true) ? -x : x;
+    *pos = p;
+    return true;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-static char nibble_to_hexchar(uint8_t a) {
-    if (a < 10) {
-        return '0' + a;
-    } else if (a < 16) {
-        return 'A' + (a-10);
+static int hexchar_to_nibble(uint8_t c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    } else if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    } else if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
     } else {
-        return '?';
+        return -1;
     }
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 /*
-Calculate the checksum of a NMEA frame and compare it to the checksum that is
-present at the end of it.
-Return true if it matches
+Decode a checksum verified UBX frame, its payload starts at st->start
 */
-static bool validate_nmea_checksum(const char *serial_buff, int buff_size) {
-    int checksum_index;
-    char checksum[2]; /* 2 characters to calculate NMEA checksum */
-
-    checksum_index = nmea_checksum(serial_buff, buff_size, checksum);
-
-    /* could we calculate a verification checksum ? */
-    if (checksum_index < 0) {
-        DEBUG_MSG("ERROR: IMPOSSIBLE TO PARSE NMEA SENTENCE\n");
-        return false;
+static enum gps_msg ubx_decode(const struct lgw_gps_stream_s *st) {
+    uint32_t p = st->start;
+    uint8_t valid;
+    int32_t nano;
+
+    if (st->ubx_class == UBX_CLASS_NAV && st->ubx_id == UBX_ID_NAV_TIMEGPS && st->ubx_len == UBX_NAV_TIMEGPS_LEN) {
+        /* Check validity of information */
+        valid = ring_at(st, p + 11) & 0x3; /* towValid, weekValid */
+        if (valid) {
+            /* Warning: payload byte ordering is Little Endian */
+            gps_iTOW = ring_le(st, p + 0, 4); /* GPS time of week, in ms */
+            gps_fTOW = (int32_t)ring_le(st, p + 4, 4); /* Fractional part of iTOW, in ns */
+            gps_week = (int16_t)ring_le(st, p + 8, 2); /* GPS week number */
+            gps_time_ok = true;
+        } else {
+            gps_time_ok = false;
+        }
+        return UBX_NAV_TIMEGPS;
+    } else if (st->ubx_class == UBX_CLASS_NAV && st->ubx_id == UBX_ID_NAV_TIMEUTC && st->ubx_len == UBX_NAV_TIMEUTC_LEN) {
+        /* Check validity of information */
+        valid = ring_at(st, p + 19) & 0x4; /* validUTC */
+        if (valid) {
+            gps_yea = (short)ring_le(st, p + 12, 2); /* 4 digits year */
+            gps_mon = ring_at(st, p + 14);
+            gps_day = ring_at(st, p + 15);
+            gps_hou = ring_at(st, p + 16);
+            gps_min = ring_at(st, p + 17);
+            gps_sec = ring_at(st, p + 18);
+            /* nanoseconds to the rounded second, within the time accuracy at the top of the second */
+            nano = (int32_t)ring_le(st, p + 8, 4);
+            gps_fra = (nano > 0) ? (float)nano / 1E9 : 0.0;
+            gps_time_ok = true;
+        } else {
+            gps_time_ok = false;
+        }
+        return UBX_NAV_TIMEUTC;
+    } else if (st->ubx_class == 0x05) {
+        DEBUG_MSG("NOTE: UBX ACK-%s received\n", (st->ubx_id == 0x01) ? "ACK" : "NAK");
+        return IGNORED;
+    } else { /* not a supported message */
+        DEBUG_MSG("NOTE: UBX message is not supported (%02x %02x)\n", st->ubx_class, st->ubx_id);
+        return IGNORED;
     }
+}
 
-    /* check if there are enough char in the serial buffer to read checksum */
-    if (checksum_index >= (buff_size - 2)) {
-        DEBUG_MSG("ERROR: IMPOSSIBLE TO READ NMEA SENTENCE CHECKSUM\n");
-        return false;
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/*
+Decode a checksum verified NMEA sentence, its fields are located by st->field
+*/
+static enum gps_msg nmea_decode(const struct lgw_gps_stream_s *st) {
+    const uint32_t * f = st->field;
+    uint32_t p;
+    double hou, min, sec, day, mon, yea;
+    double x = 0.0;
+    double fra = 0.0;
+    bool time_ok, date_ok, lat_ok, lon_ok, alt_ok;
+    char mode;
+
+    /* field 0 is the sentence label, with a wildcard for the talker */
+    if ((ring_at(st, f[0]) != 'G') || ((f[1] - f[0]) != 6)) {
+        DEBUG_MSG("Note: ignored NMEA sentence\n");
+        return IGNORED;
     }
 
-    /* check the checksum per se */
-    if ((serial_buff[checksum_index] == checksum[0]) && (serial_buff[checksum_index+1] == checksum[1])) {
-        return true;
+    if ((ring_at(st, f[0] + 2) == 'R') && (ring_at(st, f[0] + 3) == 'M') && (ring_at(st, f[0] + 4) == 'C')) {
+        /*
+        NMEA sentence format: $xxRMC,time,status,lat,NS,long,EW,spd,cog,date,mv,mvEW,posMode*cs<CR><LF>
+        Valid fix: $GPRMC,083559.34,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A*00
+        No fix: $GPRMC,,V,,,,,,,,,,N*00
+        */
+        if (st->nb_fields != 13) {
+            DEBUG_MSG("Warning: invalid RMC sentence (number of fields)\n");
+            return IGNORED;
+        }
+        /* parse GPS status */
+        mode = (f[12] != (f[13] - 1)) ? (char)ring_at(st, f[12]) : 0;
+        gps_mod = ((mode == 'A') || (mode == 'D')) ? mode : 'N';
+        /* parse complete time: hhmmss.ss and ddmmyy */
+        p = f[1];
+        time_ok = ring_number(st, &p, f[2] - 1, 2, &hou) && ring_number(st, &p, f[2] - 1, 2, &min) &&
+                  ring_number(st, &p, f[2] - 1, 2, &sec) && ring_number(st, &p, f[2] - 1, 4, &fra);
+        p = f[9];
+        date_ok = ring_number(st, &p, f[10] - 1, 2, &day) && ring_number(st, &p, f[10] - 1, 2, &mon) &&
+                  ring_number(st, &p, f[10] - 1, 2, &yea);
+        if (time_ok && date_ok) {
+            gps_hou = (short)hou;
+            gps_min = (short)min;
+            gps_sec = (short)sec;
+            gps_fra = (float)fra;
+            gps_day = (short)day;
+            gps_mon = (short)mon;
+            gps_yea = (short)yea;
+            gps_time_ok = (gps_mod == 'A') || (gps_mod == 'D');
+            DEBUG_MSG("Note: Valid RMC sentence, mode %c, date: 20%02d-%02d-%02dT%02d:%02d:%06.3fZ\n", gps_mod, gps_yea, gps_mon, gps_day, gps_hou, gps_min, gps_fra + (float)gps_sec);
+        } else {
+            /* could not get a valid hour AND date */
+            gps_time_ok = false;
+            DEBUG_MSG("Note: Valid RMC sentence, mode %c, no date\n", gps_mod);
+        }
+        return NMEA_RMC;
+    } else if ((ring_at(st, f[0] + 2) == 'G') && (ring_at(st, f[0] + 3) == 'G') && (ring_at(st, f[0] + 4) == 'A')) {
+        /*
+        NMEA sentence format: $xxGGA,time,lat,NS,long,EW,quality,numSV,HDOP,alt,M,sep,M,diffAge,diffStation*cs<CR><LF>
+        Valid fix: $GPGGA,092725.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*5B
+        */
+        if (st->nb_fields != 15) {
+            DEBUG_MSG("Warning: invalid GGA sentence (number of fields)\n");
+            return IGNORED;
+        }
+        /* parse number of satellites used for fix */
+        p = f[7];
+        if (ring_number(st, &p, f[8] - 1, 16, &x)) {
+            gps_sat = (short)x;
+        }
+        /* parse 3D coordinates: ddmm.mmmm, dddmm.mmmm */
+        p = f[2];
+        lat_ok = ring_number(st, &p, f[3] - 1, 2, &x) && ring_number(st, &p, f[3] - 1, 10, &gps_mla);
+        gps_dla = (short)x;
+        gps_ola = (f[3] != (f[4] - 1)) ? (char)ring_at(st, f[3]) : 0;
+        p = f[4];
+        lon_ok = ring_number(st, &p, f[5] - 1, 3, &x) && ring_number(st, &p, f[5] - 1, 10, &gps_mlo);
+        gps_dlo = (short)x;
+        gps_olo = (f[5] != (f[6] - 1)) ? (char)ring_at(st, f[5]) : 0;
+        p = f[9];
+        alt_ok = ring_number(st, &p, f[10] - 1, 16, &x);
+        if (alt_ok) {
+            gps_alt = (short)x;
+        }
+        if (lat_ok && lon_ok && alt_ok && ((gps_ola=='N')||(gps_ola=='S')) && ((gps_olo=='E')||(gps_olo=='W'))) {
+            gps_pos_ok = true;
+            DEBUG_MSG("Note: Valid GGA sentence, %d sat, lat %02ddeg %06.3fmin %c, lon %03ddeg%06.3fmin %c, alt %d\n", gps_sat, gps_dla, gps_mla, gps_ola, gps_dlo, gps_mlo, gps_olo, gps_alt);
+        } else {
+            /* could not get a valid latitude, longitude AND altitude */
+            gps_pos_ok = false;
+            DEBUG_MSG("Note: Valid GGA sentence, %d sat, no coordinates\n", gps_sat);
+        }
+        return NMEA_GGA;
     } else {
-        DEBUG_MSG("ERROR: NMEA CHECKSUM %c%c DOESN'T MATCH VERIFICATION CHECKSUM %c%c\n", serial_buff[checksum_index], serial_buff[checksum_index+1], checksum[0], checksum[1]);
-        return false;
+        DEBUG_MSG("Note: ignored NMEA sentence\n"); /* quite verbose */
+        return IGNORED;
     }
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 /*
-Return true if the "label" string (can contain wildcard characters) matches
-the begining of the "s" string
+Look for the start of a frame
 */
-static bool match_label(const char *s, char *label, int size, char wildcard) {
-    int i;
-
-    for (i=0; i < size; i++) {
-        if (label[i] == wildcard) continue;
-        if (label[i] != s[i]) return false;
+static void stream_sync(struct lgw_gps_stream_s *st, uint8_t c, uint32_t pos) {
+    st->keep = false;
+    if (c == LGW_GPS_UBX_SYNC_CHAR) {
+        st->state = ST_UBX_SYNC2;
+    } else if (c == LGW_GPS_NMEA_SYNC_CHAR) {
+        /* NMEA sentences are short, keep them in the ring to decode their fields at the end */
+        st->state = ST_NMEA_BODY;
+        st->start = pos;
+        st->keep = true;
+        st->ck_a = 0;
+        st->nb_fields = 1;
+        st->field[0] = pos + 1;
+    } else {
+        st->state = ST_SYNC;
     }
-    return true;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 /*
-Chop a string into smaller strings
-Replace every separator in the input character buffer by a null character so
-that all s[index] are valid strings.
-Populate an array of integer 'idx_ary' representing indexes of token in the
-string.
-buff_size and max_idx are there to prevent segfaults.
-Return the number of token found (number of idx_ary filled).
+Get the free space of the ring, as 2 segments
 */
-int str_chop(char *s, int buff_size, char separator, int *idx_ary, int max_idx) {
-    int i = 0; /* index in the string */
-    int j = 0; /* index in the result array */
-
-    if ((s == NULL) || (buff_size < 0) || (separator == 0) || (idx_ary == NULL) || (max_idx < 0)) {
-        /* unsafe to do anything */
-        return -1;
+static size_t stream_room(struct lgw_gps_stream_s *st, struct iovec iov[2]) {
+    uint32_t used = st->wr - ((st->keep == true) ? st->start : st->rd);
+    size_t room, first;
+
+    if (used >= LGW_GPS_STREAM_SIZE) {
+        /* cannot happen if all bytes are parsed before writing more, start over */
+        DEBUG_MSG("WARNING: GPS stream overflow, dropping buffered bytes\n");
+        st->rd = st->wr;
+        st->state = ST_SYNC;
+        st->keep = false;
+        used = 0;
     }
-    if ((buff_size == 0) || (max_idx == 0)) {
-        /* nothing to do */
-        return 0;
-    }
-    s[buff_size - 1] = 0; /* add string terminator at the end of the buffer, just to be sure */
-    idx_ary[j] = 0;
-    j += 1;
-    /* loop until string terminator is reached */
-    while (s[i] != 0) {
-        if (s[i] == separator) {
-            s[i] = 0; /* replace separator by string terminator */
-            if (j >= max_idx) { /* no more room in the index array */
-                return j;
-            }
-            idx_ary[j] = i+1; /* next token start after replaced separator */
-            ++j;
-        }
-        ++i;
+
+    /* free space, up to the end of the ring then from its beginning */
+    room = LGW_GPS_STREAM_SIZE - used;
+    first = LGW_GPS_STREAM_SIZE - (st->wr & STREAM_MASK);
+    if (first > room) {
+        first = room;
     }
-    return j;
+    iov[0].iov_base = &st->ring[st->wr & STREAM_MASK];
+    iov[0].iov_len = first;
+    iov[1].iov_base = &st->ring[0];
+    iov[1].iov_len = room - first;
+
+    return room;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -336,8 +515,9 @@ int lgw_gps_enable(char *tty_path, char *gps_family, speed_t target_brate, int *
     ttyopt.c_lflag &= ~ECHOK;  /* do not echo NL after KILL character */
 
     /* settings for non-canonical mode
-       read will block for until the lesser of VMIN or requested chars have been received */
-    ttyopt.c_cc[VMIN]  = LGW_GPS_MIN_MSG_SIZE;
+       read will block until at least one char is received, so that a frame is
+       parsed as soon as its last byte arrives */
+    ttyopt.c_cc[VMIN]  = 1;
     ttyopt.c_cc[VTIME] = 0;
 
     /* set new serial ports parameters */
@@ -391,11 +571,8 @@ int lgw_gps_disable(int fd) {
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 enum gps_msg lgw_parse_ubx(const char *serial_buff, size_t buff_size, size_t *msg_size) {
-    bool valid = 0;    /* iTOW, fTOW and week validity */
-    unsigned int payload_length;
-    uint8_t ck_a, ck_b;
-    uint8_t ck_a_rcv, ck_b_rcv;
-    unsigned int i;
+    struct lgw_gps_stream_s st;
+    enum gps_msg msg;
 
     *msg_size = 0; /* ensure msg_size alway receives a value */
 
@@ -407,193 +584,265 @@ enum gps_msg lgw_parse_ubx(const char *serial_buff, size_t buff_size, size_t *ms
         DEBUG_MSG("ERROR: TOO SHORT TO BE A VALID UBX MESSAGE\n");
         return IGNORED;
     }
-
-    /* display received serial data and checksum */
-    DEBUG_MSG("Note: parsing UBX frame> ");
-    for (i=0; i<buff_size; i++) {
-        DEBUG_MSG("%02x ", serial_buff[i]);
+    if (((uint8_t)serial_buff[0] != LGW_GPS_UBX_SYNC_CHAR) || ((uint8_t)serial_buff[1] != UBX_SYNC_CHAR2)) {
+        /* Ignore messages which are not UBX ones */
+        return IGNORED;
     }
-    DEBUG_MSG("\n");
-
-    /* Check for UBX sync chars 0xB5 0x62 */
-    if ((serial_buff[0] == (char)0xB5) && (serial_buff[1] == (char)0x62)) {
-
-        /* Get payload length to compute message size */
-        payload_length  = (uint8_t)serial_buff[4];
-        payload_length |= (uint8_t)serial_buff[5] << 8;
-        *msg_size = 6 + payload_length + 2; /* header + payload + checksum */
 
-        /* check for complete message in buffer */
-        if(*msg_size <= buff_size) {
-            /* Validate checksum of message */
-            ck_a_rcv = serial_buff[*msg_size-2]; /* received checksum */
-            ck_b_rcv = serial_buff[*msg_size-1]; /* received checksum */
-            /* Use 8-bit Fletcher Algorithm to compute checksum of actual payload */
-            ck_a = 0; ck_b = 0;
-            for (i=0; i<(4 + payload_length); i++) {
-                ck_a = ck_a + serial_buff[i+2];
-                ck_b = ck_b + ck_a;
-            }
-
-            /* Compare checksums and parse if OK */
-            if ((ck_a == ck_a_rcv) && (ck_b == ck_b_rcv)) {
-                /* Check for Class 0x01 (NAV) and ID 0x20 (NAV-TIMEGPS) */
-                if ((serial_buff[2] == 0x01) && (serial_buff[3] == 0x20)) {
-                    /* Check validity of information */
-                    valid = serial_buff[17] & 0x3; /* towValid, weekValid */
-                    if (valid) {
-                        /* Parse buffer to extract GPS time */
-                        /* Warning: payload byte ordering is Little Endian */
-                        gps_iTOW =  (uint8_t)serial_buff[6];
-                        gps_iTOW |= (uint8_t)serial_buff[7] << 8;
-                        gps_iTOW |= (uint8_t)serial_buff[8] << 16;
-                        gps_iTOW |= (uint8_t)serial_buff[9] << 24; /* GPS time of week, in ms */
-
-                        gps_fTOW =  (uint8_t)serial_buff[10];
-                        gps_fTOW |= (uint8_t)serial_buff[11] << 8;
-                        gps_fTOW |= (uint8_t)serial_buff[12] << 16;
-                        gps_fTOW |= (uint8_t)serial_buff[13] << 24; /* Fractional part of iTOW, in ns */
-
-                        gps_week =  (uint8_t)serial_buff[14];
-                        gps_week |= (uint8_t)serial_buff[15] << 8; /* GPS week number */
-
-                        gps_time_ok = true;
-#if 0
-                        /* For debug */
-                        {
-                            short ubx_gps_hou = 0; /* hours (0-23) */
-                            short ubx_gps_min = 0; /* minutes (0-59) */
-                            short ubx_gps_sec = 0; /* seconds (0-59) */
-
-                            /* Format GPS time in hh:mm:ss based on iTOW */
-                            ubx_gps_sec = (gps_iTOW / 1000) % 60;
-                            ubx_gps_min = (gps_iTOW / 1000 / 60) % 60;
-                            ubx_gps_hou = (gps_iTOW / 1000 / 60 / 60) % 24;
-                            printf("  GPS time = %02d:%02d:%02d\n", ubx_gps_hou, ubx_gps_min, ubx_gps_sec);
-                        }
-#endif
-                    } else { /* valid */
-                        gps_time_ok = false;
-                    }
-
-                    return UBX_NAV_TIMEGPS;
-                } else if ((serial_buff[2] == 0x05) && (serial_buff[3] == 0x00)) {
-                    DEBUG_MSG("NOTE: UBX ACK-NAK received\n");
-                    return IGNORED;
-                } else if ((serial_buff[2] == 0x05) && (serial_buff[3] == 0x01)) {
-                    DEBUG_MSG("NOTE: UBX ACK-ACK received\n");
-                    return IGNORED;
-                } else { /* not a supported message */
-                    DEBUG_MSG("ERROR: UBX message is not supported (%02x %02x)\n", serial_buff[2], serial_buff[3]);
-                    return IGNORED;
-                }
-            } else { /* checksum failed */
-                DEBUG_MSG("ERROR: UBX message is corrupted, checksum failed\n");
-                return INVALID;
-            }
-        } else { /* message contains less bytes than indicated by header */
-            DEBUG_MSG("ERROR: UBX message incomplete\n");
-            return INCOMPLETE;
-        }
-    } else { /* Not a UBX message */
-        /* Ignore messages which are not UBX ones for now */
-        return IGNORED;
+    /* Run the frame through the incremental parser, up to its end */
+    lgw_gps_stream_init(&st);
+    lgw_gps_stream_write(&st, (const uint8_t *)serial_buff, buff_size);
+    msg = lgw_gps_stream_next(&st);
+    if (msg == UNKNOWN) {
+        DEBUG_MSG("ERROR: UBX message incomplete\n");
+        *msg_size = 6 + ((uint8_t)serial_buff[4] | ((uint8_t)serial_buff[5] << 8)) + 2; /* header + payload + checksum */
+        return INCOMPLETE;
     }
+    *msg_size = st.rd;
+
+    return msg;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 enum gps_msg lgw_parse_nmea(const char *serial_buff, int buff_size) {
-    int i, j, k;
-    int str_index[30]; /* string index from the string chopping */
-    int nb_fields; /* number of strings detected by string chopping */
-    char parser_buf[256]; /* parsing modifies buffer so need a local copy */
+    struct lgw_gps_stream_s st;
+    enum gps_msg msg;
 
     /* check input parameters */
     if (serial_buff == NULL) {
         return UNKNOWN;
     }
-
-    if(buff_size > (int)(sizeof(parser_buf) - 1)) {
+    if (buff_size < 8) {
+        DEBUG_MSG("ERROR: TOO SHORT TO BE A VALID NMEA SENTENCE\n");
+        return UNKNOWN;
+    }
+    if (buff_size > NMEA_LEN_MAX) {
         DEBUG_MSG("Note: input string to big for parsing\n");
         return INVALID;
     }
 
-    /* look for some NMEA sentences in particular */
-    if (buff_size < 8) {
-        DEBUG_MSG("ERROR: TOO SHORT TO BE A VALID NMEA SENTENCE\n");
+    /* Run the sentence through the incremental parser, the end of line is optional */
+    lgw_gps_stream_init(&st);
+    lgw_gps_stream_write(&st, (const uint8_t *)serial_buff, buff_size);
+    msg = lgw_gps_stream_next(&st);
+    if (msg == UNKNOWN) {
+        lgw_gps_stream_write(&st, (const uint8_t *)"\n", 1);
+        msg = lgw_gps_stream_next(&st);
+    }
+
+    return (msg == UNKNOWN) ? INVALID : msg;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_gps_stream_init(struct lgw_gps_stream_s *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    stream->wr = 0;
+    stream->rd = 0;
+    stream->start = 0;
+    stream->state = ST_SYNC;
+    stream->keep = false;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+ssize_t lgw_gps_stream_read(struct lgw_gps_stream_s *stream, int fd) {
+    struct iovec iov[2];
+    ssize_t n;
+
+    if (stream == NULL) {
+        return -1;
+    }
+
+    /* read straight into the ring */
+    stream_room(stream, iov);
+    n = readv(fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+    if (n > 0) {
+        stream->wr += (uint32_t)n;
+    }
+
+    return n;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+size_t lgw_gps_stream_write(struct lgw_gps_stream_s *stream, const uint8_t *data, size_t size) {
+    struct iovec iov[2];
+    size_t room, n;
+
+    if ((stream == NULL) || (data == NULL)) {
+        return 0;
+    }
+
+    room = stream_room(stream, iov);
+    if (size > room) {
+        size = room;
+    }
+    n = (size < iov[0].iov_len) ? size : iov[0].iov_len;
+    memcpy(iov[0].iov_base, data, n);
+    memcpy(iov[1].iov_base, data + n, size - n);
+    stream->wr += (uint32_t)size;
+
+    return size;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+enum gps_msg lgw_gps_stream_next(struct lgw_gps_stream_s *stream) {
+    struct lgw_gps_stream_s *st = stream;
+    enum gps_msg msg;
+    uint32_t pos;
+    uint8_t c;
+    int x;
+
+    if (st == NULL) {
         return UNKNOWN;
-    } else if (!validate_nmea_checksum(serial_buff, buff_size)) {
-        DEBUG_MSG("Warning: invalid NMEA sentence (bad checksum)\n");
-        return INVALID;
-    } else if (match_label(serial_buff, "$G?RMC", 6, '?')) {
-        /*
-        NMEA sentence format: $xxRMC,time,status,lat,NS,long,EW,spd,cog,date,mv,mvEW,posMode*cs<CR><LF>
-        Valid fix: $GPRMC,083559.34,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A*00
-        No fix: $GPRMC,,V,,,,,,,,,,N*00
-        */
-        memcpy(parser_buf, serial_buff, buff_size);
-        parser_buf[buff_size] = '\0';
-        nb_fields = str_chop(parser_buf, buff_size, ',', str_index, ARRAY_SIZE(str_index));
-        if (nb_fields != 13) {
-            DEBUG_MSG("Warning: invalid RMC sentence (number of fields)\n");
-            return IGNORED;
-        }
-        /* parse GPS status */
-        gps_mod = *(parser_buf + str_index[12]); /* get first character, no need to bother with sscanf */
-        if ((gps_mod != 'N') && (gps_mod != 'A') && (gps_mod != 'D')) {
-            gps_mod = 'N';
-        }
-        /* parse complete time */
-        i = sscanf(parser_buf + str_index[1], "%2hd%2hd%2hd%4f", &gps_hou, &gps_min, &gps_sec, &gps_fra);
-        j = sscanf(parser_buf + str_index[9], "%2hd%2hd%2hd", &gps_day, &gps_mon, &gps_yea);
-        if ((i == 4) && (j == 3)) {
-            if ((gps_mod == 'A') || (gps_mod == 'D')) {
-                gps_time_ok = true;
-                DEBUG_MSG("Note: Valid RMC sentence, GPS locked, date: 20%02d-%02d-%02dT%02d:%02d:%06.3fZ\n", gps_yea, gps_mon, gps_day, gps_hou, gps_min, gps_fra + (float)gps_sec);
-            } else {
-                gps_time_ok = false;
-                DEBUG_MSG("Note: Valid RMC sentence, no satellite fix, estimated date: 20%02d-%02d-%02dT%02d:%02d:%06.3fZ\n", gps_yea, gps_mon, gps_day, gps_hou, gps_min, gps_fra + (float)gps_sec);
-            }
-        } else {
-            /* could not get a valid hour AND date */
-            gps_time_ok = false;
-            DEBUG_MSG("Note: Valid RMC sentence, mode %c, no date\n", gps_mod);
-        }
-        return NMEA_RMC;
-    } else if (match_label(serial_buff, "$G?GGA", 6, '?')) {
-        /*
-        NMEA sentence format: $xxGGA,time,lat,NS,long,EW,quality,numSV,HDOP,alt,M,sep,M,diffAge,diffStation*cs<CR><LF>
-        Valid fix: $GPGGA,092725.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*5B
-        */
-        memcpy(parser_buf, serial_buff, buff_size);
-        parser_buf[buff_size] = '\0';
-        nb_fields = str_chop(parser_buf, buff_size, ',', str_index, ARRAY_SIZE(str_index));
-        if (nb_fields != 15) {
-            DEBUG_MSG("Warning: invalid GGA sentence (number of fields)\n");
-            return IGNORED;
+    }
+
+    while (st->rd != st->wr) {
+        pos = st->rd;
+        c = ring_at(st, pos);
+        st->rd += 1;
+        msg = UNKNOWN;
+
+        switch (st->state) {
+            case ST_SYNC:
+                stream_sync(st, c, pos);
+                break;
+
+            /* UBX: sync chars, class, id, length, payload and 8-bit Fletcher checksum */
+            case ST_UBX_SYNC2:
+                if (c == UBX_SYNC_CHAR2) {
+                    st->state = ST_UBX_CLASS;
+                    st->ck_a = 0;
+                    st->ck_b = 0;
+                } else {
+                    stream_sync(st, c, pos);
+                }
+                break;
+            case ST_UBX_CLASS:
+            case ST_UBX_ID:
+            case ST_UBX_LEN1:
+            case ST_UBX_LEN2:
+            case ST_UBX_PAYLOAD:
+                st->ck_a += c;
+                st->ck_b += st->ck_a;
+                if (st->state == ST_UBX_CLASS) {
+                    st->ubx_class = c;
+                    st->state = ST_UBX_ID;
+                } else if (st->state == ST_UBX_ID) {
+                    st->ubx_id = c;
+                    st->state = ST_UBX_LEN1;
+                } else if (st->state == ST_UBX_LEN1) {
+                    st->ubx_len = c;
+                    st->state = ST_UBX_LEN2;
+                } else if (st->state == ST_UBX_LEN2) {
+                    st->ubx_len |= (uint16_t)c << 8;
+                    if (st->ubx_len > UBX_LEN_MAX) {
+                        /* do not swallow up to 64 kB of stream, look for the next frame from there */
+                        DEBUG_MSG("ERROR: UBX message is corrupted, invalid length\n");
+                        msg = INVALID;
+                        break;
+                    }
+                    st->ubx_todo = st->ubx_len;
+                    /* only the payloads decoded at the end are kept in the ring */
+                    st->start = pos + 1;
+                    st->keep = (st->ubx_class == UBX_CLASS_NAV) && (st->ubx_len <= UBX_NAV_TIMEUTC_LEN);
+                    st->state = (st->ubx_todo > 0) ? ST_UBX_PAYLOAD : ST_UBX_CK_A;
+                } else {
+                    st->ubx_todo -= 1;
+                    if (st->ubx_todo == 0) {
+                        st->state = ST_UBX_CK_A;
+                    }
+                }
+                break;
+            case ST_UBX_CK_A:
+                if (c == st->ck_a) {
+                    st->state = ST_UBX_CK_B;
+                } else {
+                    DEBUG_MSG("ERROR: UBX message is corrupted, checksum failed\n");
+                    msg = INVALID;
+                }
+                break;
+            case ST_UBX_CK_B:
+                if (c == st->ck_b) {
+                    msg = ubx_decode(st);
+                } else {
+                    DEBUG_MSG("ERROR: UBX message is corrupted, checksum failed\n");
+                    msg = INVALID;
+                }
+                break;
+
+            /* NMEA: '$', comma separated fields, '*', 2 hex chars XOR checksum, CR LF */
+            case ST_NMEA_BODY:
+                if (c == '*') {
+                    st->field[st->nb_fields] = pos + 1; /* end of the last field + 1 */
+                    st->state = ST_NMEA_CK1;
+                } else if ((c < 0x20) || (c >= 0x7F) || ((pos - st->start) >= NMEA_LEN_MAX)) {
+                    /* not a NMEA sentence, look for the next frame from there */
+                    DEBUG_MSG("Warning: invalid NMEA sentence\n");
+                    stream_sync(st, c, pos);
+                } else {
+                    st->ck_a ^= c;
+                    if (c == ',') {
+                        if (st->nb_fields < LGW_GPS_NMEA_FIELDS_MAX) {
+                            st->field[st->nb_fields] = pos + 1;
+                        }
+                        if (st->nb_fields <= LGW_GPS_NMEA_FIELDS_MAX) {
+                            st->nb_fields += 1; /* saturates at LGW_GPS_NMEA_FIELDS_MAX + 1 */
+                        }
+                    }
+                }
+                break;
+            case ST_NMEA_CK1:
+            case ST_NMEA_CK2:
+                x = hexchar_to_nibble(c);
+                if (x < 0) {
+                    DEBUG_MSG("Warning: invalid NMEA sentence (checksum chars)\n");
+                    msg = INVALID;
+                } else if (st->state == ST_NMEA_CK1) {
+                    st->ck_rcv = (uint8_t)(x << 4);
+                    st->state = ST_NMEA_CK2;
+                } else {
+                    st->ck_rcv |= (uint8_t)x;
+                    st->state = ST_NMEA_EOL;
+                }
+                break;
+            case ST_NMEA_EOL:
+                if (c == '\r') {
+                    break;
+                }
+                if (c != '\n') {
+                    DEBUG_MSG("Warning: invalid NMEA sentence (end of line)\n");
+                    msg = INVALID;
+                } else if (st->ck_rcv != st->ck_a) {
+                    DEBUG_MSG("Warning: invalid NMEA sentence (bad checksum)\n");
+                    msg = INVALID;
+                } else if (st->nb_fields > LGW_GPS_NMEA_FIELDS_MAX) {
+                    DEBUG_MSG("Note: ignored NMEA sentence (number of fields)\n");
+                    msg = IGNORED;
+                } else {
+                    msg = nmea_decode(st);
+                }
+                break;
+
+            default:
+                st->state = ST_SYNC;
+                break;
         }
-        /* parse number of satellites used for fix */
-        sscanf(parser_buf + str_index[7], "%hd", &gps_sat);
-        /* parse 3D coordinates */
-        i = sscanf(parser_buf + str_index[2], "%2hd%10lf", &gps_dla, &gps_mla);
-        gps_ola = *(parser_buf + str_index[3]);
-        j = sscanf(parser_buf + str_index[4], "%3hd%10lf", &gps_dlo, &gps_mlo);
-        gps_olo = *(parser_buf + str_index[5]);
-        k = sscanf(parser_buf + str_index[9], "%hd", &gps_alt);
-        if ((i == 2) && (j == 2) && (k == 1) && ((gps_ola=='N')||(gps_ola=='S')) && ((gps_olo=='E')||(gps_olo=='W'))) {
-            gps_pos_ok = true;
-            DEBUG_MSG("Note: Valid GGA sentence, %d sat, lat %02ddeg %06.3fmin %c, lon %03ddeg%06.3fmin %c, alt %d\n", gps_sat, gps_dla, gps_mla, gps_ola, gps_dlo, gps_mlo, gps_olo, gps_alt);
-        } else {
-            /* could not get a valid latitude, longitude AND altitude */
-            gps_pos_ok = false;
-            DEBUG_MSG("Note: Valid GGA sentence, %d sat, no coordinates\n", gps_sat);
+
+        /* a frame just ended, report it before parsing further */
+        if (msg != UNKNOWN) {
+            st->state = ST_SYNC;
+            st->keep = false;
+            return msg;
         }
-        return NMEA_GGA;
-    } else {
-        DEBUG_MSG("Note: ignored NMEA sentence\n"); /* quite verbose */
-        return IGNORED;
     }
+
+    return UNKNOWN;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
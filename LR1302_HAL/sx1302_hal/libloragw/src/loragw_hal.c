@@ -36,6 +36,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_reg.h"
 #include "loragw_hal.h"
 #include "loragw_aux.h"
+#include "loragw_trace.h"
 #include "loragw_com.h"
 #include "loragw_i2c.h"
 #include "loragw_lbt.h"
@@ -44,9 +45,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_sx1261.h"
 #include "loragw_sx1302.h"
 #include "loragw_sx1302_timestamp.h"
+#include "loragw_cal.h"
 #include "loragw_stts751.h"
 #include "loragw_ad5338r.h"
 #include "loragw_debug.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- DEBUG CONSTANTS ------------------------------------------------------ */
@@ -85,6 +88,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define CONTEXT_FINE_TIMESTAMP  lgw_context.ftime_cfg
 #define CONTEXT_SX1261          lgw_context.sx1261_cfg
 #define CONTEXT_DEBUG           lgw_context.debug_cfg
+#define CONTEXT_CAL             lgw_context.cal_cfg
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
@@ -114,100 +118,153 @@ const char lgw_version_string[] = "Version: " LIBLORAGW_VERSION ";";
 #include "agc_fw_sx1257.var"    /* text_agc_sx1257_19_Nov_1 */
 
 /*
-The following static variable holds the gateway configuration provided by the
-user that need to be propagated in the drivers.
+The following macro holds the initial state of a concentrator: the gateway
+configuration provided by the user that need to be propagated in the drivers,
+and the state of the drivers.
 
 Parameters validity and coherency is verified by the _setconf functions and
 the _start and _send functions assume they are valid.
 */
-static lgw_context_t lgw_context = {
-    .is_started = false,
-    .board_cfg.com_type = LGW_COM_SPI,
-    .board_cfg.com_path = "/dev/spidev0.0",
-    .board_cfg.lorawan_public = true,
-    .board_cfg.clksrc = 0,
-    .board_cfg.full_duplex = false,
-    .rf_chain_cfg = {{0}},
-    .if_chain_cfg = {{0}},
-    .demod_cfg = {
-        .multisf_datarate = LGW_MULTI_SF_EN
-    },
-    .lora_service_cfg = {
-        .enable = 0,    /* not used, handled by if_chain_cfg */
-        .rf_chain = 0,  /* not used, handled by if_chain_cfg */
-        .freq_hz = 0,   /* not used, handled by if_chain_cfg */
-        .bandwidth = BW_250KHZ,
-        .datarate = DR_LORA_SF7,
-        .implicit_hdr = false,
-        .implicit_payload_length = 0,
-        .implicit_crc_en = 0,
-        .implicit_coderate = 0
-    },
-    .fsk_cfg = {
-        .enable = 0,    /* not used, handled by if_chain_cfg */
-        .rf_chain = 0,  /* not used, handled by if_chain_cfg */
-        .freq_hz = 0,   /* not used, handled by if_chain_cfg */
-        .bandwidth = BW_125KHZ,
-        .datarate = 50000,
-        .sync_word_size = 3,
-        .sync_word = 0xC194C1
-    },
-    .tx_gain_lut = {
-        {
-            .size = 1,
-            .lut[0] = {
-                .rf_power = 14,
-                .dig_gain = 0,
-                .pa_gain = 2,
-                .dac_gain = 3,
-                .mix_gain = 10,
-                .offset_i = 0,
-                .offset_q = 0,
-                .pwr_idx = 0
-            }
-        },{
-            .size = 1,
-            .lut[0] = {
-                .rf_power = 14,
-                .dig_gain = 0,
-                .pa_gain = 2,
-                .dac_gain = 3,
-                .mix_gain = 10,
-                .offset_i = 0,
-                .offset_q = 0,
-                .pwr_idx = 0
-            }
-        }
-    },
-    .ftime_cfg = {
-        .enable = false,
-        .mode = LGW_FTIME_MODE_ALL_SF
-    },
-    .sx1261_cfg = {
-        .enable = false,
-        .spi_path = "/dev/spidev0.1",
-        .rssi_offset = 0,
-        .lbt_conf = {
-            .rssi_target = 0,
-            .nb_channel = 0,
-            .channels = {{ 0 }}
-        }
-    },
-    .debug_cfg = {
-        .nb_ref_payload = 0,
-        .log_file_name = "loragw_hal.log"
-    }
-};
+#define LGW_CTX_INITIALIZER {                                       \
+    .hal = {                                                        \
+        .is_started = false,                                        \
+        .board_cfg.com_type = LGW_COM_SPI,                          \
+        .board_cfg.com_path = "/dev/spidev0.0",                     \
+        .board_cfg.lorawan_public = true,                           \
+        .board_cfg.clksrc = 0,                                      \
+        .board_cfg.full_duplex = false,                             \
+        .rf_chain_cfg = {{0}},                                      \
+        .if_chain_cfg = {{0}},                                      \
+        .demod_cfg = {                                              \
+            .multisf_datarate = LGW_MULTI_SF_EN                     \
+        },                                                          \
+        .lora_service_cfg = {                                       \
+            .enable = 0,    /* not used, handled by if_chain_cfg */ \
+            .rf_chain = 0,  /* not used, handled by if_chain_cfg */ \
+            .freq_hz = 0,   /* not used, handled by if_chain_cfg */ \
+            .bandwidth = BW_250KHZ,                                 \
+            .datarate = DR_LORA_SF7,                                \
+            .implicit_hdr = false,                                  \
+            .implicit_payload_length = 0,                           \
+            .implicit_crc_en = 0,                                   \
+            .implicit_coderate = 0                                  \
+        },                                                          \
+        .fsk_cfg = {                                                \
+            .enable = 0,    /* not used, handled by if_chain_cfg */ \
+            .rf_chain = 0,  /* not used, handled by if_chain_cfg */ \
+            .freq_hz = 0,   /* not used, handled by if_chain_cfg */ \
+            .bandwidth = BW_125KHZ,                                 \
+            .datarate = 50000,                                      \
+            .sync_word_size = 3,                                    \
+            .sync_word = 0xC194C1                                   \
+        },                                                          \
+        .tx_gain_lut = {                                            \
+            {                                                       \
+                .size = 1,                                          \
+                .lut[0] = {                                         \
+                    .rf_power = 14,                                 \
+                    .dig_gain = 0,                                  \
+                    .pa_gain = 2,                                   \
+                    .dac_gain = 3,                                  \
+                    .mix_gain = 10,                                 \
+                    .offset_i = 0,                                  \
+                    .offset_q = 0,                                  \
+                    .pwr_idx = 0                                    \
+                }                                                   \
+            },{                                                     \
+                .size = 1,                                          \
+                .lut[0] = {                                         \
+                    .rf_power = 14,                                 \
+                    .dig_gain = 0,                                  \
+                    .pa_gain = 2,                                   \
+                    .dac_gain = 3,                                  \
+                    .mix_gain = 10,                                 \
+                    .offset_i = 0,                                  \
+                    .offset_q = 0,                                  \
+                    .pwr_idx = 0                                    \
+                }                                                   \
+            }                                                       \
+        },                                                          \
+        .ftime_cfg = {                                              \
+            .enable = false,                                        \
+            .mode = LGW_FTIME_MODE_ALL_SF                           \
+        },                                                          \
+        .sx1261_cfg = {                                             \
+            .enable = false,                                        \
+            .spi_path = "/dev/spidev0.1",                           \
+            .rssi_offset = 0,                                       \
+            .lbt_conf = {                                           \
+                .rssi_target = 0,                                   \
+                .nb_channel = 0,                                    \
+                .channels = {{ 0 }},                                \
+                .hold_ms = 0                                        \
+            }                                                       \
+        },                                                          \
+        .cal_cfg = {                                                \
+            .cache_enable = false,                                  \
+            .cache_path = "",                                       \
+            .temp_drift = 5.0                                       \
+        },                                                          \
+        .debug_cfg = {                                              \
+            .nb_ref_payload = 0,                                    \
+            .log_file_name = "loragw_hal.log",                      \
+            .fw_check_strict = false                                \
+        }                                                           \
+    },                                                              \
+    .log_file = NULL,                                               \
+    .ts_fd = -1,                                                    \
+    .ts_addr = 0xFF,                                                \
+    .ad_fd = -1,                                                    \
+    .com_type = LGW_COM_UNKNOWN,                                    \
+    .com_target = NULL,                                             \
+    .write_mode = LGW_COM_WRITE_MODE_SINGLE,                        \
+    .spi_req_nb = 0,                                                \
+    .mcu_pipe = NULL,                                               \
+    .mcu_req_id = 0,                                                \
+    .sx1261_com_type = LGW_COM_UNKNOWN,                             \
+    .sx1261_com_target = NULL,                                      \
+    .sx1261_write_mode = LGW_COM_WRITE_MODE_SINGLE,                 \
+    .sx1261_spi_req_nb = 0,                                         \
+    .lbt_parked = false,                                            \
+    .fw_check_strict = false,                                       \
+    .rf_rx_image_amp = {0, 0},                                      \
+    .rf_rx_image_phi = {0, 0}                                       \
+}
+
+/* Context of the legacy API, and of the threads which did not select another one */
+lgw_ctx_t lgw_ctx_default = LGW_CTX_INITIALIZER;
+
+/* Initial state of the contexts created by lgw_ctx_new() */
+static const lgw_ctx_t lgw_ctx_init = LGW_CTX_INITIALIZER;
+
+/* Context selected by the calling thread */
+__thread lgw_ctx_t * lgw_ctx_tls = &lgw_ctx_default;
+
+/* State of the selected concentrator */
+#define lgw_context         (lgw_ctx_cur()->hal)
 
 /* File handle to write debug logs */
-FILE * log_file = NULL;
+#define log_file            (lgw_ctx_cur()->log_file)
 
 /* I2C temperature sensor handles */
-static int     ts_fd = -1;
-static uint8_t ts_addr = 0xFF;
+#define ts_fd               (lgw_ctx_cur()->ts_fd)
+#define ts_addr             (lgw_ctx_cur()->ts_addr)
 
 /* I2C AD5338 handles */
-static int     ad_fd = -1;
+#define ad_fd               (lgw_ctx_cur()->ad_fd)
+
+/* Run a legacy function on the concentrator of handle ctx */
+#define CTX_CALL(ctx, call)  do {                                   \
+    lgw_ctx_t * ctx_prev;                                           \
+    int ctx_err;                                                    \
+    if (ctx == NULL) {                                              \
+        return LGW_HAL_ERROR;                                       \
+    }                                                               \
+    ctx_prev = lgw_ctx_select(ctx);                                 \
+    ctx_err = call;                                                 \
+    lgw_ctx_select(ctx_prev);                                       \
+    return ctx_err;                                                 \
+} while (0)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
@@ -218,6 +275,7 @@ int32_t lgw_bw_getval(int x);
 static bool is_same_pkt(struct lgw_pkt_rx_s *p1, struct lgw_pkt_rx_s *p2);
 static int remove_pkt(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt, uint8_t pkt_index);
 static int merge_packets(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt);
+static int radio_calibrate(void);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
@@ -445,6 +503,54 @@ static int merge_packets(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt) {
     return 0;
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int radio_calibrate(void) {
+    int i, err;
+    uint64_t eui;
+    float temperature;
+
+    /* Only the sx125x calibration results can be read back and restored,
+       the sx1250 image calibration is internal to the radio */
+    if ((CONTEXT_CAL.cache_enable == false) || (CONTEXT_RF_CHAIN[CONTEXT_BOARD.clksrc].type == LGW_RADIO_TYPE_SX1250)) {
+        return sx1302_radio_calibrate(&CONTEXT_RF_CHAIN[0], CONTEXT_BOARD.clksrc, &CONTEXT_TX_GAIN_LUT[0]);
+    }
+
+    /* The sx1302 needs its clock to read the EUI from OTP */
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        if (CONTEXT_RF_CHAIN[i].enable == true) {
+            err  = sx1302_radio_reset(i, CONTEXT_RF_CHAIN[i].type);
+            err |= sx1302_radio_set_mode(i, CONTEXT_RF_CHAIN[i].type);
+            if (err != LGW_REG_SUCCESS) {
+                fprintf(stderr,"ERROR: failed to reset radio %d\n", i);
+                return LGW_REG_ERROR;
+            }
+        }
+    }
+    err  = sx1302_radio_clock_select(CONTEXT_BOARD.clksrc);
+    err |= sx1302_get_eui(&eui);
+    if (err != LGW_REG_SUCCESS) {
+        fprintf(stderr,"ERROR: failed to get concentrator EUI\n");
+        return LGW_REG_ERROR;
+    }
+    if (lgw_get_temperature(&temperature) != LGW_HAL_SUCCESS) {
+        fprintf(stderr,"WARNING: failed to get temperature, calibration cache not used\n");
+        return sx1302_radio_calibrate(&CONTEXT_RF_CHAIN[0], CONTEXT_BOARD.clksrc, &CONTEXT_TX_GAIN_LUT[0]);
+    }
+
+    if (sx1302_cal_cache_load(CONTEXT_CAL.cache_path, eui, CONTEXT_BOARD.clksrc, &CONTEXT_RF_CHAIN[0], &CONTEXT_TX_GAIN_LUT[0], temperature, CONTEXT_CAL.temp_drift) == LGW_HAL_SUCCESS) {
+        return LGW_REG_SUCCESS;
+    }
+
+    err = sx1302_radio_calibrate(&CONTEXT_RF_CHAIN[0], CONTEXT_BOARD.clksrc, &CONTEXT_TX_GAIN_LUT[0]);
+    if (err == LGW_REG_SUCCESS) {
+        /* not fatal, next start will calibrate again */
+        sx1302_cal_cache_save(CONTEXT_CAL.cache_path, eui, CONTEXT_BOARD.clksrc, &CONTEXT_RF_CHAIN[0], &CONTEXT_TX_GAIN_LUT[0], temperature);
+    }
+
+    return err;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -458,7 +564,7 @@ int lgw_board_setconf(struct lgw_conf_board_s * conf) {
     }
 
     /* Check input parameters */
-    if ((conf->com_type != LGW_COM_SPI) && (conf->com_type != LGW_COM_USB)) {
+    if ((conf->com_type != LGW_COM_SPI) && (conf->com_type != LGW_COM_USB) && (conf->com_type != LGW_COM_SIM)) {
         DEBUG_MSG("ERROR: WRONG COM TYPE\n");
         return LGW_HAL_ERROR;
     }
@@ -471,7 +577,7 @@ int lgw_board_setconf(struct lgw_conf_board_s * conf) {
     strncpy(CONTEXT_COM_PATH, conf->com_path, sizeof CONTEXT_COM_PATH);
     CONTEXT_COM_PATH[sizeof CONTEXT_COM_PATH - 1] = '\0'; /* ensure string termination */
 
-    DEBUG_fprintf(stderr,"Note: board configuration: com_type: %s, com_path: %s, lorawan_public:%d, clksrc:%d, full_duplex:%d\n",   (CONTEXT_COM_TYPE == LGW_COM_SPI) ? "SPI" : "USB",
+    DEBUG_fprintf(stderr,"Note: board configuration: com_type: %s, com_path: %s, lorawan_public:%d, clksrc:%d, full_duplex:%d\n",   (CONTEXT_COM_TYPE == LGW_COM_SPI) ? "SPI" : ((CONTEXT_COM_TYPE == LGW_COM_USB) ? "USB" : "SIM"),
                                                                                                                             CONTEXT_COM_PATH,
                                                                                                                             CONTEXT_LWAN_PUBLIC,
                                                                                                                             CONTEXT_BOARD.clksrc,
@@ -709,6 +815,42 @@ int lgw_rxif_setconf(uint8_t if_chain, struct lgw_conf_rxif_s * conf) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int lgw_rxif_set_fsk_datarate(uint32_t datarate) {
+    int err;
+    struct lgw_conf_rxif_s fsk_cfg;
+
+    /* check if the concentrator is running */
+    if (CONTEXT_STARTED == false) {
+        DEBUG_MSG("ERROR: CONCENTRATOR IS NOT RUNNING, START IT BEFORE CHANGING FSK DATARATE\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* check input parameters */
+    if (CONTEXT_IF_CHAIN[9].enable == false) {
+        DEBUG_MSG("ERROR: FSK IF CHAIN IS NOT ENABLED\n");
+        return LGW_HAL_ERROR;
+    }
+    if (!IS_FSK_DR(datarate)) {
+        DEBUG_MSG("ERROR: DATARATE NOT SUPPORTED BY FSK IF CHAIN\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* the modem takes the new bitrate for the next packet, the context is
+       only updated once it is applied */
+    fsk_cfg = CONTEXT_FSK;
+    fsk_cfg.datarate = datarate;
+    err = sx1302_fsk_configure(&fsk_cfg);
+    if (err != LGW_REG_SUCCESS) {
+        fprintf(stderr,"ERROR: failed to configure SX1302 FSK modem\n");
+        return LGW_HAL_ERROR;
+    }
+    CONTEXT_FSK.datarate = datarate;
+
+    return LGW_HAL_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int lgw_demod_setconf(struct lgw_conf_demod_s * conf) {
     CHECK_NULL(conf);
 
@@ -800,6 +942,7 @@ int lgw_sx1261_setconf(struct lgw_conf_sx1261_s * conf) {
     CONTEXT_SX1261.lbt_conf.enable = conf->lbt_conf.enable;
     CONTEXT_SX1261.lbt_conf.rssi_target = conf->lbt_conf.rssi_target;
     CONTEXT_SX1261.lbt_conf.nb_channel = conf->lbt_conf.nb_channel;
+    CONTEXT_SX1261.lbt_conf.hold_ms = conf->lbt_conf.hold_ms;
     for (i = 0; i < CONTEXT_SX1261.lbt_conf.nb_channel; i++) {
         if (conf->lbt_conf.channels[i].bandwidth != BW_125KHZ && conf->lbt_conf.channels[i].bandwidth != BW_250KHZ) {
             fprintf(stderr,"ERROR: bandwidth not supported for LBT channel %d\n", i);
@@ -840,6 +983,35 @@ int lgw_debug_setconf(struct lgw_conf_debug_s * conf) {
         CONTEXT_DEBUG.log_file_name[sizeof CONTEXT_DEBUG.log_file_name - 1] = '\0'; /* ensure string termination */
     }
 
+    CONTEXT_DEBUG.fw_check_strict = conf->fw_check_strict;
+
+    return LGW_HAL_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_cal_setconf(struct lgw_conf_cal_s * conf) {
+    CHECK_NULL(conf);
+
+    if (CONTEXT_STARTED == true) {
+        DEBUG_MSG("Note: calibration cache configuration will be used at next start\n");
+    }
+    if ((conf->cache_enable == true) && (conf->cache_path[0] == '\0')) {
+        fprintf(stderr,"ERROR: no path given for the calibration cache\n");
+        return LGW_HAL_ERROR;
+    }
+    if (conf->temp_drift <= 0.0) {
+        fprintf(stderr,"ERROR: invalid calibration cache temperature drift (%.1f)\n", conf->temp_drift);
+        return LGW_HAL_ERROR;
+    }
+
+    CONTEXT_CAL.cache_enable = conf->cache_enable;
+    strncpy(CONTEXT_CAL.cache_path, conf->cache_path, sizeof CONTEXT_CAL.cache_path);
+    CONTEXT_CAL.cache_path[sizeof CONTEXT_CAL.cache_path - 1] = '\0'; /* ensure string termination */
+    CONTEXT_CAL.temp_drift = conf->temp_drift;
+
+    DEBUG_fprintf(stderr,"Note: calibration cache: enable:%d, path:%s, temp_drift:%.1f\n", CONTEXT_CAL.cache_enable, CONTEXT_CAL.cache_path, CONTEXT_CAL.temp_drift);
+
     return LGW_HAL_SUCCESS;
 }
 
@@ -868,10 +1040,50 @@ int lgw_start(void) {
         return LGW_HAL_ERROR;
     }
 
-    /* Calibrate radios */
-    err = sx1302_radio_calibrate(&CONTEXT_RF_CHAIN[0], CONTEXT_BOARD.clksrc, &CONTEXT_TX_GAIN_LUT[0]);
+    /* Full or sampled read back of the MCU firmwares */
+    sx1302_set_fw_check_strict(CONTEXT_DEBUG.fw_check_strict);
+
+    /* The temperature is needed to validate the calibration cache */
+    if (CONTEXT_COM_TYPE == LGW_COM_SPI) {
+        /* Sensor left open by a start which failed */
+        if (ts_fd != -1) {
+            i2c_linuxdev_close(ts_fd);
+            ts_fd = -1;
+        }
+
+        /* Find the temperature sensor on the known supported ports */
+        for (i = 0; i < (int)(sizeof I2C_PORT_TEMP_SENSOR); i++) {
+            ts_addr = I2C_PORT_TEMP_SENSOR[i];
+            err = i2c_linuxdev_open(I2C_DEVICE, ts_addr, &ts_fd);
+            if (err != LGW_I2C_SUCCESS) {
+                fprintf(stderr,"ERROR: failed to open I2C for temperature sensor on port 0x%02X\n", ts_addr);
+                return LGW_HAL_ERROR;
+            }
+
+            err = stts751_configure(ts_fd, ts_addr);
+            if (err != LGW_I2C_SUCCESS) {
+                fprintf(stderr,"INFO: no temperature sensor found on port 0x%02X\n", ts_addr);
+                i2c_linuxdev_close(ts_fd);
+                ts_fd = -1;
+            } else {
+                fprintf(stderr,"INFO: found temperature sensor on port 0x%02X\n", ts_addr);
+                break;
+            }
+        }
+        if (i == sizeof I2C_PORT_TEMP_SENSOR) {
+            fprintf(stderr,"ERROR: no temperature sensor found.\n");
+            return LGW_HAL_ERROR;
+        }
+    }
+
+    /* Calibrate radios, or restore the results of a previous calibration */
+    err = radio_calibrate();
     if (err != LGW_REG_SUCCESS) {
         fprintf(stderr,"ERROR: radio calibration failed\n");
+        if (ts_fd != -1) {
+            i2c_linuxdev_close(ts_fd);
+            ts_fd = -1;
+        }
         return LGW_HAL_ERROR;
     }
 
@@ -1093,30 +1305,6 @@ int lgw_start(void) {
     dbg_init_random();
 
     if (CONTEXT_COM_TYPE == LGW_COM_SPI) {
-        /* Find the temperature sensor on the known supported ports */
-        for (i = 0; i < (int)(sizeof I2C_PORT_TEMP_SENSOR); i++) {
-            ts_addr = I2C_PORT_TEMP_SENSOR[i];
-            err = i2c_linuxdev_open(I2C_DEVICE, ts_addr, &ts_fd);
-            if (err != LGW_I2C_SUCCESS) {
-                fprintf(stderr,"ERROR: failed to open I2C for temperature sensor on port 0x%02X\n", ts_addr);
-                return LGW_HAL_ERROR;
-            }
-
-            err = stts751_configure(ts_fd, ts_addr);
-            if (err != LGW_I2C_SUCCESS) {
-                fprintf(stderr,"INFO: no temperature sensor found on port 0x%02X\n", ts_addr);
-                i2c_linuxdev_close(ts_fd);
-                ts_fd = -1;
-            } else {
-                fprintf(stderr,"INFO: found temperature sensor on port 0x%02X\n", ts_addr);
-                break;
-            }
-        }
-        if (i == sizeof I2C_PORT_TEMP_SENSOR) {
-            fprintf(stderr,"ERROR: no temperature sensor found.\n");
-            return LGW_HAL_ERROR;
-        }
-
         /* Configure ADC AD338R for full duplex (CN490 reference design) */
         if (CONTEXT_BOARD.full_duplex == true) {
             err = i2c_linuxdev_open(I2C_DEVICE, I2C_PORT_DAC_AD5338R, &ad_fd);
@@ -1208,6 +1396,14 @@ int lgw_stop(void) {
         }
     }
 
+    /* Release the SX1261 if it was kept on a TX channel */
+    if ((CONTEXT_SX1261.enable == true) && (CONTEXT_SX1261.lbt_conf.enable == true)) {
+        if (lgw_lbt_release() != 0) {
+            fprintf(stderr,"WARNING: failed to release LBT\n");
+            err = LGW_HAL_ERROR;
+        }
+    }
+
     /* Close log file */
     if (log_file != NULL) {
         fclose(log_file);
@@ -1228,6 +1424,7 @@ int lgw_stop(void) {
             fprintf(stderr,"ERROR: failed to close I2C temperature sensor device (err=%i)\n", x);
             err = LGW_HAL_ERROR;
         }
+        ts_fd = -1;
 
         if (CONTEXT_BOARD.full_duplex == true) {
             DEBUG_MSG("INFO: Closing I2C for AD5338R\n");
@@ -1254,31 +1451,23 @@ int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
     uint8_t nb_pkt_found = 0;
     uint8_t nb_pkt_left = 0;
     float current_temperature = 0.0, rssi_temperature_offset = 0.0;
-    /* performances variables */
-    struct timeval tm;
 
     DEBUG_fprintf(stderr," --- %s\n", "IN");
 
     /* Record function start time */
-    _meas_time_start(&tm);
-
-    /* Get packets from SX1302, if any */
-    res = sx1302_fetch(&nb_pkt_fetched);
-    if (res != LGW_REG_SUCCESS) {
-        fprintf(stderr,"ERROR: failed to fetch packets from SX1302\n");
-        return LGW_HAL_ERROR;
-    }
+    LGW_TRACE_BEGIN(LGW_TRACE_HAL_RECEIVE, max_pkt);
 
-    /* Update internal counter */
+    /* Get packets from SX1302, if any, and update internal counter */
     /* WARNING: this needs to be called regularly by the upper layer */
-    res = sx1302_update();
+    res = sx1302_poll(&nb_pkt_fetched);
     if (res != LGW_REG_SUCCESS) {
+        fprintf(stderr,"ERROR: failed to fetch packets from SX1302\n");
         return LGW_HAL_ERROR;
     }
 
     /* Exit now if no packet fetched */
     if (nb_pkt_fetched == 0) {
-        _meas_time_stop(1, tm, __FUNCTION__);
+        LGW_TRACE_END(LGW_TRACE_HAL_RECEIVE, 0);
         return 0;
     }
     if (nb_pkt_fetched > max_pkt) {
@@ -1327,7 +1516,7 @@ int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
         DEBUG_fprintf(stderr,"INFO: nb pkt found:%u (after de-duplicating)\n", nb_pkt_found);
     }
 
-    _meas_time_stop(1, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_HAL_RECEIVE, nb_pkt_found);
 
     DEBUG_fprintf(stderr," --- %s\n", "OUT");
 
@@ -1339,13 +1528,11 @@ int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
 int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
     int err;
     bool lbt_tx_allowed;
-    /* performances variables */
-    struct timeval tm;
 
     DEBUG_fprintf(stderr," --- %s\n", "IN");
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_HAL_SEND, 0);
 
     /* check if the concentrator is running */
     if (CONTEXT_STARTED == false) {
@@ -1437,7 +1624,7 @@ int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
         fprintf(stderr,"ERROR: %s: Failed to send packet\n", __FUNCTION__);
 
         if (CONTEXT_SX1261.lbt_conf.enable == true) {
-            err = lgw_lbt_stop();
+            err = lgw_lbt_release();
             if (err != 0) {
                 fprintf(stderr,"ERROR: %s: Failed to stop LBT\n", __FUNCTION__);
             }
@@ -1446,7 +1633,7 @@ int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
         return LGW_HAL_ERROR;
     }
 
-    _meas_time_stop(1, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_HAL_SEND, LGW_HAL_SUCCESS);
 
     /* Stop Listen-Before-Talk */
     if (CONTEXT_SX1261.lbt_conf.enable == true) {
@@ -1457,7 +1644,7 @@ int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
             if (err != 0) {
                 fprintf(stderr,"ERROR: %s: Failed to abort TX\n", __FUNCTION__);
             }
-            err = lgw_lbt_stop();
+            err = lgw_lbt_release();
             if (err != 0) {
                 fprintf(stderr,"ERROR: %s: Failed to stop LBT\n", __FUNCTION__);
             }
@@ -1465,11 +1652,12 @@ int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
         }
         if (lbt_tx_allowed == true) {
             fprintf(stderr,"LBT: packet is allowed to be transmitted\n");
+            err = lgw_lbt_stop();
         } else {
             fprintf(stderr,"LBT: (ERROR) packet is NOT allowed to be transmitted\n");
+            /* busy channel: do not reuse this scan, the next packet gets a fresh one */
+            err = lgw_lbt_release();
         }
-
-        err = lgw_lbt_stop();
         if (err != 0) {
             fprintf(stderr,"ERROR: %s: Failed to stop LBT\n", __FUNCTION__);
             return LGW_HAL_ERROR;
@@ -1600,6 +1788,7 @@ int lgw_get_temperature(float* temperature) {
             err = stts751_get_temperature(ts_fd, ts_addr, temperature);
             break;
         case LGW_COM_USB:
+        case LGW_COM_SIM:
             err = lgw_com_get_temperature(temperature);
             break;
         default:
@@ -1667,6 +1856,9 @@ int lgw_spectral_scan_start(uint32_t freq_hz, uint16_t nb_scan) {
         return LGW_HAL_ERROR;
     }
 
+    /* the SX1261 is retuned, a LBT scan in progress on a TX channel is lost */
+    lgw_lbt_forget();
+
     err = sx1261_set_rx_params(freq_hz, BW_125KHZ);
     if (err != LGW_REG_SUCCESS) {
         fprintf(stderr,"ERROR: Failed to set RX params for Spectral Scan\n");
@@ -1700,4 +1892,158 @@ int lgw_spectral_scan_abort() {
     return sx1261_spectral_scan_abort();
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+lgw_ctx_t * lgw_ctx_new(void) {
+    lgw_ctx_t * ctx;
+
+    ctx = malloc(sizeof *ctx);
+    if (ctx == NULL) {
+        printf("ERROR: failed to allocate concentrator context\n");
+        return NULL;
+    }
+    memcpy(ctx, &lgw_ctx_init, sizeof *ctx);
+
+    return ctx;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_ctx_free(lgw_ctx_t * ctx) {
+    if ((ctx == NULL) || (ctx == &lgw_ctx_default)) {
+        return;
+    }
+    if (ctx->hal.is_started == true) {
+        printf("WARNING: releasing the context of a concentrator which is still started\n");
+    }
+    if (lgw_ctx_tls == ctx) {
+        lgw_ctx_tls = &lgw_ctx_default;
+    }
+    free(ctx);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+lgw_ctx_t * lgw_ctx_select(lgw_ctx_t * ctx) {
+    lgw_ctx_t * prev = lgw_ctx_tls;
+
+    lgw_ctx_tls = (ctx != NULL) ? ctx : &lgw_ctx_default;
+
+    return prev;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_board_setconf(lgw_ctx_t * ctx, struct lgw_conf_board_s * conf) {
+    CTX_CALL(ctx, lgw_board_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_rxrf_setconf(lgw_ctx_t * ctx, uint8_t rf_chain, struct lgw_conf_rxrf_s * conf) {
+    CTX_CALL(ctx, lgw_rxrf_setconf(rf_chain, conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_rxif_setconf(lgw_ctx_t * ctx, uint8_t if_chain, struct lgw_conf_rxif_s * conf) {
+    CTX_CALL(ctx, lgw_rxif_setconf(if_chain, conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_demod_setconf(lgw_ctx_t * ctx, struct lgw_conf_demod_s * conf) {
+    CTX_CALL(ctx, lgw_demod_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_txgain_setconf(lgw_ctx_t * ctx, uint8_t rf_chain, struct lgw_tx_gain_lut_s * conf) {
+    CTX_CALL(ctx, lgw_txgain_setconf(rf_chain, conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_ftime_setconf(lgw_ctx_t * ctx, struct lgw_conf_ftime_s * conf) {
+    CTX_CALL(ctx, lgw_ftime_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_sx1261_setconf(lgw_ctx_t * ctx, struct lgw_conf_sx1261_s * conf) {
+    CTX_CALL(ctx, lgw_sx1261_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_cal_setconf(lgw_ctx_t * ctx, struct lgw_conf_cal_s * conf) {
+    CTX_CALL(ctx, lgw_cal_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_debug_setconf(lgw_ctx_t * ctx, struct lgw_conf_debug_s * conf) {
+    CTX_CALL(ctx, lgw_debug_setconf(conf));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_start(lgw_ctx_t * ctx) {
+    CTX_CALL(ctx, lgw_start());
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_stop(lgw_ctx_t * ctx) {
+    CTX_CALL(ctx, lgw_stop());
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_receive(lgw_ctx_t * ctx, uint8_t max_pkt, struct lgw_pkt_rx_s * pkt_data) {
+    CTX_CALL(ctx, lgw_receive(max_pkt, pkt_data));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_send(lgw_ctx_t * ctx, struct lgw_pkt_tx_s * pkt_data) {
+    CTX_CALL(ctx, lgw_send(pkt_data));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_status(lgw_ctx_t * ctx, uint8_t rf_chain, uint8_t select, uint8_t * code) {
+    CTX_CALL(ctx, lgw_status(rf_chain, select, code));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_abort_tx(lgw_ctx_t * ctx, uint8_t rf_chain) {
+    CTX_CALL(ctx, lgw_abort_tx(rf_chain));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_get_trigcnt(lgw_ctx_t * ctx, uint32_t * trig_cnt_us) {
+    CTX_CALL(ctx, lgw_get_trigcnt(trig_cnt_us));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_get_instcnt(lgw_ctx_t * ctx, uint32_t * inst_cnt_us) {
+    CTX_CALL(ctx, lgw_get_instcnt(inst_cnt_us));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_get_eui(lgw_ctx_t * ctx, uint64_t * eui) {
+    CTX_CALL(ctx, lgw_get_eui(eui));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_ctx_get_temperature(lgw_ctx_t * ctx, float * temperature) {
+    CTX_CALL(ctx, lgw_get_temperature(temperature));
+}
+
 /* --- EOF ------------------------------------------------------------------ */
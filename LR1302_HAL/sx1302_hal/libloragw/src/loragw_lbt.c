@@ -27,6 +27,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <stdlib.h>     /* llabs */
 
 #include "loragw_aux.h"
+#include "loragw_trace.h"
+#include "loragw_ctx.h"
 #include "loragw_lbt.h"
 #include "loragw_sx1261.h"
 #include "loragw_sx1302.h"
@@ -43,6 +45,17 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
     #define DEBUG_PRINTF(fmt, args...)
 #endif
 
+/* SX1261 parking state, in the context of the calling thread */
+#define _lbt_parked         (lgw_ctx_cur()->lbt_parked)
+#define _lbt_freq_hz        (lgw_ctx_cur()->lbt_freq_hz)
+#define _lbt_bandwidth      (lgw_ctx_cur()->lbt_bandwidth)
+#define _lbt_scan_start     (lgw_ctx_cur()->lbt_scan_start)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define LBT_SENSE_MARGIN_MS 2   /* channel sensing is checked 1.5ms before the packet departure time */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
@@ -86,11 +99,10 @@ int lgw_lbt_start(const struct lgw_conf_sx1261_s * sx1261_context, const struct
     int err;
     int lbt_channel_selected;
     uint32_t toa_ms;
-    /* performances variables */
-    struct timeval tm;
+    int32_t hold_ms, delay_ms;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_LBT_START, 0);
 
     /* Check if we have a LBT channel for this transmit frequency */
     lbt_channel_selected = is_lbt_channel(&(sx1261_context->lbt_conf), pkt->freq_hz, pkt->bandwidth);
@@ -111,21 +123,52 @@ int lgw_lbt_start(const struct lgw_conf_sx1261_s * sx1261_context, const struct
         return -1;
     }
 
-    /* Set LBT scan frequency */
-    err = sx1261_set_rx_params(pkt->freq_hz, pkt->bandwidth);
-    if (err != 0) {
-        printf("ERROR: Cannot start LBT - unable to set sx1261 RX parameters\n");
-        return -1;
+    /* The SX1261 kept scanning this channel since the last packet: its result is reused as long as the
+       packet ends within both the hold time and the allowed transmit time from the start of the scan,
+       counted up to the departure of the packet, not to now */
+    hold_ms = (int32_t)sx1261_context->lbt_conf.channels[lbt_channel_selected].transmit_time_ms - (int32_t)toa_ms - LBT_SENSE_MARGIN_MS;
+    if (hold_ms > (int32_t)sx1261_context->lbt_conf.hold_ms) {
+        hold_ms = sx1261_context->lbt_conf.hold_ms;
+    }
+    if (pkt->tx_mode == IMMEDIATE) {
+        delay_ms = 0;
+    } else if ((_lbt_parked == true) && (pkt->tx_mode == TIMESTAMPED)) {
+        /* a packet already late departs now */
+        delay_ms = (int32_t)(pkt->count_us - sx1302_timestamp_counter(false));
+        delay_ms = (delay_ms > 0) ? ((delay_ms + 999) / 1000) : 0;
+    } else {
+        delay_ms = hold_ms; /* departure on the next PPS, not known here */
+    }
+    hold_ms -= delay_ms;
+    if ((_lbt_parked == true) && (hold_ms > 0) && (_lbt_freq_hz == pkt->freq_hz) && (_lbt_bandwidth == pkt->bandwidth) &&
+        (timeout_check(_lbt_scan_start, (uint32_t)hold_ms) == 0)) {
+        DEBUG_PRINTF("LBT: reuse scan of %u Hz\n", pkt->freq_hz);
+        LGW_TRACE_END(LGW_TRACE_LBT_START, 1);
+        return 0;
     }
 
-    /* Start LBT */
-    err = sx1261_lbt_start(sx1261_context->lbt_conf.channels[lbt_channel_selected].scan_time_us, sx1261_context->lbt_conf.rssi_target + sx1261_context->rssi_offset);
+    /* Set LBT scan frequency and start LBT, in one SX1261 transfer */
+    _lbt_parked = false;
+    err = sx1261_lbt_start_on(pkt->freq_hz, pkt->bandwidth, sx1261_context->lbt_conf.channels[lbt_channel_selected].scan_time_us, sx1261_context->lbt_conf.rssi_target + sx1261_context->rssi_offset);
     if (err != 0) {
         printf("ERROR: Cannot start LBT - sx1261 LBT start\n");
         return -1;
     }
 
-    _meas_time_stop(3, tm, __FUNCTION__);
+    /* the scan started scan_time_us ago, sx1261_lbt_start_on() waited for it */
+    if (sx1261_context->lbt_conf.hold_ms > 0) {
+        _lbt_parked = true;
+        _lbt_freq_hz = pkt->freq_hz;
+        _lbt_bandwidth = pkt->bandwidth;
+        timeout_start(&_lbt_scan_start);
+        _lbt_scan_start.tv_usec -= (suseconds_t)sx1261_context->lbt_conf.channels[lbt_channel_selected].scan_time_us;
+        if (_lbt_scan_start.tv_usec < 0) {
+            _lbt_scan_start.tv_usec += 1000000;
+            _lbt_scan_start.tv_sec -= 1;
+        }
+    }
+
+    LGW_TRACE_END(LGW_TRACE_LBT_START, 0);
 
     return 0;
 }
@@ -137,11 +180,9 @@ int lgw_lbt_tx_status(uint8_t rf_chain, bool * tx_ok) {
     uint8_t status;
     bool tx_timeout = false;
     struct timeval tm_start;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_LBT_TX_STATUS, rf_chain);
 
     /* Wait for transmit to be initiated */
     /* Bit 0 in status: TX has been initiated on Radio A */
@@ -162,8 +203,11 @@ int lgw_lbt_tx_status(uint8_t rf_chain, bool * tx_ok) {
             printf("ERROR: %s: failed to get AGC status\n", __FUNCTION__);
             return -1;
         }
+        if ((status & (1 << rf_chain)) != 0x00) {
+            break;
+        }
         wait_ms(1);
-    } while ((status & (1 << rf_chain)) == 0x00);
+    } while (1);
 
     if (tx_timeout == false) {
         /* Check if the packet has been transmitted or blocked by LBT */
@@ -195,13 +239,16 @@ int lgw_lbt_tx_status(uint8_t rf_chain, bool * tx_ok) {
             printf("ERROR: %s: failed to get AGC status\n", __FUNCTION__);
             return -1;
         }
+        if (status == 0x00) {
+            break;
+        }
         wait_ms(1);
-    } while (status != 0x00);
+    } while (1);
 
     /* Acknoledge */
     sx1302_agc_mailbox_write(0, 0x00);
 
-    _meas_time_stop(3, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_LBT_TX_STATUS, tx_timeout);
 
     if (tx_timeout == true) {
         return -1;
@@ -215,11 +262,13 @@ int lgw_lbt_tx_status(uint8_t rf_chain, bool * tx_ok) {
 int lgw_lbt_stop(void) {
     int err;
 
-    /* performances variables */
-    struct timeval tm;
+    /* Keep the SX1261 scanning the channel for the next packet of the burst */
+    if (_lbt_parked == true) {
+        return 0;
+    }
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_LBT_STOP, 0);
 
     err = sx1261_lbt_stop();
     if (err != 0) {
@@ -227,9 +276,22 @@ int lgw_lbt_stop(void) {
         return -1;
     }
 
-    _meas_time_stop(3, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_LBT_STOP, 0);
 
     return 0;
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_lbt_release(void) {
+    _lbt_parked = false;
+    return lgw_lbt_stop();
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_lbt_forget(void) {
+    _lbt_parked = false;
+}
+
 /* --- EOF ------------------------------------------------------------------ */
@@ -18,17 +18,30 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
 #include <stdint.h>     /* C99 types */
 #include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf fprintf */
-#include <stdlib.h>     /* rand */
+#include <stdlib.h>     /* malloc free */
 #include <unistd.h>     /* lseek, close */
 #include <string.h>     /* memset */
 #include <errno.h>      /* Error number definitions */
 #include <termios.h>    /* POSIX terminal control definitions */
+#include <time.h>       /* clock_gettime */
+#include <poll.h>       /* poll */
+#include <pthread.h>    /* reader thread */
+#include <sys/uio.h>    /* writev */
 
 #include "loragw_mcu.h"
 #include "loragw_aux.h"
+#include "loragw_trace.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -51,51 +64,67 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define DEBUG_VERBOSE 0
 #endif
 
-#define HEADER_CMD_SIZE 4
+#define PIPE_POLL_MS    100 /* period at which the reader thread checks if it must stop */
+#define PIPE_STACK_SIZE (64 * 1024) /* reader thread stack, locked whole if the process called mlockall */
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE TYPES -------------------------------------------------------- */
 
-typedef struct spi_req_bulk_s {
-    uint16_t size;
-    uint8_t nb_req;
-    uint8_t buffer[LGW_USB_BURST_CHUNK];
-} spi_req_bulk_t;
+/**
+@struct mcu_pipe_s
+@brief Requests in flight on a USB link, and the thread reading their ACKs
+*/
+struct mcu_pipe_s {
+    int fd;
+    bool running;                           /*!> cleared to stop the reader thread */
+    bool alive;                             /*!> cleared by the reader thread on I/O error */
+    pthread_t thread;
+    pthread_mutex_t mx;                     /*!> protects pending[] and the requests in it */
+    pthread_cond_t cond;                    /*!> signaled when a request is done or a slot is freed */
+    pthread_mutex_t mx_write;               /*!> keeps the frames of concurrent requests apart */
+    mcu_req_t * pending[MCU_PIPE_DEPTH];    /*!> requests waiting for their ACK */
+};
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES  --------------------------------------------------- */
 
-static uint8_t buf_hdr[HEADER_CMD_SIZE];
-
-static spi_req_bulk_t spi_bulk_buffer = {
-    .size = 0,
-    .nb_req = 0,
-    .buffer = { 0 }
-};
+/* held by the context of the selected concentrator */
+#define spi_bulk_buffer     (lgw_ctx_cur()->spi_bulk_buffer)
+#define mcu_pipe            (lgw_ctx_cur()->mcu_pipe)
+#define mcu_req_id          (lgw_ctx_cur()->mcu_req_id)
+#define bulk_req            (lgw_ctx_cur()->mcu_bulk_req)
+#define bulk_pending        (lgw_ctx_cur()->mcu_bulk_pending)
+#define bulk_inflight       (lgw_ctx_cur()->mcu_bulk_inflight)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
-int spi_req_bulk_insert(spi_req_bulk_t * bulk_buffer, uint8_t * req, uint16_t req_size) {
+int spi_req_bulk_insert(spi_req_bulk_t * bulk_buffer, const uint8_t * req, uint16_t req_size, const uint8_t * payload, uint16_t payload_size) {
     /* Check input parameters */
     CHECK_NULL(bulk_buffer);
     CHECK_NULL(req);
+    if ((payload_size > 0) && (payload == NULL)) {
+        return -1;
+    }
 
     if (bulk_buffer->nb_req == 255) {
         printf("ERROR: cannot insert a new SPI request in bulk buffer - too many requests\n");
         return -1;
     }
 
-    if ((bulk_buffer->size + req_size) > LGW_USB_BURST_CHUNK) {
+    if ((bulk_buffer->size + req_size + payload_size) > LGW_USB_BURST_CHUNK) {
         printf("ERROR: cannot insert a new SPI request in bulk buffer - buffer full\n");
         return -1;
     }
 
-    /* Add a new request entry in storage buffer */
+    /* Add a new request entry in storage buffer, header then payload */
     memcpy(bulk_buffer->buffer + bulk_buffer->size, req, req_size);
+    if (payload_size > 0) {
+        memcpy(bulk_buffer->buffer + bulk_buffer->size + req_size, payload, payload_size);
+    }
 
     bulk_buffer->nb_req += 1;
-    bulk_buffer->size += req_size;
+    bulk_buffer->size += req_size + payload_size;
 
     return 0;
 }
@@ -190,119 +219,185 @@ const char * spi_status_get_str(const uint8_t status) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int write_req(int fd, order_id_t cmd, const uint8_t * payload, uint16_t payload_size ) {
+int write_req(int fd, uint8_t id, order_id_t cmd, const struct iovec * payload, int payload_cnt) {
     uint8_t buf_w[HEADER_CMD_SIZE];
-    int n;
-    /* performances variables */
-    struct timeval tm;
+    struct iovec iov[1 + MCU_REQ_IOV_MAX];
+    int iovcnt = 1;
+    size_t payload_size = 0;
+    ssize_t n;
+    int i;
     /* debug variables */
 #if DEBUG_MCU == 1
     struct timeval write_tv;
 #endif
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_MCU_WRITE_REQ, cmd);
 
     /* Check input params */
+    if ((payload_cnt < 0) || (payload_cnt > MCU_REQ_IOV_MAX) || ((payload_cnt > 0) && (payload == NULL))) {
+        printf("ERROR: invalid payload\n");
+        return -1;
+    }
+
+    /* Command payload, sent from the caller buffers */
+    for (i = 0; i < payload_cnt; i++) {
+        if (payload[i].iov_len == 0) {
+            continue;
+        }
+        if (payload[i].iov_base == NULL) {
+            printf("ERROR: invalid payload\n");
+            return -1;
+        }
+        iov[iovcnt++] = payload[i];
+        payload_size += payload[i].iov_len;
+    }
     if (payload_size > MAX_SIZE_COMMAND) {
-        printf("ERROR: payload size exceeds maximum transfer size (req:%u, max:%d)\n", payload_size, MAX_SIZE_COMMAND);
+        printf("ERROR: payload size exceeds maximum transfer size (req:%zu, max:%d)\n", payload_size, MAX_SIZE_COMMAND);
         return -1;
     }
 
-    /* Write command header */
-    buf_w[0] = rand() % 255;
+    /* Command header */
+    buf_w[0] = id;
     buf_w[1] = (uint8_t)(payload_size >> 8); /* MSB */
     buf_w[2] = (uint8_t)(payload_size >> 0); /* LSB */
     buf_w[3] = cmd;
-    n = write(fd, buf_w, HEADER_CMD_SIZE);
-    if (n < 0) {
-        printf("ERROR: failed to write command header to com port\n");
-        return -1;
-    }
+    iov[0].iov_base = buf_w;
+    iov[0].iov_len = HEADER_CMD_SIZE;
 
-    /* Write command payload */
-    if (payload_size > 0) {
-        if (payload == NULL) {
-            printf("ERROR: invalid payload\n");
-            return -1;
+#if DEBUG_VERBOSE
+    int j;
+    for (i = 0; i < iovcnt; i++) {
+        for (j = 0; j < (int)iov[i].iov_len; j++) {
+            printf("%02X ", ((uint8_t *)iov[i].iov_base)[j]);
         }
-        n = write(fd, payload, payload_size);
+    }
+    printf("\n");
+#endif
+
+    /* Write header and payload with one system call, handle partial writes */
+    i = 0;
+    while (i < iovcnt) {
+        n = writev(fd, &iov[i], iovcnt - i);
         if (n < 0) {
-            printf("ERROR: failed to write command payload to com port\n");
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("ERROR: failed to write command to com port\n");
             return -1;
         }
+        while ((i < iovcnt) && ((size_t)n >= iov[i].iov_len)) {
+            n -= iov[i].iov_len;
+            i += 1;
+        }
+        if (i < iovcnt) {
+            iov[i].iov_base = (uint8_t *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
     }
 
 #if DEBUG_MCU == 1
     gettimeofday(&write_tv, NULL);
 #endif
-    DEBUG_PRINTF("\nINFO: %ld.%ld: write_req 0x%02X (%s) done, id:0x%02X, size:%u\n", write_tv.tv_sec, write_tv.tv_usec, cmd, cmd_get_str(cmd), buf_w[0], payload_size);
+    DEBUG_PRINTF("\nINFO: %ld.%ld: write_req 0x%02X (%s) done, id:0x%02X, size:%zu\n", write_tv.tv_sec, write_tv.tv_usec, cmd, cmd_get_str(cmd), buf_w[0], payload_size);
 
-#if DEBUG_VERBOSE
-    int i;
-    for (i = 0; i < 4; i++) {
-        printf("%02X ", buf_w[i]);
+    /* Compute time spent in this function */
+    LGW_TRACE_END(LGW_TRACE_MCU_WRITE_REQ, 0);
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int read_full(int fd, mcu_pipe_t * pipe, uint8_t * buf, size_t size) {
+    struct pollfd pfd;
+    size_t nb_read = 0;
+    ssize_t n;
+    int x;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (nb_read < size) {
+        if (pipe != NULL) {
+            /* Wait for data, checking periodically if the reader thread must stop */
+            x = poll(&pfd, 1, PIPE_POLL_MS);
+            if (__atomic_load_n(&pipe->running, __ATOMIC_ACQUIRE) == false) {
+                return -1;
+            }
+            if ((x < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if ((x < 0) || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+                return -1;
+            }
+            if (x == 0) {
+                continue;
+            }
+        }
+
+        /* handle EINTR as it is a blocking call */
+        n = read(fd, &buf[nb_read], size - nb_read);
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        nb_read += n;
     }
-    for (i = 0; i < payload_size; i++) {
-        printf("%02X ", payload[i]);
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int read_scatter(int fd, mcu_pipe_t * pipe, const struct iovec * iov, int iovcnt, size_t size) {
+    uint8_t sink[64];
+    size_t len;
+    int i;
+
+    /* Read straight into the caller buffers */
+    for (i = 0; (i < iovcnt) && (size > 0); i++) {
+        len = (iov[i].iov_len < size) ? iov[i].iov_len : size;
+        if ((len > 0) && (read_full(fd, pipe, (uint8_t *)iov[i].iov_base, len) != 0)) {
+            return -1;
+        }
+        size -= len;
     }
-    printf("\n");
-#endif
 
-    /* Compute time spent in this function */
-    _meas_time_stop(5, tm, __FUNCTION__);
+    /* Drop what does not fit, to stay in sync with the MCU */
+    while (size > 0) {
+        len = (sizeof sink < size) ? sizeof sink : size;
+        if (read_full(fd, pipe, sink, len) != 0) {
+            return -1;
+        }
+        size -= len;
+    }
 
     return 0;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int read_ack(int fd, uint8_t * hdr, uint8_t * buf, size_t buf_size) {
-#if DEBUG_VERBOSE
-    int i;
-#endif
-    int n;
+int read_ack(int fd, uint8_t * hdr, const struct iovec * payload, int payload_cnt) {
     size_t size;
-    int nb_read = 0;
-    /* performances variables */
-    struct timeval tm;
-    /* debug variables */
-#if DEBUG_MCU == 1
-    struct timeval read_tv;
-#endif
 
     /* Record function start time */
-    _meas_time_start(&tm);
-
-    /* Read message header first, handle EINTR as it is a blocking call */
-    do {
-        n = read(fd, &hdr[0], (size_t)HEADER_CMD_SIZE);
-    } while (n == -1 && errno == EINTR);
+    LGW_TRACE_BEGIN(LGW_TRACE_MCU_READ_ACK_HDR, 0);
 
-    if (n == -1) {
+    /* Read message header first */
+    if (read_full(fd, NULL, hdr, HEADER_CMD_SIZE) != 0) {
         perror("ERROR: Unable to read /dev/ttyACMx - ");
         return -1;
-    } else {
-#if DEBUG_MCU == 1
-        gettimeofday(&read_tv, NULL);
-#endif
-        DEBUG_PRINTF("INFO: %ld.%ld: read %d bytes for header from gateway\n", read_tv.tv_sec, read_tv.tv_usec, n);
     }
+    DEBUG_PRINTF("INFO: read ACK header %02X %02X %02X %02X\n", hdr[0], hdr[1], hdr[2], hdr[3]);
 
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, "read_ack(hdr)");
-
-#if DEBUG_VERBOSE
-    printf("read_ack(hdr):");
-    /* debug print */
-    for (i = 0; i < (int)(HEADER_CMD_SIZE); i++) {
-        printf("%02X ", hdr[i]);
-    }
-    printf("\n");
-#endif
+    LGW_TRACE_END(LGW_TRACE_MCU_READ_ACK_HDR, HEADER_CMD_SIZE);
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_MCU_READ_ACK_PAYLOAD, cmd_get_type(hdr));
 
     /* Check if the command id is valid */
     if ((cmd_get_type(hdr) < 0x40) || (cmd_get_type(hdr) > 0x46)) {
@@ -310,47 +405,17 @@ int read_ack(int fd, uint8_t * hdr, uint8_t * buf, size_t buf_size) {
         return -1;
     }
 
-    /* Get remaining payload size (metadata + pkt payload) */
+    /* Read payload if any (metadata + pkt payload) */
     size = (size_t)cmd_get_size(hdr);
-    if (size > buf_size) {
-        printf("ERROR: not enough memory to store all data (%zd)\n", size);
+    if (read_scatter(fd, NULL, payload, payload_cnt, size) != 0) {
+        perror("ERROR: Unable to read /dev/ttyACMx - ");
         return -1;
     }
 
-    /* Read payload if any */
-    if (size > 0) {
-        do {
-            /* handle EINTR as it is a blocking call */
-            do {
-                n = read(fd, &buf[nb_read], size - nb_read);
-            } while (n == -1 && errno == EINTR);
-
-            if (n == -1) {
-                perror("ERROR: Unable to read /dev/ttyACMx - ");
-                return -1;
-            } else {
-#if DEBUG_MCU == 1
-                gettimeofday(&read_tv, NULL);
-#endif
-                DEBUG_PRINTF("INFO: %ld.%ld: read %d bytes from gateway\n", read_tv.tv_sec, read_tv.tv_usec, n);
-                nb_read += n;
-            }
-        } while (nb_read < (int)size); /* we want to read only the expected payload, not more */
-
-#if DEBUG_VERBOSE
-        /* debug print */
-        printf("read_ack(pld):");
-        for (i = 0; i < (int)size; i++) {
-            printf("%02X ", buf[i]);
-        }
-        printf("\n");
-#endif
-    }
-
     /* Compute time spent in this function */
-    _meas_time_stop(5, tm, "read_ack(payload)");
+    LGW_TRACE_END(LGW_TRACE_MCU_READ_ACK_PAYLOAD, size);
 
-    return nb_read;
+    return (int)size;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -472,10 +537,13 @@ int decode_ack_gpio_access(const uint8_t * hdr, const uint8_t * payload, uint8_t
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int decode_ack_spi_bulk(const uint8_t * hdr, const uint8_t * payload) {
+int decode_ack_spi_bulk(const uint8_t * hdr, const uint8_t * payload, const spi_req_bulk_t * bulk_buffer) {
     uint8_t req_id, req_type, req_status;
     uint16_t frame_size;
     int i;
+    int req_idx = 0;
+    int nb_read = 0;
+    const spi_req_read_t * rd;
 
     /* sanity checks */
     if ((hdr == NULL) || (payload == NULL)) {
@@ -525,6 +593,16 @@ int decode_ack_spi_bulk(const uint8_t * hdr, const uint8_t * payload) {
             }
             DEBUG_MSG("\n");
 #endif
+            /* Copy the result of a stored read request to the caller buffer */
+            if ((bulk_buffer != NULL) && (nb_read < bulk_buffer->nb_read) && (bulk_buffer->read[nb_read].req_idx == req_idx)) {
+                rd = &bulk_buffer->read[nb_read];
+                if (frame_size != (rd->size + 4)) { /* spi_mux_target + address + dummy byte */
+                    printf("ERROR: %s: wrong size for SPI read request %u (expected:%u, got:%u)\n", __FUNCTION__, req_id, rd->size + 4, frame_size);
+                    return -1;
+                }
+                memcpy(rd->data, &payload[i + 5 + 4], rd->size);
+                nb_read += 1;
+            }
             i += (5 + frame_size); /* REQ ACK metadata + SPI raw frame */
         } else {
 #if DEBUG_VERBOSE
@@ -533,6 +611,179 @@ int decode_ack_spi_bulk(const uint8_t * hdr, const uint8_t * payload) {
 #endif
             i += 5;
         }
+        req_idx += 1;
+    }
+
+    if ((bulk_buffer != NULL) && (nb_read != bulk_buffer->nb_read)) {
+        printf("ERROR: %s: missing SPI read results (expected:%u, got:%d)\n", __FUNCTION__, bulk_buffer->nb_read, nb_read);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* to be called with pipe->mx held */
+void pipe_fail_all(mcu_pipe_t * pipe) {
+    int i;
+
+    for (i = 0; i < MCU_PIPE_DEPTH; i++) {
+        if (pipe->pending[i] != NULL) {
+            pipe->pending[i]->ack_len = -1;
+            pipe->pending[i]->done = true;
+            pipe->pending[i] = NULL;
+        }
+    }
+    pthread_cond_broadcast(&pipe->cond);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void * pipe_reader(void * arg) {
+    mcu_pipe_t * pipe = (mcu_pipe_t *)arg;
+    uint8_t hdr[HEADER_CMD_SIZE];
+    size_t size;
+    mcu_req_t * req;
+    int i, x;
+
+    while (__atomic_load_n(&pipe->running, __ATOMIC_ACQUIRE) == true) {
+        /* Read the next ACK header, whichever request it belongs to */
+        if (read_full(pipe->fd, pipe, hdr, HEADER_CMD_SIZE) != 0) {
+            break;
+        }
+        size = (size_t)cmd_get_size(hdr);
+        if ((cmd_get_type(hdr) < 0x40) || (cmd_get_type(hdr) > 0x46) || (size > MAX_SIZE_COMMAND)) {
+            /* Lost sync with the MCU: drop what was received, fail the requests in flight */
+            printf("ERROR: received wrong ACK (type:0x%02X size:%zu), flushing the link\n", cmd_get_type(hdr), size);
+            tcflush(pipe->fd, TCIFLUSH);
+            pthread_mutex_lock(&pipe->mx);
+            pipe_fail_all(pipe);
+            pthread_mutex_unlock(&pipe->mx);
+            continue;
+        }
+
+        /* Claim the request with the same ID, its owner now waits until it is done */
+        pthread_mutex_lock(&pipe->mx);
+        req = NULL;
+        for (i = 0; i < MCU_PIPE_DEPTH; i++) {
+            if ((pipe->pending[i] != NULL) && (pipe->pending[i]->id == cmd_get_id(hdr))) {
+                req = pipe->pending[i];
+                req->claimed = true;
+                pipe->pending[i] = NULL;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&pipe->mx);
+
+        /* Read the payload straight into the request buffers */
+        if (req != NULL) {
+            x = read_scatter(pipe->fd, pipe, req->ack, req->ack_iovcnt, size);
+        } else {
+            x = read_scatter(pipe->fd, pipe, NULL, 0, size);
+            printf("WARNING: dropping ACK 0x%02X with unknown request id:0x%02X\n", cmd_get_type(hdr), cmd_get_id(hdr));
+        }
+
+        if (req != NULL) {
+            pthread_mutex_lock(&pipe->mx);
+            memcpy(req->hdr, hdr, HEADER_CMD_SIZE);
+            req->ack_len = (x == 0) ? (int)size : -1;
+            req->done = true;
+            pthread_cond_broadcast(&pipe->cond);
+            pthread_mutex_unlock(&pipe->mx);
+        }
+        if (x != 0) {
+            break;
+        }
+    }
+
+    /* Stopped or I/O error: nobody will answer the requests in flight */
+    pthread_mutex_lock(&pipe->mx);
+    pipe->alive = false;
+    pipe_fail_all(pipe);
+    pthread_mutex_unlock(&pipe->mx);
+
+    return NULL;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+mcu_pipe_t * pipe_get(int fd) {
+    mcu_pipe_t * pipe = mcu_pipe;
+
+    if ((pipe == NULL) || (pipe->fd != fd) || (__atomic_load_n(&pipe->alive, __ATOMIC_ACQUIRE) == false)) {
+        return NULL;
+    }
+
+    return pipe;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void timeout_ms_get(struct timespec * ts, long ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Check the ACK of the write-only bulk left in flight by mcu_spi_flush(), if any */
+int bulk_sync(int fd) {
+    if (bulk_pending == false) {
+        return 0;
+    }
+    bulk_pending = false;
+
+    if (mcu_spi_write_wait(fd, &bulk_req) != 0) {
+        printf("ERROR: %s: SPI requests sent without waiting failed\n", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* the ACK header goes to the caller, requests of several threads may be in flight */
+int req_transfer(int fd, order_id_t cmd, const uint8_t * payload, uint16_t payload_size, uint8_t * hdr, uint8_t * ack, size_t ack_size) {
+    mcu_req_t req;
+    int len;
+
+    if (mcu_req_submit(fd, &req, cmd, payload, payload_size, ack, ack_size) != 0) {
+        return -1;
+    }
+
+    len = mcu_req_wait(fd, &req);
+    memcpy(hdr, req.hdr, HEADER_CMD_SIZE); /* for the decode_ack functions */
+    if (bulk_sync(fd) != 0) { /* ACKed before this one */
+        return -1;
+    }
+    if (len > (int)ack_size) {
+        printf("ERROR: not enough memory to store all data (%d)\n", len);
+        return -1;
+    }
+
+    return len;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int spi_req_send(int fd, uint8_t * in_out_buf, size_t buf_size, const spi_req_bulk_t * bulk_buffer) {
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
+
+    if (req_transfer(fd, ORDER_ID__REQ_MULTIPLE_SPI, in_out_buf, buf_size, buf_hdr, in_out_buf, buf_size) < 0) {
+        printf("ERROR: failed to transfer REQ_MULTIPLE_SPI request\n");
+        return -1;
+    }
+
+    if (decode_ack_spi_bulk(buf_hdr, in_out_buf, bulk_buffer) != 0) {
+        printf("ERROR: invalid REQ_MULTIPLE_SPI ack\n");
+        return -1;
     }
 
     return 0;
@@ -542,17 +793,13 @@ int decode_ack_spi_bulk(const uint8_t * hdr, const uint8_t * payload) {
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
 int mcu_ping(int fd, s_ping_info * info) {
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
     uint8_t buf_ack[ACK_PING_SIZE];
 
     CHECK_NULL(info);
 
-    if (write_req(fd, ORDER_ID__REQ_PING, NULL, 0) != 0) {
-        printf("ERROR: failed to write PING request\n");
-        return -1;
-    }
-
-    if (read_ack(fd, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
-        printf("ERROR: failed to read PING ack\n");
+    if (req_transfer(fd, ORDER_ID__REQ_PING, NULL, 0, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
+        printf("ERROR: failed to transfer PING request\n");
         return -1;
     }
 
@@ -567,13 +814,10 @@ int mcu_ping(int fd, s_ping_info * info) {
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 int mcu_boot(int fd) {
-    if (write_req(fd, ORDER_ID__REQ_BOOTLOADER_MODE, NULL, 0) != 0) {
-        printf("ERROR: failed to write BOOTLOADER_MODE request\n");
-        return -1;
-    }
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
 
-    if (read_ack(fd, buf_hdr, NULL, 0) < 0) {
-        printf("ERROR: failed to read BOOTLOADER_MODE ack\n");
+    if (req_transfer(fd, ORDER_ID__REQ_BOOTLOADER_MODE, NULL, 0, buf_hdr, NULL, 0) < 0) {
+        printf("ERROR: failed to transfer BOOTLOADER_MODE request\n");
         return -1;
     }
 
@@ -588,17 +832,13 @@ int mcu_boot(int fd) {
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 int mcu_get_status(int fd, s_status * status) {
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
     uint8_t buf_ack[ACK_GET_STATUS_SIZE];
 
     CHECK_NULL(status);
 
-    if (write_req(fd, ORDER_ID__REQ_GET_STATUS, NULL, 0) != 0) {
-        printf("ERROR: failed to write GET_STATUS request\n");
-        return -1;
-    }
-
-    if (read_ack(fd, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
-        printf("ERROR: failed to read GET_STATUS ack\n");
+    if (req_transfer(fd, ORDER_ID__REQ_GET_STATUS, NULL, 0, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
+        printf("ERROR: failed to transfer GET_STATUS request\n");
         return -1;
     }
 
@@ -614,19 +854,15 @@ int mcu_get_status(int fd, s_status * status) {
 
 int mcu_gpio_write(int fd, uint8_t gpio_port, uint8_t gpio_id, uint8_t gpio_value) {
     uint8_t status;
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
     uint8_t buf_req[REQ_WRITE_GPIO_SIZE];
     uint8_t buf_ack[ACK_GPIO_WRITE_SIZE];
 
     buf_req[REQ_WRITE_GPIO__PORT]   = gpio_port;
     buf_req[REQ_WRITE_GPIO__PIN]    = gpio_id;
     buf_req[REQ_WRITE_GPIO__STATE]  = gpio_value;
-    if (write_req(fd, ORDER_ID__REQ_WRITE_GPIO, buf_req, REQ_WRITE_GPIO_SIZE) != 0) {
-        printf("ERROR: failed to write REQ_WRITE_GPIO request\n");
-        return -1;
-    }
-
-    if (read_ack(fd, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
-        printf("ERROR: failed to read PING ack\n");
+    if (req_transfer(fd, ORDER_ID__REQ_WRITE_GPIO, buf_req, REQ_WRITE_GPIO_SIZE, buf_hdr, buf_ack, sizeof buf_ack) < 0) {
+        printf("ERROR: failed to transfer REQ_WRITE_GPIO request\n");
         return -1;
     }
 
@@ -649,18 +885,60 @@ int mcu_spi_write(int fd, uint8_t * in_out_buf, size_t buf_size) {
     /* Check input parameters */
     CHECK_NULL(in_out_buf);
 
-    if (write_req(fd, ORDER_ID__REQ_MULTIPLE_SPI, in_out_buf, buf_size) != 0) {
-        printf("ERROR: failed to write REQ_MULTIPLE_SPI request\n");
+    return spi_req_send(fd, in_out_buf, buf_size, NULL);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_spi_transfer(int fd, uint8_t * hdr, uint16_t hdr_size, const uint8_t * tx, uint8_t * rx, uint16_t size) {
+    mcu_req_t req;
+    struct iovec iov[2];
+    struct iovec ack[2];
+    uint16_t frame_size;
+    int len;
+
+    /* Check input parameters */
+    CHECK_NULL(hdr);
+    CHECK_NULL(tx);
+    if (hdr_size < 5) {
+        printf("ERROR: %s: invalid SPI request header size (%u)\n", __FUNCTION__, hdr_size);
         return -1;
     }
 
-    if (read_ack(fd, buf_hdr, in_out_buf, buf_size) < 0) {
+    /* Request header from the caller, then the data without copy */
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hdr_size;
+    iov[1].iov_base = (void *)tx;
+    iov[1].iov_len = size;
+
+    /* ACK metadata and SPI header overwrite the request ones, the data goes to rx */
+    ack[0].iov_base = hdr;
+    ack[0].iov_len = hdr_size;
+    ack[1].iov_base = rx;
+    ack[1].iov_len = (rx != NULL) ? size : 0; /* written data is echoed, dropped */
+
+    if (mcu_req_submitv(fd, &req, ORDER_ID__REQ_MULTIPLE_SPI, iov, 2, ack, 2) != 0) {
+        printf("ERROR: failed to write REQ_MULTIPLE_SPI request\n");
+        return -1;
+    }
+    len = mcu_req_wait(fd, &req);
+    if (len < 0) {
         printf("ERROR: failed to read REQ_MULTIPLE_SPI ack\n");
         return -1;
     }
+    if (bulk_sync(fd) != 0) { /* ACKed before this one */
+        return -1;
+    }
 
-    if (decode_ack_spi_bulk(buf_hdr, in_out_buf) != 0) {
-        printf("ERROR: invalid REQ_MULTIPLE_SPI ack\n");
+    /* Check the ACK of the single read/write request */
+    frame_size = (uint16_t)(hdr[3] << 8) | (uint16_t)hdr[4];
+    if ((cmd_get_type(req.hdr) != ORDER_ID__ACK_MULTIPLE_SPI) || (len != (hdr_size + size)) ||
+        (hdr[1] != MCU_SPI_REQ_TYPE_READ_WRITE) || (frame_size != (hdr_size - 5 + size))) {
+        printf("ERROR: invalid REQ_MULTIPLE_SPI ack (type:0x%02X len:%d)\n", cmd_get_type(req.hdr), len);
+        return -1;
+    }
+    if (hdr[2] != 0) {
+        printf("ERROR: %s: SPI request failed with status %s\n", __FUNCTION__, spi_status_get_str(hdr[2]));
         return -1;
     }
 
@@ -672,21 +950,328 @@ int mcu_spi_write(int fd, uint8_t * in_out_buf, size_t buf_size) {
 int mcu_spi_store(uint8_t * in_out_buf, size_t buf_size) {
     CHECK_NULL(in_out_buf);
 
-    return spi_req_bulk_insert(&spi_bulk_buffer, in_out_buf, buf_size);
+    return spi_req_bulk_insert(&spi_bulk_buffer, in_out_buf, buf_size, NULL, 0);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_spi_store_write(const uint8_t * hdr, uint16_t hdr_size, const uint8_t * data, uint16_t size) {
+    CHECK_NULL(hdr);
+    CHECK_NULL(data);
+
+    return spi_req_bulk_insert(&spi_bulk_buffer, hdr, hdr_size, data, size);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_spi_store_read(const uint8_t * hdr, uint16_t hdr_size, uint8_t * data, uint16_t size) {
+    spi_req_read_t * rd;
+
+    CHECK_NULL(hdr);
+    CHECK_NULL(data);
+
+    if (spi_bulk_buffer.nb_read == LGW_USB_BULK_READ_MAX) {
+        printf("ERROR: cannot insert a new SPI read request in bulk buffer - too many reads\n");
+        return -1;
+    }
+
+    /* Remember where to copy the result, before the request index is incremented */
+    rd = &spi_bulk_buffer.read[spi_bulk_buffer.nb_read];
+    rd->req_idx = spi_bulk_buffer.nb_req;
+    rd->size = size;
+    rd->data = data;
+
+    /* The content of data is clocked out while reading, as dummy bytes */
+    if (spi_req_bulk_insert(&spi_bulk_buffer, hdr, hdr_size, data, size) != 0) {
+        return -1;
+    }
+    spi_bulk_buffer.nb_read += 1;
+
+    return 0;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 int mcu_spi_flush(int fd) {
-    /* Write pending SPI requests to MCU */
-    if (mcu_spi_write(fd, spi_bulk_buffer.buffer, spi_bulk_buffer.size) != 0) {
+    int err;
+
+    if ((spi_bulk_buffer.nb_read == 0) && (pipe_get(fd) != NULL)) {
+        /* Nothing to read back (TX programming, configuration): send the requests without waiting,
+           the ACK is checked by the next request, so that both round trips overlap. One at a time,
+           the bulk buffer is reused as soon as this function returns */
+        err = bulk_sync(fd);
+        if (err == 0) {
+            memcpy(bulk_inflight, spi_bulk_buffer.buffer, spi_bulk_buffer.size);
+            err = mcu_spi_write_submit(fd, &bulk_req, bulk_inflight, spi_bulk_buffer.size);
+            bulk_pending = (err == 0);
+        }
+    } else {
+        /* Write pending SPI requests to MCU, and copy the read results */
+        err = spi_req_send(fd, spi_bulk_buffer.buffer, spi_bulk_buffer.size, &spi_bulk_buffer);
+    }
+    if (err != 0) {
         printf("ERROR: %s: failed to write SPI requests to MCU\n", __FUNCTION__);
-        return -1;
     }
 
-    /* Reset bulk storage buffer */
+    /* Reset bulk storage buffer, also on error so that the next bulk starts clean */
     spi_bulk_buffer.nb_req = 0;
     spi_bulk_buffer.size = 0;
+    spi_bulk_buffer.nb_read = 0;
+
+    return err;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_pipe_start(int fd) {
+    mcu_pipe_t * pipe;
+    pthread_condattr_t attr;
+    pthread_attr_t thread_attr;
+    uint8_t id = mcu_req_id++;
+    uint8_t buf_hdr[HEADER_CMD_SIZE];
+    uint8_t buf_ack[ACK_PING_SIZE];
+    struct iovec ack = { buf_ack, sizeof buf_ack };
+    int i;
+
+    if (mcu_pipe != NULL) {
+        printf("ERROR: %s: already started\n", __FUNCTION__);
+        return -1;
+    }
+
+    /* ACKs are matched to requests by ID: check that the MCU echoes it */
+    if ((write_req(fd, id, ORDER_ID__REQ_PING, NULL, 0) != 0) || (read_ack(fd, buf_hdr, &ack, 1) < 0)) {
+        printf("ERROR: %s: failed to ping the MCU\n", __FUNCTION__);
+        return -1;
+    }
+    if (cmd_get_id(buf_hdr) != id) {
+        printf("WARNING: MCU does not echo request IDs (sent:0x%02X, got:0x%02X), requests will not be pipelined\n", id, cmd_get_id(buf_hdr));
+        return 0;
+    }
+
+    pipe = calloc(1, sizeof *pipe);
+    if (pipe == NULL) {
+        printf("ERROR: %s: failed to allocate memory\n", __FUNCTION__);
+        return -1;
+    }
+    pipe->fd = fd;
+    pipe->running = true;
+    pipe->alive = true;
+    pthread_mutex_init(&pipe->mx, NULL);
+    pthread_mutex_init(&pipe->mx_write, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pipe->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setstacksize(&thread_attr, PIPE_STACK_SIZE);
+    i = pthread_create(&pipe->thread, &thread_attr, pipe_reader, pipe);
+    pthread_attr_destroy(&thread_attr);
+    if (i != 0) {
+        printf("ERROR: %s: failed to create the reader thread\n", __FUNCTION__);
+        pthread_cond_destroy(&pipe->cond);
+        pthread_mutex_destroy(&pipe->mx_write);
+        pthread_mutex_destroy(&pipe->mx);
+        free(pipe);
+        return -1;
+    }
+
+    mcu_pipe = pipe;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void mcu_pipe_stop(void) {
+    mcu_pipe_t * pipe = mcu_pipe;
+
+    if (pipe == NULL) {
+        return;
+    }
+
+    /* Collect the last write-only bulk, the reader thread still completes it */
+    bulk_sync(pipe->fd);
+
+    /* The reader thread notices within PIPE_POLL_MS, and fails the requests in flight */
+    __atomic_store_n(&pipe->running, false, __ATOMIC_RELEASE);
+    pthread_join(pipe->thread, NULL);
+
+    mcu_pipe = NULL;
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mx_write);
+    pthread_mutex_destroy(&pipe->mx);
+    free(pipe);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_req_submit(int fd, mcu_req_t * req, order_id_t cmd, const uint8_t * payload, uint16_t payload_size, uint8_t * ack, size_t ack_size) {
+    struct iovec iov = { (void *)payload, payload_size };
+    struct iovec ack_iov = { ack, (ack != NULL) ? ack_size : 0 };
+
+    return mcu_req_submitv(fd, req, cmd, &iov, (payload != NULL) ? 1 : 0, &ack_iov, 1);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_req_submitv(int fd, mcu_req_t * req, order_id_t cmd, const struct iovec * payload, int payload_cnt, const struct iovec * ack, int ack_cnt) {
+    mcu_pipe_t * pipe = pipe_get(fd);
+    struct timespec ts;
+    int i, slot = -1;
+    int x;
+
+    CHECK_NULL(req);
+    if ((ack_cnt < 0) || (ack_cnt > MCU_REQ_IOV_MAX) || ((ack_cnt > 0) && (ack == NULL))) {
+        printf("ERROR: %s: invalid ACK buffers\n", __FUNCTION__);
+        return -1;
+    }
+
+    for (i = 0; i < ack_cnt; i++) {
+        req->ack[i] = ack[i];
+    }
+    req->ack_iovcnt = ack_cnt;
+    req->ack_len = -1;
+    req->claimed = false;
+    req->done = false;
+
+    /* No reader thread: the ACK is read by mcu_req_wait() */
+    if (pipe == NULL) {
+        req->id = mcu_req_id++;
+        if (write_req(fd, req->id, cmd, payload, payload_cnt) != 0) {
+            req->done = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&pipe->mx_write);
+    req->id = mcu_req_id++;
+
+    /* Register the request before sending it, its ACK may come back right away */
+    pthread_mutex_lock(&pipe->mx);
+    timeout_ms_get(&ts, MCU_ACK_TIMEOUT_MS);
+    while (slot < 0) {
+        for (i = 0; i < MCU_PIPE_DEPTH; i++) {
+            if (pipe->pending[i] == NULL) {
+                slot = i;
+                break;
+            }
+        }
+        if ((slot < 0) && (pthread_cond_timedwait(&pipe->cond, &pipe->mx, &ts) == ETIMEDOUT)) {
+            break;
+        }
+    }
+    if (slot >= 0) {
+        pipe->pending[slot] = req;
+    }
+    pthread_mutex_unlock(&pipe->mx);
+    if (slot < 0) {
+        pthread_mutex_unlock(&pipe->mx_write);
+        printf("ERROR: %s: too many requests in flight\n", __FUNCTION__);
+        return -1;
+    }
+
+    x = write_req(fd, req->id, cmd, payload, payload_cnt);
+    pthread_mutex_unlock(&pipe->mx_write);
+
+    if (x != 0) {
+        pthread_mutex_lock(&pipe->mx);
+        if (pipe->pending[slot] == req) {
+            pipe->pending[slot] = NULL;
+        }
+        req->done = true;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mx);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_req_wait(int fd, mcu_req_t * req) {
+    mcu_pipe_t * pipe = pipe_get(fd);
+    struct timespec ts;
+    int i;
+
+    CHECK_NULL(req);
+
+    /* No reader thread: the next ACK on the link is the one of the oldest request */
+    if (pipe == NULL) {
+        if (req->done == true) { /* failed at submission, or completed by a reader thread stopped since */
+            return req->ack_len;
+        }
+        req->ack_len = read_ack(fd, req->hdr, req->ack, req->ack_iovcnt);
+        req->done = true;
+        return req->ack_len;
+    }
+
+    /* Record function start time */
+    LGW_TRACE_BEGIN(LGW_TRACE_MCU_READ_ACK_HDR, req->id);
+
+    pthread_mutex_lock(&pipe->mx);
+    timeout_ms_get(&ts, MCU_ACK_TIMEOUT_MS);
+    while (req->done == false) {
+        if (pthread_cond_timedwait(&pipe->cond, &pipe->mx, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if ((req->done == false) && (req->claimed == true)) {
+        /* The ACK stalled while being read into the request buffers: the link is lost, stop the
+           reader thread, it lets go of the buffers and completes the request within PIPE_POLL_MS */
+        __atomic_store_n(&pipe->running, false, __ATOMIC_RELEASE);
+        while (req->done == false) {
+            pthread_cond_wait(&pipe->cond, &pipe->mx);
+        }
+        pthread_mutex_unlock(&pipe->mx);
+        printf("ERROR: %s: ACK stalled for request id:0x%02X, reader thread stopped\n", __FUNCTION__, req->id);
+        return -1;
+    }
+    if (req->done == false) {
+        /* The reader thread must not write to req anymore */
+        for (i = 0; i < MCU_PIPE_DEPTH; i++) {
+            if (pipe->pending[i] == req) {
+                pipe->pending[i] = NULL;
+            }
+        }
+        req->done = true;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mx);
+        printf("ERROR: %s: no ACK received for request id:0x%02X\n", __FUNCTION__, req->id);
+        return -1;
+    }
+    pthread_mutex_unlock(&pipe->mx);
+
+    /* Compute time spent in this function */
+    LGW_TRACE_END(LGW_TRACE_MCU_READ_ACK_HDR, req->ack_len);
+
+    return req->ack_len;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_spi_write_submit(int fd, mcu_req_t * req, uint8_t * in_out_buf, size_t buf_size) {
+    /* Check input parameters */
+    CHECK_NULL(in_out_buf);
+
+    /* The payload is sent before returning, in_out_buf can receive the ACK */
+    return mcu_req_submit(fd, req, ORDER_ID__REQ_MULTIPLE_SPI, in_out_buf, buf_size, in_out_buf, buf_size);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int mcu_spi_write_wait(int fd, mcu_req_t * req) {
+    if (mcu_req_wait(fd, req) < 0) {
+        printf("ERROR: failed to read REQ_MULTIPLE_SPI ack\n");
+        return -1;
+    }
+
+    if (decode_ack_spi_bulk(req->hdr, (const uint8_t *)req->ack[0].iov_base, NULL) != 0) {
+        printf("ERROR: invalid REQ_MULTIPLE_SPI ack\n");
+        return -1;
+    }
 
     return 0;
 }
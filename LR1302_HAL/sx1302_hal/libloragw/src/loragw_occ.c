@@ -0,0 +1,499 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator spectrum occupancy map
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdio.h>      /* printf, rename, snprintf */
+#include <stdlib.h>     /* calloc, mkstemp */
+#include <string.h>     /* memcmp, memcpy */
+#include <math.h>       /* exp2 */
+#include <time.h>       /* clock_gettime */
+#include <sched.h>      /* sched_yield */
+#include <signal.h>     /* kill */
+#include <errno.h>      /* ESRCH */
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close, ftruncate, getpid */
+#include <sys/mman.h>   /* mmap */
+#include <sys/stat.h>   /* fstat */
+
+#include "loragw_occ.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#if DEBUG_OCC == 1
+    #define DEBUG_MSG(str)                fprintf(stdout, str)
+    #define DEBUG_PRINTF(fmt, args...)    fprintf(stdout,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
+#else
+    #define DEBUG_MSG(str)
+    #define DEBUG_PRINTF(fmt, args...)
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define OCC_MAGIC           "LGWOCC"
+#define OCC_VERSION         2
+#define OCC_READ_RETRIES    1000 /* a writer killed in the middle of an update must not hang the readers */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* layout of the file, shared by all the processes mapping it */
+struct occ_hdr_s {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    freq_hz_start;
+    uint32_t    freq_step_hz;
+    uint32_t    half_life_s;
+    uint16_t    nb_slots;
+    uint16_t    nb_bins;
+    uint32_t    slot_size;
+} __attribute__((aligned(64)));
+
+/* one cache line per seqlock, so that updates of a slot do not disturb the readers of another */
+struct occ_slot_s {
+    uint32_t    seq;        /* odd while the slot is being written */
+    int32_t     owner;      /* pid of the process writing the slot, 0 if none */
+    uint32_t    nb_updates;
+    uint64_t    ts_ns;
+    int16_t     level_dbm;
+    float       above[LGW_OCC_NB_BINS];
+} __attribute__((aligned(64)));
+
+/* the grid of a file never changes (a new grid is a new file), it is copied at open
+   so that the slots accessed are always within the mapping */
+struct lgw_occ_s {
+    struct occ_hdr_s *  hdr;
+    struct occ_slot_s * slot;
+    size_t              size;
+    uint32_t            freq_hz_start;
+    uint32_t            freq_step_hz;
+    uint16_t            nb_slots;
+    bool                writable;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+static uint64_t now_ns(void);
+
+static struct occ_slot_s * find_slot(const lgw_occ_t * occ, uint32_t freq_hz);
+
+static int read_slot(const struct occ_slot_s * slot, struct occ_slot_s * copy);
+
+static uint32_t lock_slot(struct occ_slot_s * slot);
+
+static int create_map(const char * path, const struct occ_hdr_s * hdr, size_t size);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static struct occ_slot_s * find_slot(const lgw_occ_t * occ, uint32_t freq_hz) {
+    uint32_t i;
+
+    /* nearest slot, within half a step */
+    if ((freq_hz + (occ->freq_step_hz / 2)) < occ->freq_hz_start) {
+        return NULL;
+    }
+    i = (freq_hz + (occ->freq_step_hz / 2) - occ->freq_hz_start) / occ->freq_step_hz;
+    if (i >= occ->nb_slots) {
+        return NULL;
+    }
+
+    return &occ->slot[i];
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int read_slot(const struct occ_slot_s * slot, struct occ_slot_s * copy) {
+    uint32_t seq1, seq2;
+    int i;
+
+    for (i = 0; i < OCC_READ_RETRIES; i++) {
+        seq1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((seq1 & 1) == 0) {
+            memcpy(copy, slot, sizeof *copy);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            seq2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+            if (seq1 == seq2) {
+                return LGW_OCC_SUCCESS;
+            }
+        }
+        sched_yield();
+    }
+
+    DEBUG_MSG("ERROR: OCC SLOT IS LOCKED\n");
+    return LGW_OCC_ERROR;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* take the writer lock of a slot and make its sequence odd, return the sequence to publish
+   when done: several processes may update the map, and a writer killed while holding the
+   lock is detected by its pid */
+static uint32_t lock_slot(struct occ_slot_s * slot) {
+    int32_t pid = (int32_t)getpid();
+    int32_t owner;
+    uint32_t seq;
+
+    owner = 0;
+    while (!__atomic_compare_exchange_n(&slot->owner, &owner, pid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if ((kill(owner, 0) != 0) && (errno == ESRCH)) {
+            /* the owner is gone, take over its lock if nobody did it meanwhile */
+            if (__atomic_compare_exchange_n(&slot->owner, &owner, pid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else {
+            sched_yield();
+        }
+        owner = 0;
+    }
+
+    /* a killed writer may have left the sequence odd */
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    seq += (seq & 1) ? 1 : 2;
+    __atomic_store_n(&slot->seq, seq - 1, __ATOMIC_RELAXED);
+
+    /* the odd sequence must be visible before any data is written */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return seq;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* build a new map aside and move it in place: processes which have the previous file
+   mapped keep it untouched, a file is never truncated nor resized while mapped */
+static int create_map(const char * path, const struct occ_hdr_s * hdr, size_t size) {
+    char tmp_path[256];
+    struct occ_hdr_s * map;
+    int fd;
+
+    if (snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", path) >= (int)sizeof tmp_path) {
+        printf("ERROR: occupancy map path too long %s\n", path);
+        return LGW_OCC_ERROR;
+    }
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        printf("ERROR: failed to create occupancy map %s\n", tmp_path);
+        return LGW_OCC_ERROR;
+    }
+    if ((fchmod(fd, 0644) != 0) || (ftruncate(fd, size) != 0)) {
+        printf("ERROR: failed to size occupancy map %s\n", tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return LGW_OCC_ERROR;
+    }
+    map = mmap(NULL, sizeof *hdr, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmp_path);
+        return LGW_OCC_ERROR;
+    }
+
+    /* the slots are zeroed by ftruncate */
+    memcpy(map, hdr, sizeof *hdr);
+    memcpy(map->magic, OCC_MAGIC, sizeof OCC_MAGIC);
+    munmap(map, sizeof *hdr);
+
+    if (rename(tmp_path, path) != 0) {
+        printf("ERROR: failed to install occupancy map %s\n", path);
+        unlink(tmp_path);
+        return LGW_OCC_ERROR;
+    }
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int lgw_occ_open(const char * path, const struct lgw_occ_conf_s * conf, lgw_occ_t ** occ) {
+    lgw_occ_t * o;
+    struct occ_hdr_s hdr;
+    struct stat st;
+    size_t size = 0;
+    bool reuse = false;
+    bool created = false;
+    void * map;
+    int fd;
+
+    /* check input parameters */
+    if (occ == NULL) {
+        return LGW_OCC_ERROR;
+    }
+    if (path == NULL) {
+        path = LGW_OCC_PATH_DEFAULT;
+    }
+    if ((conf != NULL) && ((conf->freq_step_hz == 0) || (conf->nb_slots == 0))) {
+        printf("ERROR: invalid occupancy map grid\n");
+        return LGW_OCC_ERROR;
+    }
+
+reopen:
+    fd = open(path, (conf != NULL) ? O_RDWR : O_RDONLY);
+    if ((fd < 0) && ((conf == NULL) || (created == true))) {
+        printf("ERROR: failed to open occupancy map %s\n", path);
+        return LGW_OCC_ERROR;
+    }
+    memset(&st, 0, sizeof st);
+    if ((fd >= 0) && (fstat(fd, &st) != 0)) {
+        close(fd);
+        return LGW_OCC_ERROR;
+    }
+
+    /* a map is reused as long as its grid is unchanged, so that the history survives restarts */
+    memset(&hdr, 0, sizeof hdr);
+    if ((size_t)st.st_size >= sizeof hdr) {
+        if (pread(fd, &hdr, sizeof hdr, 0) != (ssize_t)sizeof hdr) {
+            memset(&hdr, 0, sizeof hdr);
+        }
+        reuse = (memcmp(hdr.magic, OCC_MAGIC, sizeof OCC_MAGIC) == 0) && (hdr.version == OCC_VERSION) &&
+                (hdr.nb_bins == LGW_OCC_NB_BINS) && (hdr.slot_size == sizeof(struct occ_slot_s));
+        size = sizeof hdr + ((size_t)hdr.nb_slots * sizeof(struct occ_slot_s));
+        reuse = reuse && ((size_t)st.st_size >= size);
+    }
+    if (conf == NULL) {
+        if (reuse == false) {
+            printf("ERROR: %s is not an occupancy map\n", path);
+            close(fd);
+            return LGW_OCC_ERROR;
+        }
+    } else {
+        reuse = reuse && (hdr.freq_hz_start == conf->freq_hz_start) && (hdr.freq_step_hz == conf->freq_step_hz) &&
+                (hdr.nb_slots == conf->nb_slots);
+        if (reuse == false) {
+            if (created == true) {
+                printf("ERROR: occupancy map %s replaced by another process\n", path);
+                close(fd);
+                return LGW_OCC_ERROR;
+            }
+            /* (re)create the map, then open the new file */
+            if (fd >= 0) {
+                close(fd);
+            }
+            memset(&hdr, 0, sizeof hdr);
+            hdr.version = OCC_VERSION;
+            hdr.freq_hz_start = conf->freq_hz_start;
+            hdr.freq_step_hz = conf->freq_step_hz;
+            hdr.half_life_s = conf->half_life_s;
+            hdr.nb_slots = conf->nb_slots;
+            hdr.nb_bins = LGW_OCC_NB_BINS;
+            hdr.slot_size = sizeof(struct occ_slot_s);
+            size = sizeof hdr + ((size_t)hdr.nb_slots * sizeof(struct occ_slot_s));
+            if (create_map(path, &hdr, size) != LGW_OCC_SUCCESS) {
+                return LGW_OCC_ERROR;
+            }
+            created = true;
+            goto reopen;
+        }
+    }
+
+    map = mmap(NULL, size, (conf != NULL) ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("ERROR: failed to map occupancy map %s\n", path);
+        return LGW_OCC_ERROR;
+    }
+
+    o = calloc(1, sizeof *o);
+    if (o == NULL) {
+        munmap(map, size);
+        return LGW_OCC_ERROR;
+    }
+    o->hdr = (struct occ_hdr_s *)map;
+    o->slot = (struct occ_slot_s *)((uint8_t *)map + sizeof hdr);
+    o->size = size;
+    o->freq_hz_start = hdr.freq_hz_start;
+    o->freq_step_hz = hdr.freq_step_hz;
+    o->nb_slots = hdr.nb_slots;
+    o->writable = (conf != NULL);
+
+    if (conf != NULL) {
+        o->hdr->half_life_s = conf->half_life_s;
+    }
+
+    DEBUG_PRINTF("occupancy map %s: %u slots from %u Hz every %u Hz\n", path, o->nb_slots, o->freq_hz_start, o->freq_step_hz);
+
+    *occ = o;
+    return LGW_OCC_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_occ_close(lgw_occ_t * occ) {
+    if (occ == NULL) {
+        return LGW_OCC_ERROR;
+    }
+
+    munmap(occ->hdr, occ->size);
+    free(occ);
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_occ_get_conf(const lgw_occ_t * occ, struct lgw_occ_conf_s * conf) {
+    if ((occ == NULL) || (conf == NULL)) {
+        return LGW_OCC_ERROR;
+    }
+
+    conf->freq_hz_start = occ->freq_hz_start;
+    conf->freq_step_hz = occ->freq_step_hz;
+    conf->nb_slots = occ->nb_slots;
+    conf->half_life_s = occ->hdr->half_life_s;
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_occ_update(lgw_occ_t * occ, uint32_t freq_hz, const int16_t levels_dbm[LGW_OCC_NB_BINS], const uint16_t results[LGW_OCC_NB_BINS]) {
+    struct occ_slot_s * slot;
+    float above[LGW_OCC_NB_BINS];
+    uint32_t total = 0;
+    uint32_t seq;
+    uint64_t ts_ns;
+    float w; /* weight of the history */
+    int i;
+
+    /* check input parameters */
+    if ((occ == NULL) || (levels_dbm == NULL) || (results == NULL) || (occ->writable == false)) {
+        return LGW_OCC_ERROR;
+    }
+    slot = find_slot(occ, freq_hz);
+    if (slot == NULL) {
+        DEBUG_PRINTF("ERROR: %u Hz is out of the occupancy map\n", freq_hz);
+        return LGW_OCC_ERROR;
+    }
+
+    /* histogram to probability above each threshold, the last bin is below the lowest one */
+    for (i = 0; i < LGW_OCC_NB_BINS; i++) {
+        total += results[i];
+        above[i] = (float)total;
+    }
+    if (total == 0) {
+        return LGW_OCC_SUCCESS; /* nothing measured */
+    }
+    for (i = 0; i < LGW_OCC_NB_BINS; i++) {
+        above[i] /= (float)total;
+    }
+    ts_ns = now_ns();
+
+    /* lock the slot (odd sequence) */
+    seq = lock_slot(slot);
+
+    /* decay the history according to its age, the thresholds depend on the sx1261 rssi_offset */
+    if ((slot->nb_updates == 0) || (slot->level_dbm != levels_dbm[0]) || (ts_ns < slot->ts_ns) || (occ->hdr->half_life_s == 0)) {
+        w = 0.0;
+    } else {
+        w = (float)exp2(-(double)(ts_ns - slot->ts_ns) / (1E9 * occ->hdr->half_life_s));
+    }
+    for (i = 0; i < LGW_OCC_NB_BINS; i++) {
+        slot->above[i] = (w * slot->above[i]) + ((1.0 - w) * above[i]);
+    }
+    slot->level_dbm = levels_dbm[0];
+    slot->ts_ns = ts_ns;
+    slot->nb_updates += 1;
+
+    /* unlock */
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_occ_get_slot(const lgw_occ_t * occ, uint32_t freq_hz, struct lgw_occ_slot_s * slot) {
+    const struct occ_slot_s * s;
+    struct occ_slot_s copy;
+
+    /* check input parameters */
+    if ((occ == NULL) || (slot == NULL)) {
+        return LGW_OCC_ERROR;
+    }
+    s = find_slot(occ, freq_hz);
+    if (s == NULL) {
+        return LGW_OCC_ERROR;
+    }
+
+    if (read_slot(s, &copy) != LGW_OCC_SUCCESS) {
+        return LGW_OCC_ERROR;
+    }
+    slot->freq_hz = occ->freq_hz_start + (uint32_t)(s - occ->slot) * occ->freq_step_hz;
+    slot->nb_updates = copy.nb_updates;
+    slot->ts_ns = copy.ts_ns;
+    slot->level_dbm = copy.level_dbm;
+    memcpy(slot->above, copy.above, sizeof slot->above);
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_occ_busy(const lgw_occ_t * occ, uint32_t freq_hz, int16_t rssi_dbm, float * ratio, uint32_t * age_s) {
+    const struct occ_slot_s * s;
+    struct occ_slot_s copy;
+    uint64_t ts_ns;
+    int i;
+
+    /* check input parameters */
+    if ((occ == NULL) || (ratio == NULL)) {
+        return LGW_OCC_ERROR;
+    }
+    s = find_slot(occ, freq_hz);
+    if ((s == NULL) || (read_slot(s, &copy) != LGW_OCC_SUCCESS) || (copy.nb_updates == 0)) {
+        return LGW_OCC_ERROR;
+    }
+
+    /* lowest threshold at or above rssi_dbm, everything is above the last one */
+    if (rssi_dbm >= copy.level_dbm) {
+        i = 0;
+    } else {
+        i = (copy.level_dbm - rssi_dbm) / LGW_OCC_BIN_DB;
+        if (i > (LGW_OCC_NB_BINS - 1)) {
+            i = LGW_OCC_NB_BINS - 1;
+        }
+    }
+    *ratio = copy.above[i];
+
+    if (age_s != NULL) {
+        ts_ns = now_ns();
+        *age_s = (ts_ns > copy.ts_ns) ? (uint32_t)((ts_ns - copy.ts_ns) / 1000000000ULL) : 0;
+    }
+
+    return LGW_OCC_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
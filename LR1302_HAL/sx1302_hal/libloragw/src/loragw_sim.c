@@ -0,0 +1,949 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Simulated concentrator, used as a communication interface (LGW_COM_SIM)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf fprintf */
+#include <stdlib.h>     /* calloc free strtoul strtod */
+#include <string.h>     /* memset memmove strncpy strtok_r */
+#include <time.h>       /* clock_gettime nanosleep */
+#include <math.h>       /* log */
+
+#include "loragw_sim.h"
+#include "loragw_com.h"
+#include "loragw_reg.h"
+#include "loragw_hal.h"
+#include "loragw_aux.h"
+#include "loragw_sx1302.h"
+#include "tinymt32.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#if DEBUG_COM == 1
+    #define DEBUG_MSG(str)                fprintf(stderr, str)
+    #define DEBUG_PRINTF(fmt, args...)    fprintf(stderr,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
+    #define CHECK_NULL(a)                if(a==NULL){fprintf(stderr,"%s:%d: ERROR: NULL POINTER AS ARGUMENT\n", __FUNCTION__, __LINE__);return LGW_SIM_ERROR;}
+#else
+    #define DEBUG_MSG(str)
+    #define DEBUG_PRINTF(fmt, args...)
+    #define CHECK_NULL(a)                if(a==NULL){return LGW_SIM_ERROR;}
+#endif
+
+#define SIM_ADDR(reg)       (loregs[(reg)].addr)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_MEM_SIZE        0x10000
+#define SIM_RX_BUFFER_ADDR  0x4000  /* reads anywhere in the RX buffer pop the FIFO */
+#define SIM_RX_BUFFER_SIZE  4096
+#define SIM_AIR_MAX         256     /* uplinks on air at the same time */
+#define SIM_XFER_HEADER     3       /* mux target and address */
+#define SIM_SPIN_NS         100000  /* link delays are slept, except for the last 100us which are spun */
+
+#define SIM_FW_VERSION_AGC  10      /* version of the sx1250 AGC firmware, as expected by the HAL */
+#define SIM_FW_VERSION_ARB  2
+#define SIM_MODEL_ID_ADDR   0xD0    /* in OTP */
+
+#define SIM_TX_FREE         0x80
+#define SIM_TX_SCHEDULED    0x91
+#define SIM_TX_SCHEDULED_GPS 0x92
+#define SIM_TX_EMITTING     0x30
+
+/* sx1250 modes, as reported by GET_STATUS */
+#define SIM_RADIO_STDBY_RC  0x02
+#define SIM_RADIO_STDBY_XOSC 0x03
+#define SIM_RADIO_FS        0x04
+#define SIM_RADIO_RX        0x05
+#define SIM_RADIO_TX        0x06
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct sim_pkt_s {
+    uint64_t    start_ns;   /* first preamble symbol on air */
+    uint64_t    end_ns;
+    uint32_t    seq;
+    uint8_t     channel;
+    uint8_t     sf;
+    bool        collided;
+};
+
+struct sim_tx_s {
+    uint8_t     status;
+    uint64_t    start_ns;   /* emission start, when scheduled or emitting */
+    uint64_t    end_ns;
+    uint64_t    last_start_ns; /* last emission, the radio is deaf meanwhile */
+    uint64_t    last_end_ns;
+};
+
+struct sim_s {
+    uint8_t                 mem[SIM_MEM_SIZE];
+    uint8_t                 otp[256];
+    uint64_t                t0_ns;
+    uint64_t                now_ns;         /* latched at the start of each transaction */
+
+    /* link model */
+    uint32_t                lat_ns;
+    uint32_t                byte_ns;
+    uint16_t                chunk;
+    bool                    rmw_atomic;     /* read-modify-write done by the MCU in one request */
+
+    /* traffic generator */
+    double                  rate;
+    uint32_t                sf_weight[13];
+    uint32_t                sf_weight_sum;
+    uint8_t                 nb_chan;
+    uint8_t                 size;
+    double                  coll;
+    tinymt32_t              rng;
+    uint64_t                next_ns;        /* next uplink arrival */
+    struct sim_pkt_s        air[SIM_AIR_MAX];
+    int                     air_nb;
+    uint8_t                 last_channel;
+    uint8_t                 last_sf;
+    uint8_t                 fifo[SIM_RX_BUFFER_SIZE];
+    uint16_t                fifo_rd;
+    uint16_t                fifo_wr;
+
+    /* MCUs, radios and TX chains */
+    uint8_t                 radio_mode[LGW_RF_CHAIN_NB];
+    struct sim_tx_s         tx[LGW_RF_CHAIN_NB];
+
+    struct lgw_sim_stats_s  stats;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const uint32_t sim_sf_mix_default[13] = { 0, 0, 0, 0, 0, 0, 0, 40, 20, 15, 10, 10, 5 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t sim_clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* the 32MHz counter of the sx1302 */
+static uint32_t sim_cnt(uint64_t t_ns) {
+    return (uint32_t)((t_ns * 32) / 1000);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint8_t sim_field(const struct sim_s * s, uint16_t reg) {
+    const struct lgw_reg_s * r = &loregs[reg];
+
+    return (uint8_t)((s->mem[r->addr] >> r->offs) & ((1 << r->leng) - 1));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_xfer_begin(struct sim_s * s) {
+    s->now_ns = sim_clock_ns() - s->t0_ns;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_xfer_end(struct sim_s * s, uint32_t nb_bytes) {
+    uint64_t cost = (uint64_t)s->lat_ns + ((uint64_t)nb_bytes * s->byte_ns);
+    uint64_t end_ns = s->t0_ns + s->now_ns + cost;
+    struct timespec ts;
+
+    s->stats.nb_xfer += 1;
+    s->stats.xfer_bytes += nb_bytes;
+    s->stats.xfer_ns += cost;
+
+    if (cost > SIM_SPIN_NS) {
+        ts.tv_sec = (time_t)((cost - SIM_SPIN_NS) / 1000000000);
+        ts.tv_nsec = (long)((cost - SIM_SPIN_NS) % 1000000000);
+        nanosleep(&ts, NULL);
+    }
+    while (sim_clock_ns() < end_ns);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static double sim_rand01(struct sim_s * s) {
+    return (double)tinymt32_generate_floatOC(&s->rng);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint64_t sim_lora_toa_ns(uint8_t sf, uint8_t size) {
+    return (uint64_t)lora_packet_time_on_air(BW_125KHZ, sf, CR_LORA_4_5, 8, false, false, size, NULL, NULL, NULL) * 1000;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static bool sim_tx_overlap(const struct sim_s * s, uint64_t start_ns, uint64_t end_ns) {
+    int i;
+
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        if ((s->tx[i].last_end_ns > start_ns) && (s->tx[i].last_start_ns < end_ns)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_rx_generate(struct sim_s * s, uint64_t start_ns) {
+    struct sim_pkt_s * p;
+    uint32_t w;
+    int i;
+
+    if (s->air_nb == SIM_AIR_MAX) {
+        s->stats.nb_rx_overflow += 1;
+        return;
+    }
+    p = &s->air[s->air_nb];
+
+    if ((s->stats.nb_rx_generated > 0) && (sim_rand01(s) <= s->coll)) {
+        /* same channel and SF as the previous uplink, which may still be on air */
+        p->channel = s->last_channel;
+        p->sf = s->last_sf;
+    } else {
+        p->channel = (uint8_t)(tinymt32_generate_uint32(&s->rng) % s->nb_chan);
+        w = tinymt32_generate_uint32(&s->rng) % s->sf_weight_sum;
+        for (p->sf = 5; w >= s->sf_weight[p->sf]; p->sf++) {
+            w -= s->sf_weight[p->sf];
+        }
+    }
+    p->start_ns = start_ns;
+    p->end_ns = start_ns + sim_lora_toa_ns(p->sf, s->size);
+    p->seq = s->stats.nb_rx_generated;
+    p->collided = false;
+
+    /* no capture effect: both uplinks are lost */
+    for (i = 0; i < s->air_nb; i++) {
+        if ((s->air[i].channel == p->channel) && (s->air[i].sf == p->sf) && (s->air[i].end_ns > p->start_ns)) {
+            s->air[i].collided = true;
+            p->collided = true;
+        }
+    }
+
+    s->air_nb += 1;
+    s->last_channel = p->channel;
+    s->last_sf = p->sf;
+    s->stats.nb_rx_generated += 1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Format an uplink the way the sx1302 stores it in its RX buffer */
+static void sim_rx_deliver(struct sim_s * s, const struct sim_pkt_s * p) {
+    uint8_t pkt[9 + 255 + 14];
+    uint16_t crc, k, i;
+    uint32_t ts;
+    uint8_t sum = 0;
+    uint16_t nb_bytes = 9 + s->size + 14;
+
+    if ((s->fifo_wr - s->fifo_rd + nb_bytes) > SIM_RX_BUFFER_SIZE) {
+        s->stats.nb_rx_overflow += 1;
+        return;
+    }
+
+    /* header */
+    pkt[0] = 0xA5;
+    pkt[1] = 0xC0;
+    pkt[2] = s->size;
+    pkt[3] = p->channel;
+    pkt[4] = (uint8_t)(0x01 | (CR_LORA_4_5 << 1) | (p->sf << 4)); /* CRC on */
+    pkt[5] = p->channel; /* modem id */
+    pkt[6] = 0x00;
+    pkt[7] = 0x00;
+    pkt[8] = 0x00;
+
+    /* payload: sequence number, then random bytes */
+    for (i = 0; i < s->size; i++) {
+        pkt[9 + i] = (i < 4) ? (uint8_t)(p->seq >> (24 - (8 * i))) : (uint8_t)tinymt32_generate_uint32(&s->rng);
+    }
+    crc = sx1302_lora_payload_crc(&pkt[9], s->size);
+
+    /* tail, timestamped at the end of the uplink */
+    k = 9 + s->size;
+    ts = sim_cnt(p->end_ns);
+    pkt[k + 0] = (p->collided == true) ? 0x01 : 0x00; /* CRC error */
+    pkt[k + 1] = (uint8_t)(int8_t)((int)(tinymt32_generate_uint32(&s->rng) % 60) - 20); /* SNR, 0.25dB steps */
+    pkt[k + 2] = (uint8_t)(100 + (tinymt32_generate_uint32(&s->rng) % 60)); /* RSSI, before offset */
+    pkt[k + 3] = pkt[k + 2] - 2;
+    pkt[k + 4] = 0x00;
+    pkt[k + 5] = 0x00;
+    pkt[k + 6] = (uint8_t)(ts >> 0);
+    pkt[k + 7] = (uint8_t)(ts >> 8);
+    pkt[k + 8] = (uint8_t)(ts >> 16);
+    pkt[k + 9] = (uint8_t)(ts >> 24);
+    pkt[k + 10] = (uint8_t)(crc >> 0);
+    pkt[k + 11] = (uint8_t)(crc >> 8);
+    pkt[k + 12] = 0; /* no fine timestamp metrics */
+    for (i = 0; i < (nb_bytes - 1); i++) {
+        sum += pkt[i];
+    }
+    pkt[k + 13] = sum;
+
+    if ((s->fifo_wr + nb_bytes) > SIM_RX_BUFFER_SIZE) {
+        memmove(s->fifo, &s->fifo[s->fifo_rd], s->fifo_wr - s->fifo_rd);
+        s->fifo_wr -= s->fifo_rd;
+        s->fifo_rd = 0;
+    }
+    memcpy(&s->fifo[s->fifo_wr], pkt, nb_bytes);
+    s->fifo_wr += nb_bytes;
+
+    s->stats.nb_rx_delivered += 1;
+    if (p->collided == true) {
+        s->stats.nb_rx_collided += 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Put the uplinks received until now in the RX FIFO, in order of end of reception */
+static void sim_rx_update(struct sim_s * s) {
+    int i, first;
+
+    if (sim_field(s, SX1302_REG_COMMON_GEN_CONCENTRATOR_MODEM_ENABLE) == 0) {
+        s->next_ns = s->now_ns;
+        return;
+    }
+
+    /* do not generate the backlog of a process which has stopped polling */
+    if (s->now_ns > (s->next_ns + 1000000000)) {
+        s->next_ns = s->now_ns;
+    }
+    while (s->next_ns <= s->now_ns) {
+        sim_rx_generate(s, s->next_ns);
+        s->next_ns += (uint64_t)(-log(sim_rand01(s)) * 1e9 / s->rate);
+    }
+
+    while (1) {
+        first = -1;
+        for (i = 0; i < s->air_nb; i++) {
+            if ((s->air[i].end_ns <= s->now_ns) && ((first < 0) || (s->air[i].end_ns < s->air[first].end_ns))) {
+                first = i;
+            }
+        }
+        if (first < 0) {
+            break;
+        }
+        if (sim_tx_overlap(s, s->air[first].start_ns, s->air[first].end_ns) == true) {
+            s->stats.nb_rx_blind += 1;
+        } else {
+            sim_rx_deliver(s, &s->air[first]);
+        }
+        s->air[first] = s->air[s->air_nb - 1];
+        s->air_nb -= 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Time on air of the packet configured on a TX chain */
+static uint64_t sim_tx_toa_ns(const struct sim_s * s, uint8_t rf_chain) {
+    uint16_t preamble, bit_rate;
+    uint32_t toa_us;
+
+    if (sim_field(s, SX1302_REG_TX_TOP_GEN_CFG_0_MODULATION_TYPE(rf_chain)) == 1) {
+        /* FSK: preamble, 3 bytes of sync word, size byte, payload and CRC */
+        bit_rate = (uint16_t)((sim_field(s, SX1302_REG_TX_TOP_FSK_BIT_RATE_MSB_BIT_RATE(rf_chain)) << 8) | sim_field(s, SX1302_REG_TX_TOP_FSK_BIT_RATE_LSB_BIT_RATE(rf_chain)));
+        preamble = (uint16_t)((sim_field(s, SX1302_REG_TX_TOP_FSK_PREAMBLE_SIZE_MSB_PREAMBLE_SIZE(rf_chain)) << 8) | sim_field(s, SX1302_REG_TX_TOP_FSK_PREAMBLE_SIZE_LSB_PREAMBLE_SIZE(rf_chain)));
+        if (bit_rate == 0) {
+            return 0;
+        }
+        return (uint64_t)(preamble + 3 + 1 + sim_field(s, SX1302_REG_TX_TOP_FSK_PKT_LEN_PKT_LENGTH(rf_chain)) + 2) * 8 * 1000 * bit_rate / 32;
+    }
+
+    preamble = (uint16_t)((sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG1_3_PREAMBLE_SYMB_NB(rf_chain)) << 8) | sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG1_2_PREAMBLE_SYMB_NB(rf_chain)));
+    toa_us = lora_packet_time_on_air(sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_0_MODEM_BW(rf_chain)),
+                                     sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_0_MODEM_SF(rf_chain)),
+                                     sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_1_CODING_RATE(rf_chain)),
+                                     preamble,
+                                     sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_2_IMPLICIT_HEADER(rf_chain)),
+                                     (sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_2_CRC_EN(rf_chain)) == 0),
+                                     sim_field(s, SX1302_REG_TX_TOP_TXRX_CFG0_3_PAYLOAD_LENGTH(rf_chain)),
+                                     NULL, NULL, NULL);
+    return (uint64_t)toa_us * 1000;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_tx_update(struct sim_s * s, uint8_t rf_chain) {
+    struct sim_tx_s * tx = &s->tx[rf_chain];
+
+    if (((tx->status == SIM_TX_SCHEDULED) || (tx->status == SIM_TX_SCHEDULED_GPS)) && (s->now_ns >= tx->start_ns)) {
+        tx->status = SIM_TX_EMITTING;
+        tx->last_start_ns = tx->start_ns;
+        tx->last_end_ns = tx->end_ns;
+        s->stats.nb_tx += 1;
+    }
+    if ((tx->status == SIM_TX_EMITTING) && (s->now_ns >= tx->end_ns)) {
+        tx->status = SIM_TX_FREE;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_tx_trig(struct sim_s * s, uint8_t rf_chain, uint8_t old, uint8_t data) {
+    struct sim_tx_s * tx = &s->tx[rf_chain];
+    uint8_t rise = (uint8_t)(~old & data);
+    uint32_t trig;
+    int i;
+
+    sim_tx_update(s, rf_chain);
+
+    if ((old & ~data) != 0) {
+        /* clearing a trigger resets the state machine, or aborts */
+        if (tx->status == SIM_TX_EMITTING) {
+            tx->last_end_ns = s->now_ns;
+        }
+        tx->status = SIM_TX_FREE;
+    }
+
+    if (rise & (1 << loregs[SX1302_REG_TX_TOP_TX_TRIG_TX_TRIG_IMMEDIATE(rf_chain)].offs)) {
+        tx->start_ns = s->now_ns;
+        tx->status = SIM_TX_SCHEDULED;
+    } else if (rise & (1 << loregs[SX1302_REG_TX_TOP_TX_TRIG_TX_TRIG_DELAYED(rf_chain)].offs)) {
+        trig = 0;
+        for (i = 0; i < 4; i++) {
+            trig |= (uint32_t)s->mem[SIM_ADDR(SX1302_REG_TX_TOP_TIMER_TRIG_BYTE0_TIMER_DELAYED_TRIG(rf_chain)) + i] << (8 * i);
+        }
+        /* a trigger in the past waits for the counter to wrap, like the hardware */
+        tx->start_ns = s->now_ns + (((uint64_t)(uint32_t)(trig - sim_cnt(s->now_ns)) * 1000) / 32);
+        tx->status = SIM_TX_SCHEDULED;
+    } else if (rise & (1 << loregs[SX1302_REG_TX_TOP_TX_TRIG_TX_TRIG_GPS(rf_chain)].offs)) {
+        /* next PPS, or never without GPS */
+        tx->start_ns = (sim_field(s, SX1302_REG_TIMESTAMP_GPS_CTRL_GPS_EN) == 1) ? ((s->now_ns / 1000000000) + 1) * 1000000000 : UINT64_MAX;
+        tx->status = SIM_TX_SCHEDULED_GPS;
+    } else {
+        return;
+    }
+    tx->end_ns = (tx->start_ns == UINT64_MAX) ? UINT64_MAX : tx->start_ns + sim_tx_toa_ns(s, rf_chain);
+    sim_tx_update(s, rf_chain);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* AGC and ARB firmwares start when their MCU is released from reset */
+static bool sim_mcu_released(uint16_t reg_clear, uint16_t reg_prog, uint8_t old, uint8_t data) {
+    uint8_t clear = (uint8_t)(1 << loregs[reg_clear].offs);
+    uint8_t prog = (uint8_t)(1 << loregs[reg_prog].offs);
+
+    return ((old & clear) != 0) && ((data & clear) == 0) && ((data & prog) == 0);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sim_write(struct sim_s * s, uint16_t addr, uint8_t data) {
+    uint8_t old = s->mem[addr];
+    uint8_t v;
+    int i;
+
+    s->mem[addr] = data;
+
+    if (addr == SIM_ADDR(SX1302_REG_AGC_MCU_CTRL_MCU_CLEAR)) {
+        if (sim_mcu_released(SX1302_REG_AGC_MCU_CTRL_MCU_CLEAR, SX1302_REG_AGC_MCU_CTRL_HOST_PROG, old, data) == true) {
+            s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_AGC_STATUS_MCU_AGC_STATUS)] = 0x01;
+            s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_MAIL_BOX_RD_DATA_BYTE0_MCU_MAIL_BOX_RD_DATA)] = SIM_FW_VERSION_AGC;
+        } else if (sim_field(s, SX1302_REG_AGC_MCU_CTRL_MCU_CLEAR) == 1) {
+            s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_AGC_STATUS_MCU_AGC_STATUS)] = 0x00;
+        }
+    } else if (addr == SIM_ADDR(SX1302_REG_AGC_MCU_MCU_MAIL_BOX_WR_DATA_BYTE3_MCU_MAIL_BOX_WR_DATA)) {
+        /* configuration handshake: the AGC echoes the parameters and moves to the next step */
+        for (i = 0; i < 3; i++) {
+            v = s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_MAIL_BOX_WR_DATA_BYTE0_MCU_MAIL_BOX_WR_DATA - i)];
+            s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_MAIL_BOX_RD_DATA_BYTE0_MCU_MAIL_BOX_RD_DATA - i)] = v;
+        }
+        switch (data) {
+            case 0x80: v = 0x02; break; /* radio A init done */
+            case 0x20: v = 0x03; break; /* radio B init done */
+            case 0x0B: v = 0x0F; break;
+            default:
+                v = ((data >= 0x03) && (data <= 0x0A)) ? (uint8_t)(data + 1) : s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_AGC_STATUS_MCU_AGC_STATUS)];
+                break;
+        }
+        s->mem[SIM_ADDR(SX1302_REG_AGC_MCU_MCU_AGC_STATUS_MCU_AGC_STATUS)] = v;
+    } else if (addr == SIM_ADDR(SX1302_REG_ARB_MCU_CTRL_MCU_CLEAR)) {
+        if (sim_mcu_released(SX1302_REG_ARB_MCU_CTRL_MCU_CLEAR, SX1302_REG_ARB_MCU_CTRL_HOST_PROG, old, data) == true) {
+            s->mem[SIM_ADDR(SX1302_REG_ARB_MCU_MCU_ARB_STATUS_MCU_ARB_STATUS)] = 0x01;
+            s->mem[SIM_ADDR(SX1302_REG_ARB_MCU_ARB_DEBUG_STS_0_ARB_DEBUG_STS_0)] = SIM_FW_VERSION_ARB;
+        } else if (sim_field(s, SX1302_REG_ARB_MCU_CTRL_MCU_CLEAR) == 1) {
+            s->mem[SIM_ADDR(SX1302_REG_ARB_MCU_MCU_ARB_STATUS_MCU_ARB_STATUS)] = 0x00;
+        }
+    } else if (addr == SIM_ADDR(SX1302_REG_ARB_MCU_ARB_DEBUG_CFG_1_ARB_DEBUG_CFG_1)) {
+        if (data == 0x01) {
+            s->mem[SIM_ADDR(SX1302_REG_ARB_MCU_MCU_ARB_STATUS_MCU_ARB_STATUS)] = 0x00; /* configuration done */
+        }
+    } else if (addr == SIM_ADDR(SX1302_REG_TX_TOP_TX_TRIG_TX_TRIG_IMMEDIATE(0))) {
+        sim_tx_trig(s, 0, old, data);
+    } else if (addr == SIM_ADDR(SX1302_REG_TX_TOP_TX_TRIG_TX_TRIG_IMMEDIATE(1))) {
+        sim_tx_trig(s, 1, old, data);
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint8_t sim_read(struct sim_s * s, uint16_t addr) {
+    uint16_t pps_addr = SIM_ADDR(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS);
+    uint16_t inst_addr = SIM_ADDR(SX1302_REG_TIMESTAMP_TIMESTAMP_MSB2_TIMESTAMP);
+    uint32_t cnt;
+    int i;
+
+    if ((addr >= SIM_RX_BUFFER_ADDR) && (addr < (SIM_RX_BUFFER_ADDR + SIM_RX_BUFFER_SIZE))) {
+        if (s->fifo_rd == s->fifo_wr) {
+            return 0x00;
+        }
+        return s->fifo[s->fifo_rd++];
+    }
+
+    if ((addr >= pps_addr) && (addr < (pps_addr + 4))) {
+        /* the PPS is simulated on each second since the start, when GPS is enabled */
+        cnt = (sim_field(s, SX1302_REG_TIMESTAMP_GPS_CTRL_GPS_EN) == 1) ? sim_cnt((s->now_ns / 1000000000) * 1000000000) : 0;
+        return (uint8_t)(cnt >> (8 * (3 - (addr - pps_addr))));
+    }
+    if ((addr >= inst_addr) && (addr < (inst_addr + 4))) {
+        cnt = sim_cnt(s->now_ns);
+        return (uint8_t)(cnt >> (8 * (3 - (addr - inst_addr))));
+    }
+
+    if (addr == SIM_ADDR(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_MSB_RX_BUFFER_NB_BYTES)) {
+        /* the FIFO is only filled here, so that it is stable until read out */
+        sim_rx_update(s);
+        return (uint8_t)((s->fifo_wr - s->fifo_rd) >> 8);
+    }
+    if (addr == SIM_ADDR(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_LSB_RX_BUFFER_NB_BYTES)) {
+        return (uint8_t)(s->fifo_wr - s->fifo_rd);
+    }
+
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        if (addr == SIM_ADDR(SX1302_REG_TX_TOP_TX_FSM_STATUS_TX_STATUS(i))) {
+            sim_tx_update(s, (uint8_t)i);
+            return s->tx[i].status;
+        }
+    }
+
+    if (addr == SIM_ADDR(SX1302_REG_OTP_RD_DATA_RD_DATA)) {
+        return s->otp[s->mem[SIM_ADDR(SX1302_REG_OTP_BYTE_ADDR_ADDR)]];
+    }
+
+    return s->mem[addr];
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int sim_parse_sf_mix(struct sim_s * s, char * str) {
+    char * tok;
+    char * save = NULL;
+    unsigned sf, w;
+
+    memset(s->sf_weight, 0, sizeof s->sf_weight);
+    for (tok = strtok_r(str, "/", &save); tok != NULL; tok = strtok_r(NULL, "/", &save)) {
+        if ((sscanf(tok, "%u:%u", &sf, &w) != 2) || (sf < 5) || (sf > 12)) {
+            printf("ERROR: sim: wrong SF mix element \"%s\"\n", tok);
+            return LGW_SIM_ERROR;
+        }
+        s->sf_weight[sf] = w;
+    }
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int sim_parse_options(struct sim_s * s, const char * com_path) {
+    char buf[256];
+    char * tok;
+    char * val;
+    char * save = NULL;
+    long lat_us = -1;
+    long byte_ns = -1;
+    unsigned long seed = 1;
+    int i;
+
+    /* defaults */
+    s->rate = 10.0;
+    memcpy(s->sf_weight, sim_sf_mix_default, sizeof s->sf_weight);
+    s->nb_chan = 8;
+    s->size = 20;
+    s->coll = 0.0;
+    s->lat_ns = 20000;      /* spidev ioctl */
+    s->byte_ns = 1000;      /* 8MHz */
+    s->chunk = 1024;        /* as LGW_BURST_CHUNK */
+    s->rmw_atomic = false;
+
+    strncpy(buf, com_path, sizeof buf - 1);
+    buf[sizeof buf - 1] = '\0';
+    for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        val = strchr(tok, '=');
+        if (val == NULL) {
+            if ((strcmp(tok, "sim") == 0) || (strcmp(tok, "SIM") == 0)) {
+                continue; /* accept a plain "sim" path */
+            }
+            printf("ERROR: sim: option \"%s\" has no value\n", tok);
+            return LGW_SIM_ERROR;
+        }
+        *val++ = '\0';
+        if (strcmp(tok, "rate") == 0) {
+            s->rate = strtod(val, NULL);
+        } else if (strcmp(tok, "sf") == 0) {
+            if (sim_parse_sf_mix(s, val) != LGW_SIM_SUCCESS) {
+                return LGW_SIM_ERROR;
+            }
+        } else if (strcmp(tok, "ch") == 0) {
+            s->nb_chan = (uint8_t)strtoul(val, NULL, 10);
+        } else if (strcmp(tok, "len") == 0) {
+            s->size = (uint8_t)strtoul(val, NULL, 10);
+        } else if (strcmp(tok, "coll") == 0) {
+            s->coll = strtod(val, NULL);
+        } else if (strcmp(tok, "link") == 0) {
+            if (strcmp(val, "spi") == 0) {
+                /* defaults */
+            } else if (strcmp(val, "usb") == 0) {
+                s->lat_ns = 1000000;    /* request/acknowledge round trip with the MCU, USB full speed frames */
+                s->byte_ns = 1000;      /* MCU to sx1302 SPI */
+                s->chunk = 4096;        /* as LGW_USB_BURST_CHUNK */
+                s->rmw_atomic = true;
+            } else if (strcmp(val, "none") == 0) {
+                s->lat_ns = 0;
+                s->byte_ns = 0;
+                s->chunk = 4096;
+            } else {
+                printf("ERROR: sim: unknown link \"%s\"\n", val);
+                return LGW_SIM_ERROR;
+            }
+        } else if (strcmp(tok, "lat") == 0) {
+            lat_us = strtol(val, NULL, 10);
+        } else if (strcmp(tok, "bns") == 0) {
+            byte_ns = strtol(val, NULL, 10);
+        } else if (strcmp(tok, "seed") == 0) {
+            seed = strtoul(val, NULL, 0);
+        } else {
+            printf("ERROR: sim: unknown option \"%s\"\n", tok);
+            return LGW_SIM_ERROR;
+        }
+    }
+    if (lat_us >= 0) {
+        s->lat_ns = (uint32_t)lat_us * 1000;
+    }
+    if (byte_ns >= 0) {
+        s->byte_ns = (uint32_t)byte_ns;
+    }
+
+    /* check */
+    s->sf_weight_sum = 0;
+    for (i = 0; i < (int)ARRAY_SIZE(s->sf_weight); i++) {
+        s->sf_weight_sum += s->sf_weight[i];
+    }
+    if ((s->rate <= 0.0) || (s->sf_weight_sum == 0) || (s->nb_chan < 1) || (s->nb_chan > 8) || (s->coll < 0.0) || (s->coll > 1.0)) {
+        printf("ERROR: sim: wrong traffic options (rate:%.1f ch:%u coll:%.2f)\n", s->rate, s->nb_chan, s->coll);
+        return LGW_SIM_ERROR;
+    }
+
+    s->rng.mat1 = 0x8f7011ee;
+    s->rng.mat2 = 0xfc78ff1f;
+    s->rng.tmat = 0x3793fdff;
+    tinymt32_init(&s->rng, (uint32_t)seed);
+
+    /* EUI, derived from the seed, and chip model */
+    for (i = 0; i < 8; i++) {
+        s->otp[i] = (uint8_t)((0x0016C001FFFE0000ULL + (seed & 0xFFFF)) >> (56 - (8 * i)));
+    }
+    s->otp[SIM_MODEL_ID_ADDR] = CHIP_MODEL_ID_SX1302;
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int lgw_sim_open(const char * com_path, void **com_target_ptr) {
+    struct sim_s * s;
+    const struct lgw_reg_s * r;
+    int i;
+
+    /* check input variables */
+    CHECK_NULL(com_path);
+    CHECK_NULL(com_target_ptr);
+
+    s = calloc(1, sizeof *s);
+    if (s == NULL) {
+        DEBUG_MSG("ERROR : MALLOC FAIL\n");
+        return LGW_SIM_ERROR;
+    }
+
+    if (sim_parse_options(s, com_path) != LGW_SIM_SUCCESS) {
+        free(s);
+        return LGW_SIM_ERROR;
+    }
+
+    /* registers at their reset value */
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        r = &loregs[i];
+        s->mem[r->addr] |= (uint8_t)((r->dflt & ((1 << r->leng) - 1)) << r->offs);
+    }
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        s->radio_mode[i] = SIM_RADIO_STDBY_RC;
+        s->tx[i].status = SIM_TX_FREE;
+    }
+
+    s->t0_ns = sim_clock_ns();
+
+    printf("INFO: sim: %.1f uplinks/s on %u channels, %u bytes, collisions %.2f, link %u us + %u ns/byte\n",
+            s->rate, s->nb_chan, s->size, s->coll, s->lat_ns / 1000, s->byte_ns);
+
+    *com_target_ptr = (void *)s;
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_close(void *com_target) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+
+    printf("INFO: sim: uplinks generated:%u delivered:%u collided:%u overflow:%u blind:%u, downlinks:%u\n",
+            s->stats.nb_rx_generated, s->stats.nb_rx_delivered, s->stats.nb_rx_collided, s->stats.nb_rx_overflow, s->stats.nb_rx_blind, s->stats.nb_tx);
+    printf("INFO: sim: %llu transactions, %llu bytes, %.3f s on the link\n",
+            (unsigned long long)s->stats.nb_xfer, (unsigned long long)s->stats.xfer_bytes, (double)s->stats.xfer_ns / 1e9);
+
+    free(s);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t data) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    if (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) {
+        return LGW_SIM_ERROR;
+    }
+
+    sim_xfer_begin(s);
+    sim_write(s, address, data);
+    sim_xfer_end(s, SIM_XFER_HEADER + 1);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(data);
+    if (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) {
+        return LGW_SIM_ERROR;
+    }
+
+    sim_xfer_begin(s);
+    *data = sim_read(s, address);
+    sim_xfer_end(s, SIM_XFER_HEADER + 2); /* with the dummy byte */
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_rmw(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data) {
+    struct sim_s * s = (struct sim_s *)com_target;
+    uint8_t buf, mask;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    if (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) {
+        return LGW_SIM_ERROR;
+    }
+
+    mask = (uint8_t)(((1 << leng) - 1) << offs);
+
+    sim_xfer_begin(s);
+    buf = sim_read(s, address);
+    if (s->rmw_atomic == false) {
+        /* two transactions on SPI */
+        sim_xfer_end(s, SIM_XFER_HEADER + 2);
+        sim_xfer_begin(s);
+    }
+    sim_write(s, address, (uint8_t)((buf & ~mask) | ((data << offs) & mask)));
+    sim_xfer_end(s, SIM_XFER_HEADER + 1);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size) {
+    struct sim_s * s = (struct sim_s *)com_target;
+    uint16_t i;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(data);
+    if (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) {
+        return LGW_SIM_ERROR;
+    }
+
+    sim_xfer_begin(s);
+    for (i = 0; i < size; i++) {
+        sim_write(s, (uint16_t)(address + i), data[i]);
+    }
+    sim_xfer_end(s, SIM_XFER_HEADER + size);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
+    struct sim_s * s = (struct sim_s *)com_target;
+    uint16_t i;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(data);
+    if (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) {
+        return LGW_SIM_ERROR;
+    }
+
+    sim_xfer_begin(s);
+    for (i = 0; i < size; i++) {
+        data[i] = sim_read(s, (uint16_t)(address + i));
+    }
+    sim_xfer_end(s, SIM_XFER_HEADER + 1 + size);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint16_t lgw_sim_chunk_size(void *com_target) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    return (s != NULL) ? s->chunk : 1024;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_radio_w(void *com_target, uint8_t spi_mux_target, sx1250_op_code_t op_code, uint8_t *data, uint16_t size) {
+    struct sim_s * s = (struct sim_s *)com_target;
+    uint8_t * mode;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(data);
+    if ((spi_mux_target != LGW_SPI_MUX_TARGET_RADIOA) && (spi_mux_target != LGW_SPI_MUX_TARGET_RADIOB)) {
+        return LGW_SIM_ERROR;
+    }
+    mode = &s->radio_mode[(spi_mux_target == LGW_SPI_MUX_TARGET_RADIOA) ? 0 : 1];
+
+    sim_xfer_begin(s);
+    switch (op_code) {
+        case SET_STANDBY:
+            *mode = ((size > 0) && (data[0] == STDBY_XOSC)) ? SIM_RADIO_STDBY_XOSC : SIM_RADIO_STDBY_RC;
+            break;
+        case SET_FS:
+            *mode = SIM_RADIO_FS;
+            break;
+        case SET_RX:
+            *mode = SIM_RADIO_RX;
+            break;
+        case SET_TX:
+            *mode = SIM_RADIO_TX;
+            break;
+        case SET_SLEEP:
+            *mode = SIM_RADIO_STDBY_RC; /* woken up by the next command */
+            break;
+        default:
+            /* calibrations and configuration are accepted as is */
+            break;
+    }
+    sim_xfer_end(s, 2 + size);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_radio_r(void *com_target, uint8_t spi_mux_target, sx1250_op_code_t op_code, uint8_t *data, uint16_t size) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(data);
+    if ((spi_mux_target != LGW_SPI_MUX_TARGET_RADIOA) && (spi_mux_target != LGW_SPI_MUX_TARGET_RADIOB)) {
+        return LGW_SIM_ERROR;
+    }
+
+    sim_xfer_begin(s);
+    memset(data, 0, size); /* no device errors, registers read as 0 */
+    if ((op_code == GET_STATUS) && (size > 0)) {
+        data[0] = (uint8_t)(s->radio_mode[(spi_mux_target == LGW_SPI_MUX_TARGET_RADIOA) ? 0 : 1] << 4);
+    }
+    sim_xfer_end(s, 2 + size);
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_get_temperature(void *com_target, float * temperature) {
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(temperature);
+
+    *temperature = 25.0;
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_sim_get_stats(void *com_target, struct lgw_sim_stats_s * stats) {
+    struct sim_s * s = (struct sim_s *)com_target;
+
+    /* check input variables */
+    CHECK_NULL(com_target);
+    CHECK_NULL(stats);
+
+    *stats = s->stats;
+
+    return LGW_SIM_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -11,6 +11,8 @@ Description:
     a SPI interface.
     Single-byte read/write and burst read/write.
     Could be used with multiple SPI ports in parallel (explicit file descriptor)
+    The clock and burst size of the SX1302 accesses are per device, they can be
+    calibrated and persisted with lgw_spi_link_save(), lgw_spi_open() uses them.
 
 License: Revised BSD License, see LICENSE.TXT file include in the project
 */
@@ -25,6 +27,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <unistd.h>     /* lseek, close */
 #include <fcntl.h>      /* open */
 #include <string.h>     /* memset */
+#include <errno.h>      /* errno */
 
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
@@ -52,14 +55,66 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define READ_ACCESS     0x00
 #define WRITE_ACCESS    0x80
 
-#define LGW_BURST_CHUNK     1024
+#define SPI_LINK_MAGIC      "LGWSPI"
+#define SPI_LINK_VERSION    1   /* to be incremented when the record changes */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/**
+@struct spi_device_s
+@brief SPI link to the SX1302, given as com_target
+*/
+typedef struct spi_device_s {
+    int fd;             /*!> must stay first, the radio modules only see the file descriptor */
+    uint32_t speed_hz;  /*!> clock of the SX1302 accesses */
+    uint16_t chunk;     /*!> max size of a burst transfer */
+} spi_device_t;
+
+/* SPI link file content */
+struct spi_link_record_s {
+    char        magic[sizeof SPI_LINK_MAGIC];
+    uint8_t     version;
+    struct lgw_spi_link_s link;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int spi_link_check(const struct lgw_spi_link_s * link) {
+    if ((link->speed_hz < LGW_SPI_SPEED_MIN) || (link->speed_hz > LGW_SPI_SPEED_MAX)) {
+        return LGW_SPI_ERROR;
+    }
+    if ((link->chunk < LGW_SPI_BURST_CHUNK_MIN) || (link->chunk > LGW_SPI_BURST_CHUNK_MAX)) {
+        return LGW_SPI_ERROR;
+    }
+    return LGW_SPI_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int spi_set_max_speed(int dev, uint32_t speed_hz) {
+    uint32_t i;
+    int a, b;
+
+    /* the radios are still accessed at SPI_SPEED */
+    i = (speed_hz > SPI_SPEED) ? speed_hz : SPI_SPEED;
+    a = ioctl(dev, SPI_IOC_WR_MAX_SPEED_HZ, &i);
+    b = ioctl(dev, SPI_IOC_RD_MAX_SPEED_HZ, &i);
+    if ((a < 0) || (b < 0)) {
+        return LGW_SPI_ERROR;
+    }
+    return LGW_SPI_SUCCESS;
+}
 
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
 /* SPI initialization and configuration */
 int lgw_spi_open(const char * com_path, void **com_target_ptr) {
-    int *spi_device = NULL;
+    spi_device_t *spi_device = NULL;
+    struct lgw_spi_link_s link;
+    char link_path[128];
     int dev;
     int a=0, b=0;
     int i;
@@ -69,7 +124,7 @@ int lgw_spi_open(const char * com_path, void **com_target_ptr) {
     CHECK_NULL(com_target_ptr);
 
     /* allocate memory for the device descriptor */
-    spi_device = malloc(sizeof(int));
+    spi_device = malloc(sizeof(spi_device_t));
     if (spi_device == NULL) {
         DEBUG_MSG("ERROR: MALLOC FAIL\n");
         return LGW_SPI_ERROR;
@@ -79,6 +134,7 @@ int lgw_spi_open(const char * com_path, void **com_target_ptr) {
     dev = open(com_path, O_RDWR);
     if (dev < 0) {
         DEBUG_PRINTF("ERROR: failed to open SPI device %s\n", com_path);
+        free(spi_device);
         return LGW_SPI_ERROR;
     }
 
@@ -93,11 +149,17 @@ int lgw_spi_open(const char * com_path, void **com_target_ptr) {
         return LGW_SPI_ERROR;
     }
 
+    /* use the calibrated link parameters if any, the defaults otherwise */
+    link.speed_hz = SPI_SPEED;
+    link.chunk = LGW_SPI_BURST_CHUNK;
+    link.throughput = 0;
+    if ((lgw_spi_link_path(com_path, link_path, sizeof link_path) == LGW_SPI_SUCCESS) &&
+        (lgw_spi_link_load(link_path, &link) == LGW_SPI_SUCCESS)) {
+        printf("INFO: SPI link from %s: %u Hz, bursts of %u bytes\n", link_path, link.speed_hz, link.chunk);
+    }
+
     /* setting SPI max clk (in Hz) */
-    i = SPI_SPEED;
-    a = ioctl(dev, SPI_IOC_WR_MAX_SPEED_HZ, &i);
-    b = ioctl(dev, SPI_IOC_RD_MAX_SPEED_HZ, &i);
-    if ((a < 0) || (b < 0)) {
+    if (spi_set_max_speed(dev, link.speed_hz) != LGW_SPI_SUCCESS) {
         DEBUG_MSG("ERROR: SPI PORT FAIL TO SET MAX SPEED\n");
         close(dev);
         free(spi_device);
@@ -122,10 +184,13 @@ int lgw_spi_open(const char * com_path, void **com_target_ptr) {
     if ((a < 0) || (b < 0)) {
         DEBUG_MSG("ERROR: SPI PORT FAIL TO SET 8 BITS-PER-WORD\n");
         close(dev);
+        free(spi_device);
         return LGW_SPI_ERROR;
     }
 
-    *spi_device = dev;
+    spi_device->fd = dev;
+    spi_device->speed_hz = link.speed_hz;
+    spi_device->chunk = link.chunk;
     *com_target_ptr = (void *)spi_device;
     DEBUG_MSG("Note: SPI port opened and configured ok\n");
     return LGW_SPI_SUCCESS;
@@ -160,7 +225,7 @@ int lgw_spi_close(void *com_target) {
 
 /* Simple write */
 int lgw_spi_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t data) {
-    int spi_device;
+    spi_device_t *spi_device;
     uint8_t out_buf[4];
     uint8_t command_size;
     struct spi_ioc_transfer k;
@@ -169,7 +234,7 @@ int lgw_spi_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
     /* check input variables */
     CHECK_NULL(com_target);
 
-    spi_device = *(int *)com_target; /* must check that spi_target is not null beforehand */
+    spi_device = (spi_device_t *)com_target; /* must check that spi_target is not null beforehand */
 
     /* prepare frame to be sent */
     out_buf[0] = spi_mux_target;
@@ -182,10 +247,10 @@ int lgw_spi_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
     memset(&k, 0, sizeof(k)); /* clear k */
     k.tx_buf = (unsigned long) out_buf;
     k.len = command_size;
-    k.speed_hz = SPI_SPEED;
+    k.speed_hz = spi_device->speed_hz;
     k.cs_change = 0;
     k.bits_per_word = 8;
-    a = ioctl(spi_device, SPI_IOC_MESSAGE(1), &k);
+    a = ioctl(spi_device->fd, SPI_IOC_MESSAGE(1), &k);
 
     /* determine return code */
     if (a != (int)k.len) {
@@ -201,7 +266,7 @@ int lgw_spi_w(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
 
 /* Simple read */
 int lgw_spi_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
-    int spi_device;
+    spi_device_t *spi_device;
     uint8_t out_buf[5];
     uint8_t command_size;
     uint8_t in_buf[ARRAY_SIZE(out_buf)];
@@ -212,7 +277,7 @@ int lgw_spi_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
     CHECK_NULL(com_target);
     CHECK_NULL(data);
 
-    spi_device = *(int *)com_target; /* must check that com_target is not null beforehand */
+    spi_device = (spi_device_t *)com_target; /* must check that com_target is not null beforehand */
 
     /* prepare frame to be sent */
     out_buf[0] = spi_mux_target;
@@ -227,8 +292,9 @@ int lgw_spi_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
     k.tx_buf = (unsigned long) out_buf;
     k.rx_buf = (unsigned long) in_buf;
     k.len = command_size;
+    k.speed_hz = spi_device->speed_hz;
     k.cs_change = 0;
-    a = ioctl(spi_device, SPI_IOC_MESSAGE(1), &k);
+    a = ioctl(spi_device->fd, SPI_IOC_MESSAGE(1), &k);
 
     /* determine return code */
     if (a != (int)k.len) {
@@ -266,7 +332,7 @@ int lgw_spi_rmw(void *com_target, uint8_t spi_mux_target, uint16_t address, uint
 
 /* Burst (multiple-byte) write */
 int lgw_spi_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size) {
-    int spi_device;
+    spi_device_t *spi_device;
     uint8_t command[3];
     uint8_t command_size;
     struct spi_ioc_transfer k[2];
@@ -282,7 +348,7 @@ int lgw_spi_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
         return LGW_SPI_ERROR;
     }
 
-    spi_device = *(int *)com_target; /* must check that com_target is not null beforehand */
+    spi_device = (spi_device_t *)com_target; /* must check that com_target is not null beforehand */
 
     /* prepare command byte */
     command[0] = spi_mux_target;
@@ -295,14 +361,16 @@ int lgw_spi_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
     memset(&k, 0, sizeof(k)); /* clear k */
     k[0].tx_buf = (unsigned long) &command[0];
     k[0].len = command_size;
+    k[0].speed_hz = spi_device->speed_hz;
     k[0].cs_change = 0;
+    k[1].speed_hz = spi_device->speed_hz;
     k[1].cs_change = 0;
     for (i=0; size_to_do > 0; ++i) {
-        chunk_size = (size_to_do < LGW_BURST_CHUNK) ? size_to_do : LGW_BURST_CHUNK;
-        offset = i * LGW_BURST_CHUNK;
+        chunk_size = (size_to_do < spi_device->chunk) ? size_to_do : spi_device->chunk;
+        offset = i * spi_device->chunk;
         k[1].tx_buf = (unsigned long)(data + offset);
         k[1].len = chunk_size;
-        byte_transfered += (ioctl(spi_device, SPI_IOC_MESSAGE(2), &k) - k[0].len );
+        byte_transfered += (ioctl(spi_device->fd, SPI_IOC_MESSAGE(2), &k) - k[0].len );
         DEBUG_PRINTF("BURST WRITE: to trans %d # chunk %d # transferred %d \n", size_to_do, chunk_size, byte_transfered);
         size_to_do -= chunk_size; /* subtract the quantity of data already transferred */
     }
@@ -321,7 +389,7 @@ int lgw_spi_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
 
 /* Burst (multiple-byte) read */
 int lgw_spi_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
-    int spi_device;
+    spi_device_t *spi_device;
     uint8_t command[4];
     uint8_t command_size;
     struct spi_ioc_transfer k[2];
@@ -337,7 +405,7 @@ int lgw_spi_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8
         return LGW_SPI_ERROR;
     }
 
-    spi_device = *(int *)com_target; /* must check that com_target is not null beforehand */
+    spi_device = (spi_device_t *)com_target; /* must check that com_target is not null beforehand */
 
     /* prepare command byte */
     command[0] = spi_mux_target;
@@ -351,14 +419,16 @@ int lgw_spi_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8
     memset(&k, 0, sizeof(k)); /* clear k */
     k[0].tx_buf = (unsigned long) &command[0];
     k[0].len = command_size;
+    k[0].speed_hz = spi_device->speed_hz;
     k[0].cs_change = 0;
+    k[1].speed_hz = spi_device->speed_hz;
     k[1].cs_change = 0;
     for (i=0; size_to_do > 0; ++i) {
-        chunk_size = (size_to_do < LGW_BURST_CHUNK) ? size_to_do : LGW_BURST_CHUNK;
-        offset = i * LGW_BURST_CHUNK;
+        chunk_size = (size_to_do < spi_device->chunk) ? size_to_do : spi_device->chunk;
+        offset = i * spi_device->chunk;
         k[1].rx_buf = (unsigned long)(data + offset);
         k[1].len = chunk_size;
-        byte_transfered += (ioctl(spi_device, SPI_IOC_MESSAGE(2), &k) - k[0].len );
+        byte_transfered += (ioctl(spi_device->fd, SPI_IOC_MESSAGE(2), &k) - k[0].len );
         DEBUG_PRINTF("BURST READ: to trans %d # chunk %d # transferred %d \n", size_to_do, chunk_size, byte_transfered);
         size_to_do -= chunk_size;  /* subtract the quantity of data already transferred */
     }
@@ -375,8 +445,150 @@ int lgw_spi_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-uint16_t lgw_spi_chunk_size(void) {
-    return (uint16_t)LGW_BURST_CHUNK;
+uint16_t lgw_spi_chunk_size(void *com_target) {
+    if (com_target == NULL) {
+        return (uint16_t)LGW_SPI_BURST_CHUNK;
+    }
+    return ((spi_device_t *)com_target)->chunk;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_spi_set_link(void *com_target, const struct lgw_spi_link_s * link) {
+    spi_device_t *spi_device;
+
+    /* check input parameters */
+    CHECK_NULL(com_target);
+    CHECK_NULL(link);
+    if (spi_link_check(link) != LGW_SPI_SUCCESS) {
+        printf("ERROR: invalid SPI link parameters (%u Hz, %u bytes)\n", link->speed_hz, link->chunk);
+        return LGW_SPI_ERROR;
+    }
+
+    spi_device = (spi_device_t *)com_target;
+    if (spi_set_max_speed(spi_device->fd, link->speed_hz) != LGW_SPI_SUCCESS) {
+        printf("ERROR: failed to set SPI max speed to %u Hz\n", link->speed_hz);
+        return LGW_SPI_ERROR;
+    }
+    spi_device->speed_hz = link->speed_hz;
+    spi_device->chunk = link->chunk;
+
+    return LGW_SPI_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_spi_get_link(void *com_target, struct lgw_spi_link_s * link) {
+    /* check input parameters */
+    CHECK_NULL(com_target);
+    CHECK_NULL(link);
+
+    link->speed_hz = ((spi_device_t *)com_target)->speed_hz;
+    link->chunk = ((spi_device_t *)com_target)->chunk;
+    link->throughput = 0;
+
+    return LGW_SPI_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_spi_link_path(const char * com_path, char * path, size_t size) {
+    const char * name;
+
+    /* check input parameters */
+    CHECK_NULL(com_path);
+    CHECK_NULL(path);
+
+    /* one file per SPI device, named after it */
+    name = strrchr(com_path, '/');
+    name = (name != NULL) ? (name + 1) : com_path;
+    if (snprintf(path, size, "%s/spi_link_%s", LGW_SPI_LINK_DIR, name) >= (int)size) {
+        return LGW_SPI_ERROR;
+    }
+
+    return LGW_SPI_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_spi_link_load(const char * path, struct lgw_spi_link_s * link) {
+    FILE * f;
+    size_t n;
+    struct spi_link_record_s rec;
+
+    /* check input parameters */
+    CHECK_NULL(path);
+    CHECK_NULL(link);
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        DEBUG_PRINTF("INFO: no SPI link file %s\n", path);
+        return LGW_SPI_ERROR;
+    }
+    n = fread(&rec, 1, sizeof rec, f);
+    fclose(f);
+
+    if ((n != sizeof rec) || (memcmp(rec.magic, SPI_LINK_MAGIC, sizeof SPI_LINK_MAGIC) != 0) || (rec.version != SPI_LINK_VERSION)) {
+        printf("WARNING: SPI link file %s is invalid or from another version, ignored\n", path);
+        return LGW_SPI_ERROR;
+    }
+    if (spi_link_check(&rec.link) != LGW_SPI_SUCCESS) {
+        printf("WARNING: SPI link file %s is out of range (%u Hz, %u bytes), ignored\n", path, rec.link.speed_hz, rec.link.chunk);
+        return LGW_SPI_ERROR;
+    }
+
+    *link = rec.link;
+
+    return LGW_SPI_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_spi_link_save(const char * path, const struct lgw_spi_link_s * link) {
+    FILE * f;
+    size_t n;
+    char tmp_path[136];
+    struct spi_link_record_s rec;
+
+    /* check input parameters */
+    CHECK_NULL(path);
+    CHECK_NULL(link);
+    if (spi_link_check(link) != LGW_SPI_SUCCESS) {
+        printf("ERROR: invalid SPI link parameters (%u Hz, %u bytes)\n", link->speed_hz, link->chunk);
+        return LGW_SPI_ERROR;
+    }
+
+    memset(&rec, 0, sizeof rec);
+    memcpy(rec.magic, SPI_LINK_MAGIC, sizeof SPI_LINK_MAGIC);
+    rec.version = SPI_LINK_VERSION;
+    rec.link = *link;
+
+    /* Write aside then rename, so that a crash never leaves a truncated file */
+    if (snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path) >= (int)sizeof tmp_path) {
+        printf("ERROR: SPI link path %s is too long\n", path);
+        return LGW_SPI_ERROR;
+    }
+    f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        printf("ERROR: failed to create SPI link file %s - %s\n", tmp_path, strerror(errno));
+        return LGW_SPI_ERROR;
+    }
+    n = fwrite(&rec, sizeof rec, 1, f);
+    if (fclose(f) != 0) {
+        n = 0;
+    }
+    if (n != 1) {
+        printf("ERROR: failed to write SPI link file %s\n", tmp_path);
+        remove(tmp_path);
+        return LGW_SPI_ERROR;
+    }
+    if (rename(tmp_path, path) != 0) {
+        printf("ERROR: failed to rename %s to %s\n", tmp_path, path);
+        remove(tmp_path);
+        return LGW_SPI_ERROR;
+    }
+
+    return LGW_SPI_SUCCESS;
 }
 
 /* --- EOF ------------------------------------------------------------------ */
@@ -25,6 +25,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_spi.h"
 #include "loragw_com.h"
 #include "loragw_aux.h"
+#include "loragw_trace.h"
 #include "loragw_reg.h"
 #include "loragw_hal.h"
 
@@ -55,6 +56,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define SX1261_PRAM_VERSION_FULL_SIZE 16 /* 15 bytes + terminating char */
 
+#define PRAM_BURST_WORDS 32 /* PRAM words per register write, the command size is limited to 255 bytes */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
@@ -138,6 +141,143 @@ const char * get_scan_status_str(const lgw_spectral_scan_status_t status) {
     }
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* SX1261 commands to receive on a channel, the write mode is left to the caller */
+static int rx_params_write(uint32_t freq_hz, uint8_t bandwidth) {
+    int err;
+    uint8_t buff[16];
+    int32_t freq_reg;
+    uint8_t fsk_bw_reg;
+
+    /* Disable any on-going spectral scan to free the sx1261 radio for LBT */
+    err = sx1261_spectral_scan_abort();
+    CHECK_ERR(err);
+
+    /* Set FS */
+    err = sx1261_reg_w(SX1261_SET_FS, buff, 0);
+    CHECK_ERR(err);
+
+#if DEBUG_SX1261_GET_STATUS /* need to disable spi bulk mode if enable this check */
+    /* Check radio status */
+    err = sx1261_check_status(SX1261_STATUS_MODE_FS | SX1261_STATUS_READY);
+    CHECK_ERR(err);
+#endif
+
+    /* Set frequency */
+    freq_reg = SX1261_FREQ_TO_REG(freq_hz);
+    buff[0] = (uint8_t)(freq_reg >> 24);
+    buff[1] = (uint8_t)(freq_reg >> 16);
+    buff[2] = (uint8_t)(freq_reg >> 8);
+    buff[3] = (uint8_t)(freq_reg >> 0);
+    err = sx1261_reg_w(SX1261_SET_RF_FREQUENCY, buff, 4);
+    CHECK_ERR(err);
+
+    /* Configure RSSI averaging window */
+    buff[0] = 0x08;
+    buff[1] = 0x9B;
+    buff[2] = 0x05 << 2;
+    err = sx1261_reg_w(SX1261_WRITE_REGISTER, buff, 3);
+    CHECK_ERR(err);
+
+    /* Set PacketType */
+    buff[0] = 0x00; /* FSK */
+    err = sx1261_reg_w(SX1261_SET_PACKET_TYPE, buff, 1);
+    CHECK_ERR(err);
+
+    /* Set GFSK bandwidth */
+    switch (bandwidth) {
+        case BW_125KHZ:
+            fsk_bw_reg = 0x0A; /* RX_BW_234300 Hz */
+            break;
+        case BW_250KHZ:
+            fsk_bw_reg = 0x09; /* RX_BW_467000 Hz */
+            break;
+        default:
+            printf("ERROR: %s: Cannot configure sx1261 for bandwidth %u\n", __FUNCTION__, bandwidth);
+            return LGW_REG_ERROR;
+    }
+
+    /* Set modulation params for FSK */
+    buff[0] = 0;    // BR
+    buff[1] = 0x14; // BR
+    buff[2] = 0x00; // BR
+    buff[3] = 0x00; // Gaussian BT disabled
+    buff[4] = fsk_bw_reg;
+    buff[5] = 0x02; // FDEV
+    buff[6] = 0xE9; // FDEV
+    buff[7] = 0x0F; // FDEV
+    err = sx1261_reg_w(SX1261_SET_MODULATION_PARAMS, buff, 8);
+    CHECK_ERR(err);
+
+    /* Set packet params for FSK */
+    buff[0] = 0x00; /* Preamble length MSB */
+    buff[1] = 0x20; /* Preamble length LSB 32 bits*/
+    buff[2] = 0x05; /* Preamble detector lenght 16 bits */
+    buff[3] = 0x20; /* SyncWordLength 32 bits*/
+    buff[4] = 0x00; /* AddrComp disabled */
+    buff[5] = 0x01; /* PacketType variable size */
+    buff[6] = 0xff; /* PayloadLength 255 bytes */
+    buff[7] = 0x00; /* CRCType 1 Byte */
+    buff[8] = 0x00; /* Whitening disabled*/
+    err = sx1261_reg_w(SX1261_SET_PACKET_PARAMS, buff, 9);
+    CHECK_ERR(err);
+
+    /* Set Radio in Rx continuous mode */
+    buff[0] = 0xFF;
+    buff[1] = 0xFF;
+    buff[2] = 0xFF;
+    err = sx1261_reg_w(SX1261_SET_RX, buff, 3);
+    CHECK_ERR(err);
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* SX1261 command to start LBT scanning on the current channel, the write mode is left to the caller */
+static int lbt_config_write(lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm) {
+    uint8_t buff[16];
+    uint16_t nb_scan;
+    uint8_t threshold_reg = -2 * threshold_dbm;
+
+    switch (scan_time_us) {
+        case LGW_LBT_SCAN_TIME_128_US:
+            nb_scan = 24;
+            break;
+        case LGW_LBT_SCAN_TIME_5000_US:
+            nb_scan = 715;
+            break;
+        default:
+            printf("ERROR: wrong scan_time_us value\n");
+            return -1;
+    }
+
+    /* Configure LBT scan */
+    buff[0] = 11; // intervall_rssi_read (10 => 7.68 usec,11 => 8.2 usec, 12 => 8.68 usec)
+    buff[1] = (nb_scan >> 8) & 0xFF;
+    buff[2] = (nb_scan >> 0) & 0xFF;
+    buff[3] = threshold_reg;
+    buff[4] = 1; // gpioId
+    return sx1261_reg_w(0x9a, buff, 5);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* Leave the BULK write mode, on success or error: the queued writes are flushed
+   so that none is left in the MCU buffer, and SINGLE mode is restored */
+static int bulk_mode_exit(int err) {
+    if (sx1261_com_flush() != 0) {
+        printf("ERROR: Failed to flush sx1261 SPI\n");
+        err = LGW_REG_ERROR;
+    }
+    if (sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_SINGLE) != 0) {
+        err = LGW_REG_ERROR;
+    }
+
+    return err;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -192,8 +332,9 @@ int sx1261_reg_r(sx1261_op_code_t op_code, uint8_t *data, uint16_t size) {
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 int sx1261_load_pram(void) {
-    int i, err;
+    int i, j, n, err;
     uint8_t buff[32];
+    uint8_t burst[2 + 4*PRAM_BURST_WORDS];
     char pram_version[SX1261_PRAM_VERSION_FULL_SIZE];
     uint32_t val, addr;
 
@@ -222,20 +363,29 @@ int sx1261_load_pram(void) {
     err = sx1261_reg_w( SX1261_WRITE_REGISTER, buff, 3);
     CHECK_ERR(err);
 
-    /* Load patch */
-    for (i = 0; i < (int)PRAM_COUNT; i++) {
-        val = pram[i];
+    /* Load patch, by bursts (the register address auto-increments), all in one USB transfer */
+    err = sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
+    CHECK_ERR(err);
+    for (i = 0; i < (int)PRAM_COUNT; i += n) {
+        n = ((PRAM_COUNT - i) > PRAM_BURST_WORDS) ? PRAM_BURST_WORDS : (PRAM_COUNT - i);
         addr = 0x8000 + 4*i;
 
-        buff[0] = (addr >> 8) & 0xFF;
-        buff[1] = (addr >> 0) & 0xFF;
-        buff[2] = (val >> 24) & 0xFF;
-        buff[3] = (val >> 16) & 0xFF;
-        buff[4] = (val >> 8)  & 0xFF;
-        buff[5] = (val >> 0)  & 0xFF;
-        err = sx1261_reg_w(SX1261_WRITE_REGISTER, buff, 6);
-        CHECK_ERR(err);
+        burst[0] = (addr >> 8) & 0xFF;
+        burst[1] = (addr >> 0) & 0xFF;
+        for (j = 0; j < n; j++) {
+            val = pram[i + j];
+            burst[2 + 4*j] = (val >> 24) & 0xFF;
+            burst[3 + 4*j] = (val >> 16) & 0xFF;
+            burst[4 + 4*j] = (val >> 8)  & 0xFF;
+            burst[5 + 4*j] = (val >> 0)  & 0xFF;
+        }
+        err = sx1261_reg_w(SX1261_WRITE_REGISTER, burst, 2 + 4*n);
+        if (err != LGW_REG_SUCCESS) {
+            break;
+        }
     }
+    err = bulk_mode_exit(err);
+    CHECK_ERR(err);
 
     /* Disable patch update */
     buff[0] = 0x06;
@@ -351,109 +501,40 @@ int sx1261_setup(void) {
 
 int sx1261_set_rx_params(uint32_t freq_hz, uint8_t bandwidth) {
     int err;
-    uint8_t buff[16];
-    int32_t freq_reg;
-    uint8_t fsk_bw_reg;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_SET_RX_PARAMS, freq_hz);
 
     /* Set SPI write bulk mode to optimize speed on USB */
     err = sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
     CHECK_ERR(err);
 
-    /* Disable any on-going spectral scan to free the sx1261 radio for LBT */
-    err = sx1261_spectral_scan_abort();
-    CHECK_ERR(err);
+    err = rx_params_write(freq_hz, bandwidth);
 
-    /* Set FS */
-    err = sx1261_reg_w(SX1261_SET_FS, buff, 0);
+    /* Flush write (USB BULK mode) and set back to SINGLE write mode */
+    err = bulk_mode_exit(err);
     CHECK_ERR(err);
 
-#if DEBUG_SX1261_GET_STATUS /* need to disable spi bulk mode if enable this check */
+#if DEBUG_SX1261_GET_STATUS
     /* Check radio status */
-    err = sx1261_check_status(SX1261_STATUS_MODE_FS | SX1261_STATUS_READY);
+    err = sx1261_check_status(SX1261_STATUS_MODE_RX | SX1261_STATUS_READY);
     CHECK_ERR(err);
 #endif
 
-    /* Set frequency */
-    freq_reg = SX1261_FREQ_TO_REG(freq_hz);
-    buff[0] = (uint8_t)(freq_reg >> 24);
-    buff[1] = (uint8_t)(freq_reg >> 16);
-    buff[2] = (uint8_t)(freq_reg >> 8);
-    buff[3] = (uint8_t)(freq_reg >> 0);
-    err = sx1261_reg_w(SX1261_SET_RF_FREQUENCY, buff, 4);
-    CHECK_ERR(err);
-
-    /* Configure RSSI averaging window */
-    buff[0] = 0x08;
-    buff[1] = 0x9B;
-    buff[2] = 0x05 << 2;
-    err = sx1261_reg_w(SX1261_WRITE_REGISTER, buff, 3);
-    CHECK_ERR(err);
-
-    /* Set PacketType */
-    buff[0] = 0x00; /* FSK */
-    err = sx1261_reg_w(SX1261_SET_PACKET_TYPE, buff, 1);
-    CHECK_ERR(err);
-
-    /* Set GFSK bandwidth */
-    switch (bandwidth) {
-        case BW_125KHZ:
-            fsk_bw_reg = 0x0A; /* RX_BW_234300 Hz */
-            break;
-        case BW_250KHZ:
-            fsk_bw_reg = 0x09; /* RX_BW_467000 Hz */
-            break;
-        default:
-            printf("ERROR: %s: Cannot configure sx1261 for bandwidth %u\n", __FUNCTION__, bandwidth);
-            return LGW_REG_ERROR;
-    }
+    DEBUG_PRINTF("SX1261: RX params set to %u Hz (bw:0x%02X)\n", freq_hz, bandwidth);
 
-    /* Set modulation params for FSK */
-    buff[0] = 0;    // BR
-    buff[1] = 0x14; // BR
-    buff[2] = 0x00; // BR
-    buff[3] = 0x00; // Gaussian BT disabled
-    buff[4] = fsk_bw_reg;
-    buff[5] = 0x02; // FDEV
-    buff[6] = 0xE9; // FDEV
-    buff[7] = 0x0F; // FDEV
-    err = sx1261_reg_w(SX1261_SET_MODULATION_PARAMS, buff, 8);
-    CHECK_ERR(err);
+    LGW_TRACE_END(LGW_TRACE_SX1261_SET_RX_PARAMS, LGW_REG_SUCCESS);
 
-    /* Set packet params for FSK */
-    buff[0] = 0x00; /* Preamble length MSB */
-    buff[1] = 0x20; /* Preamble length LSB 32 bits*/
-    buff[2] = 0x05; /* Preamble detector lenght 16 bits */
-    buff[3] = 0x20; /* SyncWordLength 32 bits*/
-    buff[4] = 0x00; /* AddrComp disabled */
-    buff[5] = 0x01; /* PacketType variable size */
-    buff[6] = 0xff; /* PayloadLength 255 bytes */
-    buff[7] = 0x00; /* CRCType 1 Byte */
-    buff[8] = 0x00; /* Whitening disabled*/
-    err = sx1261_reg_w(SX1261_SET_PACKET_PARAMS, buff, 9);
-    CHECK_ERR(err);
+    return LGW_REG_SUCCESS;
+}
 
-    /* Set Radio in Rx continuous mode */
-    buff[0] = 0xFF;
-    buff[1] = 0xFF;
-    buff[2] = 0xFF;
-    err = sx1261_reg_w(SX1261_SET_RX, buff, 3);
-    CHECK_ERR(err);
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-    /* Flush write (USB BULK mode) */
-    err = sx1261_com_flush();
-    if (err != 0) {
-        printf("ERROR: %s: Failed to flush sx1261 SPI\n", __FUNCTION__);
-        return -1;
-    }
+int sx1261_lbt_start(lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm) {
+    int err;
 
-    /* Setting back to SINGLE BULK write mode */
-    err = sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_SINGLE);
-    CHECK_ERR(err);
+    /* Record function start time */
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_LBT_START, scan_time_us);
 
 #if DEBUG_SX1261_GET_STATUS
     /* Check radio status */
@@ -461,62 +542,48 @@ int sx1261_set_rx_params(uint32_t freq_hz, uint8_t bandwidth) {
     CHECK_ERR(err);
 #endif
 
-    DEBUG_PRINTF("SX1261: RX params set to %u Hz (bw:0x%02X)\n", freq_hz, bandwidth);
+    err = lbt_config_write(scan_time_us, threshold_dbm);
+    CHECK_ERR(err);
+
+    /* Wait for Scan Time before TX trigger request */
+    wait_us((uint16_t)scan_time_us);
+
+    DEBUG_PRINTF("SX1261: LBT started: scan time = %uus, threshold = %ddBm\n", (uint16_t)scan_time_us, threshold_dbm);
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_LBT_START, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
+
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int sx1261_lbt_start(lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm) {
+int sx1261_lbt_start_on(uint32_t freq_hz, uint8_t bandwidth, lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm) {
     int err;
-    uint8_t buff[16];
-    uint16_t nb_scan;
-    uint8_t threshold_reg = -2 * threshold_dbm;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
-
-    switch (scan_time_us) {
-        case LGW_LBT_SCAN_TIME_128_US:
-            nb_scan = 24;
-            break;
-        case LGW_LBT_SCAN_TIME_5000_US:
-            nb_scan = 715;
-            break;
-        default:
-            printf("ERROR: wrong scan_time_us value\n");
-            return -1;
-    }
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_LBT_START, scan_time_us);
 
-#if DEBUG_SX1261_GET_STATUS
-    /* Check radio status */
-    err = sx1261_check_status(SX1261_STATUS_MODE_RX | SX1261_STATUS_READY);
+    /* RX parameters and LBT configuration in a single transfer on USB */
+    err = sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
     CHECK_ERR(err);
-#endif
 
-    /* Configure LBT scan */
-    buff[0] = 11; // intervall_rssi_read (10 => 7.68 usec,11 => 8.2 usec, 12 => 8.68 usec)
-    buff[1] = (nb_scan >> 8) & 0xFF;
-    buff[2] = (nb_scan >> 0) & 0xFF;
-    buff[3] = threshold_reg;
-    buff[4] = 1; // gpioId
-    err = sx1261_reg_w(0x9a, buff, 5);
+    err = rx_params_write(freq_hz, bandwidth);
+    if (err == LGW_REG_SUCCESS) {
+        err = lbt_config_write(scan_time_us, threshold_dbm);
+    }
+
+    err = bulk_mode_exit(err);
     CHECK_ERR(err);
 
     /* Wait for Scan Time before TX trigger request */
     wait_us((uint16_t)scan_time_us);
 
-    DEBUG_PRINTF("SX1261: LBT started: scan time = %uus, threshold = %ddBm\n", (uint16_t)scan_time_us, threshold_dbm);
+    DEBUG_PRINTF("SX1261: LBT started on %u Hz (bw:0x%02X): scan time = %uus, threshold = %ddBm\n", freq_hz, bandwidth, (uint16_t)scan_time_us, threshold_dbm);
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_LBT_START, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
-
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -524,26 +591,30 @@ int sx1261_lbt_start(lgw_lbt_scan_time_t scan_time_us, int8_t threshold_dbm) {
 int sx1261_lbt_stop(void) {
     int err;
     uint8_t buff[16];
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_LBT_STOP, 0);
+
+    err = sx1261_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
+    CHECK_ERR(err);
 
     /* Disable LBT */
     buff[0] = 0x08;
     buff[1] = 0x9B;
     buff[2] = 0x00;
     err = sx1261_reg_w(SX1261_WRITE_REGISTER, buff, 3);
-    CHECK_ERR(err);
 
     /* Set FS */
-    err = sx1261_reg_w(SX1261_SET_FS, buff, 0);
+    if (err == LGW_REG_SUCCESS) {
+        err = sx1261_reg_w(SX1261_SET_FS, buff, 0);
+    }
+
+    err = bulk_mode_exit(err);
     CHECK_ERR(err);
 
     DEBUG_MSG("SX1261: LBT stopped\n");
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_LBT_STOP, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
@@ -553,11 +624,9 @@ int sx1261_lbt_stop(void) {
 int sx1261_spectral_scan_start(uint16_t nb_scan) {
     int err;
     uint8_t buff[4]; /* 66 bytes for spectral scan results + 2 bytes register address + 1 dummy byte for reading */
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_SCAN_START, nb_scan);
 
     /* Start spectral scan */
     buff[0] = (nb_scan >> 8) & 0xFF; /* nb_scan MSB */
@@ -568,7 +637,7 @@ int sx1261_spectral_scan_start(uint16_t nb_scan) {
 
     DEBUG_MSG("INFO: Spectral Scan started...\n");
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_SCAN_START, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
@@ -578,11 +647,9 @@ int sx1261_spectral_scan_start(uint16_t nb_scan) {
 int sx1261_spectral_scan_get_results(int8_t rssi_offset, int16_t * levels_dbm, uint16_t * results) {
     int err, i;
     uint8_t buff[69]; /* 66 bytes for spectral scan results + 2 bytes register address + 1 dummy byte for reading */
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_SCAN_RESULTS, 0);
 
     /* Check input parameters */
     CHECK_NULL(levels_dbm);
@@ -608,7 +675,7 @@ int sx1261_spectral_scan_get_results(int8_t rssi_offset, int16_t * levels_dbm, u
     levels_dbm[32] = -31*4 + rssi_offset;
     results[32] = (uint16_t)((buff[3 + 32*2] << 8) + buff[3 + 32*2 + 1]);
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_SCAN_RESULTS, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
@@ -618,13 +685,11 @@ int sx1261_spectral_scan_get_results(int8_t rssi_offset, int16_t * levels_dbm, u
 int sx1261_spectral_scan_status(lgw_spectral_scan_status_t * status) {
     int err;
     uint8_t buff[16];
-    /* performances variables */
-    struct timeval tm;
 
     CHECK_NULL(status);
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_SCAN_STATUS, 0);
 
     /* Get status */
     buff[0] = 0x07;
@@ -654,7 +719,7 @@ int sx1261_spectral_scan_status(lgw_spectral_scan_status_t * status) {
 
     DEBUG_PRINTF("INFO: %s: %s\n", __FUNCTION__, get_scan_status_str(*status));
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_SCAN_STATUS, *status);
 
     return LGW_REG_SUCCESS;
 }
@@ -664,11 +729,9 @@ int sx1261_spectral_scan_status(lgw_spectral_scan_status_t * status) {
 int sx1261_spectral_scan_abort(void) {
     int err;
     uint8_t buff[16];
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1261_SCAN_ABORT, 0);
 
     /* Disable LBT */
     buff[0] = 0x08;
@@ -679,7 +742,7 @@ int sx1261_spectral_scan_abort(void) {
 
     DEBUG_MSG("SX1261: spectral scan aborted\n");
 
-    _meas_time_stop(4, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1261_SCAN_ABORT, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
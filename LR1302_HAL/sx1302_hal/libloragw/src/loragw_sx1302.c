@@ -24,6 +24,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "loragw_reg.h"
 #include "loragw_aux.h"
+#include "loragw_trace.h"
 #include "loragw_hal.h"
 #include "loragw_sx1302.h"
 #include "loragw_sx1302_timestamp.h"
@@ -32,6 +33,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_agc_params.h"
 #include "loragw_cal.h"
 #include "loragw_debug.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -81,6 +83,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define ARB_MEM_ADDR 0x2000
 
 #define MCU_FW_SIZE 8192 /* size of the firmware IN BYTES (= twice the number of 14b words) */
+#define MCU_FW_CHECK_NB 8      /* number of windows read back by the sampled firmware check */
+#define MCU_FW_CHECK_SIZE 32   /* size of each window */
 
 #define FW_VERSION_CAL 1 /* Expected version of calibration firmware */
 
@@ -135,11 +139,17 @@ const uint8_t ifmod_config[LGW_IF_CHAIN_NB] = LGW_IFMODEM_CONFIG;
 /* Radio calibration firmware */
 #include "cal_fw.var" /* text_cal_sx1257_16_Nov_1 */
 
+/* Log file */
+#define log_file            (lgw_ctx_cur()->log_file)
+
 /* Buffer to hold RX data */
-rx_buffer_t rx_buffer;
+#define rx_buffer           (lgw_ctx_cur()->rx_buffer)
 
 /* Internal timestamp counter */
-timestamp_counter_t counter_us;
+#define counter_us          (lgw_ctx_cur()->counter_us)
+
+/* Read back the whole firmware after loading, instead of a few windows */
+#define fw_check_strict     (lgw_ctx_cur()->fw_check_strict)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
@@ -165,15 +175,52 @@ extern int32_t lgw_bw_getval(int x);
 */
 void lora_crc16(const char data, int *crc);
 
-/* -------------------------------------------------------------------------- */
-/* --- INTERNAL SHARED VARIABLES -------------------------------------------- */
-
-/* Log file */
-extern FILE *log_file;
+/**
+@brief Check a firmware written in AGC or ARB memory
+@param mem_addr address of the MCU memory
+@param firmware firmware which has been written
+@param name MCU name, for error messages
+@return LGW_REG_SUCCESS if the memory content matches, LGW_REG_ERROR otherwise
+*/
+static int mcu_fw_check(uint16_t mem_addr, const uint8_t *firmware, const char *name);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
+static int mcu_fw_check(uint16_t mem_addr, const uint8_t *firmware, const char *name)
+{
+    uint8_t fw_check[MCU_FW_SIZE];
+    uint16_t offset;
+    int i, err;
+
+    if (fw_check_strict == true)
+    {
+        err = lgw_mem_rb(mem_addr, fw_check, MCU_FW_SIZE, false);
+        if ((err != LGW_REG_SUCCESS) || (memcmp(firmware, fw_check, MCU_FW_SIZE) != 0))
+        {
+            fprintf(stderr, "ERROR: %s fw read/write check failed\n", name);
+            return LGW_REG_ERROR;
+        }
+        return LGW_REG_SUCCESS;
+    }
+
+    /* Windows evenly spread from the first to the last byte, the MCU parity check covers the rest */
+    for (i = 0; i < MCU_FW_CHECK_NB; i++)
+    {
+        offset = (uint16_t)((i * (MCU_FW_SIZE - MCU_FW_CHECK_SIZE)) / (MCU_FW_CHECK_NB - 1));
+        err = lgw_mem_rb(mem_addr + offset, fw_check, MCU_FW_CHECK_SIZE, false);
+        if ((err != LGW_REG_SUCCESS) || (memcmp(firmware + offset, fw_check, MCU_FW_CHECK_SIZE) != 0))
+        {
+            fprintf(stderr, "ERROR: %s fw read/write check failed at offset 0x%04X\n", name, offset);
+            return LGW_REG_ERROR;
+        }
+    }
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int calculate_freq_to_time_drift(uint32_t freq_hz, uint8_t bw, uint16_t *mant, uint8_t *exp)
 {
     uint64_t mantissa_u64;
@@ -363,11 +410,9 @@ int sx1302_get_model_id(sx1302_model_id_t *model_id)
 int sx1302_update(void)
 {
     uint32_t inst, pps;
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1302_UPDATE, 0);
 
 #if 0 /* Disabled because it brings latency on USB, for low value. TODO: do this less frequently ? */
     int32_t val;
@@ -388,7 +433,7 @@ int sx1302_update(void)
     /* Update internal timestamp counter wrapping status */
     timestamp_counter_get(&counter_us, &inst, &pps);
 
-    _meas_time_stop(2, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1302_UPDATE, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
@@ -1267,7 +1312,6 @@ int sx1302_gps_enable(bool enable)
 int sx1302_agc_load_firmware(const uint8_t *firmware)
 {
     int32_t val;
-    uint8_t fw_check[MCU_FW_SIZE];
     int err = LGW_REG_SUCCESS;
 
     /* Take control over AGC MCU */
@@ -1279,10 +1323,8 @@ int sx1302_agc_load_firmware(const uint8_t *firmware)
     err |= lgw_mem_wb(AGC_MEM_ADDR, firmware, MCU_FW_SIZE);
 
     /* Read back and check */
-    err |= lgw_mem_rb(AGC_MEM_ADDR, fw_check, MCU_FW_SIZE, false);
-    if (memcmp(firmware, fw_check, sizeof fw_check) != 0)
+    if (mcu_fw_check(AGC_MEM_ADDR, firmware, "AGC") != LGW_REG_SUCCESS)
     {
-        fprintf(stderr, "ERROR: AGC fw read/write check failed\n");
         return LGW_REG_ERROR;
     }
 
@@ -1303,6 +1345,13 @@ int sx1302_agc_load_firmware(const uint8_t *firmware)
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+void sx1302_set_fw_check_strict(bool strict)
+{
+    fw_check_strict = strict;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int sx1302_agc_status(uint8_t *status)
 {
     int32_t val;
@@ -1772,7 +1821,6 @@ int sx1302_agc_start(uint8_t version, lgw_radio_type_t radio_type, uint8_t ana_g
 
 int sx1302_arb_load_firmware(const uint8_t *firmware)
 {
-    uint8_t fw_check[MCU_FW_SIZE];
     int32_t val;
     int err = LGW_REG_SUCCESS;
 
@@ -1782,13 +1830,11 @@ int sx1302_arb_load_firmware(const uint8_t *firmware)
     err |= lgw_reg_w(SX1302_REG_COMMON_PAGE_PAGE, 0x00);
 
     /* Write ARB fw in ARB MEM */
-    err |= lgw_mem_wb(ARB_MEM_ADDR, &firmware[0], MCU_FW_SIZE);
+    err |= lgw_mem_wb(ARB_MEM_ADDR, firmware, MCU_FW_SIZE);
 
     /* Read back and check */
-    err |= lgw_mem_rb(ARB_MEM_ADDR, fw_check, MCU_FW_SIZE, false);
-    if (memcmp(firmware, fw_check, sizeof fw_check) != 0)
+    if (mcu_fw_check(ARB_MEM_ADDR, firmware, "ARB") != LGW_REG_SUCCESS)
     {
-        fprintf(stderr, "ERROR: ARB fw read/write check failed\n");
         return LGW_REG_ERROR;
     }
 
@@ -2038,10 +2084,9 @@ int sx1302_arb_start(uint8_t version, const struct lgw_conf_ftime_s *ftime_conte
 int sx1302_fetch(uint8_t *nb_pkt)
 {
     int err;
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1302_FETCH, 0);
 
     /* Fetch packets from sx1302 if no more left in RX buffer */
     if (rx_buffer.buffer_pkt_nb == 0)
@@ -2070,7 +2115,66 @@ int sx1302_fetch(uint8_t *nb_pkt)
     /* Return the number of packet fetched */
     *nb_pkt = rx_buffer.buffer_pkt_nb;
 
-    _meas_time_stop(2, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1302_FETCH, *nb_pkt);
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int sx1302_poll(uint8_t *nb_pkt)
+{
+    int err, err_flush;
+    bool fetch = (rx_buffer.buffer_pkt_nb == 0);
+    uint8_t raw_nb_bytes[RX_BUFFER_NB_BYTES_RAW_SIZE] = {0};
+    uint8_t raw_counter[TIMESTAMP_COUNTER_RAW_SIZE];
+    uint32_t inst, pps;
+
+    /* Record function start time */
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1302_POLL, 0);
+
+    CHECK_NULL(nb_pkt);
+
+    /* Read the RX buffer level, then the counters, in a single transaction (USB BULK mode).
+       The counters are read after the level so that the timestamps of the packets fetched
+       are always older than the counter reference used to expand them */
+    err = lgw_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
+    CHECK_ERR(err);
+    if (fetch == true)
+    {
+        rx_buffer_read_nb_bytes(raw_nb_bytes); /* errors ignored, as in rx_buffer_fetch() */
+    }
+    err = timestamp_counter_read(raw_counter);
+    err_flush = lgw_com_flush();
+    if ((err != LGW_REG_SUCCESS) || (err_flush != LGW_COM_SUCCESS))
+    {
+        printf("ERROR: Failed to read RX buffer level and counters\n");
+        return LGW_REG_ERROR;
+    }
+
+    /* Fetch packets from sx1302 if no more left in RX buffer */
+    if (fetch == true)
+    {
+        rx_buffer_new(&rx_buffer);
+        err = rx_buffer_fetch_nb_bytes(&rx_buffer, raw_nb_bytes);
+        if (err != LGW_REG_SUCCESS)
+        {
+            printf("ERROR: Failed to fetch RX buffer\n");
+            return LGW_REG_ERROR;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Note: remaining %u packets in RX buffer, do not fetch sx1302 yet...\n", rx_buffer.buffer_pkt_nb);
+    }
+
+    /* Update internal timestamp counter wrapping status */
+    timestamp_counter_decode(&counter_us, raw_counter, &inst, &pps);
+
+    /* Return the number of packet fetched */
+    *nb_pkt = rx_buffer.buffer_pkt_nb;
+
+    LGW_TRACE_END(LGW_TRACE_SX1302_POLL, *nb_pkt);
 
     return LGW_REG_SUCCESS;
 }
@@ -2088,10 +2192,9 @@ int sx1302_parse(lgw_context_t *context, struct lgw_pkt_rx_s *p)
     uint8_t cr;
     int32_t timestamp_correction;
     rx_packet_t pkt;
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1302_PARSE, 0);
 
     /* Check input params */
     CHECK_NULL(context);
@@ -2427,7 +2530,7 @@ int sx1302_parse(lgw_context_t *context, struct lgw_pkt_rx_s *p)
     /* Packet CRC status */
     p->crc = pkt.rx_crc16_value;
 
-    _meas_time_stop(2, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1302_PARSE, p->size);
 
     return LGW_REG_SUCCESS;
 }
@@ -2696,11 +2799,9 @@ int sx1302_send(lgw_radio_type_t radio_type, struct lgw_tx_gain_lut_s *tx_lut, b
     uint16_t tx_start_delay;
     uint8_t chirp_lowpass = 0;
     uint8_t buff[2]; /* for 16-bits register write operation */
-    /* performances variables */
-    struct timeval tm;
 
     /* Record function start time */
-    _meas_time_start(&tm);
+    LGW_TRACE_BEGIN(LGW_TRACE_SX1302_SEND, 0);
 
     /* Check input parameters */
     CHECK_NULL(tx_lut);
@@ -3106,7 +3207,7 @@ int sx1302_send(lgw_radio_type_t radio_type, struct lgw_tx_gain_lut_s *tx_lut, b
     CHECK_ERR(err);
 
     /* Compute time spent in this function */
-    _meas_time_stop(2, tm, __FUNCTION__);
+    LGW_TRACE_END(LGW_TRACE_SX1302_SEND, LGW_REG_SUCCESS);
 
     return LGW_REG_SUCCESS;
 }
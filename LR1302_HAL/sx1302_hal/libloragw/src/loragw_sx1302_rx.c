@@ -126,9 +126,39 @@ int rx_buffer_del(rx_buffer_t * self) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int rx_buffer_read_nb_bytes(uint8_t * raw) {
+    int err;
+
+    /* Check input params */
+    CHECK_NULL(raw);
+
+    /* Check if there is data in the FIFO */
+    err = lgw_reg_rb(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_MSB_RX_BUFFER_NB_BYTES, &raw[0], 2);
+
+    /* Workaround for multi-byte read issue: read again (the highest value is kept by rx_buffer_fetch_nb_bytes) */
+    err |= lgw_reg_rb(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_MSB_RX_BUFFER_NB_BYTES, &raw[2], 2);
+
+    return (err == LGW_REG_SUCCESS) ? LGW_REG_SUCCESS : LGW_REG_ERROR;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int rx_buffer_fetch(rx_buffer_t * self) {
+    uint8_t raw[RX_BUFFER_NB_BYTES_RAW_SIZE] = {0};
+
+    /* Check input params */
+    CHECK_NULL(self);
+
+    /* Errors are ignored here, as before: the FIFO is then considered empty */
+    rx_buffer_read_nb_bytes(raw);
+
+    return rx_buffer_fetch_nb_bytes(self, raw);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int rx_buffer_fetch_nb_bytes(rx_buffer_t * self, const uint8_t * raw) {
     int i, res;
-    uint8_t buff[2];
     uint8_t payload_len;
     uint16_t next_pkt_idx;
     int idx;
@@ -136,21 +166,18 @@ int rx_buffer_fetch(rx_buffer_t * self) {
 
     /* Check input params */
     CHECK_NULL(self);
+    CHECK_NULL(raw);
 
-    /* Check if there is data in the FIFO */
-    lgw_reg_rb(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_MSB_RX_BUFFER_NB_BYTES, buff, sizeof buff);
-    nb_bytes_1 = (buff[0] << 8) | (buff[1] << 0);
-
-    /* Workaround for multi-byte read issue: read again and ensure new read is not lower than the previous one */
-    lgw_reg_rb(SX1302_REG_RX_TOP_RX_BUFFER_NB_BYTES_MSB_RX_BUFFER_NB_BYTES, buff, sizeof buff);
-    nb_bytes_2 = (buff[0] << 8) | (buff[1] << 0);
+    /* Ensure second read is not lower than the first one */
+    nb_bytes_1 = (raw[0] << 8) | (raw[1] << 0);
+    nb_bytes_2 = (raw[2] << 8) | (raw[3] << 0);
 
     self->buffer_size = (nb_bytes_2 > nb_bytes_1) ? nb_bytes_2 : nb_bytes_1;
 
     /* Fetch bytes from fifo if any */
     if (self->buffer_size > 0) {
         DEBUG_MSG   ("-----------------\n");
-        DEBUG_PRINTF("%s: nb_bytes to be fetched: %u (%u %u)\n", __FUNCTION__, self->buffer_size, buff[1], buff[0]);
+        DEBUG_PRINTF("%s: nb_bytes to be fetched: %u (%u %u)\n", __FUNCTION__, self->buffer_size, raw[3], raw[2]);
 
         memset(self->buffer, 0, sizeof self->buffer);
         res = lgw_mem_rb(0x4000, self->buffer, self->buffer_size, true);
@@ -31,6 +31,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_sx1302_timestamp.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -46,16 +47,6 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
     #define CHECK_NULL(a)                if(a==NULL){return LGW_REG_ERROR;}
 #endif
 
-/* -------------------------------------------------------------------------- */
-/* --- PRIVATE TYPES -------------------------------------------------------- */
-
-#define MAX_TIMESTAMP_PPS_HISTORY 16
-struct timestamp_pps_history_s {
-    uint32_t history[MAX_TIMESTAMP_PPS_HISTORY];
-    uint8_t idx; /* next slot to be written */
-    uint8_t size; /* current size */
-};
-
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
@@ -66,11 +57,7 @@ struct timestamp_pps_history_s {
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
 /* history of the last PPS timestamps */
-static struct timestamp_pps_history_s timestamp_pps_history = {
-    .history = { 0 },
-    .idx = 0,
-    .size = 0
-};
+#define timestamp_pps_history   (lgw_ctx_cur()->timestamp_pps_history)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
@@ -319,32 +306,42 @@ void timestamp_counter_update(timestamp_counter_t * self, uint32_t pps, uint32_t
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t * pps) {
+int timestamp_counter_read(uint8_t * raw) {
     int x;
-    uint8_t buff[8];
-    uint8_t buff_wa[8];
-    uint32_t counter_inst_us_raw_27bits_now;
-    uint32_t counter_pps_us_raw_27bits_now;
 
     /* Get the freerun and pps 32MHz timestamp counters - 8 bytes
             0 -> 3 : PPS counter
             4 -> 7 : Freerun counter (inst)
     */
-    x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &buff[0], 8);
+    x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &raw[0], 8);
     if (x != LGW_REG_SUCCESS) {
         printf("ERROR: Failed to get timestamp counter value\n");
         return -1;
     }
 
-    /* Workaround concentrator chip issue:
-        - read MSB again
-        - if MSB changed, read the full counter again
-     */
-    x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &buff_wa[0], 8);
+    /* Workaround concentrator chip issue: read MSB again (checked by timestamp_counter_decode) */
+    x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &raw[8], 8);
     if (x != LGW_REG_SUCCESS) {
         printf("ERROR: Failed to get timestamp counter MSB value\n");
         return -1;
     }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int timestamp_counter_decode(timestamp_counter_t * self, uint8_t * raw, uint32_t * inst, uint32_t * pps) {
+    int x;
+    uint8_t * buff = &raw[0];
+    uint8_t * buff_wa = &raw[8];
+    uint32_t counter_inst_us_raw_27bits_now;
+    uint32_t counter_pps_us_raw_27bits_now;
+
+    /* Workaround concentrator chip issue:
+        - read MSB again
+        - if MSB changed, read the full counter again
+     */
     if ((buff[0] != buff_wa[0]) || (buff[4] != buff_wa[4])) {
         x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &buff_wa[0], 8);
         if (x != LGW_REG_SUCCESS) {
@@ -376,6 +373,18 @@ int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t * pps) {
+    uint8_t raw[TIMESTAMP_COUNTER_RAW_SIZE];
+
+    if (timestamp_counter_read(raw) != 0) {
+        return -1;
+    }
+
+    return timestamp_counter_decode(self, raw, inst, pps);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 uint32_t timestamp_counter_expand(timestamp_counter_t * self, bool pps, uint32_t cnt_us) {
     struct timestamp_info_s* tinfo = (pps == true) ? &self->pps : &self->inst;
     uint32_t counter_us_32bits;
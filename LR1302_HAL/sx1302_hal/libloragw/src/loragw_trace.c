@@ -0,0 +1,265 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator HAL runtime tracing
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdio.h>      /* fopen, fprintf */
+#include <stdlib.h>     /* calloc, malloc */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getpid */
+
+#include "loragw_trace.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RING_LOAD(x)        __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RING_STORE(x, v)    __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* a complete section, recorded at its end */
+struct trace_rec_s {
+    uint64_t    ts_ns;      /* CLOCK_MONOTONIC, beginning of the section */
+    uint64_t    dur_ns;
+    uint32_t    arg;
+    uint32_t    ret;
+    uint16_t    event;
+};
+
+/* section begun and not ended yet */
+struct trace_open_s {
+    uint64_t    ts_ns;
+    uint32_t    arg;
+    uint16_t    event;
+};
+
+/* written by a single thread, read by the exporter */
+struct trace_ring_s {
+    struct trace_ring_s *   next;
+    uint32_t                tid;    /* thread index, in order of first event */
+    uint32_t                head;   /* number of records written */
+    uint32_t                wr;     /* number of records written or being written */
+    struct trace_rec_s      rec[LGW_TRACE_RING_SIZE];
+    /* private to the thread */
+    struct trace_open_s     open[LGW_TRACE_EVENT_NB];
+    uint32_t                depth;  /* number of open sections */
+};
+
+struct trace_event_desc_s {
+    const char *    name;
+    const char *    cat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const struct trace_event_desc_s trace_event_desc[LGW_TRACE_EVENT_NB] = {
+    [LGW_TRACE_HAL_RECEIVE]             = { "lgw_receive",                      "hal" },
+    [LGW_TRACE_HAL_SEND]                = { "lgw_send",                         "hal" },
+    [LGW_TRACE_SX1302_UPDATE]           = { "sx1302_update",                    "sx1302" },
+    [LGW_TRACE_SX1302_FETCH]            = { "sx1302_fetch",                     "sx1302" },
+    [LGW_TRACE_SX1302_POLL]             = { "sx1302_poll",                      "sx1302" },
+    [LGW_TRACE_SX1302_PARSE]            = { "sx1302_parse",                     "sx1302" },
+    [LGW_TRACE_SX1302_SEND]             = { "sx1302_send",                      "sx1302" },
+    [LGW_TRACE_COM_W]                   = { "lgw_com_w",                        "com" },
+    [LGW_TRACE_COM_R]                   = { "lgw_com_r",                        "com" },
+    [LGW_TRACE_COM_RMW]                 = { "lgw_com_rmw",                      "com" },
+    [LGW_TRACE_COM_WB]                  = { "lgw_com_wb",                       "com" },
+    [LGW_TRACE_COM_RB]                  = { "lgw_com_rb",                       "com" },
+    [LGW_TRACE_MCU_WRITE_REQ]           = { "write_req",                        "mcu" },
+    [LGW_TRACE_MCU_READ_ACK_HDR]        = { "read_ack(hdr)",                    "mcu" },
+    [LGW_TRACE_MCU_READ_ACK_PAYLOAD]    = { "read_ack(payload)",                "mcu" },
+    [LGW_TRACE_LBT_START]               = { "lgw_lbt_start",                    "lbt" },
+    [LGW_TRACE_LBT_TX_STATUS]           = { "lgw_lbt_tx_status",                "lbt" },
+    [LGW_TRACE_LBT_STOP]                = { "lgw_lbt_stop",                     "lbt" },
+    [LGW_TRACE_SX1261_SET_RX_PARAMS]    = { "sx1261_set_rx_params",             "sx1261" },
+    [LGW_TRACE_SX1261_LBT_START]        = { "sx1261_lbt_start",                 "sx1261" },
+    [LGW_TRACE_SX1261_LBT_STOP]         = { "sx1261_lbt_stop",                  "sx1261" },
+    [LGW_TRACE_SX1261_SCAN_START]       = { "sx1261_spectral_scan_start",       "sx1261" },
+    [LGW_TRACE_SX1261_SCAN_RESULTS]     = { "sx1261_spectral_scan_get_results", "sx1261" },
+    [LGW_TRACE_SX1261_SCAN_STATUS]      = { "sx1261_spectral_scan_status",      "sx1261" },
+    [LGW_TRACE_SX1261_SCAN_ABORT]       = { "sx1261_spectral_scan_abort",       "sx1261" }
+};
+
+bool lgw_trace_enabled = false;
+
+static struct trace_ring_s * ring_list = NULL;  /* all the rings, never freed */
+static uint32_t ring_nb = 0;
+static __thread struct trace_ring_s * ring_self = NULL;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static struct trace_ring_s * trace_ring_new(void) {
+    struct trace_ring_s * ring;
+
+    /* once per thread, on its first event */
+    ring = calloc(1, sizeof *ring);
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = __atomic_add_fetch(&ring_nb, 1, __ATOMIC_RELAXED);
+
+    /* lock-free push, the list is only ever prepended */
+    ring->next = RING_LOAD(ring_list);
+    while (!__atomic_compare_exchange_n(&ring_list, &ring->next, ring, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    ring_self = ring;
+    return ring;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void lgw_trace_enable(bool enable) {
+    __atomic_store_n(&lgw_trace_enabled, enable, __ATOMIC_RELAXED);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_trace_record(lgw_trace_event_t event, lgw_trace_phase_t phase, uint32_t arg) {
+    struct trace_ring_s * ring = ring_self;
+    struct trace_rec_s * rec;
+    struct timespec now;
+    uint64_t ts_ns;
+    uint32_t head, i;
+
+    if (ring == NULL) {
+        ring = trace_ring_new();
+        if (ring == NULL) {
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ts_ns = ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+
+    /* innermost open section of this event, the traced functions are not reentrant */
+    for (i = ring->depth; i > 0; i--) {
+        if (ring->open[i - 1].event == (uint16_t)event) {
+            break;
+        }
+    }
+
+    if (phase == LGW_TRACE_PHASE_BEGIN) {
+        /* a previous section of this event, and the ones opened in it, returned
+           without their end: drop them */
+        if (i > 0) {
+            ring->depth = i - 1;
+        }
+        if (ring->depth < LGW_TRACE_EVENT_NB) {
+            ring->open[ring->depth].ts_ns = ts_ns;
+            ring->open[ring->depth].arg = arg;
+            ring->open[ring->depth].event = (uint16_t)event;
+            ring->depth += 1;
+        }
+        return;
+    }
+
+    /* end without a beginning (tracing enabled within the section) */
+    if (i == 0) {
+        return;
+    }
+    ring->depth = i - 1;
+
+    /* announce the slot before overwriting it, see lgw_trace_export() */
+    head = ring->head;
+    __atomic_store_n(&ring->wr, head + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* overwrite the oldest record when the ring is full */
+    rec = &ring->rec[head & (LGW_TRACE_RING_SIZE - 1)];
+    rec->ts_ns = ring->open[i - 1].ts_ns;
+    rec->dur_ns = ts_ns - ring->open[i - 1].ts_ns;
+    rec->arg = ring->open[i - 1].arg;
+    rec->ret = arg;
+    rec->event = (uint16_t)event;
+    RING_STORE(ring->head, head + 1);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_trace_export(const char * path) {
+    struct trace_ring_s * ring;
+    struct trace_rec_s * copy, * rec;
+    FILE * file;
+    uint32_t i, head, base, first, wr;
+    int pid = (int)getpid();
+    bool comma = false;
+
+    copy = malloc(LGW_TRACE_RING_SIZE * sizeof *copy);
+    if (copy == NULL) {
+        printf("ERROR: failed to allocate trace export buffer\n");
+        return LGW_TRACE_ERROR;
+    }
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("ERROR: failed to open trace file %s\n", path);
+        free(copy);
+        return LGW_TRACE_ERROR;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (ring = RING_LOAD(ring_list); ring != NULL; ring = ring->next) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", (comma == true) ? ",\n" : "", pid, ring->tid, ring->tid);
+        comma = true;
+
+        /* copy the ring, then keep only the records its writer did not start
+           overwriting meanwhile: record i shares its slot with i + LGW_TRACE_RING_SIZE */
+        head = RING_LOAD(ring->head);
+        base = (head > LGW_TRACE_RING_SIZE) ? (head - LGW_TRACE_RING_SIZE) : 0;
+        for (i = base; i != head; i++) {
+            copy[i - base] = ring->rec[i & (LGW_TRACE_RING_SIZE - 1)];
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        wr = __atomic_load_n(&ring->wr, __ATOMIC_RELAXED);
+        first = (wr > (base + LGW_TRACE_RING_SIZE)) ? (wr - LGW_TRACE_RING_SIZE) : base;
+
+        for (i = first; i < head; i++) {
+            rec = &copy[i - base];
+            if (rec->event >= LGW_TRACE_EVENT_NB) {
+                continue;
+            }
+            /* Chrome trace timestamps are in microseconds */
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%u,\"args\":{\"arg\":%lld,\"ret\":%lld}}",
+                            trace_event_desc[rec->event].name, trace_event_desc[rec->event].cat,
+                            (unsigned long long)(rec->ts_ns / 1000), (unsigned)(rec->ts_ns % 1000),
+                            (unsigned long long)(rec->dur_ns / 1000), (unsigned)(rec->dur_ns % 1000),
+                            pid, ring->tid,
+                            (long long)rec->arg, (long long)(int32_t)rec->ret); /* results may be negative error codes */
+        }
+    }
+    fprintf(file, "\n]}\n");
+    free(copy);
+
+    if (fclose(file) != 0) {
+        printf("ERROR: failed to write trace file %s\n", path);
+        return LGW_TRACE_ERROR;
+    }
+
+    return LGW_TRACE_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -18,10 +18,17 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
 #include <stdint.h>     /* C99 types */
 #include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf fprintf */
-#include <stdlib.h>     /* malloc free */
+#include <stdlib.h>     /* posix_memalign free */
 #include <unistd.h>     /* lseek, close */
 #include <fcntl.h>      /* open */
 #include <string.h>     /* strncmp */
@@ -32,6 +39,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_usb.h"
 #include "loragw_mcu.h"
 #include "loragw_aux.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -50,14 +58,30 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
+#define USB_CACHELINE_SIZE  64
+
+#define USB_REQ_WB_HDR_SIZE 8   /* 5 bytes: REQ metadata (MCU), 3 bytes: SPI header (SX1302) */
+#define USB_REQ_RB_HDR_SIZE 9   /* 5 bytes: REQ metadata (MCU), 3 bytes: SPI header (SX1302), 1 byte: dummy */
+#define USB_REQ_RMW_SIZE    6
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE TYPES -------------------------------------------------------- */
 
+/**
+@struct usb_device_s
+@brief USB link to the concentrator MCU, given as com_target
+*/
+typedef struct usb_device_s {
+    int fd; /*!> must stay first, some modules only see the file descriptor */
+    uint8_t hdr[USB_CACHELINE_SIZE] __attribute__((aligned(USB_CACHELINE_SIZE))); /*!> header of the SPI request being sent */
+} usb_device_t;
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES  --------------------------------------------------- */
 
-static lgw_com_write_mode_t _lgw_write_mode = LGW_COM_WRITE_MODE_SINGLE;
-static uint8_t _lgw_spi_req_nb = 0;
+/* held by the context of the selected concentrator */
+#define _lgw_write_mode     (lgw_ctx_cur()->write_mode)
+#define _lgw_spi_req_nb     (lgw_ctx_cur()->spi_req_nb)
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
@@ -133,7 +157,8 @@ int set_blocking_linux(int fd, bool blocking) {
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
 int lgw_usb_open(const char * com_path, void **com_target_ptr) {
-    int *usb_device = NULL;
+    usb_device_t *usb_device = NULL;
+    void *ptr;
     char portname[50];
     int x;
     int fd;
@@ -145,11 +170,12 @@ int lgw_usb_open(const char * com_path, void **com_target_ptr) {
     /*check input variables*/
     CHECK_NULL(com_target_ptr);
 
-    usb_device = malloc(sizeof(int));
-    if (usb_device == NULL) {
+    /* request headers are built in place, keep them on their own cacheline */
+    if (posix_memalign(&ptr, USB_CACHELINE_SIZE, sizeof(usb_device_t)) != 0) {
         DEBUG_MSG("ERROR : MALLOC FAIL\n");
         return LGW_USB_ERROR;
     }
+    usb_device = (usb_device_t *)ptr;
 
     /* open tty port */
     sprintf(portname, "%s", com_path);
@@ -161,6 +187,7 @@ int lgw_usb_open(const char * com_path, void **com_target_ptr) {
         x = set_interface_attribs_linux(fd, B115200);
         if (x != 0) {
             printf("ERROR: failed to configure COM port %s\n", portname);
+            close(fd);
             free(usb_device);
             return LGW_USB_ERROR;
         }
@@ -179,20 +206,19 @@ int lgw_usb_open(const char * com_path, void **com_target_ptr) {
         x = set_blocking_linux(fd, true);
         if (x != 0) {
             printf("ERROR: failed to configure COM port %s\n", portname);
+            close(fd);
             free(usb_device);
             return LGW_USB_ERROR;
         }
 
-        *usb_device = fd;
-        *com_target_ptr = (void*)usb_device;
-
-        /* Initialize pseudo-random generator for MCU request ID */
-        srand(0);
+        usb_device->fd = fd;
 
         /* Check MCU version (ignore first char of the received version (release/debug) */
         printf("INFO: Connect to MCU\n");
         if (mcu_ping(fd, &gw_info) != 0) {
             printf("ERROR: failed to ping the concentrator MCU\n");
+            close(fd);
+            free(usb_device);
             return LGW_USB_ERROR;
         }
         if (strncmp(gw_info.version + 1, mcu_version_string, sizeof mcu_version_string) != 0) {
@@ -200,9 +226,20 @@ int lgw_usb_open(const char * com_path, void **com_target_ptr) {
         }
         printf("INFO: Concentrator MCU version is %s\n", gw_info.version);
 
+        /* Read the ACKs from a dedicated thread, so that requests can be pipelined */
+        if (mcu_pipe_start(fd) != 0) {
+            printf("ERROR: failed to start the MCU request pipeline\n");
+            close(fd);
+            free(usb_device);
+            return LGW_USB_ERROR;
+        }
+
         /* Get MCU status */
         if (mcu_get_status(fd, &mcu_status) != 0) {
             printf("ERROR: failed to get status from the concentrator MCU\n");
+            mcu_pipe_stop();
+            close(fd);
+            free(usb_device);
             return LGW_USB_ERROR;
         }
         printf("INFO: MCU status: sys_time:%u temperature:%.1foC\n", mcu_status.system_time_ms, mcu_status.temperature);
@@ -216,10 +253,13 @@ int lgw_usb_open(const char * com_path, void **com_target_ptr) {
         x |= mcu_gpio_write(fd, 0, 8, 1); /* unset PA8 : SX1261_NRESET inactive */
         if (x != 0) {
             printf("ERROR: failed to reset SX1302\n");
+            mcu_pipe_stop();
+            close(fd);
             free(usb_device);
             return LGW_USB_ERROR;
         }
 
+        *com_target_ptr = (void*)usb_device;
         return LGW_USB_SUCCESS;
     }
 
@@ -251,6 +291,9 @@ int lgw_usb_close(void *com_target) {
         err = LGW_USB_ERROR;
     }
 
+    /* stop reading ACKs before closing the file */
+    mcu_pipe_stop();
+
     /* close file & deallocate file descriptor */
     x = close(usb_device);
     free(com_target);
@@ -287,15 +330,15 @@ int lgw_usb_r(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_
 
 /* Single Byte Read-Modify-Write */
 int lgw_usb_rmw(void *com_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data) {
-    int usb_device;
-    uint8_t command_size = 6;
-    uint8_t in_out_buf[command_size];
+    usb_device_t *usb_device;
+    uint8_t *in_out_buf;
     int a = 0;
 
     /* check input variables */
     CHECK_NULL(com_target);
 
-    usb_device = *(int *)com_target;
+    usb_device = (usb_device_t *)com_target;
+    in_out_buf = usb_device->hdr;
 
     DEBUG_PRINTF("==> RMW register @ 0x%04X, offs:%u leng:%u value:0x%02X\n", address, offs, leng, data);
 
@@ -308,10 +351,10 @@ int lgw_usb_rmw(void *com_target, uint16_t address, uint8_t offs, uint8_t leng,
     in_out_buf[5] = data << offs;
 
     if (_lgw_write_mode == LGW_COM_WRITE_MODE_BULK) {
-        a = mcu_spi_store(in_out_buf, command_size);
+        a = mcu_spi_store(in_out_buf, USB_REQ_RMW_SIZE);
         _lgw_spi_req_nb += 1;
     } else {
-        a = mcu_spi_write(usb_device, in_out_buf, command_size);
+        a = mcu_spi_write(usb_device->fd, in_out_buf, USB_REQ_RMW_SIZE);
     }
 
     /* determine return code */
@@ -328,19 +371,18 @@ int lgw_usb_rmw(void *com_target, uint16_t address, uint8_t offs, uint8_t leng,
 
 /* Burst (multiple-byte) write */
 int lgw_usb_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size) {
-    int usb_device;
-    uint16_t command_size = size + 8; /* 5 bytes: REQ metadata (MCU), 3 bytes: SPI header (SX1302) */
-    uint8_t in_out_buf[command_size];
-    int i;
+    usb_device_t *usb_device;
+    uint8_t *in_out_buf;
     int a = 0;
 
     /* check input parameters */
     CHECK_NULL(com_target);
     CHECK_NULL(data);
 
-    usb_device = *(int *)com_target;
+    usb_device = (usb_device_t *)com_target;
+    in_out_buf = usb_device->hdr;
 
-    /* prepare command */
+    /* prepare command header, the data is sent from the caller buffer */
     /* Request metadata */
     in_out_buf[0] = _lgw_spi_req_nb; /* Req ID */
     in_out_buf[1] = MCU_SPI_REQ_TYPE_READ_WRITE; /* Req type */
@@ -351,15 +393,12 @@ int lgw_usb_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
     in_out_buf[5] = spi_mux_target; /* SX1302 -> RADIO_A or RADIO_B */
     in_out_buf[6] = 0x80 | ((address >> 8) & 0x7F);
     in_out_buf[7] =        ((address >> 0) & 0xFF);
-    for (i = 0; i < size; i++) {
-        in_out_buf[i + 8] = data[i];
-    }
 
     if (_lgw_write_mode == LGW_COM_WRITE_MODE_BULK) {
-        a = mcu_spi_store(in_out_buf, command_size);
+        a = mcu_spi_store_write(in_out_buf, USB_REQ_WB_HDR_SIZE, data, size);
         _lgw_spi_req_nb += 1;
     } else {
-        a = mcu_spi_write(usb_device, in_out_buf, command_size);
+        a = mcu_spi_transfer(usb_device->fd, in_out_buf, USB_REQ_WB_HDR_SIZE, data, NULL, size);
     }
 
     /* determine return code */
@@ -376,21 +415,20 @@ int lgw_usb_wb(void *com_target, uint8_t spi_mux_target, uint16_t address, const
 
 /* Burst (multiple-byte) read */
 int lgw_usb_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
-    int usb_device;
-    uint16_t command_size = size + 9;  /* 5 bytes: REQ metadata (MCU), 3 bytes: SPI header (SX1302), 1 byte: dummy*/
-    uint8_t in_out_buf[command_size];
-    int i;
+    usb_device_t *usb_device;
+    uint8_t *in_out_buf;
     int a = 0;
 
     /* check input parameters */
     CHECK_NULL(com_target);
     CHECK_NULL(data);
 
-    usb_device = *(int *)com_target;
+    usb_device = (usb_device_t *)com_target;
+    in_out_buf = usb_device->hdr;
 
-    /* prepare command */
+    /* prepare command header, the content of data is sent as dummy bytes */
     /* Request metadata */
-    in_out_buf[0] = 0; /* Req ID */
+    in_out_buf[0] = _lgw_spi_req_nb; /* Req ID */
     in_out_buf[1] = MCU_SPI_REQ_TYPE_READ_WRITE; /* Req type */
     in_out_buf[2] = MCU_SPI_TARGET_SX1302; /* MCU -> SX1302 */
     in_out_buf[3] = (uint8_t)((size + 4) >> 8); /* payload size + spi_mux_target + address + dummy byte */
@@ -400,16 +438,20 @@ int lgw_usb_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8
     in_out_buf[6] = 0x00 | ((address >> 8) & 0x7F);
     in_out_buf[7] =        ((address >> 0) & 0xFF);
     in_out_buf[8] = 0x00; /* dummy byte */
-    for (i = 0; i < size; i++) {
-        in_out_buf[i + 9] = data[i];
-    }
 
     if (_lgw_write_mode == LGW_COM_WRITE_MODE_BULK) {
-        /* makes no sense to read in bulk mode, as we can't get the result */
-        printf("ERROR: USB READ BURST FAILURE - bulk mode is enabled\n");
-        return -1;
+        /* the result is copied to data when the bulk buffer is flushed */
+        a = mcu_spi_store_read(in_out_buf, USB_REQ_RB_HDR_SIZE, data, size);
+        _lgw_spi_req_nb += 1;
+        if (a != 0) {
+            DEBUG_MSG("ERROR: USB READ BURST FAILURE\n");
+            return -1;
+        }
+        DEBUG_MSG("Note: USB read burst queued\n");
+        return 0;
     } else {
-        a = mcu_spi_write(usb_device, in_out_buf, command_size);
+        /* the bytes read land directly in data */
+        a = mcu_spi_transfer(usb_device->fd, in_out_buf, USB_REQ_RB_HDR_SIZE, data, data, size);
     }
 
     /* determine return code */
@@ -418,7 +460,6 @@ int lgw_usb_rb(void *com_target, uint8_t spi_mux_target, uint16_t address, uint8
         return -1;
     } else {
         DEBUG_MSG("Note: USB read burst success\n");
-        memcpy(data, in_out_buf + 9, size); /* remove the first bytes, keep only the payload */
         return 0;
     }
 }
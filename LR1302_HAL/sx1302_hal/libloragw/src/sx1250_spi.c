@@ -128,6 +128,7 @@ int sx1250_spi_r(void *com_target, uint8_t spi_mux_target, sx1250_op_code_t op_c
     k.tx_buf = (unsigned long) out_buf;
     k.rx_buf = (unsigned long) in_buf;
     k.len = command_size;
+    k.speed_hz = SPI_SPEED;
     k.cs_change = 0;
     a = ioctl(com_device, SPI_IOC_MESSAGE(1), &k);
 
@@ -84,6 +84,7 @@ int sx125x_spi_r(void *com_target, uint8_t spi_mux_target, uint8_t address, uint
     k.tx_buf = (unsigned long) out_buf;
     k.rx_buf = (unsigned long) in_buf;
     k.len = command_size;
+    k.speed_hz = SPI_SPEED;
     k.cs_change = 0;
     a = ioctl(com_device, SPI_IOC_MESSAGE(1), &k);
 
@@ -24,6 +24,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "sx1261_com.h"
 #include "sx1261_spi.h"
 #include "sx1261_usb.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -46,14 +47,14 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
 /**
-@brief The current communication type in use (SPI, USB)
+@brief The current communication type in use (SPI, USB), of the selected concentrator
 */
-static lgw_com_type_t _sx1261_com_type = LGW_COM_UNKNOWN;
+#define _sx1261_com_type    (lgw_ctx_cur()->sx1261_com_type)
 
 /**
-@brief A generic pointer to the COM device (file descriptor)
+@brief A generic pointer to the COM device (file descriptor), of the selected concentrator
 */
-static void* _sx1261_com_target = NULL;
+#define _sx1261_com_target  (lgw_ctx_cur()->sx1261_com_target)
 
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
@@ -81,6 +82,9 @@ int sx1261_com_open(lgw_com_type_t com_type, const char *com_path) {
             _sx1261_com_target = lgw_com_target();
             DEBUG_MSG("SX1261: connected with USB\n");
             break;
+        case LGW_COM_SIM:
+            printf("ERROR: %s: sx1261 is not supported by the simulated concentrator\n", __FUNCTION__);
+            return LGW_COM_ERROR;
         default:
             printf("ERROR: %s: wrong COM type\n", __FUNCTION__);
             return LGW_COM_ERROR;
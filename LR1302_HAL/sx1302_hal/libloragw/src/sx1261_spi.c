@@ -126,6 +126,7 @@ int sx1261_spi_r(void *com_target, sx1261_op_code_t op_code, uint8_t *data, uint
     k.tx_buf = (unsigned long) out_buf;
     k.rx_buf = (unsigned long) in_buf;
     k.len = command_size;
+    k.speed_hz = SPI_SPEED;
     k.cs_change = 0;
     a = ioctl(com_device, SPI_IOC_MESSAGE(1), &k);
 
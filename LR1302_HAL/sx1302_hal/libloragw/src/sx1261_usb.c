@@ -23,6 +23,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_aux.h"
 #include "loragw_mcu.h"
 #include "sx1261_usb.h"
+#include "loragw_ctx.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -44,8 +45,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
-static lgw_com_write_mode_t _sx1261_write_mode = LGW_COM_WRITE_MODE_SINGLE;
-static uint8_t _sx1261_spi_req_nb = 0;
+/* held by the context of the selected concentrator */
+#define _sx1261_write_mode  (lgw_ctx_cur()->sx1261_write_mode)
+#define _sx1261_spi_req_nb  (lgw_ctx_cur()->sx1261_spi_req_nb)
 
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
@@ -24,6 +24,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,8 +32,10 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <unistd.h>     /* getopt, access */
 #include <time.h>
 #include <errno.h>
+#include <sys/stat.h>   /* mkdir */
 
 #include "loragw_com.h"
+#include "loragw_spi.h"
 #include "loragw_aux.h"
 #include "loragw_hal.h"
 
@@ -47,6 +50,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define BUFF_SIZE_SPI       1024
 #define BUFF_SIZE_USB       4096
 
+#define BENCH_MIN_SIZE      16
+#define BENCH_BYTES         (256 * 1024) /* transferred for each burst size, both ways */
+
+#define CAL_BYTES           (64 * 1024) /* transferred for each SPI clock and burst size, both ways */
+
 #define SX1302_AGC_MCU_MEM  0x0000
 #define SX1302_REG_COMMON   0x5600
 #define SX1302_REG_AGC_MCU  0x5780
@@ -65,12 +73,18 @@ static int quit_sig = 0; /* 1 -> application terminates without shutting down th
 static uint8_t * test_buff = NULL;
 static uint8_t * read_buff = NULL;
 
+/* SPI link calibration sweep, in increasing order */
+static const uint32_t cal_speed_hz[] = { 2000000, 4000000, 8000000, 10000000, 12000000, 16000000, 20000000, 24000000, 32000000 };
+static const uint16_t cal_chunk[] = { 256, 512, 1024, 2048, LGW_SPI_BURST_CHUNK_MAX };
+
 /* -------------------------------------------------------------------------- */
 /* --- SUBFUNCTIONS DECLARATION --------------------------------------------- */
 
 static void sig_handler(int sigio);
 static void usage(void);
 static void exit_failure(void);
+static void benchmark(uint16_t max_size);
+static void calibrate(const char * com_path);
 
 /* -------------------------------------------------------------------------- */
 /* --- MAIN FUNCTION -------------------------------------------------------- */
@@ -89,9 +103,11 @@ int main(int argc, char ** argv)
     const char com_path_default[] = COM_PATH_DEFAULT;
     const char * com_path = com_path_default;
     lgw_com_type_t com_type = COM_TYPE_DEFAULT;
+    bool bench = false;
+    bool cal = false;
 
     /* Parse command line options */
-    while ((i = getopt(argc, argv, "hd:u")) != -1) {
+    while ((i = getopt(argc, argv, "hd:ubc")) != -1) {
         switch (i) {
             case 'h':
                 usage();
@@ -108,6 +124,14 @@ int main(int argc, char ** argv)
                 com_type = LGW_COM_USB;
                 break;
 
+            case 'b':
+                bench = true;
+                break;
+
+            case 'c':
+                cal = true;
+                break;
+
             default:
                 printf("ERROR: argument parsing options, use -h option for help\n");
                 usage();
@@ -115,6 +139,11 @@ int main(int argc, char ** argv)
             }
     }
 
+    if ((cal == true) && (com_type != LGW_COM_SPI)) {
+        printf("ERROR: the link calibration is only available on SPI\n");
+        return EXIT_FAILURE;
+    }
+
     /* Configure signal handling */
     sigemptyset( &sigact.sa_mask );
     sigact.sa_flags = 0;
@@ -169,6 +198,9 @@ int main(int argc, char ** argv)
 
     /* Allocate buffers according to com type capabilities */
     max_buff_size = (com_type == LGW_COM_SPI) ? BUFF_SIZE_SPI : BUFF_SIZE_USB;
+    if ((cal == true) && (max_buff_size < LGW_SPI_BURST_CHUNK_MAX)) {
+        max_buff_size = LGW_SPI_BURST_CHUNK_MAX;
+    }
     test_buff = (uint8_t*)malloc(max_buff_size * sizeof(uint8_t));
     if (test_buff == NULL) {
         printf("ERROR: failed to allocate memory for test_buff - %s\n", strerror(errno));
@@ -180,6 +212,18 @@ int main(int argc, char ** argv)
         exit_failure();
     }
 
+    /* throughput versus burst size, instead of the stress test */
+    if (bench == true) {
+        benchmark(max_buff_size);
+        exit_sig = 1;
+    }
+
+    /* SPI clock and burst size, instead of the stress test */
+    if (cal == true) {
+        calibrate(com_path);
+        exit_sig = 1;
+    }
+
     /* databuffer R/W stress test */
     while ((quit_sig != 1) && (exit_sig != 1)) {
         /*************************************************
@@ -414,12 +458,159 @@ static void exit_failure(void) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+static void benchmark(uint16_t max_size) {
+    struct timespec t0, t1, t2;
+    double rd_s, wr_s;
+    uint32_t size, nb, n;
+    int x;
+
+    printf("burst size | write (kB/s) | read (kB/s)\n");
+    for (size = BENCH_MIN_SIZE; (size <= max_size) && (quit_sig != 1) && (exit_sig != 1); size *= 2) {
+        nb = BENCH_BYTES / size;
+        for (n = 0; n < size; n++) {
+            test_buff[n] = rand() & 0xFF;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (n = 0; n < nb; n++) {
+            x = lgw_com_wb(LGW_SPI_MUX_TARGET_SX1302, SX1302_AGC_MCU_MEM, test_buff, size);
+            if (x != 0) {
+                printf("ERROR (%d): failed to write burst\n", __LINE__);
+                exit_failure();
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for (n = 0; n < nb; n++) {
+            x = lgw_com_rb(LGW_SPI_MUX_TARGET_SX1302, SX1302_AGC_MCU_MEM, read_buff, size);
+            if (x != 0) {
+                printf("ERROR (%d): failed to read burst\n", __LINE__);
+                exit_failure();
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        if (memcmp(test_buff, read_buff, size) != 0) {
+            printf("error during the buffer comparison (%u bytes)\n", size);
+            exit_failure();
+        }
+
+        wr_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        rd_s = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+        printf("%10u | %12.1f | %11.1f\n", size, (nb * size) / wr_s / 1e3, (nb * size) / rd_s / 1e3);
+
+        /* always end with the largest burst supported */
+        if ((size < max_size) && ((size * 2) > max_size)) {
+            size = max_size / 2;
+        }
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void calibrate(const char * com_path) {
+    const int nb_speed = sizeof cal_speed_hz / sizeof cal_speed_hz[0];
+    const int nb_chunk = sizeof cal_chunk / sizeof cal_chunk[0];
+    uint32_t throughput[sizeof cal_speed_hz / sizeof cal_speed_hz[0]][sizeof cal_chunk / sizeof cal_chunk[0]];
+    struct lgw_spi_link_s link, link_default;
+    struct timespec t0, t1;
+    char link_path[128];
+    double elapsed;
+    uint32_t n, nb, nb_err;
+    int i, j, best = -1, failed = -1;
+
+    if (lgw_spi_get_link(lgw_com_target(), &link_default) != LGW_SPI_SUCCESS) {
+        printf("ERROR: failed to get the SPI link parameters\n");
+        exit_failure();
+    }
+    memset(throughput, 0, sizeof throughput);
+
+    /* Write/read back random data for each clock, stop at the first one showing errors */
+    printf("SPI clock (Hz) | burst size | errors | R/W (kB/s)\n");
+    for (i = 0; (i < nb_speed) && (failed < 0) && (quit_sig != 1) && (exit_sig != 1); i++) {
+        for (j = 0; (j < nb_chunk) && (quit_sig != 1) && (exit_sig != 1); j++) {
+            link.speed_hz = cal_speed_hz[i];
+            link.chunk = cal_chunk[j];
+            if (lgw_spi_set_link(lgw_com_target(), &link) != LGW_SPI_SUCCESS) {
+                failed = i;
+                break;
+            }
+
+            nb = CAL_BYTES / cal_chunk[j];
+            nb_err = 0;
+            for (n = 0; n < cal_chunk[j]; n++) {
+                test_buff[n] = rand() & 0xFF;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (n = 0; n < nb; n++) {
+                test_buff[n % cal_chunk[j]] = rand() & 0xFF; /* keep data changing between bursts */
+                if ((lgw_com_wb(LGW_SPI_MUX_TARGET_SX1302, SX1302_AGC_MCU_MEM, test_buff, cal_chunk[j]) != 0) ||
+                    (lgw_com_rb(LGW_SPI_MUX_TARGET_SX1302, SX1302_AGC_MCU_MEM, read_buff, cal_chunk[j]) != 0) ||
+                    (memcmp(test_buff, read_buff, cal_chunk[j]) != 0)) {
+                    nb_err += 1;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+            printf("%14u | %10u | %6u | %10.1f\n", cal_speed_hz[i], cal_chunk[j], nb_err, (2.0 * nb * cal_chunk[j]) / elapsed / 1e3);
+            if (nb_err > 0) {
+                failed = i;
+            } else {
+                throughput[i][j] = (uint32_t)((2.0 * nb * cal_chunk[j]) / elapsed);
+            }
+        }
+    }
+
+    /* Keep one clock step of margin below the first one showing errors, if possible */
+    best = (failed < 0) ? (i - 1) : (failed - 2);
+    if ((failed > 0) && (best < 0)) {
+        best = failed - 1;
+    }
+    if ((quit_sig == 1) || (exit_sig == 1) || (best < 0)) {
+        printf("ERROR: no reliable SPI link parameters found, keeping %u Hz / %u bytes\n", link_default.speed_hz, link_default.chunk);
+        lgw_spi_set_link(lgw_com_target(), &link_default);
+        return;
+    }
+    link.speed_hz = cal_speed_hz[best];
+    link.chunk = cal_chunk[0];
+    link.throughput = throughput[best][0];
+    for (j = 1; j < nb_chunk; j++) {
+        if (throughput[best][j] > link.throughput) {
+            link.chunk = cal_chunk[j];
+            link.throughput = throughput[best][j];
+        }
+    }
+    lgw_spi_set_link(lgw_com_target(), &link);
+    printf("Selected: %u Hz, bursts of %u bytes, %.1f kB/s (was %u Hz, %u bytes)\n", link.speed_hz, link.chunk, link.throughput / 1e3, link_default.speed_hz, link_default.chunk);
+
+    /* Persist them for lgw_spi_open() */
+    if (lgw_spi_link_path(com_path, link_path, sizeof link_path) != LGW_SPI_SUCCESS) {
+        printf("ERROR: failed to get the SPI link file of %s\n", com_path);
+        exit_failure();
+    }
+    if ((mkdir(LGW_SPI_LINK_DIR, 0755) != 0) && (errno != EEXIST)) {
+        printf("ERROR: failed to create %s - %s\n", LGW_SPI_LINK_DIR, strerror(errno));
+        exit_failure();
+    }
+    if (lgw_spi_link_save(link_path, &link) != LGW_SPI_SUCCESS) {
+        exit_failure();
+    }
+    printf("SPI link parameters saved to %s\n", link_path);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 static void usage(void) {
     printf("~~~ Library version string~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
     printf(" %s\n", lgw_version_info());
     printf("~~~ Available options ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
     printf(" -h            print this help\n");
     printf(" -u            set COM type as USB (default is SPI)\n");
+    printf(" -b            measure the R/W throughput versus the burst size, up to\n");
+    printf("               the burst chunk of the COM type, instead of the stress test\n");
+    printf(" -c            calibrate the SPI clock and burst size with write/read back\n");
+    printf("               of the SX1302 AGC memory, save the fastest error-free ones\n");
+    printf("               in " LGW_SPI_LINK_DIR " for lgw_spi_open()\n");
     printf(" -d <path>     COM path to be used to connect the concentrator\n");
     printf("               => default path (SPI): " COM_PATH_DEFAULT "\n");
 }
@@ -0,0 +1,301 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    Test program for the multi-concentrator HAL API: receive on several boards
+    from one process, with a thread and a context handle per board.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "loragw_hal.h"
+#include "loragw_aux.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_FREQ_HZ     868500000U
+#define BOARD_NB_MAX        4
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct board_s {
+    int                 index;
+    lgw_ctx_t *         ctx;
+    pthread_t           thread;
+    struct lgw_conf_board_s boardconf;
+    uint32_t            freq_hz[LGW_RF_CHAIN_NB];
+    unsigned long       nb_pkt_crc_ok;
+    unsigned long       nb_pkt_crc_bad;
+    int                 err;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static volatile sig_atomic_t exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
+
+static lgw_radio_type_t radio_type = LGW_RADIO_TYPE_NONE;
+
+static const int32_t channel_if[9] = { -400000, -200000, 0, -400000, -200000, 0, 200000, 400000, -200000 };
+static const uint8_t channel_rfchain[9] = { 1, 1, 1, 0, 0, 0, 0, 0, 1 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+
+static void sig_handler(int sigio) {
+    if ((sigio == SIGQUIT) || (sigio == SIGINT) || (sigio == SIGTERM)) {
+        exit_sig = 1;
+    }
+}
+
+void usage(void) {
+    printf("Library version information: %s\n", lgw_version_info());
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -u            set COM type as USB (default is SPI)\n");
+    printf(" -d <path>     COM path of a concentrator, once per board (up to %d)\n", BOARD_NB_MAX);
+    printf(" -r <uint>     Radio type (1255, 1257, 1250)\n");
+    printf(" -a <float>    Radio A RX frequency in MHz of the first board\n");
+    printf(" -b <float>    Radio B RX frequency in MHz of the first board\n");
+    printf(" -s <float>    Frequency step in MHz between two boards\n");
+    printf(" SPI boards must have been reset beforehand (reset_lgw.sh)\n");
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int board_configure(struct board_s * board) {
+    struct lgw_conf_rxrf_s rfconf;
+    struct lgw_conf_rxif_s ifconf;
+    int i;
+
+    if (lgw_ctx_board_setconf(board->ctx, &board->boardconf) != LGW_HAL_SUCCESS) {
+        printf("ERROR: board %d: failed to configure board\n", board->index);
+        return -1;
+    }
+
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        memset(&rfconf, 0, sizeof rfconf);
+        rfconf.enable = true;
+        rfconf.freq_hz = board->freq_hz[i];
+        rfconf.type = radio_type;
+        rfconf.tx_enable = false;
+        if (lgw_ctx_rxrf_setconf(board->ctx, i, &rfconf) != LGW_HAL_SUCCESS) {
+            printf("ERROR: board %d: failed to configure rxrf %d\n", board->index, i);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < 9; i++) {
+        memset(&ifconf, 0, sizeof ifconf);
+        ifconf.enable = true;
+        ifconf.rf_chain = channel_rfchain[i];
+        ifconf.freq_hz = channel_if[i];
+        ifconf.datarate = DR_LORA_SF7;
+        if (i == 8) {
+            ifconf.bandwidth = BW_250KHZ; /* LoRa service channel */
+        }
+        if (lgw_ctx_rxif_setconf(board->ctx, i, &ifconf) != LGW_HAL_SUCCESS) {
+            printf("ERROR: board %d: failed to configure rxif %d\n", board->index, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void * thread_board(void * arg) {
+    struct board_s * board = (struct board_s *)arg;
+    struct lgw_pkt_rx_s rxpkt[16];
+    int i, nb_pkt;
+
+    /* the legacy API of this thread now applies to this board */
+    lgw_ctx_select(board->ctx);
+
+    if (lgw_start() != LGW_HAL_SUCCESS) {
+        printf("ERROR: board %d: failed to start the concentrator\n", board->index);
+        board->err = -1;
+        return NULL;
+    }
+    printf("INFO: board %d started on %s\n", board->index, board->boardconf.com_path);
+
+    while (exit_sig != 1) {
+        nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
+        if (nb_pkt < 0) {
+            printf("ERROR: board %d: failed to receive\n", board->index);
+            board->err = -1;
+            break;
+        }
+        if (nb_pkt == 0) {
+            wait_ms(10);
+            continue;
+        }
+        for (i = 0; i < nb_pkt; i++) {
+            if (rxpkt[i].status == STAT_CRC_OK) {
+                board->nb_pkt_crc_ok += 1;
+            } else {
+                board->nb_pkt_crc_bad += 1;
+            }
+            printf("board %d: %u Hz SF%u CRC:%s RSSI:%.1f SNR:%.1f size:%u\n", board->index, rxpkt[i].freq_hz,
+                    rxpkt[i].datarate, (rxpkt[i].status == STAT_CRC_OK) ? "OK" : "BAD",
+                    rxpkt[i].rssis, rxpkt[i].snr, rxpkt[i].size);
+        }
+    }
+
+    lgw_stop();
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
+    struct board_s board[BOARD_NB_MAX];
+    const char * com_path[BOARD_NB_MAX];
+    lgw_com_type_t com_type = LGW_COM_SPI;
+    int nb_board = 0;
+    uint32_t fa = DEFAULT_FREQ_HZ;
+    uint32_t fb = DEFAULT_FREQ_HZ;
+    uint32_t fstep = 0;
+    double arg_d = 0.0;
+    unsigned int arg_u;
+    int i, err = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hud:r:a:b:s:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'u':
+                com_type = LGW_COM_USB;
+                break;
+            case 'd':
+                if (nb_board == BOARD_NB_MAX) {
+                    printf("ERROR: too many boards, %d max\n", BOARD_NB_MAX);
+                    return EXIT_FAILURE;
+                }
+                com_path[nb_board++] = optarg;
+                break;
+            case 'r':
+                i = sscanf(optarg, "%u", &arg_u);
+                if ((i != 1) || ((arg_u != 1255) && (arg_u != 1257) && (arg_u != 1250))) {
+                    printf("ERROR: argument parsing of -r argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                }
+                radio_type = (arg_u == 1255) ? LGW_RADIO_TYPE_SX1255 : ((arg_u == 1257) ? LGW_RADIO_TYPE_SX1257 : LGW_RADIO_TYPE_SX1250);
+                break;
+            case 'a':
+            case 'b':
+            case 's':
+                if (sscanf(optarg, "%lf", &arg_d) != 1) {
+                    printf("ERROR: argument parsing of -%c argument. Use -h to print help\n", i);
+                    return EXIT_FAILURE;
+                }
+                arg_u = (uint32_t)((arg_d*1e6) + 0.5); /* .5 Hz offset to get rounding instead of truncating */
+                if (i == 'a') {
+                    fa = arg_u;
+                } else if (i == 'b') {
+                    fb = arg_u;
+                } else {
+                    fstep = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return -1;
+        }
+    }
+    if ((nb_board == 0) || (radio_type == LGW_RADIO_TYPE_NONE)) {
+        printf("ERROR: at least one COM path and the radio type are required. Use -h to print help\n");
+        return EXIT_FAILURE;
+    }
+
+    /* configure signal handling */
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigact.sa_handler = sig_handler;
+    sigaction(SIGQUIT, &sigact, NULL);
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
+    printf("===== sx1302 HAL multi-concentrator RX test =====\n");
+
+    /* one context per board, configured from the main thread */
+    memset(board, 0, sizeof board);
+    for (i = 0; i < nb_board; i++) {
+        board[i].index = i;
+        board[i].ctx = lgw_ctx_new();
+        if (board[i].ctx == NULL) {
+            return EXIT_FAILURE;
+        }
+        board[i].boardconf.lorawan_public = true;
+        board[i].boardconf.clksrc = 0;
+        board[i].boardconf.com_type = com_type;
+        strncpy(board[i].boardconf.com_path, com_path[i], sizeof board[i].boardconf.com_path);
+        board[i].boardconf.com_path[sizeof board[i].boardconf.com_path - 1] = '\0'; /* ensure string termination */
+        board[i].freq_hz[0] = fa + (i * fstep);
+        board[i].freq_hz[1] = fb + (i * fstep);
+        if (board_configure(&board[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* start and receive, one thread per board */
+    for (i = 0; i < nb_board; i++) {
+        if (pthread_create(&board[i].thread, NULL, thread_board, &board[i]) != 0) {
+            printf("ERROR: failed to create thread of board %d\n", i);
+            exit_sig = 1;
+            nb_board = i;
+            err = -1;
+            break;
+        }
+    }
+
+    for (i = 0; i < nb_board; i++) {
+        pthread_join(board[i].thread, NULL);
+        printf("INFO: board %d: %lu packets with CRC OK, %lu with CRC BAD\n", i, board[i].nb_pkt_crc_ok, board[i].nb_pkt_crc_bad);
+        err |= board[i].err;
+        lgw_ctx_free(board[i].ctx);
+    }
+
+    printf("=========== Test %s ===========\n", (err == 0) ? "End" : "Failed");
+
+    return (err == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
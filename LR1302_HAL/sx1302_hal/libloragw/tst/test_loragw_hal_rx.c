@@ -31,6 +31,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <signal.h>
 #include <math.h>
 #include <getopt.h>
+#include <time.h>       /* clock_gettime */
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
@@ -85,6 +86,8 @@ void usage(void) {
     printf(" -j            Set radio in single input mode (SX1250 only)\n");
     printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
     printf(" --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
+    printf(" --sim         Use a simulated concentrator, -d gives its options (see loragw_sim.h)\n");
+    printf(" --cal-cache <path> Reuse the radio calibration saved in this file, when still valid (sx125x only)\n");
 }
 
 /* -------------------------------------------------------------------------- */
@@ -110,8 +113,12 @@ int main(int argc, char **argv)
     bool single_input_mode = false;
     float rssi_offset = 0.0;
     bool full_duplex = false;
+    const char * cal_cache_path = NULL;
+    struct timespec tm_start, tm_stop;
+    double start_ms, start_ms_first = 0.0, start_ms_sum = 0.0;
 
     struct lgw_conf_board_s boardconf;
+    struct lgw_conf_cal_s calconf;
     struct lgw_conf_rxrf_s rfconf;
     struct lgw_conf_rxif_s ifconf;
 
@@ -152,6 +159,8 @@ int main(int argc, char **argv)
     int option_index = 0;
     static struct option long_options[] = {
         {"fdd",  no_argument, 0, 0},
+        {"sim",  no_argument, 0, 0},
+        {"cal-cache", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -258,6 +267,10 @@ int main(int argc, char **argv)
             case 0:
                 if (strcmp(long_options[option_index].name, "fdd") == 0) {
                     full_duplex = true;
+                } else if (strcmp(long_options[option_index].name, "sim") == 0) {
+                    com_type = LGW_COM_SIM;
+                } else if (strcmp(long_options[option_index].name, "cal-cache") == 0) {
+                    cal_cache_path = optarg;
                 } else {
                     printf("ERROR: argument parsing options. Use -h to print help\n");
                     return EXIT_FAILURE;
@@ -286,6 +299,9 @@ int main(int argc, char **argv)
     boardconf.clksrc = clocksource;
     boardconf.full_duplex = full_duplex;
     boardconf.com_type = com_type;
+    if ((com_type == LGW_COM_SIM) && (com_path == com_path_default)) {
+        com_path = ""; /* default options */
+    }
     strncpy(boardconf.com_path, com_path, sizeof boardconf.com_path);
     boardconf.com_path[sizeof boardconf.com_path - 1] = '\0'; /* ensure string termination */
     if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
@@ -293,6 +309,18 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    if (cal_cache_path != NULL) {
+        memset(&calconf, 0, sizeof calconf);
+        calconf.cache_enable = true;
+        strncpy(calconf.cache_path, cal_cache_path, sizeof calconf.cache_path);
+        calconf.cache_path[sizeof calconf.cache_path - 1] = '\0'; /* ensure string termination */
+        calconf.temp_drift = 5.0;
+        if (lgw_cal_setconf(&calconf) != LGW_HAL_SUCCESS) {
+            printf("ERROR: failed to configure calibration cache\n");
+            return EXIT_FAILURE;
+        }
+    }
+
     /* set configuration for RF chains */
     memset( &rfconf, 0, sizeof rfconf);
     rfconf.enable = true;
@@ -370,11 +398,20 @@ int main(int argc, char **argv)
         }
 
         /* connect, configure and start the LoRa concentrator */
+        clock_gettime(CLOCK_MONOTONIC, &tm_start);
         x = lgw_start();
         if (x != 0) {
             printf("ERROR: failed to start the gateway\n");
             return EXIT_FAILURE;
         }
+        clock_gettime(CLOCK_MONOTONIC, &tm_stop);
+        start_ms = ((tm_stop.tv_sec - tm_start.tv_sec) * 1e3) + ((tm_stop.tv_nsec - tm_start.tv_nsec) / 1e6);
+        if (cnt_loop == 1) {
+            start_ms_first = start_ms;
+        } else {
+            start_ms_sum += start_ms;
+        }
+        printf("INFO: lgw_start() took %.1f ms\n", start_ms);
 
         /* Loop until we have enough packets with CRC OK */
         printf("Waiting for packets...\n");
@@ -430,6 +467,12 @@ int main(int argc, char **argv)
         }
     }
 
+    if (cnt_loop > 1) {
+        printf("INFO: lgw_start() took %.1f ms the first time, %.1f ms on average the %lu next times\n", start_ms_first, start_ms_sum / (cnt_loop - 1), cnt_loop - 1);
+    } else if (cnt_loop == 1) {
+        printf("INFO: lgw_start() took %.1f ms\n", start_ms_first);
+    }
+
     printf("=========== Test End ===========\n");
 
     return 0;
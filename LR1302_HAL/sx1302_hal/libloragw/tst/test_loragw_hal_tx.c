@@ -98,6 +98,7 @@ void usage(void) {
     printf(" --loop        Number of loops for HAL start/stop (HAL unitary test)\n");
     printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
     printf(" --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
+    printf(" --sim         Use a simulated concentrator, -d gives its options (see loragw_sim.h)\n");
 }
 
 /* handle signals */
@@ -175,6 +176,7 @@ int main(int argc, char **argv)
         {"loop", required_argument, 0, 0},
         {"nhdr", no_argument, 0, 0},
         {"fdd",  no_argument, 0, 0},
+        {"sim",  no_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -405,6 +407,8 @@ int main(int argc, char **argv)
                     no_header = true;
                 } else if (strcmp(long_options[option_index].name, "fdd") == 0) {
                     full_duplex = true;
+                } else if (strcmp(long_options[option_index].name, "sim") == 0) {
+                    com_type = LGW_COM_SIM;
                 } else {
                     printf("ERROR: argument parsing options. Use -h to print help\n");
                     return EXIT_FAILURE;
@@ -441,6 +445,9 @@ int main(int argc, char **argv)
     boardconf.clksrc = clocksource;
     boardconf.full_duplex = full_duplex;
     boardconf.com_type = com_type;
+    if ((com_type == LGW_COM_SIM) && (com_path == com_path_default)) {
+        com_path = ""; /* default options */
+    }
     strncpy(boardconf.com_path, com_path, sizeof boardconf.com_path);
     boardconf.com_path[sizeof boardconf.com_path - 1] = '\0'; /* ensure string termination */
     if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
@@ -0,0 +1,143 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : I/O owner thread
+
+    A single thread accesses the concentrator once it is started. It fetches
+    the received packets into a ring read by the upstream thread, and serves
+    the commands (TX, counters, temperature, spectral scan) posted by the
+    other threads. Each client thread has its own single-producer single-
+    consumer command ring, so that no lock is shared between them. Pending
+    commands are always served before the next RX fetch, and the JIT client
+    before the others, so that a TX never waits for more than one fetch.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_CONCENT_IO_H
+#define _LORA_PKTFWD_CONCENT_IO_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <time.h>       /* timespec */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define CONCENT_IO_SKIPPED      1   /* spectral scan not started, a downlink is programmed */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/* Threads posting commands, by decreasing priority. Each one must only be used by a single thread */
+enum concent_io_client_e {
+    CONCENT_IO_JIT,
+    CONCENT_IO_DOWN,
+    CONCENT_IO_GPS,
+    CONCENT_IO_SCAN,
+    CONCENT_IO_MAIN,
+    CONCENT_IO_CLIENT_NB
+};
+
+/* when and how late a received packet was fetched from the concentrator */
+struct concent_io_rx_meta_s {
+    struct timespec fetch_time; /* CLOCK_MONOTONIC time of the fetch */
+    uint32_t fetch_cnt_us;      /* concentrator counter after the fetch, if enabled at start */
+};
+
+struct concent_io_stats_s {
+    uint32_t nb_cmd;            /* commands served */
+    uint32_t nb_fetch;          /* RX fetches */
+    uint32_t nb_fetch_deferred; /* RX fetches deferred because the RX ring was full */
+    uint32_t tx_wait_max_us;    /* longest time a JIT command waited to be served */
+    uint32_t cmd_wait_max_us;   /* longest time any other command waited to be served */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Start the I/O owner thread, the concentrator must have been started
+@param fetch_sleep_ms time between two RX fetches when no packet is received
+@param fetch_cnt read the concentrator counter after each fetch returning packets
+@return 0 on success, -1 on error
+*/
+int concent_io_start(uint32_t fetch_sleep_ms, bool fetch_cnt);
+
+/**
+@brief Stop the I/O owner thread, the client threads must have stopped posting commands
+@return 0 on success, -1 on error
+
+The concentrator can be accessed directly again afterwards (ie. to stop it).
+*/
+int concent_io_stop(void);
+
+/**
+@brief Get the packets fetched by the owner thread (upstream thread only)
+@param max_pkt maximum number of packets to return
+@param pkt_data array of at least max_pkt packets
+@param meta array of at least max_pkt fetch information, may be NULL
+@return the number of packets, LGW_HAL_ERROR if a fetch failed
+*/
+int concent_io_receive(uint8_t max_pkt, struct lgw_pkt_rx_s * pkt_data, struct concent_io_rx_meta_s * meta);
+
+/**
+@brief Same as lgw_get_instcnt, lgw_get_trigcnt, lgw_get_temperature, lgw_status
+and lgw_send, executed by the owner thread
+@param client thread posting the command
+@return same as the HAL function
+*/
+int concent_io_get_instcnt(enum concent_io_client_e client, uint32_t * inst_cnt_us);
+int concent_io_get_trigcnt(enum concent_io_client_e client, uint32_t * trig_cnt_us);
+int concent_io_get_temperature(enum concent_io_client_e client, float * temperature);
+int concent_io_status(enum concent_io_client_e client, uint8_t rf_chain, uint8_t select, uint8_t * code);
+
+/**
+@brief Send a packet, executed by the owner thread
+@param client thread posting the command
+@param pkt_data packet to be sent
+@param abort_scan abort the spectral scan in progress before
+@return same as lgw_send
+*/
+int concent_io_send(enum concent_io_client_e client, struct lgw_pkt_tx_s * pkt_data, bool abort_scan);
+
+/**
+@brief Start a spectral scan unless a downlink is programmed, executed by the owner thread
+@param client thread posting the command
+@param tx_enable RF chains on which TX is enabled, to be checked for programmed downlinks
+@param freq_hz frequency to be scanned
+@param nb_scan number of scan points
+@return LGW_HAL_SUCCESS if started, CONCENT_IO_SKIPPED if a downlink is programmed, LGW_HAL_ERROR else
+*/
+int concent_io_spectral_scan_start(enum concent_io_client_e client, const bool tx_enable[LGW_RF_CHAIN_NB], uint32_t freq_hz, uint16_t nb_scan);
+
+/**
+@brief Same as lgw_spectral_scan_get_status and lgw_spectral_scan_get_results,
+executed by the owner thread
+@param client thread posting the command
+@return same as the HAL function
+*/
+int concent_io_spectral_scan_get_status(enum concent_io_client_e client, lgw_spectral_scan_status_t * status);
+int concent_io_spectral_scan_get_results(enum concent_io_client_e client, int16_t levels_dbm[LGW_SPECTRAL_SCAN_RESULT_SIZE], uint16_t results[LGW_SPECTRAL_SCAN_RESULT_SIZE]);
+
+/**
+@brief Get the owner thread statistics, and reset the maximum wait times
+@param client thread posting the command
+@param stats structure to be filled
+@return 0 on success, -1 on error
+*/
+int concent_io_get_stats(enum concent_io_client_e client, struct concent_io_stats_s * stats);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -22,6 +22,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <stdint.h>     /* C99 types */
 #include <stdbool.h>    /* bool type */
 #include <sys/time.h>   /* timeval */
+#include <time.h>       /* timespec */
 
 #include "loragw_hal.h"
 
@@ -52,6 +53,7 @@ enum jit_error_e {
     JIT_ERROR_TX_FREQ,      /* The required frequency for downlink is not supported */
     JIT_ERROR_TX_POWER,     /* The required power for downlink is not supported */
     JIT_ERROR_GPS_UNLOCKED, /* GPS timestamp could not be used as GPS is unlocked */
+    JIT_ERROR_DUTY_CYCLE,   /* The sub-band duty cycle would be exceeded */
     JIT_ERROR_INVALID       /* Packet is invalid */
 };
 
@@ -59,6 +61,7 @@ struct jit_node_s {
     /* API fields */
     struct lgw_pkt_tx_s pkt;        /* TX packet */
     enum jit_pkt_type_e pkt_type;   /* Packet type: Downlink, Beacon... */
+    struct timespec enqueue_time;   /* CLOCK_MONOTONIC time of the enqueue, for latency statistics */
 
     /* Internal fields */
     uint32_t pre_delay;             /* Amount of time before packet timestamp to be reserved */
@@ -0,0 +1,96 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : latency histograms and Prometheus metrics endpoint
+
+    Latencies are recorded in log-linear histograms (4 buckets per power of
+    two, 25% resolution, up to 2^32 us) without any lock. They are served in
+    the Prometheus text format by a small HTTP server listening on localhost.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_METRICS_H
+#define _LORA_PKTFWD_METRICS_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <time.h>       /* timespec */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum metrics_hist_e {
+    METRICS_UP_RECEIVE,     /* packet count_us to the fetch by lgw_receive() */
+    METRICS_UP_PUSH,        /* packet count_us to the PUSH_DATA carrying it */
+    METRICS_UP_PUSH_ACK,    /* PUSH_DATA to PUSH_ACK round trip */
+    METRICS_DOWN_PULL_ACK,  /* PULL_DATA to PULL_ACK round trip */
+    METRICS_DOWN_ENQUEUE,   /* PULL_RESP arrival to the end of jit_enqueue() */
+    METRICS_DOWN_SEND,      /* jit_enqueue() to the end of lgw_send() */
+    METRICS_DOWN_SLACK,     /* end of lgw_send() to the packet count_us */
+    METRICS_HIST_NB
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Enable the recording, and serve the metrics on 127.0.0.1
+@param port TCP port of the HTTP server
+@return 0 on success, -1 on error
+*/
+int metrics_start(uint16_t port);
+
+/**
+@brief Stop the HTTP server
+*/
+void metrics_stop(void);
+
+/**
+@brief Check if the latencies are recorded
+@return true if metrics_start() succeeded
+*/
+bool metrics_enabled(void);
+
+/**
+@brief Record a latency
+@param hist histogram
+@param value_us latency in microseconds
+*/
+void metrics_record(enum metrics_hist_e hist, uint32_t value_us);
+
+/**
+@brief Record the time elapsed between two CLOCK_MONOTONIC times
+@param hist histogram
+@param from start time
+@param to end time, NULL for now
+*/
+void metrics_record_elapsed(enum metrics_hist_e hist, const struct timespec * from, const struct timespec * to);
+
+/**
+@brief Get the number of samples and a quantile of a histogram
+@param hist histogram
+@param q quantile [0..1]
+@param count number of samples recorded so far, may be NULL
+@return upper bound of the quantile in microseconds (the maximum for q = 1)
+*/
+uint32_t metrics_quantile(enum metrics_hist_e hist, double q, uint64_t * count);
+
+/**
+@brief Get the short name of a histogram, as used on the console
+@param hist histogram
+@return the name
+*/
+const char * metrics_name(enum metrics_hist_e hist);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
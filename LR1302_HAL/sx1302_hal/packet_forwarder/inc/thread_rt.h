@@ -0,0 +1,125 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : real-time scheduling of the forwarder threads
+
+    Each thread applies its own scheduling policy, priority and CPU set when
+    it starts, and prefaults its stack. The threads are created with a stack
+    of THREAD_RT_STACK_SIZE rather than the default one (8 MB on glibc), which
+    mlockall() would lock whole. The periodic sleeps of the threads record how
+    late they wake up, the worst case being reported with the statistics.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_THREAD_RT_H
+#define _LORA_PKTFWD_THREAD_RT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <time.h>       /* timespec */
+#include <pthread.h>    /* pthread_t */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define THREAD_RT_PRIO_NONE     0   /* keep SCHED_OTHER */
+#define THREAD_RT_LAT_NONE      -1  /* no wakeup recorded */
+
+#define THREAD_RT_STACK_SIZE        (512 * 1024)    /* the upstream thread keeps ~230 kB of packets on its stack */
+#define THREAD_RT_PREFAULT_KB_MAX   256             /* at most half of the stack */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum thread_rt_id_e {
+    THREAD_RT_UP,
+    THREAD_RT_DOWN,
+    THREAD_RT_JIT,
+    THREAD_RT_GPS,
+    THREAD_RT_VALID,
+    THREAD_RT_SCAN,
+    THREAD_RT_IO,
+    THREAD_RT_NB
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Get the name of a thread, as used in the configuration and reports
+@param id thread
+@return the name
+*/
+const char * thread_rt_name(enum thread_rt_id_e id);
+
+/**
+@brief Configure the scheduling of a thread, before it is started
+@param id thread
+@param priority SCHED_FIFO priority [1..99], THREAD_RT_PRIO_NONE for SCHED_OTHER
+@param cpus CPU list as "0,2-3", NULL to let the thread run on any CPU
+@return 0 on success, -1 if a parameter is invalid
+*/
+int thread_rt_configure(enum thread_rt_id_e id, int priority, const char * cpus);
+
+/**
+@brief Set the amount of stack prefaulted by each thread when it starts
+@param size_kb size in kB, 0 to disable, limited to THREAD_RT_PREFAULT_KB_MAX
+@return the size set, in kB
+*/
+uint32_t thread_rt_set_prefault(uint32_t size_kb);
+
+/**
+@brief Lock all the current and future pages of the process in memory
+@return 0 on success, -1 on error
+*/
+int thread_rt_lock_memory(void);
+
+/**
+@brief Create a thread with a stack of THREAD_RT_STACK_SIZE
+@param thread pointer to the thread identifier
+@param start function run by the thread
+@param arg argument of the function
+@return 0 on success, an error number else (see pthread_create)
+*/
+int thread_rt_create(pthread_t * thread, void * (*start)(void *), void * arg);
+
+/**
+@brief Apply the configuration of a thread to the calling thread
+@param id thread
+@return 0 on success, -1 if the configuration could not be fully applied
+*/
+int thread_rt_apply(enum thread_rt_id_e id);
+
+/**
+@brief Sleep, and record how late the calling thread woke up
+@param id thread
+@param delay_ms time to sleep
+*/
+void thread_rt_sleep_ms(enum thread_rt_id_e id, unsigned long delay_ms);
+
+/**
+@brief Record how late the calling thread woke up, for a wait done elsewhere
+@param id thread
+@param deadline CLOCK_MONOTONIC time at which the thread should have woken up
+*/
+void thread_rt_wakeup(enum thread_rt_id_e id, const struct timespec * deadline);
+
+/**
+@brief Get the worst wakeup latency of a thread since the previous call
+@param id thread
+@return latency in microseconds, THREAD_RT_LAT_NONE if the thread did not wake up
+*/
+int32_t thread_rt_get_latency(enum thread_rt_id_e id);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
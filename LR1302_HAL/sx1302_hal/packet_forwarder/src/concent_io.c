@@ -0,0 +1,530 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : I/O owner thread
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset, memcpy */
+#include <time.h>       /* clock_gettime */
+#include <errno.h>      /* EINTR, ETIMEDOUT */
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "trace.h"
+#include "concent_io.h"
+#include "thread_rt.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+/* ring indexes are free running, published with release and read with acquire semantic */
+#define RING_LOAD(x)        __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RING_STORE(x, v)    __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define CMD_RING_SIZE   4   /* power of 2 */
+#define RX_RING_SIZE    256 /* power of 2 */
+#define RX_FETCH_MAX    16  /* packets per fetch, small enough to let a TX command through quickly */
+
+enum cmd_id_e {
+    CMD_GET_INSTCNT,
+    CMD_GET_TRIGCNT,
+    CMD_GET_TEMPERATURE,
+    CMD_STATUS,
+    CMD_SEND,
+    CMD_SS_START,
+    CMD_SS_GET_STATUS,
+    CMD_SS_GET_RESULTS,
+    CMD_GET_STATS
+};
+
+struct cmd_s {
+    enum cmd_id_e           id;
+    struct timespec         post_time;
+    int                     result;
+    union {
+        uint32_t            cnt_us;
+        float               temperature;
+        struct {
+            uint8_t         rf_chain;
+            uint8_t         select;
+            uint8_t         code;
+        } status;
+        struct {
+            struct lgw_pkt_tx_s * pkt;
+            bool            abort_scan;
+        } send;
+        struct {
+            bool            tx_enable[LGW_RF_CHAIN_NB];
+            uint32_t        freq_hz;
+            uint16_t        nb_scan;
+        } ss_start;
+        lgw_spectral_scan_status_t ss_status;
+        struct {
+            int16_t *       levels_dbm;
+            uint16_t *      results;
+        } ss_results;
+        struct concent_io_stats_s * stats;
+    } u;
+};
+
+/* commands of one client thread, the result is written back in the slot */
+struct cmd_ring_s {
+    uint32_t                head;   /* written by the client */
+    uint32_t                tail;   /* written by the owner thread */
+    struct cmd_s            slot[CMD_RING_SIZE];
+    sem_t                   done;
+};
+
+/* packets fetched by the owner thread, for the upstream thread */
+struct rx_ring_s {
+    uint32_t                head;   /* written by the owner thread */
+    uint32_t                tail;   /* written by the upstream thread */
+    bool                    error;  /* a fetch failed */
+    struct lgw_pkt_rx_s     slot[RX_RING_SIZE];
+    struct concent_io_rx_meta_s meta[RX_RING_SIZE];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static struct cmd_ring_s cmd_ring[CONCENT_IO_CLIENT_NB];
+static struct rx_ring_s rx_ring;
+static sem_t doorbell; /* posted with each command */
+static pthread_t thrid_io;
+static bool io_running = false;
+static bool io_stop = false;
+static uint32_t io_fetch_sleep_ms;
+static bool io_fetch_cnt;
+
+static struct concent_io_stats_s io_stats; /* owner thread only */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int64_t diff_us(const struct timespec * from, const struct timespec * to) {
+    return ((int64_t)(to->tv_sec - from->tv_sec) * 1000000) + ((to->tv_nsec - from->tv_nsec) / 1000);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint32_t elapsed_us(const struct timespec * from, const struct timespec * to) {
+    int64_t us = diff_us(from, to);
+    return (us > 0) ? (uint32_t)us : 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int cmd_post(enum concent_io_client_e client, struct cmd_s * cmd) {
+    struct cmd_ring_s * ring;
+    struct cmd_s * slot;
+    uint32_t head;
+
+    if ((io_running == false) || (client >= CONCENT_IO_CLIENT_NB)) {
+        return LGW_HAL_ERROR;
+    }
+    ring = &cmd_ring[client];
+
+    /* the client waits for each command, so that there is always room */
+    head = ring->head;
+    if ((head - RING_LOAD(ring->tail)) >= CMD_RING_SIZE) {
+        MSG("ERROR: [io] command ring of client %d is full\n", client);
+        return LGW_HAL_ERROR;
+    }
+    slot = &ring->slot[head & (CMD_RING_SIZE - 1)];
+    *slot = *cmd;
+    clock_gettime(CLOCK_MONOTONIC, &slot->post_time);
+    RING_STORE(ring->head, head + 1);
+    sem_post(&doorbell);
+
+    /* wait for the owner thread to serve it */
+    while (sem_wait(&ring->done) != 0) {
+        if (errno != EINTR) {
+            return LGW_HAL_ERROR;
+        }
+    }
+    *cmd = *slot;
+
+    return cmd->result;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void cmd_execute(struct cmd_s * cmd) {
+    int i, x;
+    uint8_t tx_status;
+
+    switch (cmd->id) {
+        case CMD_GET_INSTCNT:
+            cmd->result = lgw_get_instcnt(&cmd->u.cnt_us);
+            break;
+        case CMD_GET_TRIGCNT:
+            cmd->result = lgw_get_trigcnt(&cmd->u.cnt_us);
+            break;
+        case CMD_GET_TEMPERATURE:
+            cmd->result = lgw_get_temperature(&cmd->u.temperature);
+            break;
+        case CMD_STATUS:
+            cmd->result = lgw_status(cmd->u.status.rf_chain, cmd->u.status.select, &cmd->u.status.code);
+            break;
+        case CMD_SEND:
+            if (cmd->u.send.abort_scan == true) {
+                if (lgw_spectral_scan_abort() != LGW_HAL_SUCCESS) {
+                    MSG("WARNING: [io] lgw_spectral_scan_abort failed\n");
+                }
+            }
+            cmd->result = lgw_send(cmd->u.send.pkt);
+            break;
+        case CMD_SS_START:
+            /* check and start at once, so that no downlink can be programmed in between */
+            for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+                if (cmd->u.ss_start.tx_enable[i] == true) {
+                    x = lgw_status((uint8_t)i, TX_STATUS, &tx_status);
+                    if (x != LGW_HAL_SUCCESS) {
+                        printf("ERROR: failed to get TX status on chain %d\n", i);
+                    } else if ((tx_status == TX_SCHEDULED) || (tx_status == TX_EMITTING)) {
+                        printf("INFO: skip spectral scan (downlink programmed on RF chain %d)\n", i);
+                        cmd->result = CONCENT_IO_SKIPPED;
+                        return;
+                    }
+                }
+            }
+            cmd->result = lgw_spectral_scan_start(cmd->u.ss_start.freq_hz, cmd->u.ss_start.nb_scan);
+            break;
+        case CMD_SS_GET_STATUS:
+            cmd->result = lgw_spectral_scan_get_status(&cmd->u.ss_status);
+            break;
+        case CMD_SS_GET_RESULTS:
+            cmd->result = lgw_spectral_scan_get_results(cmd->u.ss_results.levels_dbm, cmd->u.ss_results.results);
+            break;
+        case CMD_GET_STATS:
+            *(cmd->u.stats) = io_stats;
+            io_stats.tx_wait_max_us = 0;
+            io_stats.cmd_wait_max_us = 0;
+            cmd->result = 0;
+            break;
+        default:
+            cmd->result = LGW_HAL_ERROR;
+            break;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* serve all pending commands, by client priority, return the number served */
+static int cmd_serve(void) {
+    struct cmd_ring_s * ring;
+    struct cmd_s * slot;
+    struct timespec now;
+    uint32_t tail, wait_us;
+    int i, nb = 0;
+
+    for (i = 0; i < CONCENT_IO_CLIENT_NB; i++) {
+        ring = &cmd_ring[i];
+        tail = ring->tail;
+        if (tail == RING_LOAD(ring->head)) {
+            continue;
+        }
+        slot = &ring->slot[tail & (CMD_RING_SIZE - 1)];
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait_us = elapsed_us(&slot->post_time, &now);
+        if (i == CONCENT_IO_JIT) {
+            if (wait_us > io_stats.tx_wait_max_us) {
+                io_stats.tx_wait_max_us = wait_us;
+            }
+        } else if (wait_us > io_stats.cmd_wait_max_us) {
+            io_stats.cmd_wait_max_us = wait_us;
+        }
+
+        cmd_execute(slot);
+        io_stats.nb_cmd += 1;
+        RING_STORE(ring->tail, tail + 1);
+        sem_post(&ring->done);
+        nb += 1;
+
+        /* a higher priority client may have posted meanwhile */
+        i = -1;
+    }
+
+    return nb;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* fetch the received packets into the RX ring, return the number fetched */
+static int rx_fetch(void) {
+    struct lgw_pkt_rx_s pkt[RX_FETCH_MAX];
+    struct concent_io_rx_meta_s meta;
+    uint32_t head, room;
+    int i, nb_pkt;
+
+    head = rx_ring.head;
+    room = RX_RING_SIZE - (head - RING_LOAD(rx_ring.tail));
+    if (room == 0) {
+        /* leave the packets in the concentrator until the upstream thread catches up */
+        io_stats.nb_fetch_deferred += 1;
+        return 0;
+    }
+
+    nb_pkt = lgw_receive((room < RX_FETCH_MAX) ? room : RX_FETCH_MAX, pkt);
+    io_stats.nb_fetch += 1;
+    if (nb_pkt == LGW_HAL_ERROR) {
+        RING_STORE(rx_ring.error, true);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &meta.fetch_time);
+    meta.fetch_cnt_us = 0;
+    if ((nb_pkt > 0) && (io_fetch_cnt == true)) {
+        lgw_get_instcnt(&meta.fetch_cnt_us);
+    }
+    for (i = 0; i < nb_pkt; i++) {
+        rx_ring.slot[(head + i) & (RX_RING_SIZE - 1)] = pkt[i];
+        rx_ring.meta[(head + i) & (RX_RING_SIZE - 1)] = meta;
+    }
+    RING_STORE(rx_ring.head, head + nb_pkt);
+
+    return nb_pkt;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void * thread_io(void * arg) {
+    struct timespec now, next_fetch, deadline;
+    int nb_pkt;
+
+    (void)arg;
+
+    thread_rt_apply(THREAD_RT_IO);
+
+    clock_gettime(CLOCK_MONOTONIC, &next_fetch);
+    while (RING_LOAD(io_stop) == false) {
+        /* TX and other commands first */
+        if (cmd_serve() > 0) {
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (diff_us(&next_fetch, &now) >= 0) {
+            nb_pkt = rx_fetch();
+            next_fetch = now;
+            if (nb_pkt == 0) {
+                /* nothing pending, wait a bit before fetching again */
+                next_fetch.tv_nsec += (long)io_fetch_sleep_ms * 1000000;
+                while (next_fetch.tv_nsec >= 1000000000) {
+                    next_fetch.tv_nsec -= 1000000000;
+                    next_fetch.tv_sec += 1;
+                }
+            }
+            continue;
+        }
+
+        /* sleep until the next fetch, or the next command */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)elapsed_us(&now, &next_fetch) * 1000;
+        while (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec += 1;
+        }
+        if ((sem_timedwait(&doorbell, &deadline) != 0) && (errno == ETIMEDOUT)) {
+            thread_rt_wakeup(THREAD_RT_IO, &next_fetch);
+        }
+    }
+
+    MSG("\nINFO: End of concentrator I/O thread\n");
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+int concent_io_start(uint32_t fetch_sleep_ms, bool fetch_cnt) {
+    int i;
+
+    if (io_running == true) {
+        return 0;
+    }
+
+    memset(&rx_ring, 0, sizeof rx_ring);
+    memset(&io_stats, 0, sizeof io_stats);
+    if (sem_init(&doorbell, 0, 0) != 0) {
+        return -1;
+    }
+    for (i = 0; i < CONCENT_IO_CLIENT_NB; i++) {
+        cmd_ring[i].head = 0;
+        cmd_ring[i].tail = 0;
+        if (sem_init(&cmd_ring[i].done, 0, 0) != 0) {
+            return -1;
+        }
+    }
+    io_fetch_sleep_ms = fetch_sleep_ms;
+    io_fetch_cnt = fetch_cnt;
+    io_stop = false;
+
+    if (thread_rt_create(&thrid_io, thread_io, NULL) != 0) {
+        MSG("ERROR: [io] impossible to create concentrator I/O thread\n");
+        return -1;
+    }
+    io_running = true;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_stop(void) {
+    int i;
+
+    if (io_running == false) {
+        return 0;
+    }
+
+    RING_STORE(io_stop, true);
+    sem_post(&doorbell);
+    i = pthread_join(thrid_io, NULL);
+    if (i != 0) {
+        printf("ERROR: failed to join concentrator I/O thread with %d - %s\n", i, strerror(i));
+        return -1;
+    }
+    io_running = false;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_receive(uint8_t max_pkt, struct lgw_pkt_rx_s * pkt_data, struct concent_io_rx_meta_s * meta) {
+    uint32_t tail, head;
+    int i, nb_pkt;
+
+    tail = rx_ring.tail;
+    head = RING_LOAD(rx_ring.head);
+    if ((tail == head) && (RING_LOAD(rx_ring.error) == true)) {
+        return LGW_HAL_ERROR;
+    }
+
+    nb_pkt = (int)(head - tail);
+    if (nb_pkt > max_pkt) {
+        nb_pkt = max_pkt;
+    }
+    for (i = 0; i < nb_pkt; i++) {
+        pkt_data[i] = rx_ring.slot[(tail + i) & (RX_RING_SIZE - 1)];
+        if (meta != NULL) {
+            meta[i] = rx_ring.meta[(tail + i) & (RX_RING_SIZE - 1)];
+        }
+    }
+    RING_STORE(rx_ring.tail, tail + nb_pkt);
+
+    return nb_pkt;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_get_instcnt(enum concent_io_client_e client, uint32_t * inst_cnt_us) {
+    struct cmd_s cmd = { .id = CMD_GET_INSTCNT };
+    int x = cmd_post(client, &cmd);
+    *inst_cnt_us = cmd.u.cnt_us;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_get_trigcnt(enum concent_io_client_e client, uint32_t * trig_cnt_us) {
+    struct cmd_s cmd = { .id = CMD_GET_TRIGCNT };
+    int x = cmd_post(client, &cmd);
+    *trig_cnt_us = cmd.u.cnt_us;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_get_temperature(enum concent_io_client_e client, float * temperature) {
+    struct cmd_s cmd = { .id = CMD_GET_TEMPERATURE };
+    int x = cmd_post(client, &cmd);
+    *temperature = cmd.u.temperature;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_status(enum concent_io_client_e client, uint8_t rf_chain, uint8_t select, uint8_t * code) {
+    struct cmd_s cmd = { .id = CMD_STATUS };
+    int x;
+
+    cmd.u.status.rf_chain = rf_chain;
+    cmd.u.status.select = select;
+    x = cmd_post(client, &cmd);
+    *code = cmd.u.status.code;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_send(enum concent_io_client_e client, struct lgw_pkt_tx_s * pkt_data, bool abort_scan) {
+    struct cmd_s cmd = { .id = CMD_SEND };
+
+    cmd.u.send.pkt = pkt_data;
+    cmd.u.send.abort_scan = abort_scan;
+    return cmd_post(client, &cmd);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_spectral_scan_start(enum concent_io_client_e client, const bool tx_enable[LGW_RF_CHAIN_NB], uint32_t freq_hz, uint16_t nb_scan) {
+    struct cmd_s cmd = { .id = CMD_SS_START };
+
+    memcpy(cmd.u.ss_start.tx_enable, tx_enable, sizeof cmd.u.ss_start.tx_enable);
+    cmd.u.ss_start.freq_hz = freq_hz;
+    cmd.u.ss_start.nb_scan = nb_scan;
+    return cmd_post(client, &cmd);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_spectral_scan_get_status(enum concent_io_client_e client, lgw_spectral_scan_status_t * status) {
+    struct cmd_s cmd = { .id = CMD_SS_GET_STATUS };
+    int x = cmd_post(client, &cmd);
+    *status = cmd.u.ss_status;
+    return x;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_spectral_scan_get_results(enum concent_io_client_e client, int16_t levels_dbm[LGW_SPECTRAL_SCAN_RESULT_SIZE], uint16_t results[LGW_SPECTRAL_SCAN_RESULT_SIZE]) {
+    struct cmd_s cmd = { .id = CMD_SS_GET_RESULTS };
+
+    cmd.u.ss_results.levels_dbm = levels_dbm;
+    cmd.u.ss_results.results = results;
+    return cmd_post(client, &cmd);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int concent_io_get_stats(enum concent_io_client_e client, struct concent_io_stats_s * stats) {
+    struct cmd_s cmd = { .id = CMD_GET_STATS };
+
+    cmd.u.stats = stats;
+    return cmd_post(client, &cmd);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -22,6 +22,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <pthread.h>
 #include <assert.h>
 #include <math.h>
+#include <time.h>       /* clock_gettime */
 
 #include "trace.h"
 #include "jitqueue.h"
@@ -299,6 +300,7 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
     queue->nodes[queue->num_pkt].pre_delay = packet_pre_delay;
     queue->nodes[queue->num_pkt].post_delay = packet_post_delay;
     queue->nodes[queue->num_pkt].pkt_type = pkt_type;
+    clock_gettime(CLOCK_MONOTONIC, &(queue->nodes[queue->num_pkt].enqueue_time));
     if (pkt_type == JIT_PKT_TYPE_BEACON) {
         queue->num_beacon++;
     }
@@ -48,12 +48,18 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "trace.h"
 #include "jitqueue.h"
+#include "concent_io.h"
+#include "thread_rt.h"
+#include "metrics.h"
 #include "parson.h"
 #include "base64.h"
 #include "loragw_hal.h"
 #include "loragw_aux.h"
 #include "loragw_reg.h"
 #include "loragw_gps.h"
+#include "loragw_occ.h"
+#include "loragw_duty.h"
+#include "loragw_trace.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -104,7 +110,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define MIN_FSK_PREAMB  3 /* minimum FSK preamble length for this application */
 #define STD_FSK_PREAMB  5
 
-#define STATUS_SIZE     200
+#define STATUS_SIZE     400
 #define TX_BUFF_SIZE    ((540 * NB_PKT_MAX) + 30 + STATUS_SIZE)
 #define ACK_BUFF_SIZE   64
 
@@ -129,6 +135,8 @@ typedef struct spectral_scan_s {
     uint8_t nb_chan;        /* number of channels to scan (200kHz between each channel) */
     uint16_t nb_scan;       /* number of scan points for each frequency scan */
     uint32_t pace_s;        /* number of seconds between 2 scans in the thread */
+    char occ_path[128];     /* occupancy map fed with the scan results, empty to disable */
+    uint32_t occ_half_life_s; /* weight half-life of a scan result in the occupancy map */
 } spectral_scan_t;
 
 /* -------------------------------------------------------------------------- */
@@ -166,7 +174,6 @@ static struct timeval push_timeout_half = {0, (PUSH_TIMEOUT_MS * 500)}; /* cut i
 static struct timeval pull_timeout = {0, (PULL_TIMEOUT_MS * 1000)}; /* non critical for throughput */
 
 /* hardware access control and correction */
-pthread_mutex_t mx_concent = PTHREAD_MUTEX_INITIALIZER; /* control access to the concentrator */
 static pthread_mutex_t mx_xcorr = PTHREAD_MUTEX_INITIALIZER; /* control access to the XTAL correction */
 static bool xtal_correct_ok = false; /* set true when XTAL correction is stable enough */
 static double xtal_correct = 1.0;
@@ -212,6 +219,7 @@ static uint32_t meas_nb_tx_rejected_collision_packet = 0; /* count packets were
 static uint32_t meas_nb_tx_rejected_collision_beacon = 0; /* count packets were TX request were rejected due to collision with a beacon already programmed */
 static uint32_t meas_nb_tx_rejected_too_late = 0; /* count packets were TX request were rejected because it is too late to program it */
 static uint32_t meas_nb_tx_rejected_too_early = 0; /* count packets were TX request were rejected because timestamp is too much in advance */
+static uint32_t meas_nb_tx_rejected_duty_cycle = 0; /* count packets were TX request were rejected because the sub-band duty cycle is exhausted */
 static uint32_t meas_nb_beacon_queued = 0; /* count beacon inserted in jit queue */
 static uint32_t meas_nb_beacon_sent = 0; /* count beacon actually sent to concentrator */
 static uint32_t meas_nb_beacon_rejected = 0; /* count beacon rejected for queuing */
@@ -238,9 +246,20 @@ static uint8_t beacon_infodesc = DEFAULT_BEACON_INFODESC; /* set beacon informat
 /* auto-quit function */
 static uint32_t autoquit_threshold = 0; /* enable auto-quit after a number of non-acknowledged PULL_DATA (0 = disabled)*/
 
+/* latency histograms */
+static uint16_t metrics_port = 0; /* local HTTP port of the Prometheus endpoint (0 = disabled) */
+
+/* real-time scheduling of the threads */
+static bool rt_enabled = false; /* report the wakeup latencies of the threads */
+static bool rt_mlockall = false; /* lock the process memory */
+
 /* Just In Time TX scheduling */
 static struct jit_queue_s jit_queue[LGW_RF_CHAIN_NB];
 
+/* regulatory duty cycle, only accessed by the downstream thread */
+static bool duty_enabled = false; /* reject the downlinks exceeding the sub-band duty cycle */
+static struct lgw_duty_s duty_ctx;
+
 /* Gateway specificities */
 static int8_t antenna_gain = 0;
 
@@ -256,6 +275,7 @@ static uint32_t nb_pkt_received_fsk = 0;
 
 static struct lgw_conf_debug_s debugconf;
 static uint32_t nb_pkt_received_ref[16];
+static char trace_file_name[128] = ""; /* HAL trace exported on exit, tracing disabled if empty */
 
 /* Interface type */
 static lgw_com_type_t com_type = LGW_COM_SPI;
@@ -266,7 +286,9 @@ static spectral_scan_t spectral_scan_params = {
     .freq_hz_start = 0,
     .nb_chan = 0,
     .nb_scan = 0,
-    .pace_s = 10
+    .pace_s = 10,
+    .occ_path = LGW_OCC_PATH_DEFAULT,
+    .occ_half_life_s = LGW_OCC_HALF_LIFE_S
 };
 
 /* -------------------------------------------------------------------------- */
@@ -376,8 +398,10 @@ static int parse_SX130x_configuration(const char * conf_file) {
         boardconf.com_type = LGW_COM_SPI;
     } else if (!strncmp(str, "USB", 3) || !strncmp(str, "usb", 3)) {
         boardconf.com_type = LGW_COM_USB;
+    } else if (!strncmp(str, "SIM", 3) || !strncmp(str, "sim", 3)) {
+        boardconf.com_type = LGW_COM_SIM;
     } else {
-        MSG("ERROR: invalid com type: %s (should be SPI or USB)\n", str);
+        MSG("ERROR: invalid com type: %s (should be SPI, USB or SIM)\n", str);
         return -1;
     }
     com_type = boardconf.com_type;
@@ -410,7 +434,7 @@ static int parse_SX130x_configuration(const char * conf_file) {
         MSG("WARNING: Data type for full_duplex seems wrong, please check\n");
         boardconf.full_duplex = false;
     }
-    MSG("INFO: com_type %s, com_path %s, lorawan_public %d, clksrc %d, full_duplex %d\n", (boardconf.com_type == LGW_COM_SPI) ? "SPI" : "USB", boardconf.com_path, boardconf.lorawan_public, boardconf.clksrc, boardconf.full_duplex);
+    MSG("INFO: com_type %s, com_path %s, lorawan_public %d, clksrc %d, full_duplex %d\n", (boardconf.com_type == LGW_COM_SPI) ? "SPI" : ((boardconf.com_type == LGW_COM_USB) ? "USB" : "SIM"), boardconf.com_path, boardconf.lorawan_public, boardconf.clksrc, boardconf.full_duplex);
     /* all parameters parsed, submitting configuration to the HAL */
     if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
         MSG("ERROR: Failed to configure board\n");
@@ -530,6 +554,15 @@ static int parse_SX130x_configuration(const char * conf_file) {
                 } else {
                     MSG("WARNING: Data type for spectral_scan.pace_s seems wrong, please check\n");
                 }
+                str = json_object_get_string(conf_scan_obj, "occupancy_map"); /* fetch value (if possible) */
+                if (str != NULL) {
+                    strncpy(spectral_scan_params.occ_path, str, sizeof spectral_scan_params.occ_path);
+                    spectral_scan_params.occ_path[sizeof spectral_scan_params.occ_path - 1] = '\0'; /* ensure string termination */
+                }
+                val = json_object_get_value(conf_scan_obj, "occupancy_half_life_s"); /* fetch value (if possible) */
+                if (json_value_get_type(val) == JSONNumber) {
+                    spectral_scan_params.occ_half_life_s = (uint32_t)json_value_get_number(val);
+                }
             }
         }
 
@@ -556,6 +589,13 @@ static int parse_SX130x_configuration(const char * conf_file) {
                     MSG("WARNING: Data type for lbt.rssi_target seems wrong, please check\n");
                     sx1261conf.lbt_conf.rssi_target = 0;
                 }
+                val = json_object_get_value(conf_lbt_obj, "hold_ms"); /* fetch value (if possible) */
+                if (json_value_get_type(val) == JSONNumber) {
+                    sx1261conf.lbt_conf.hold_ms = (uint16_t)json_value_get_number(val);
+                    MSG("INFO: LBT scans reused for %u ms during a burst\n", sx1261conf.lbt_conf.hold_ms);
+                } else {
+                    sx1261conf.lbt_conf.hold_ms = 0; /* scan before each packet */
+                }
                 /* set LBT channels configuration */
                 conf_lbtchan_array = json_object_get_array(conf_lbt_obj, "channels");
                 if (conf_lbtchan_array != NULL) {
@@ -1015,8 +1055,11 @@ static int parse_gateway_configuration(const char * conf_file) {
     JSON_Value *root_val;
     JSON_Object *conf_obj = NULL;
     JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    JSON_Object *rt_obj = NULL;
+    JSON_Object *thread_obj = NULL;
     const char *str; /* pointer to sub-strings in the JSON data */
     unsigned long long ull = 0;
+    int i, prio;
 
     /* try to parse JSON */
     root_val = json_parse_file_with_comments(conf_file);
@@ -1197,6 +1240,17 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG("INFO: Beaconing information descriptor is set to %u\n", beacon_infodesc);
     }
 
+    /* Duty cycle enforcement (optional) */
+    val = json_object_get_value(conf_obj, "duty_cycle");
+    if (json_value_get_type(val) == JSONBoolean) {
+        duty_enabled = (bool)json_value_get_boolean(val);
+        if (duty_enabled == true) {
+            MSG("INFO: downlinks limited to the EU868 sub-band duty cycles\n");
+        } else {
+            MSG("INFO: duty cycle is not enforced\n");
+        }
+    }
+
     /* Auto-quit threshold (optional) */
     val = json_object_get_value(conf_obj, "autoquit_threshold");
     if (val != NULL) {
@@ -1204,6 +1258,41 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG("INFO: Auto-quit after %u non-acknowledged PULL_DATA\n", autoquit_threshold);
     }
 
+    /* Latency metrics endpoint (optional) */
+    val = json_object_get_value(conf_obj, "metrics_port");
+    if (val != NULL) {
+        metrics_port = (uint16_t)json_value_get_number(val);
+        MSG("INFO: latency metrics served on local port %u\n", metrics_port);
+    }
+
+    /* Real-time scheduling of the threads (optional) */
+    rt_obj = json_object_get_object(conf_obj, "rt_conf");
+    if (rt_obj != NULL) {
+        rt_enabled = true;
+        val = json_object_get_value(rt_obj, "mlockall");
+        if (json_value_get_type(val) == JSONBoolean) {
+            rt_mlockall = (bool)json_value_get_boolean(val);
+        }
+        val = json_object_get_value(rt_obj, "prefault_stack_kb");
+        if (val != NULL) {
+            MSG("INFO: %u kB of stack prefaulted by each thread\n", (unsigned)thread_rt_set_prefault((uint32_t)json_value_get_number(val)));
+        }
+        MSG("INFO: real-time configuration, process memory %s\n", (rt_mlockall == true) ? "locked" : "not locked");
+        for (i = 0; i < THREAD_RT_NB; i++) {
+            thread_obj = json_object_get_object(rt_obj, thread_rt_name(i));
+            if (thread_obj == NULL) {
+                continue;
+            }
+            prio = (int)json_object_get_number(thread_obj, "priority"); /* 0 if absent */
+            str = json_object_get_string(thread_obj, "cpus");
+            if (thread_rt_configure(i, prio, str) != 0) {
+                json_value_free(root_val);
+                return -1;
+            }
+            MSG("INFO: thread %s: SCHED_FIFO priority %d, CPUs %s\n", thread_rt_name(i), prio, (str != NULL) ? str : "any");
+        }
+    }
+
     /* free JSON parsing data structure */
     json_value_free(root_val);
     return 0;
@@ -1217,6 +1306,7 @@ static int parse_debug_configuration(const char * conf_file) {
     JSON_Array *conf_array = NULL;
     JSON_Object *conf_obj_array = NULL;
     const char *str; /* pointer to sub-strings in the JSON data */
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
 
     /* Initialize structure */
     memset(&debugconf, 0, sizeof debugconf);
@@ -1266,6 +1356,22 @@ static int parse_debug_configuration(const char * conf_file) {
         MSG("INFO: setting debug log file name to %s\n", debugconf.log_file_name);
     }
 
+    /* Get firmware check configuration */
+    val = json_object_get_value(conf_obj, "fw_check_strict");
+    if (json_value_get_type(val) == JSONBoolean) {
+        debugconf.fw_check_strict = (bool)json_value_get_boolean(val);
+        MSG("INFO: firmware read back check is %s\n", (debugconf.fw_check_strict == true) ? "strict" : "sampled");
+    }
+
+    /* Get HAL trace configuration */
+    str = json_object_get_string(conf_obj, "trace_file");
+    if (str != NULL) {
+        strncpy(trace_file_name, str, sizeof trace_file_name);
+        trace_file_name[sizeof trace_file_name - 1] = '\0'; /* ensure string termination */
+        lgw_trace_enable(true);
+        MSG("INFO: HAL tracing enabled, trace exported to %s on exit\n", trace_file_name);
+    }
+
     /* Commit configuration */
     if (lgw_debug_setconf(&debugconf) != LGW_HAL_SUCCESS) {
         MSG("ERROR: Failed to configure debug\n");
@@ -1387,6 +1493,14 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error,
                 memcpy((void *)(buff_ack + buff_index), (void *)"\"GPS_UNLOCKED\"", 14);
                 buff_index += 14;
                 break;
+            case JIT_ERROR_DUTY_CYCLE:
+                memcpy((void *)(buff_ack + buff_index), (void *)"\"DUTY_CYCLE\"", 12);
+                buff_index += 12;
+                /* update stats */
+                pthread_mutex_lock(&mx_meas_dw);
+                meas_nb_tx_rejected_duty_cycle += 1;
+                pthread_mutex_unlock(&mx_meas_dw);
+                break;
             default:
                 memcpy((void *)(buff_ack + buff_index), (void *)"\"UNKNOWN\"", 9);
                 buff_index += 9;
@@ -1469,6 +1583,7 @@ int main(int argc, char ** argv)
     uint32_t cp_nb_tx_rejected_collision_beacon = 0;
     uint32_t cp_nb_tx_rejected_too_late = 0;
     uint32_t cp_nb_tx_rejected_too_early = 0;
+    uint32_t cp_nb_tx_rejected_duty_cycle = 0;
     uint32_t cp_nb_beacon_queued = 0;
     uint32_t cp_nb_beacon_sent = 0;
     uint32_t cp_nb_beacon_rejected = 0;
@@ -1480,6 +1595,16 @@ int main(int argc, char ** argv)
     /* SX1302 data variables */
     uint32_t trig_tstamp;
     uint32_t inst_tstamp;
+    struct concent_io_stats_s io_stats;
+
+    /* threads wakeup latency variables */
+    char wlat_report[160]; /* JSON object appended to the status report */
+    int wlat_index;
+    int32_t wlat;
+
+    /* latency histograms variables */
+    uint64_t lat_count;
+    uint32_t lat_p50, lat_p99;
     uint64_t eui;
     float temperature;
 
@@ -1546,6 +1671,11 @@ int main(int argc, char ** argv)
         exit(EXIT_FAILURE);
     }
 
+    /* lock the memory before the threads allocate their stacks */
+    if (rt_mlockall == true) {
+        thread_rt_lock_memory();
+    }
+
     /* Start GPS a.s.a.p., to allow it to lock */
     if (gps_tty_path[0] != '\0') { /* do not try to open GPS device if no path set */
         i = lgw_gps_enable(gps_tty_path, "ubx7", 0, &gps_tty_fd); /* HAL only supports u-blox 7 for now */
@@ -1670,18 +1800,32 @@ int main(int argc, char ** argv)
         printf("INFO: concentrator EUI: 0x%016" PRIx64 "\n", eui);
     }
 
+    /* start recording latencies */
+    if (metrics_port > 0) {
+        if (metrics_start(metrics_port) != 0) {
+            MSG("WARNING: [main] latency metrics are disabled\n");
+        }
+    }
+
+    /* from now on, only the I/O thread accesses the concentrator */
+    i = concent_io_start(FETCH_SLEEP_MS, metrics_enabled());
+    if (i != 0) {
+        MSG("ERROR: [main] impossible to create concentrator I/O thread\n");
+        exit(EXIT_FAILURE);
+    }
+
     /* spawn threads to manage upstream and downstream */
-    i = pthread_create(&thrid_up, NULL, (void * (*)(void *))thread_up, NULL);
+    i = thread_rt_create(&thrid_up, (void * (*)(void *))thread_up, NULL);
     if (i != 0) {
         MSG("ERROR: [main] impossible to create upstream thread\n");
         exit(EXIT_FAILURE);
     }
-    i = pthread_create(&thrid_down, NULL, (void * (*)(void *))thread_down, NULL);
+    i = thread_rt_create(&thrid_down, (void * (*)(void *))thread_down, NULL);
     if (i != 0) {
         MSG("ERROR: [main] impossible to create downstream thread\n");
         exit(EXIT_FAILURE);
     }
-    i = pthread_create(&thrid_jit, NULL, (void * (*)(void *))thread_jit, NULL);
+    i = thread_rt_create(&thrid_jit, (void * (*)(void *))thread_jit, NULL);
     if (i != 0) {
         MSG("ERROR: [main] impossible to create JIT thread\n");
         exit(EXIT_FAILURE);
@@ -1689,7 +1833,7 @@ int main(int argc, char ** argv)
 
     /* spawn thread for background spectral scan */
     if (spectral_scan_params.enable == true) {
-        i = pthread_create(&thrid_ss, NULL, (void * (*)(void *))thread_spectral_scan, NULL);
+        i = thread_rt_create(&thrid_ss, (void * (*)(void *))thread_spectral_scan, NULL);
         if (i != 0) {
             MSG("ERROR: [main] impossible to create Spectral Scan thread\n");
             exit(EXIT_FAILURE);
@@ -1698,12 +1842,12 @@ int main(int argc, char ** argv)
 
     /* spawn thread to manage GPS */
     if (gps_enabled == true) {
-        i = pthread_create(&thrid_gps, NULL, (void * (*)(void *))thread_gps, NULL);
+        i = thread_rt_create(&thrid_gps, (void * (*)(void *))thread_gps, NULL);
         if (i != 0) {
             MSG("ERROR: [main] impossible to create GPS thread\n");
             exit(EXIT_FAILURE);
         }
-        i = pthread_create(&thrid_valid, NULL, (void * (*)(void *))thread_valid, NULL);
+        i = thread_rt_create(&thrid_valid, (void * (*)(void *))thread_valid, NULL);
         if (i != 0) {
             MSG("ERROR: [main] impossible to create validation thread\n");
             exit(EXIT_FAILURE);
@@ -1777,6 +1921,7 @@ int main(int argc, char ** argv)
         cp_nb_tx_rejected_collision_beacon +=  meas_nb_tx_rejected_collision_beacon;
         cp_nb_tx_rejected_too_late         +=  meas_nb_tx_rejected_too_late;
         cp_nb_tx_rejected_too_early        +=  meas_nb_tx_rejected_too_early;
+        cp_nb_tx_rejected_duty_cycle       +=  meas_nb_tx_rejected_duty_cycle;
         cp_nb_beacon_queued   +=  meas_nb_beacon_queued;
         cp_nb_beacon_sent     +=  meas_nb_beacon_sent;
         cp_nb_beacon_rejected +=  meas_nb_beacon_rejected;
@@ -1792,6 +1937,7 @@ int main(int argc, char ** argv)
         meas_nb_tx_rejected_collision_beacon = 0;
         meas_nb_tx_rejected_too_late = 0;
         meas_nb_tx_rejected_too_early = 0;
+        meas_nb_tx_rejected_duty_cycle = 0;
         meas_nb_beacon_queued = 0;
         meas_nb_beacon_sent = 0;
         meas_nb_beacon_rejected = 0;
@@ -1833,18 +1979,22 @@ int main(int argc, char ** argv)
             printf("# TX rejected (collision beacon): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_collision_beacon / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_beacon);
             printf("# TX rejected (too late): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_too_late / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_late);
             printf("# TX rejected (too early): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_too_early / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_early);
+            if (duty_enabled == true) {
+                printf("# TX rejected (duty cycle): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_duty_cycle / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_duty_cycle);
+            }
         }
         printf("### SX1302 Status ###\n");
-        pthread_mutex_lock(&mx_concent);
-        i  = lgw_get_instcnt(&inst_tstamp);
-        i |= lgw_get_trigcnt(&trig_tstamp);
-        pthread_mutex_unlock(&mx_concent);
+        i  = concent_io_get_instcnt(CONCENT_IO_MAIN, &inst_tstamp);
+        i |= concent_io_get_trigcnt(CONCENT_IO_MAIN, &trig_tstamp);
         if (i != LGW_HAL_SUCCESS) {
             printf("# SX1302 counter unknown\n");
         } else {
             printf("# SX1302 counter (INST): %u\n", inst_tstamp);
             printf("# SX1302 counter (PPS):  %u\n", trig_tstamp);
         }
+        if (concent_io_get_stats(CONCENT_IO_MAIN, &io_stats) == 0) {
+            printf("# I/O thread: %u commands, %u fetches (%u deferred), max wait TX %u us, other %u us\n", io_stats.nb_cmd, io_stats.nb_fetch, io_stats.nb_fetch_deferred, io_stats.tx_wait_max_us, io_stats.cmd_wait_max_us);
+        }
         printf("# BEACON queued: %u\n", cp_nb_beacon_queued);
         printf("# BEACON sent so far: %u\n", cp_nb_beacon_sent);
         printf("# BEACON rejected: %u\n", cp_nb_beacon_rejected);
@@ -1871,22 +2021,52 @@ int main(int argc, char ** argv)
         } else {
             printf("# GPS sync is disabled\n");
         }
-        pthread_mutex_lock(&mx_concent);
-        i = lgw_get_temperature(&temperature);
-        pthread_mutex_unlock(&mx_concent);
+        i = concent_io_get_temperature(CONCENT_IO_MAIN, &temperature);
         if (i != LGW_HAL_SUCCESS) {
             printf("### Concentrator temperature unknown ###\n");
         } else {
             printf("### Concentrator temperature: %.0f C ###\n", temperature);
         }
+        if (metrics_enabled() == true) {
+            printf("### [LATENCY] ###\n");
+            for (i = 0; i < METRICS_HIST_NB; i++) {
+                lat_p50 = metrics_quantile(i, 0.50, &lat_count);
+                if (lat_count == 0) {
+                    continue;
+                }
+                lat_p99 = metrics_quantile(i, 0.99, NULL);
+                printf("# %s: %" PRIu64 " samples, p50 %u us, p99 %u us, max %u us\n", metrics_name(i), lat_count, lat_p50, lat_p99, metrics_quantile(i, 1.0, NULL));
+            }
+        }
+        wlat_report[0] = '\0';
+        if (rt_enabled == true) {
+            printf("### [THREADS] ###\n");
+            wlat_index = snprintf(wlat_report, sizeof wlat_report, ",\"wlat\":{");
+            for (i = 0; i < THREAD_RT_NB; i++) {
+                wlat = thread_rt_get_latency(i);
+                if (wlat == THREAD_RT_LAT_NONE) {
+                    continue;
+                }
+                printf("# %s: worst wakeup latency %d us\n", thread_rt_name(i), wlat);
+                if ((wlat_index > 0) && (wlat_index < (int)sizeof wlat_report)) {
+                    wlat_index += snprintf(wlat_report + wlat_index, sizeof wlat_report - wlat_index, "%s\"%s\":%d", (wlat_report[wlat_index - 1] == '{') ? "" : ",", thread_rt_name(i), wlat);
+                }
+            }
+            if ((wlat_index > 0) && (wlat_index < (int)sizeof wlat_report - 1)) {
+                wlat_report[wlat_index++] = '}';
+                wlat_report[wlat_index] = '\0';
+            } else {
+                wlat_report[0] = '\0'; /* truncated, do not report */
+            }
+        }
         printf("##### END #####\n");
 
         /* generate a JSON report (will be sent to server by upstream thread) */
         pthread_mutex_lock(&mx_stat_rep);
         if (((gps_enabled == true) && (coord_ok == true)) || (gps_fake_enable == true)) {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u,\"temp\":%.1f}", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, temperature);
+            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u,\"temp\":%.1f%s}", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, temperature, wlat_report);
         } else {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u,\"temp\":%.1f}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, temperature);
+            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u,\"temp\":%.1f%s}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, temperature, wlat_report);
         }
         report_ready = true;
         pthread_mutex_unlock(&mx_stat_rep);
@@ -1923,6 +2103,18 @@ int main(int argc, char ** argv)
         }
     }
 
+    /* all the clients are gone, give the concentrator back to the main thread */
+    concent_io_stop();
+    metrics_stop();
+
+    /* save the HAL trace, for chrome://tracing or Perfetto */
+    if (trace_file_name[0] != '\0') {
+        lgw_trace_enable(false);
+        if (lgw_trace_export(trace_file_name) == LGW_TRACE_SUCCESS) {
+            MSG("INFO: HAL trace saved to %s\n", trace_file_name);
+        }
+    }
+
     /* if an exit signal was received, try to quit properly */
     if (exit_sig) {
         /* shut down network sockets */
@@ -1961,6 +2153,8 @@ void thread_up(void) {
     /* allocate memory for packet fetching and processing */
     struct lgw_pkt_rx_s rxpkt[NB_PKT_MAX]; /* array containing inbound packets + metadata */
     struct lgw_pkt_rx_s *p; /* pointer on a RX packet */
+    struct concent_io_rx_meta_s rxmeta[NB_PKT_MAX]; /* when the packets were fetched */
+    int dgram_pkt[NB_PKT_MAX]; /* index of the packets serialized in the datagram */
     int nb_pkt;
 
     /* local copy of GPS time reference */
@@ -1993,6 +2187,9 @@ void thread_up(void) {
     uint32_t mote_addr = 0;
     uint16_t mote_fcnt = 0;
 
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_UP);
+
     /* set upstream socket RX timeout */
     i = setsockopt(sock_up, SOL_SOCKET, SO_RCVTIMEO, (void *)&push_timeout_half, sizeof push_timeout_half);
     if (i != 0) {
@@ -2009,13 +2206,16 @@ void thread_up(void) {
     while (!exit_sig && !quit_sig) {
 
         /* fetch packets */
-        pthread_mutex_lock(&mx_concent);
-        nb_pkt = lgw_receive(NB_PKT_MAX, rxpkt);
-        pthread_mutex_unlock(&mx_concent);
+        nb_pkt = concent_io_receive(NB_PKT_MAX, rxpkt, rxmeta);
         if (nb_pkt == LGW_HAL_ERROR) {
             MSG("ERROR: [up] failed packet fetch, exiting\n");
             exit(EXIT_FAILURE);
         }
+        if (metrics_enabled() == true) {
+            for (i = 0; i < nb_pkt; ++i) {
+                metrics_record(METRICS_UP_RECEIVE, rxmeta[i].fetch_cnt_us - rxpkt[i].count_us);
+            }
+        }
 
         /* check if there are status report to send */
         send_report = report_ready; /* copy the variable so it doesn't change mid-function */
@@ -2023,7 +2223,7 @@ void thread_up(void) {
 
         /* wait a short time if no packets, nor status report */
         if ((nb_pkt == 0) && (send_report == false)) {
-            wait_ms(FETCH_SLEEP_MS);
+            thread_rt_sleep_ms(THREAD_RT_UP, FETCH_SLEEP_MS);
             continue;
         }
 
@@ -2369,6 +2569,7 @@ void thread_up(void) {
             /* End of packet serialization */
             buff_up[buff_index] = '}';
             ++buff_index;
+            dgram_pkt[pkt_in_dgram] = i;
             ++pkt_in_dgram;
 
             if (p->modulation == MOD_LORA) {
@@ -2456,6 +2657,12 @@ void thread_up(void) {
         /* send datagram to server */
         send(sock_up, (void *)buff_up, buff_index, 0);
         clock_gettime(CLOCK_MONOTONIC, &send_time);
+        if (metrics_enabled() == true) {
+            for (j = 0; j < (int)pkt_in_dgram; ++j) {
+                k = dgram_pkt[j];
+                metrics_record(METRICS_UP_PUSH, (rxmeta[k].fetch_cnt_us - rxpkt[k].count_us) + (uint32_t)(1E6 * difftimespec(send_time, rxmeta[k].fetch_time)));
+            }
+        }
         pthread_mutex_lock(&mx_meas_up);
         meas_up_dgram_sent += 1;
         meas_up_network_byte += buff_index;
@@ -2478,6 +2685,7 @@ void thread_up(void) {
                 continue;
             } else {
                 MSG("INFO: [up] PUSH_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
+                metrics_record_elapsed(METRICS_UP_PUSH_ACK, &send_time, &recv_time);
                 meas_up_ack_rcv += 1;
                 break;
             }
@@ -2539,6 +2747,7 @@ void thread_down(void) {
     /* local timekeeping variables */
     struct timespec send_time; /* time of the pull request */
     struct timespec recv_time; /* time of return from recv socket call */
+    struct timespec recv_deadline; /* time at which the recv socket call times out */
 
     /* data buffers */
     uint8_t buff_down[1000]; /* buffer to receive downstream packets */
@@ -2591,6 +2800,13 @@ void thread_down(void) {
     int32_t warning_value = 0;
     uint8_t tx_lut_idx = 0;
 
+    /* duty cycle variables */
+    uint32_t duty_wait_us;
+    uint32_t duty_left_us;
+
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_DOWN);
+
     /* set downstream socket RX timeout */
     i = setsockopt(sock_down, SOL_SOCKET, SO_RCVTIMEO, (void *)&pull_timeout, sizeof pull_timeout);
     if (i != 0) {
@@ -2704,6 +2920,12 @@ void thread_down(void) {
     jit_queue_init(&jit_queue[0]);
     jit_queue_init(&jit_queue[1]);
 
+    /* duty cycle accounting initialization, all sub-bands start with no airtime used */
+    if ((duty_enabled == true) && (lgw_duty_init(&duty_ctx, NULL) != LGW_DUTY_SUCCESS)) {
+        MSG("ERROR: [down] failed to initialize duty cycle accounting, not enforced\n");
+        duty_enabled = false;
+    }
+
     while (!exit_sig && !quit_sig) {
 
         /* auto-quit if the threshold is crossed */
@@ -2733,8 +2955,18 @@ void thread_down(void) {
         while (((int)difftimespec(recv_time, send_time) < keepalive_time) && !exit_sig && !quit_sig) {
 
             /* try to receive a datagram */
+            clock_gettime(CLOCK_MONOTONIC, &recv_deadline);
+            recv_deadline.tv_sec += pull_timeout.tv_sec;
+            recv_deadline.tv_nsec += pull_timeout.tv_usec * 1000;
+            if (recv_deadline.tv_nsec >= 1000000000) {
+                recv_deadline.tv_nsec -= 1000000000;
+                recv_deadline.tv_sec += 1;
+            }
             msg_len = recv(sock_down, (void *)buff_down, (sizeof buff_down)-1, 0);
             clock_gettime(CLOCK_MONOTONIC, &recv_time);
+            if (msg_len < 0) {
+                thread_rt_wakeup(THREAD_RT_DOWN, &recv_deadline); /* woken up by the socket time-out */
+            }
 
             /* Pre-allocate beacon slots in JiT queue, to check downlink collisions */
             beacon_loop = JIT_NUM_BEACON_IN_QUEUE - jit_queue[0].num_beacon;
@@ -2799,11 +3031,14 @@ void thread_down(void) {
                     beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc1 >> 8);
 
                     /* Insert beacon packet in JiT queue */
-                    pthread_mutex_lock(&mx_concent);
-                    lgw_get_instcnt(&current_concentrator_time);
-                    pthread_mutex_unlock(&mx_concent);
+                    concent_io_get_instcnt(CONCENT_IO_DOWN, &current_concentrator_time);
                     jit_result = jit_enqueue(&jit_queue[0], current_concentrator_time, &beacon_pkt, JIT_PKT_TYPE_BEACON);
                     if (jit_result == JIT_ERROR_OK) {
+                        /* beacons are never rejected for duty cycle, but they use the airtime of their sub-band */
+                        if (duty_enabled == true) {
+                            lgw_duty_consume(&duty_ctx, &beacon_pkt);
+                        }
+
                         /* update stats */
                         pthread_mutex_lock(&mx_meas_dw);
                         meas_nb_beacon_queued += 1;
@@ -2866,6 +3101,7 @@ void thread_down(void) {
                         meas_dw_ack_rcv += 1;
                         pthread_mutex_unlock(&mx_meas_dw);
                         MSG("INFO: [down] PULL_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
+                        metrics_record_elapsed(METRICS_DOWN_PULL_ACK, &send_time, &recv_time);
                     }
                 } else { /* out-of-sync token */
                     MSG("INFO: [down] received out-of-sync ACK\n");
@@ -3192,15 +3428,29 @@ void thread_down(void) {
                 }
             }
 
+            /* check the sub-band duty cycle before trying to queue packet */
+            if ((jit_result == JIT_ERROR_OK) && (duty_enabled == true)) {
+                lgw_duty_check(&duty_ctx, &txpkt, &duty_wait_us);
+                if (duty_wait_us > 0) {
+                    jit_result = JIT_ERROR_DUTY_CYCLE;
+                    lgw_duty_deny(&duty_ctx, &txpkt);
+                    lgw_duty_remaining(&duty_ctx, txpkt.freq_hz, txpkt.rf_chain, &duty_left_us);
+                    MSG("ERROR: Packet REJECTED, duty cycle exceeded on %u Hz - %u ms of airtime left, %u ms needed\n", txpkt.freq_hz, duty_left_us / 1000, lgw_time_on_air(&txpkt));
+                }
+            }
+
             /* insert packet to be sent into JIT queue */
             if (jit_result == JIT_ERROR_OK) {
-                pthread_mutex_lock(&mx_concent);
-                lgw_get_instcnt(&current_concentrator_time);
-                pthread_mutex_unlock(&mx_concent);
+                concent_io_get_instcnt(CONCENT_IO_DOWN, &current_concentrator_time);
                 jit_result = jit_enqueue(&jit_queue[txpkt.rf_chain], current_concentrator_time, &txpkt, downlink_type);
                 if (jit_result != JIT_ERROR_OK) {
                     printf("ERROR: Packet REJECTED (jit error=%d)\n", jit_result);
                 } else {
+                    metrics_record_elapsed(METRICS_DOWN_ENQUEUE, &recv_time, NULL);
+                    /* the airtime is accounted when the packet is queued, a packet dropped later is not refunded */
+                    if (duty_enabled == true) {
+                        lgw_duty_consume(&duty_ctx, &txpkt);
+                    }
                     /* In case of a warning having been raised before, we notify it */
                     jit_result = warning_result;
                 }
@@ -3245,22 +3495,29 @@ void thread_jit(void) {
     struct lgw_pkt_tx_s pkt;
     int pkt_index = -1;
     uint32_t current_concentrator_time;
+    struct timespec current_time; /* host time at which current_concentrator_time was read */
+    struct timespec enqueue_time;
+    struct timespec send_time;
     enum jit_error_e jit_result;
     enum jit_pkt_type_e pkt_type;
     uint8_t tx_status;
+    int32_t slack_us;
     int i;
 
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_JIT);
+
     while (!exit_sig && !quit_sig) {
-        wait_ms(10);
+        thread_rt_sleep_ms(THREAD_RT_JIT, 10);
 
         for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
             /* transfer data and metadata to the concentrator, and schedule TX */
-            pthread_mutex_lock(&mx_concent);
-            lgw_get_instcnt(&current_concentrator_time);
-            pthread_mutex_unlock(&mx_concent);
+            concent_io_get_instcnt(CONCENT_IO_JIT, &current_concentrator_time);
+            clock_gettime(CLOCK_MONOTONIC, &current_time);
             jit_result = jit_peek(&jit_queue[i], current_concentrator_time, &pkt_index);
             if (jit_result == JIT_ERROR_OK) {
                 if (pkt_index > -1) {
+                    enqueue_time = jit_queue[i].nodes[pkt_index].enqueue_time;
                     jit_result = jit_dequeue(&jit_queue[i], pkt_index, &pkt, &pkt_type);
                     if (jit_result == JIT_ERROR_OK) {
                         /* update beacon stats */
@@ -3279,9 +3536,7 @@ void thread_jit(void) {
                         }
 
                         /* check if concentrator is free for sending new packet */
-                        pthread_mutex_lock(&mx_concent); /* may have to wait for a fetch to finish */
-                        result = lgw_status(pkt.rf_chain, TX_STATUS, &tx_status);
-                        pthread_mutex_unlock(&mx_concent); /* free concentrator ASAP */
+                        result = concent_io_status(CONCENT_IO_JIT, pkt.rf_chain, TX_STATUS, &tx_status); /* may have to wait for a fetch to finish */
                         if (result == LGW_HAL_ERROR) {
                             MSG("WARNING: [jit%d] lgw_status failed\n", i);
                         } else {
@@ -3298,15 +3553,7 @@ void thread_jit(void) {
                         }
 
                         /* send packet to concentrator */
-                        pthread_mutex_lock(&mx_concent); /* may have to wait for a fetch to finish */
-                        if (spectral_scan_params.enable == true) {
-                            result = lgw_spectral_scan_abort();
-                            if (result != LGW_HAL_SUCCESS) {
-                                MSG("WARNING: [jit%d] lgw_spectral_scan_abort failed\n", i);
-                            }
-                        }
-                        result = lgw_send(&pkt);
-                        pthread_mutex_unlock(&mx_concent); /* free concentrator ASAP */
+                        result = concent_io_send(CONCENT_IO_JIT, &pkt, spectral_scan_params.enable);
                         if (result != LGW_HAL_SUCCESS) {
                             pthread_mutex_lock(&mx_meas_dw);
                             meas_nb_tx_fail += 1;
@@ -3318,6 +3565,17 @@ void thread_jit(void) {
                             meas_nb_tx_ok += 1;
                             pthread_mutex_unlock(&mx_meas_dw);
                             MSG_DEBUG(DEBUG_PKT_FWD, "lgw_send done on rf_chain %d: count_us=%u\n", i, pkt.count_us);
+                            if (metrics_enabled() == true) {
+                                clock_gettime(CLOCK_MONOTONIC, &send_time);
+                                if (pkt_type != JIT_PKT_TYPE_BEACON) {
+                                    metrics_record_elapsed(METRICS_DOWN_SEND, &enqueue_time, &send_time);
+                                }
+                                if (pkt.tx_mode == TIMESTAMPED) {
+                                    /* concentrator time extrapolated from the one read before peeking */
+                                    slack_us = (int32_t)(pkt.count_us - current_concentrator_time) - (int32_t)(1E6 * difftimespec(send_time, current_time));
+                                    metrics_record(METRICS_DOWN_SLACK, (slack_us > 0) ? (uint32_t)slack_us : 0);
+                                }
+                            }
                         }
                     } else {
                         MSG("ERROR: jit_dequeue failed on rf_chain %d with %d\n", i, jit_result);
@@ -3350,9 +3608,7 @@ static void gps_process_sync(void) {
     }
 
     /* get timestamp captured on PPM pulse  */
-    pthread_mutex_lock(&mx_concent);
-    i = lgw_get_trigcnt(&trig_tstamp);
-    pthread_mutex_unlock(&mx_concent);
+    i = concent_io_get_trigcnt(CONCENT_IO_GPS, &trig_tstamp);
     if (i != LGW_HAL_SUCCESS) {
         MSG("WARNING: [gps] failed to read concentrator timestamp\n");
         return;
@@ -3388,98 +3644,46 @@ static void gps_process_coords(void) {
 
 void thread_gps(void) {
     /* serial variables */
-    char serial_buff[128]; /* buffer to receive GPS data */
-    size_t wr_idx = 0;     /* pointer to end of chars in buffer */
+    struct lgw_gps_stream_s gps_stream; /* incremental parser of the GPS data */
 
     /* variables for PPM pulse GPS synchronization */
     enum gps_msg latest_msg; /* keep track of latest NMEA message parsed */
 
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_GPS);
+
     /* initialize some variables before loop */
-    memset(serial_buff, 0, sizeof serial_buff);
+    lgw_gps_stream_init(&gps_stream);
 
     while (!exit_sig && !quit_sig) {
-        size_t rd_idx = 0;
-        size_t frame_end_idx = 0;
-
-        /* blocking non-canonical read on serial port */
-        ssize_t nb_char = read(gps_tty_fd, serial_buff + wr_idx, LGW_GPS_MIN_MSG_SIZE);
+        /* blocking non-canonical read on serial port, straight into the parser buffer */
+        ssize_t nb_char = lgw_gps_stream_read(&gps_stream, gps_tty_fd);
         if (nb_char <= 0) {
             MSG("WARNING: [gps] read() returned value %zd\n", nb_char);
             continue;
         }
-        wr_idx += (size_t)nb_char;
-
-        /*******************************************
-         * Scan buffer for UBX/NMEA sync chars and *
-         * attempt to decode frame if one is found *
-         *******************************************/
-        while (rd_idx < wr_idx) {
-            size_t frame_size = 0;
-
-            /* Scan buffer for UBX sync char */
-            if (serial_buff[rd_idx] == (char)LGW_GPS_UBX_SYNC_CHAR) {
-
-                /***********************
-                 * Found UBX sync char *
-                 ***********************/
-                latest_msg = lgw_parse_ubx(&serial_buff[rd_idx], (wr_idx - rd_idx), &frame_size);
-
-                if (frame_size > 0) {
-                    if (latest_msg == INCOMPLETE) {
-                        /* UBX header found but frame appears to be missing bytes */
-                        frame_size = 0;
-                    } else if (latest_msg == INVALID) {
-                        /* message header received but message appears to be corrupted */
-                        MSG("WARNING: [gps] could not get a valid message from GPS (no time)\n");
-                        frame_size = 0;
-                    } else if (latest_msg == UBX_NAV_TIMEGPS) {
-                        gps_process_sync();
-                    }
-                }
-            } else if (serial_buff[rd_idx] == (char)LGW_GPS_NMEA_SYNC_CHAR) {
-                /************************
-                 * Found NMEA sync char *
-                 ************************/
-                /* scan for NMEA end marker (LF = 0x0a) */
-                char* nmea_end_ptr = memchr(&serial_buff[rd_idx],(int)0x0a, (wr_idx - rd_idx));
-
-                if(nmea_end_ptr) {
-                    /* found end marker */
-                    frame_size = nmea_end_ptr - &serial_buff[rd_idx] + 1;
-                    latest_msg = lgw_parse_nmea(&serial_buff[rd_idx], frame_size);
-
-                    if(latest_msg == INVALID || latest_msg == UNKNOWN) {
-                        /* checksum failed */
-                        frame_size = 0;
-                    } else if (latest_msg == NMEA_RMC) { /* Get location from RMC frames */
-                        gps_process_coords();
-                    }
-                    else if (latest_msg == NMEA_GGA) { /* Get location from RMC frames */
-                        gps_process_coords();
-                    }
-                }
-            }
 
-            if (frame_size > 0) {
-                /* At this point message is a checksum verified frame
-                   we're processed or ignored. Remove frame from buffer */
-                rd_idx += frame_size;
-                frame_end_idx = rd_idx;
-            } else {
-                rd_idx++;
+        /*************************************************
+         * Parse the new bytes, each UBX/NMEA frame is   *
+         * reported as soon as its last byte is received *
+         *************************************************/
+        while ((latest_msg = lgw_gps_stream_next(&gps_stream)) != UNKNOWN) {
+            switch (latest_msg) {
+                case INVALID:
+                    /* message header received but message appears to be corrupted */
+                    MSG("WARNING: [gps] could not get a valid message from GPS (no time)\n");
+                    break;
+                case UBX_NAV_TIMEGPS:
+                    gps_process_sync();
+                    break;
+                case NMEA_RMC: /* Get location from RMC frames */
+                case NMEA_GGA: /* Get location from GGA frames */
+                    gps_process_coords();
+                    break;
+                default:
+                    /* checksum verified frame, ignored */
+                    break;
             }
-        } /* ...for(rd_idx = 0... */
-
-        if (frame_end_idx) {
-          /* Frames have been processed. Remove bytes to end of last processed frame */
-          memcpy(serial_buff, &serial_buff[frame_end_idx], wr_idx - frame_end_idx);
-          wr_idx -= frame_end_idx;
-        } /* ...for(rd_idx = 0... */
-
-        /* Prevent buffer overflow */
-        if ((sizeof(serial_buff) - wr_idx) < LGW_GPS_MIN_MSG_SIZE) {
-            memcpy(serial_buff, &serial_buff[LGW_GPS_MIN_MSG_SIZE], wr_idx - LGW_GPS_MIN_MSG_SIZE);
-            wr_idx -= LGW_GPS_MIN_MSG_SIZE;
         }
     }
     MSG("\nINFO: End of GPS thread\n");
@@ -3512,9 +3716,12 @@ void thread_valid(void) {
     // setbuf(log_file, NULL);
     // fprintf(log_file,"\"xtal_correct\",\"XERR_INIT_AVG %u XERR_FILT_COEF %u\"\n", XERR_INIT_AVG, XERR_FILT_COEF); // DEBUG
 
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_VALID);
+
     /* main loop task */
     while (!exit_sig && !quit_sig) {
-        wait_ms(1000);
+        thread_rt_sleep_ms(THREAD_RT_VALID, 1000);
 
         /* calculate when the time reference was last updated */
         pthread_mutex_lock(&mx_timeref);
@@ -3581,9 +3788,27 @@ void thread_spectral_scan(void) {
     uint16_t results[LGW_SPECTRAL_SCAN_RESULT_SIZE];
     struct timeval tm_start;
     lgw_spectral_scan_status_t status;
-    uint8_t tx_status = TX_FREE;
     bool spectral_scan_started;
     bool exit_thread = false;
+    lgw_occ_t * occ = NULL;
+    struct lgw_occ_conf_s occ_conf;
+
+    /* apply the real-time configuration of the thread */
+    thread_rt_apply(THREAD_RT_SCAN);
+
+    /* map the occupancy store, read by the other processes (and threads) to select clear channels */
+    if (spectral_scan_params.occ_path[0] != '\0') {
+        occ_conf.freq_hz_start = spectral_scan_params.freq_hz_start;
+        occ_conf.freq_step_hz = 200000; /* 200kHz channels */
+        occ_conf.nb_slots = spectral_scan_params.nb_chan;
+        occ_conf.half_life_s = spectral_scan_params.occ_half_life_s;
+        if (lgw_occ_open(spectral_scan_params.occ_path, &occ_conf, &occ) == LGW_OCC_SUCCESS) {
+            MSG("INFO: [scan] occupancy map %s, half-life %u s\n", spectral_scan_params.occ_path, occ_conf.half_life_s);
+        } else {
+            MSG("WARNING: [scan] occupancy map disabled\n");
+            occ = NULL;
+        }
+    }
 
     /* main loop task */
     while (!exit_sig && !quit_sig) {
@@ -3593,7 +3818,7 @@ void thread_spectral_scan(void) {
                 exit_thread = true;
                 break;
             }
-            wait_ms(1000);
+            thread_rt_sleep_ms(THREAD_RT_SCAN, 1000);
         }
         if (exit_thread == true) {
             break;
@@ -3602,31 +3827,13 @@ void thread_spectral_scan(void) {
         spectral_scan_started = false;
 
         /* Start spectral scan (if no downlink programmed) */
-        pthread_mutex_lock(&mx_concent);
-        /* -- Check if there is a downlink programmed */
-        for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
-            if (tx_enable[i] == true) {
-                x = lgw_status((uint8_t)i, TX_STATUS, &tx_status);
-                if (x != LGW_HAL_SUCCESS) {
-                    printf("ERROR: failed to get TX status on chain %d\n", i);
-                } else {
-                    if (tx_status == TX_SCHEDULED || tx_status == TX_EMITTING) {
-                        printf("INFO: skip spectral scan (downlink programmed on RF chain %d)\n", i);
-                        break; /* exit for loop */
-                    }
-                }
-            }
-        }
-        if (tx_status != TX_SCHEDULED && tx_status != TX_EMITTING) {
-            x = lgw_spectral_scan_start(freq_hz, spectral_scan_params.nb_scan);
-            if (x != 0) {
-                printf("ERROR: spectral scan start failed\n");
-                pthread_mutex_unlock(&mx_concent);
-                continue; /* main while loop */
-            }
+        x = concent_io_spectral_scan_start(CONCENT_IO_SCAN, tx_enable, freq_hz, spectral_scan_params.nb_scan);
+        if (x == LGW_HAL_SUCCESS) {
             spectral_scan_started = true;
+        } else if (x != CONCENT_IO_SKIPPED) {
+            printf("ERROR: spectral scan start failed\n");
+            continue; /* main while loop */
         }
-        pthread_mutex_unlock(&mx_concent);
 
         if (spectral_scan_started == true) {
             /* Wait for scan to be completed */
@@ -3640,25 +3847,21 @@ void thread_spectral_scan(void) {
                 }
 
                 /* get spectral scan status */
-                pthread_mutex_lock(&mx_concent);
-                x = lgw_spectral_scan_get_status(&status);
-                pthread_mutex_unlock(&mx_concent);
+                x = concent_io_spectral_scan_get_status(CONCENT_IO_SCAN, &status);
                 if (x != 0) {
                     printf("ERROR: spectral scan status failed\n");
                     break; /* do while */
                 }
 
                 /* wait a bit before checking status again */
-                wait_ms(10);
+                thread_rt_sleep_ms(THREAD_RT_SCAN, 10);
             } while (status != LGW_SPECTRAL_SCAN_STATUS_COMPLETED && status != LGW_SPECTRAL_SCAN_STATUS_ABORTED);
 
             if (status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED) {
                 /* Get spectral scan results */
                 memset(levels, 0, sizeof levels);
                 memset(results, 0, sizeof results);
-                pthread_mutex_lock(&mx_concent);
-                x = lgw_spectral_scan_get_results(levels, results);
-                pthread_mutex_unlock(&mx_concent);
+                x = concent_io_spectral_scan_get_results(CONCENT_IO_SCAN, levels, results);
                 if (x != 0) {
                     printf("ERROR: spectral scan get results failed\n");
                     continue; /* main while loop */
@@ -3671,6 +3874,11 @@ void thread_spectral_scan(void) {
                 }
                 printf("\n");
 
+                /* accumulate the histogram in the occupancy map */
+                if (occ != NULL) {
+                    lgw_occ_update(occ, freq_hz, levels, results);
+                }
+
                 /* Next frequency to scan */
                 freq_hz += 200000; /* 200kHz channels */
                 if (freq_hz >= freq_hz_stop) {
@@ -3683,6 +3891,9 @@ void thread_spectral_scan(void) {
             }
         }
     }
+    if (occ != NULL) {
+        lgw_occ_close(occ);
+    }
     printf("\nINFO: End of Spectral Scan thread\n");
 }
 
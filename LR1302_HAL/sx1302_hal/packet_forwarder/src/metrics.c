@@ -0,0 +1,362 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : latency histograms and Prometheus metrics endpoint
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#define _GNU_SOURCE     /* needed for MSG_NOSIGNAL */
+#include <stdio.h>      /* snprintf */
+#include <stdlib.h>     /* malloc, free */
+#include <string.h>     /* memset, strerror */
+#include <errno.h>      /* EINTR */
+#include <unistd.h>     /* close */
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h> /* sockaddr_in */
+#include <arpa/inet.h>  /* htonl, htons */
+
+#include "trace.h"
+#include "metrics.h"
+#include "thread_rt.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define HIST_ADD(x, v)      __atomic_fetch_add(&(x), (v), __ATOMIC_RELAXED)
+#define HIST_LOAD(x)        __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define HIST_SUB_BITS       2   /* 4 buckets per power of two */
+#define HIST_SUB_NB         (1 << HIST_SUB_BITS)
+#define HIST_BUCKET_NB      ((32 - HIST_SUB_BITS + 1) * HIST_SUB_NB) /* covers the whole uint32_t range */
+
+#define HTTP_REQ_SIZE       1024
+#define HTTP_BODY_SIZE      (METRICS_HIST_NB * (HIST_BUCKET_NB + 6) * 96)
+
+struct hist_s {
+    uint64_t    bucket[HIST_BUCKET_NB];
+    uint64_t    count;
+    uint64_t    sum_us;
+    uint32_t    max_us;
+};
+
+struct hist_desc_s {
+    const char *    name;   /* console name */
+    const char *    metric; /* Prometheus name */
+    const char *    help;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static const struct hist_desc_s hist_desc[METRICS_HIST_NB] = {
+    [METRICS_UP_RECEIVE]    = { "up receive",    "lora_pkt_fwd_up_receive_seconds",    "Time from the packet timestamp to its fetch from the concentrator" },
+    [METRICS_UP_PUSH]       = { "up push",       "lora_pkt_fwd_up_push_seconds",       "Time from the packet timestamp to the PUSH_DATA carrying it" },
+    [METRICS_UP_PUSH_ACK]   = { "up push ack",   "lora_pkt_fwd_up_push_ack_seconds",   "PUSH_DATA to PUSH_ACK round trip time" },
+    [METRICS_DOWN_PULL_ACK] = { "down pull ack", "lora_pkt_fwd_down_pull_ack_seconds", "PULL_DATA to PULL_ACK round trip time" },
+    [METRICS_DOWN_ENQUEUE]  = { "down enqueue",  "lora_pkt_fwd_down_enqueue_seconds",  "Time from the PULL_RESP arrival to the end of the JiT enqueue" },
+    [METRICS_DOWN_SEND]     = { "down send",     "lora_pkt_fwd_down_send_seconds",     "Time from the JiT enqueue to the end of the programming of the TX" },
+    [METRICS_DOWN_SLACK]    = { "down slack",    "lora_pkt_fwd_down_slack_seconds",    "Time left between the end of the programming of the TX and its timestamp" }
+};
+
+static struct hist_s hist[METRICS_HIST_NB];
+
+static bool metrics_on = false;
+static int listen_fd = -1;
+static bool server_stop = false;
+static pthread_t thrid_server;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int bucket_index(uint32_t value) {
+    int msb;
+
+    if (value < (2 * HIST_SUB_NB)) {
+        return (int)value;
+    }
+    msb = 31 - __builtin_clz(value);
+    return ((msb - HIST_SUB_BITS) << HIST_SUB_BITS) + (int)(value >> (msb - HIST_SUB_BITS));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* highest value falling in the bucket */
+static uint32_t bucket_bound(int index) {
+    int shift;
+    uint64_t sub;
+
+    if (index < (2 * HIST_SUB_NB)) {
+        return (uint32_t)index;
+    }
+    shift = (index >> HIST_SUB_BITS) - 1;
+    sub = (uint64_t)((index & (HIST_SUB_NB - 1)) + HIST_SUB_NB);
+    return (uint32_t)(((sub + 1) << shift) - 1);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int body_print(char * body, int size) {
+    uint64_t cumul, count, sum_us;
+    int i, j, len = 0;
+
+#define BODY_PRINTF(...)                                                        \
+    do {                                                                        \
+        if (len < size) {                                                       \
+            len += snprintf(body + len, size - len, __VA_ARGS__);               \
+        }                                                                       \
+    } while (0)
+
+    for (i = 0; i < METRICS_HIST_NB; i++) {
+        BODY_PRINTF("# HELP %s %s\n", hist_desc[i].metric, hist_desc[i].help);
+        BODY_PRINTF("# TYPE %s histogram\n", hist_desc[i].metric);
+        /* buckets are read one by one while being written, count is the sum to stay consistent */
+        cumul = 0;
+        for (j = 0; j < HIST_BUCKET_NB; j++) {
+            cumul += HIST_LOAD(hist[i].bucket[j]);
+            BODY_PRINTF("%s_bucket{le=\"%u.%06u\"} %llu\n", hist_desc[i].metric, bucket_bound(j) / 1000000, bucket_bound(j) % 1000000, (unsigned long long)cumul);
+        }
+        count = cumul;
+        sum_us = HIST_LOAD(hist[i].sum_us);
+        BODY_PRINTF("%s_bucket{le=\"+Inf\"} %llu\n", hist_desc[i].metric, (unsigned long long)count);
+        BODY_PRINTF("%s_sum %llu.%06u\n", hist_desc[i].metric, (unsigned long long)(sum_us / 1000000), (unsigned)(sum_us % 1000000));
+        BODY_PRINTF("%s_count %llu\n", hist_desc[i].metric, (unsigned long long)count);
+    }
+
+#undef BODY_PRINTF
+
+    return (len < size) ? len : -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static int send_all(int fd, const char * buf, int size) {
+    int n;
+
+    while (size > 0) {
+        n = send(fd, buf, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void serve_client(int fd, char * body) {
+    const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    char req[HTTP_REQ_SIZE];
+    char hdr[160];
+    struct timeval tv = { 1, 0 };
+    int n, len = 0, body_len;
+
+    /* the request line is all we need, bounded in size and time */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof tv);
+    while (len < (int)sizeof req - 1) {
+        n = recv(fd, req + len, sizeof req - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+    req[len] = '\0';
+
+    if ((strncmp(req, "GET / ", 6) != 0) && (strncmp(req, "GET /metrics ", 13) != 0)) {
+        send_all(fd, not_found, sizeof not_found - 1);
+        return;
+    }
+
+    body_len = body_print(body, HTTP_BODY_SIZE);
+    if (body_len < 0) {
+        MSG("WARNING: [metrics] report truncated\n");
+        body_len = (int)strlen(body);
+    }
+    n = snprintf(hdr, sizeof hdr, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", body_len);
+    if (send_all(fd, hdr, n) == 0) {
+        send_all(fd, body, body_len);
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void * thread_server(void * arg) {
+    char * body;
+    int fd;
+
+    (void)arg;
+
+    body = malloc(HTTP_BODY_SIZE);
+    if (body == NULL) {
+        MSG("ERROR: [metrics] failed to allocate the report buffer\n");
+        return NULL;
+    }
+
+    while (__atomic_load_n(&server_stop, __ATOMIC_ACQUIRE) == false) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; /* the listening socket was shut down */
+        }
+        serve_client(fd, body);
+        close(fd);
+    }
+
+    free(body);
+    MSG("\nINFO: End of metrics thread\n");
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+int metrics_start(uint16_t port) {
+    struct sockaddr_in addr;
+    int opt = 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        MSG("ERROR: [metrics] socket failed (%s)\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof opt);
+
+    /* local access only, the metrics are scraped by an agent running on the gateway */
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ((bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0) || (listen(listen_fd, 4) != 0)) {
+        MSG("ERROR: [metrics] failed to listen on 127.0.0.1:%u (%s)\n", port, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    server_stop = false;
+    if (thread_rt_create(&thrid_server, thread_server, NULL) != 0) {
+        MSG("ERROR: [metrics] impossible to create metrics thread\n");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    __atomic_store_n(&metrics_on, true, __ATOMIC_RELEASE);
+    MSG("INFO: [metrics] serving latency histograms on http://127.0.0.1:%u/metrics\n", port);
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void metrics_stop(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    /* unblock accept() */
+    __atomic_store_n(&server_stop, true, __ATOMIC_RELEASE);
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(thrid_server, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+bool metrics_enabled(void) {
+    return __atomic_load_n(&metrics_on, __ATOMIC_ACQUIRE);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void metrics_record(enum metrics_hist_e h, uint32_t value_us) {
+    uint32_t max;
+
+    if ((h >= METRICS_HIST_NB) || (metrics_enabled() == false)) {
+        return;
+    }
+
+    HIST_ADD(hist[h].bucket[bucket_index(value_us)], 1);
+    HIST_ADD(hist[h].sum_us, value_us);
+    HIST_ADD(hist[h].count, 1);
+    max = HIST_LOAD(hist[h].max_us);
+    while ((value_us > max) && !__atomic_compare_exchange_n(&hist[h].max_us, &max, value_us, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void metrics_record_elapsed(enum metrics_hist_e h, const struct timespec * from, const struct timespec * to) {
+    struct timespec now;
+    int64_t us;
+
+    if (to == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        to = &now;
+    }
+    us = ((int64_t)(to->tv_sec - from->tv_sec) * 1000000) + ((to->tv_nsec - from->tv_nsec) / 1000);
+    metrics_record(h, (us < 0) ? 0 : ((us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint32_t metrics_quantile(enum metrics_hist_e h, double q, uint64_t * count) {
+    uint64_t total, rank, cumul = 0;
+    uint32_t max;
+    int i;
+
+    if (h >= METRICS_HIST_NB) {
+        return 0;
+    }
+
+    total = HIST_LOAD(hist[h].count);
+    max = HIST_LOAD(hist[h].max_us);
+    if (count != NULL) {
+        *count = total;
+    }
+    if ((total == 0) || (q >= 1.0)) {
+        return max;
+    }
+
+    rank = (uint64_t)(q * (double)total);
+    for (i = 0; i < HIST_BUCKET_NB; i++) {
+        cumul += HIST_LOAD(hist[h].bucket[i]);
+        if (cumul > rank) {
+            return (bucket_bound(i) < max) ? bucket_bound(i) : max;
+        }
+    }
+
+    return max;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+const char * metrics_name(enum metrics_hist_e h) {
+    return (h < METRICS_HIST_NB) ? hist_desc[h].name : "unknown";
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,276 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+
+Description:
+    LoRa concentrator : real-time scheduling of the forwarder threads
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#define _GNU_SOURCE     /* needed for pthread_setaffinity_np and CPU_SET */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* strtoul */
+#include <string.h>     /* memset, strerror */
+#include <errno.h>      /* EINTR */
+#include <sched.h>      /* sched_param, cpu_set_t */
+#include <pthread.h>    /* pthread_attr_setstacksize */
+#include <sys/mman.h>   /* mlockall */
+
+#include "trace.h"
+#include "thread_rt.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define CPU_NB_MAX  64
+
+struct thread_rt_conf_s {
+    int         priority;
+    uint64_t    cpus;       /* bit mask, 0 for any CPU */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static const char * thread_names[THREAD_RT_NB] = { "up", "down", "jit", "gps", "valid", "scan", "io" };
+
+static struct thread_rt_conf_s thread_conf[THREAD_RT_NB];
+
+static uint32_t prefault_kb = 0;
+
+/* worst wakeup latency, written by each thread and read by the statistics */
+static int32_t wakeup_lat_max[THREAD_RT_NB] = { THREAD_RT_LAT_NONE, THREAD_RT_LAT_NONE, THREAD_RT_LAT_NONE,
+                                                 THREAD_RT_LAT_NONE, THREAD_RT_LAT_NONE, THREAD_RT_LAT_NONE,
+                                                 THREAD_RT_LAT_NONE };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int parse_cpus(const char * str, uint64_t * mask) {
+    const char * p = str;
+    char * end;
+    unsigned long first, last, i;
+
+    *mask = 0;
+    while (*p != '\0') {
+        first = strtoul(p, &end, 10);
+        if (end == p) {
+            return -1;
+        }
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        if ((first > last) || (last >= CPU_NB_MAX)) {
+            return -1;
+        }
+        for (i = first; i <= last; i++) {
+            *mask |= (uint64_t)1 << i;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+
+    return (*mask != 0) ? 0 : -1;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void prefault_stack(void) {
+    size_t i, size = (size_t)prefault_kb * 1024;
+
+    /* bounded by thread_rt_set_prefault(), well within THREAD_RT_STACK_SIZE */
+    if ((size == 0) || (size > ((size_t)THREAD_RT_PREFAULT_KB_MAX * 1024))) {
+        return;
+    }
+
+    /* touch one byte per page, the frame is released on return but the pages stay mapped */
+    uint8_t buf[size];
+    volatile uint8_t * page = buf;
+    for (i = 0; i < size; i += 4096) {
+        page[i] = 0;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+const char * thread_rt_name(enum thread_rt_id_e id) {
+    return (id < THREAD_RT_NB) ? thread_names[id] : "unknown";
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int thread_rt_configure(enum thread_rt_id_e id, int priority, const char * cpus) {
+    uint64_t mask = 0;
+
+    if (id >= THREAD_RT_NB) {
+        return -1;
+    }
+    if ((priority != THREAD_RT_PRIO_NONE) && ((priority < sched_get_priority_min(SCHED_FIFO)) || (priority > sched_get_priority_max(SCHED_FIFO)))) {
+        MSG("ERROR: [rt] invalid priority %d for thread %s\n", priority, thread_names[id]);
+        return -1;
+    }
+    if ((cpus != NULL) && (parse_cpus(cpus, &mask) != 0)) {
+        MSG("ERROR: [rt] invalid CPU list \"%s\" for thread %s\n", cpus, thread_names[id]);
+        return -1;
+    }
+
+    thread_conf[id].priority = priority;
+    thread_conf[id].cpus = mask;
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+uint32_t thread_rt_set_prefault(uint32_t size_kb) {
+    if (size_kb > THREAD_RT_PREFAULT_KB_MAX) {
+        MSG("WARNING: [rt] stack prefault limited to %u kB\n", THREAD_RT_PREFAULT_KB_MAX);
+        size_kb = THREAD_RT_PREFAULT_KB_MAX;
+    }
+    prefault_kb = size_kb;
+
+    return prefault_kb;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int thread_rt_lock_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        MSG("WARNING: [rt] mlockall failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int thread_rt_create(pthread_t * thread, void * (*start)(void *), void * arg) {
+    pthread_attr_t attr;
+    int i;
+
+    i = pthread_attr_init(&attr);
+    if (i != 0) {
+        return i;
+    }
+    i = pthread_attr_setstacksize(&attr, THREAD_RT_STACK_SIZE);
+    if (i == 0) {
+        i = pthread_create(thread, &attr, start, arg);
+    }
+    pthread_attr_destroy(&attr);
+
+    return i;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int thread_rt_apply(enum thread_rt_id_e id) {
+    struct sched_param param;
+    cpu_set_t set;
+    int i, err = 0;
+
+    if (id >= THREAD_RT_NB) {
+        return -1;
+    }
+
+    if (thread_conf[id].cpus != 0) {
+        CPU_ZERO(&set);
+        for (i = 0; i < CPU_NB_MAX; i++) {
+            if (thread_conf[id].cpus & ((uint64_t)1 << i)) {
+                CPU_SET(i, &set);
+            }
+        }
+        i = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        if (i != 0) {
+            MSG("WARNING: [rt] failed to set CPU affinity of thread %s (%s)\n", thread_names[id], strerror(i));
+            err = -1;
+        }
+    }
+
+    if (thread_conf[id].priority != THREAD_RT_PRIO_NONE) {
+        memset(&param, 0, sizeof param);
+        param.sched_priority = thread_conf[id].priority;
+        i = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (i != 0) {
+            MSG("WARNING: [rt] failed to set SCHED_FIFO priority %d for thread %s (%s)\n", param.sched_priority, thread_names[id], strerror(i));
+            err = -1;
+        } else {
+            MSG("INFO: [rt] thread %s runs SCHED_FIFO priority %d\n", thread_names[id], param.sched_priority);
+        }
+    }
+
+    prefault_stack();
+
+    return err;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void thread_rt_sleep_ms(enum thread_rt_id_e id, unsigned long delay_ms) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += delay_ms / 1000;
+    deadline.tv_nsec += (delay_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_nsec -= 1000000000;
+        deadline.tv_sec += 1;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+
+    thread_rt_wakeup(id, &deadline);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void thread_rt_wakeup(enum thread_rt_id_e id, const struct timespec * deadline) {
+    struct timespec now;
+    int64_t lat_us;
+    int32_t lat, prev;
+
+    if (id >= THREAD_RT_NB) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lat_us = ((int64_t)(now.tv_sec - deadline->tv_sec) * 1000000) + ((now.tv_nsec - deadline->tv_nsec) / 1000);
+    if (lat_us < 0) {
+        lat_us = 0; /* woken up early, by a signal or a packet */
+    }
+    lat = (lat_us > INT32_MAX) ? INT32_MAX : (int32_t)lat_us;
+
+    prev = __atomic_load_n(&wakeup_lat_max[id], __ATOMIC_RELAXED);
+    while ((lat > prev) && !__atomic_compare_exchange_n(&wakeup_lat_max[id], &prev, lat, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int32_t thread_rt_get_latency(enum thread_rt_id_e id) {
+    if (id >= THREAD_RT_NB) {
+        return THREAD_RT_LAT_NONE;
+    }
+
+    return __atomic_exchange_n(&wakeup_lat_max[id], THREAD_RT_LAT_NONE, __ATOMIC_RELAXED);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
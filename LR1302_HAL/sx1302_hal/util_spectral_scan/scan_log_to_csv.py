@@ -0,0 +1,68 @@
+#!/usr/bin/python
+# -*- encoding: utf-8 -*-
+
+#  ______                              _
+#  / _____)             _              | |
+# ( (____  _____ ____ _| |_ _____  ____| |__
+#  \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+#  _____) ) ____| | | || |_| ____( (___| | | |
+# (______/|_____)_|_|_| \__)_____)\____)_| |_|
+#
+# Description:
+#    Spectral Scan binary log to CSV file conversion, the CSV file can be
+#    plotted with plot_rssi_histogram.py
+#
+# License: Revised BSD License, see LICENSE.TXT file include in the project
+
+#Library importation
+import struct
+import sys
+
+MAGIC = b'LGWSCAN\0'
+VERSION = 1
+
+#Read argument
+if len(sys.argv) >= 2:
+    filename = sys.argv[1]
+else:
+    print ("Usage: %s <filename.bin> [filename.csv] [-t]" %sys.argv[0])
+    print ("  -t: prefix each line with the scan time (ms since epoch)")
+    sys.exit()
+args = [a for a in sys.argv[2:] if a != '-t']
+with_ts = '-t' in sys.argv[2:]
+if len(args) >= 1:
+    outname = args[0]
+elif filename.endswith('.bin'):
+    outname = filename[:-4] + '.csv'
+else:
+    outname = filename + '.csv'
+
+#Process .bin file
+with open(filename, 'rb') as binfile, open(outname, 'w') as csvfile:
+    hdr = binfile.read(16)
+    if len(hdr) != 16 or hdr[0:8] != MAGIC:
+        print ("ERROR: %s is not a spectral scan log" %filename)
+        sys.exit(1)
+    version, nb_bins, rec_size = struct.unpack('<HHH', hdr[8:14])
+    if version != VERSION:
+        print ("ERROR: unsupported log version %d" %version)
+        sys.exit(1)
+    rec = struct.Struct('<QIHH%dh%dH' %(nb_bins, nb_bins))
+    nb = 0
+    while True:
+        data = binfile.read(rec_size)
+        if len(data) < rec_size:
+            break
+        fields = rec.unpack(data[:rec.size])
+        ts_ms, freq = fields[0], fields[1]
+        levels = fields[4:4 + nb_bins]
+        counts = fields[4 + nb_bins:]
+        line = '%u' %freq
+        for k in range(nb_bins):
+            line += ',%d,%u' %(levels[k], counts[k])
+        if with_ts:
+            line = '%u,' %ts_ms + line
+        csvfile.write(line + '\n')
+        nb += 1
+
+print ("%d scans written to %s" %(nb, outname))
@@ -10,6 +10,13 @@
 Description:
     Spectral Scan Utility
 
+    The channels are swept in a pipeline: the scan of the next channel is
+    started as soon as the results of the current one have been read, and the
+    results are logged while it runs. The status is polled when the scan is
+    expected to be completed, the expected duration being learnt from the
+    previous scans. The results are logged in a buffered binary file, which
+    is converted to CSV offline by scan_log_to_csv.py.
+
 License: Revised BSD License, see LICENSE.TXT file include in the project
 */
 
@@ -33,9 +40,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <math.h>
 #include <signal.h>     /* sigaction */
 #include <getopt.h>     /* getopt_long */
+#include <time.h>       /* clock_gettime */
 
 #include "loragw_hal.h"
 #include "loragw_aux.h"
+#include "loragw_occ.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -55,10 +64,37 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define DEFAULT_RSSI_OFFSET -11 /* RSSI offset of SX1261 */
 
 #define DEFAULT_LOG_NAME    "rssi_histogram"
+#define DEFAULT_NB_SWEEP    1
+
+#define CHANNEL_STEP_HZ     200000  /* 200kHz channels */
+
+#define SCAN_POINT_NS       10000   /* initial guess of the duration of a scan point */
+#define SCAN_POLL_MIN_US    200     /* status polling period bounds */
+#define SCAN_POLL_MAX_US    10000
+#define SCAN_TIMEOUT_MIN_MS 2000
+
+#define SCAN_LOG_MAGIC      "LGWSCAN"   /* 8 bytes with the null char */
+#define SCAN_LOG_VERSION    1
+#define SCAN_LOG_REC_SIZE   (8 + 4 + 2 + 2 + (LGW_SPECTRAL_SCAN_RESULT_SIZE * 4))
+#define SCAN_LOG_BUFFER     (64 * 1024)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* results of a channel scan */
+struct scan_result_s {
+    uint64_t    ts_ms;      /* end of scan, CLOCK_REALTIME */
+    uint32_t    freq_hz;
+    int16_t     levels[LGW_SPECTRAL_SCAN_RESULT_SIZE];
+    uint16_t    results[LGW_SPECTRAL_SCAN_RESULT_SIZE];
+};
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
+static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
+static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
 
@@ -76,7 +112,142 @@ void usage(void) {
     printf(" -n <uint>  Number of channels to scan\n");
     printf(" -s <uint>  Number of scan points per frequency step [1..65535]\n");
     printf(" -o <int>   RSSI Offset of the sx1261 path, in dB [-127..128]\n");
-    printf(" -l <char>  Log file name\n");
+    printf(" -l <char>  Log file name (without extension)\n");
+    printf(" -c         Log in CSV (.csv) instead of binary (.bin, see scan_log_to_csv.py)\n");
+    printf(" -r <uint>  Number of sweeps, 0 to sweep until stopped\n");
+    printf(" -m <char>  Also accumulate the results in an occupancy map\n");
+    printf("            => e.g. " LGW_OCC_PATH_DEFAULT "\n");
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void sig_handler(int sigio) {
+    if (sigio == SIGQUIT) {
+        quit_sig = 1;
+    } else if ((sigio == SIGINT) || (sigio == SIGTERM)) {
+        exit_sig = 1;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static uint64_t elapsed_us(const struct timespec * start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)(now.tv_sec - start->tv_sec) * 1000000) + ((now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/*
+Wait for the end of a scan started at 'start', expected to last 'expected_us'.
+Sleep until it should be completed, then poll the status every 1/32 of the expected
+duration. The estimate is updated: with the measured duration when the scan was not
+completed at the first poll, otherwise lowered, so that it follows the actual duration
+both ways.
+*/
+static int scan_wait(const struct timespec * start, uint32_t * expected_us, lgw_spectral_scan_status_t * status) {
+    uint64_t t_us = elapsed_us(start);
+    uint32_t poll_us = MIN(MAX(*expected_us / 32, SCAN_POLL_MIN_US), SCAN_POLL_MAX_US);
+    uint32_t timeout_us = MAX(SCAN_TIMEOUT_MIN_MS * 1000, 4 * *expected_us);
+    int nb_poll = 0;
+
+    if (t_us < *expected_us) {
+        wait_us(*expected_us - t_us);
+    }
+
+    do {
+        *status = LGW_SPECTRAL_SCAN_STATUS_UNKNOWN;
+        if (lgw_spectral_scan_get_status(status) != 0) {
+            printf("ERROR: spectral scan status failed\n");
+            return -1;
+        }
+        nb_poll += 1;
+        if ((*status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED) || (*status == LGW_SPECTRAL_SCAN_STATUS_ABORTED)) {
+            break;
+        }
+        t_us = elapsed_us(start);
+        if (t_us > timeout_us) {
+            printf("ERROR: TIMEOUT on Spectral Scan\n");
+            lgw_spectral_scan_abort();
+            return -1;
+        }
+        wait_us(poll_us);
+    } while (1);
+
+    if (*status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED) {
+        if (nb_poll == 1) {
+            *expected_us -= *expected_us / 8;
+        } else {
+            *expected_us = (uint32_t)(((3 * (uint64_t)*expected_us) + elapsed_us(start)) / 4);
+        }
+    }
+
+    return 0;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static FILE * log_open(const char * name, bool csv) {
+    uint8_t buff[16];
+    FILE * f;
+
+    f = fopen(name, csv ? "w" : "wb");
+    if (f == NULL) {
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, SCAN_LOG_BUFFER);
+
+    if (csv == false) {
+        /* header: magic, version, number of bins, record size (little endian) */
+        memset(buff, 0, sizeof buff);
+        memcpy(buff, SCAN_LOG_MAGIC, sizeof SCAN_LOG_MAGIC);
+        buff[8] = SCAN_LOG_VERSION;
+        buff[10] = LGW_SPECTRAL_SCAN_RESULT_SIZE;
+        buff[12] = (uint8_t)(SCAN_LOG_REC_SIZE >> 0);
+        buff[13] = (uint8_t)(SCAN_LOG_REC_SIZE >> 8);
+        fwrite(buff, 1, sizeof buff, f);
+    }
+
+    return f;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static void log_result(FILE * f, bool csv, const struct scan_result_s * res, uint16_t nb_scan) {
+    uint8_t buff[SCAN_LOG_REC_SIZE];
+    int i, j;
+
+    if (csv == true) {
+        fprintf(f, "%u", res->freq_hz);
+        for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
+            fprintf(f, ",%d,%u", res->levels[i], res->results[i]);
+        }
+        fprintf(f, "\n");
+        return;
+    }
+
+    /* ts_ms (8), freq_hz (4), nb_scan (2), reserved (2), levels (2 each), results (2 each), little endian */
+    memset(buff, 0, sizeof buff);
+    for (i = 0; i < 8; i++) {
+        buff[i] = (uint8_t)(res->ts_ms >> (8 * i));
+    }
+    for (i = 0; i < 4; i++) {
+        buff[8 + i] = (uint8_t)(res->freq_hz >> (8 * i));
+    }
+    buff[12] = (uint8_t)(nb_scan >> 0);
+    buff[13] = (uint8_t)(nb_scan >> 8);
+    j = 16;
+    for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
+        buff[j++] = (uint8_t)((uint16_t)res->levels[i] >> 0);
+        buff[j++] = (uint8_t)((uint16_t)res->levels[i] >> 8);
+    }
+    for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
+        buff[j++] = (uint8_t)(res->results[i] >> 0);
+        buff[j++] = (uint8_t)(res->results[i] >> 8);
+    }
+    fwrite(buff, 1, sizeof buff, f);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -106,12 +277,24 @@ int main(int argc, char **argv)
     uint8_t nb_channels = DEFAULT_NB_CHAN;
     uint16_t nb_scan = DEFAULT_NB_SCAN;
     int8_t rssi_offset = DEFAULT_RSSI_OFFSET;
-    int16_t levels[LGW_SPECTRAL_SCAN_RESULT_SIZE];
-    uint16_t results[LGW_SPECTRAL_SCAN_RESULT_SIZE];
     char log_file_name[64] = DEFAULT_LOG_NAME;
     FILE * log_file = NULL;
+    bool log_csv = false;
+    unsigned int nb_sweep = DEFAULT_NB_SWEEP;
+    unsigned int nb_done = 0; /* channel scans completed or failed */
+    unsigned int nb_total;
+    struct scan_result_s res;
+    struct timespec scan_start;
+    struct timespec sweep_start;
+    struct timespec ts;
+    uint32_t expected_us;
+    uint32_t scan_freq_hz;
+    bool scan_started;
+    struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
+    char occ_path[64] = "";
+    lgw_occ_t * occ = NULL;
+    struct lgw_occ_conf_s occ_conf;
 
-    struct timeval tm_start;
     lgw_spectral_scan_status_t status;
 
     /* Parameter parsing */
@@ -121,7 +304,7 @@ int main(int argc, char **argv)
     };
 
     /* parse command line options */
-    while ((i = getopt_long (argc, argv, "hud:f:n:o:s:l:D:", long_options, &option_index)) != -1) {
+    while ((i = getopt_long (argc, argv, "hud:f:n:o:s:l:D:m:cr:", long_options, &option_index)) != -1) {
         switch (i) {
             case 'h':
                 usage();
@@ -202,6 +385,30 @@ int main(int argc, char **argv)
                 }
                 break;
 
+            case 'c': /* -c  Log in CSV */
+                log_csv = true;
+                break;
+
+            case 'r': /* -r <uint>  Number of sweeps */
+                i = sscanf(optarg, "%u", &arg_u);
+                if (i != 1) {
+                    printf("ERROR: argument parsing of -r argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_sweep = arg_u;
+                }
+                break;
+
+            case 'm': /* -m <char>  Occupancy map path */
+                j = sscanf(optarg, "%63s", arg_s);
+                if (j != 1) {
+                    printf("ERROR: argument parsing of -m argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    sprintf(occ_path, "%s", arg_s);
+                }
+                break;
+
             default:
                 printf("ERROR: argument parsing\n");
                 usage();
@@ -210,9 +417,17 @@ int main(int argc, char **argv)
     }
 
     printf("==\n");
-    printf("== Spectral Scan: freq_hz=%uHz, nb_channels=%u, nb_scan=%u, rssi_offset=%ddB\n", freq_hz, nb_channels, nb_scan, rssi_offset);
+    printf("== Spectral Scan: freq_hz=%uHz, nb_channels=%u, nb_scan=%u, rssi_offset=%ddB, nb_sweep=%u\n", freq_hz, nb_channels, nb_scan, rssi_offset, nb_sweep);
     printf("==\n");
 
+    /* configure signal handling */
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigact.sa_handler = sig_handler;
+    sigaction(SIGQUIT, &sigact, NULL);
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
     if (com_type == LGW_COM_SPI) {
         /* Board reset */
         if (system("./reset_lgw.sh start") != 0) {
@@ -276,75 +491,110 @@ int main(int argc, char **argv)
     }
 
     /* create log file */
-    strcat(log_file_name,".csv");
-    log_file = fopen(log_file_name, "w");
+    strcat(log_file_name, (log_csv == true) ? ".csv" : ".bin");
+    log_file = log_open(log_file_name, log_csv);
     if (log_file == NULL) {
         printf("ERROR: impossible to create log file %s\n", log_file_name);
         return EXIT_FAILURE;
     }
 
-    /* Launch Spectral Scan on each channels */
-    for (j = 0; j < nb_channels; j++) {
-        x = lgw_spectral_scan_start(freq_hz, nb_scan);
-        if (x != 0) {
-            printf("ERROR: spectral scan start failed\n");
-            continue;
+    /* map the occupancy store, the history is kept if the same channels were scanned before */
+    if (occ_path[0] != '\0') {
+        occ_conf.freq_hz_start = freq_hz;
+        occ_conf.freq_step_hz = CHANNEL_STEP_HZ;
+        occ_conf.nb_slots = nb_channels;
+        occ_conf.half_life_s = LGW_OCC_HALF_LIFE_S;
+        if (lgw_occ_open(occ_path, &occ_conf, &occ) != LGW_OCC_SUCCESS) {
+            printf("ERROR: impossible to map occupancy map %s\n", occ_path);
+            return EXIT_FAILURE;
         }
+    }
 
-        /* Wait for scan to be completed */
-        timeout_start(&tm_start);
-        do {
-            /* handle timeout */
-            if (timeout_check(tm_start, 2000) != 0) {
-                printf("ERROR: %s: TIMEOUT on Spectral Scan\n", __FUNCTION__);
+    /* Sweep the channels, starting the scan of the next one as soon as the results of the current one are read */
+    nb_total = nb_sweep * nb_channels; /* 0 for ever */
+    expected_us = (uint32_t)(((uint64_t)nb_scan * SCAN_POINT_NS) / 1000);
+    scan_freq_hz = freq_hz;
+    scan_started = false;
+    clock_gettime(CLOCK_MONOTONIC, &sweep_start);
+    while ((nb_channels > 0) && ((nb_total == 0) || (nb_done < nb_total)) && (quit_sig != 1) && (exit_sig != 1)) {
+        /* (re)start the pipeline */
+        if (scan_started == false) {
+            clock_gettime(CLOCK_MONOTONIC, &scan_start);
+            if (lgw_spectral_scan_start(scan_freq_hz, nb_scan) != 0) {
+                printf("ERROR: spectral scan start failed\n");
+                nb_done += 1;
+                scan_freq_hz = freq_hz + ((nb_done % nb_channels) * CHANNEL_STEP_HZ);
                 continue;
             }
+            scan_started = true;
+        }
 
-            /* get spectral scan status */
-            status = LGW_SPECTRAL_SCAN_STATUS_UNKNOWN;
-            x = lgw_spectral_scan_get_status(&status);
-            if (x != 0) {
-                printf("ERROR: spectral scan status failed\n");
-                break;
-            }
-
-            wait_ms(10);
-        } while (status != LGW_SPECTRAL_SCAN_STATUS_COMPLETED && status != LGW_SPECTRAL_SCAN_STATUS_ABORTED);
-
-        if (status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED) {
-            memset(levels, 0, sizeof levels);
-            memset(results, 0, sizeof results);
-            x = lgw_spectral_scan_get_results(levels, results);
+        /* Wait for scan to be completed */
+        x = scan_wait(&scan_start, &expected_us, &status);
+        scan_started = false;
+        if ((x == 0) && (status == LGW_SPECTRAL_SCAN_STATUS_COMPLETED)) {
+            memset(&res, 0, sizeof res);
+            x = lgw_spectral_scan_get_results(res.levels, res.results);
             if (x != 0) {
                 printf("ERROR: spectral scan get results failed\n");
-                continue;
             }
+            res.freq_hz = scan_freq_hz;
+        } else if ((x == 0) && (status == LGW_SPECTRAL_SCAN_STATUS_ABORTED)) {
+            printf("INFO: spectral scan has been aborted\n");
+            x = -1;
+        } else if (x == 0) {
+            printf("ERROR: spectral scan status us unexpected 0x%02X\n", status);
+            x = -1;
+        }
 
-            /* log results */
-            fprintf(log_file, "%u", freq_hz);
-            for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
-                fprintf(log_file, ",%d,%u", levels[i], results[i]);
+        /* Start the next scan right away, the results are logged meanwhile */
+        nb_done += 1;
+        scan_freq_hz = freq_hz + ((nb_done % nb_channels) * CHANNEL_STEP_HZ);
+        if (((nb_total == 0) || (nb_done < nb_total)) && (quit_sig != 1) && (exit_sig != 1)) {
+            clock_gettime(CLOCK_MONOTONIC, &scan_start);
+            if (lgw_spectral_scan_start(scan_freq_hz, nb_scan) == 0) {
+                scan_started = true;
+            } else {
+                printf("ERROR: spectral scan start failed\n");
             }
-            fprintf(log_file, "\n");
+        }
 
-            /* print results */
-            printf("%u: ", freq_hz);
-            for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
-                printf("%u ", results[i]);
-            }
-            printf("\n");
+        if (x != 0) {
+            continue;
+        }
 
-            /* Next frequency to scan */
-            freq_hz += 200000; /* 200kHz channels */
-        } else if (status == LGW_SPECTRAL_SCAN_STATUS_ABORTED) {
-            printf("INFO: spectral scan has been aborted\n");
-        } else {
-            printf("ERROR: spectral scan status us unexpected 0x%02X\n", status);
+        /* log results */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        res.ts_ms = ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+        log_result(log_file, log_csv, &res, nb_scan);
+        if (occ != NULL) {
+            lgw_occ_update(occ, res.freq_hz, res.levels, res.results);
+        }
+
+        /* print results */
+        printf("%u: ", res.freq_hz);
+        for (i = 0; i < LGW_SPECTRAL_SCAN_RESULT_SIZE; i++) {
+            printf("%u ", res.results[i]);
+        }
+        printf("\n");
+
+        /* sweep duration */
+        if ((nb_done % nb_channels) == 0) {
+            printf("INFO: sweep of %u channels in %.1f ms (scan expected to last %u us)\n", nb_channels, elapsed_us(&sweep_start) / 1000.0, expected_us);
+            clock_gettime(CLOCK_MONOTONIC, &sweep_start);
         }
     }
 
+    /* do not leave a scan running */
+    if (scan_started == true) {
+        lgw_spectral_scan_abort();
+    }
+
     /* close log file */
     fclose(log_file);
+    if (occ != NULL) {
+        lgw_occ_close(occ);
+    }
 
     /* Stop the gateway */
     x = lgw_stop();